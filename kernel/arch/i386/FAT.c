@@ -1,18 +1,26 @@
 #include "FAT.h"
+#include "ata.h"
+#include "partition.h"
+#ifdef __is_kernel
+#include "pmm.h"
+#include "dma.h"
+#include "kheap.h"
+#include "ktime.h"
+#endif
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 //Global variables
-unsigned int fat_type;
-unsigned int first_fat_sector;
-unsigned int first_data_sector;
-unsigned int total_clusters;
-fat_BS_t bootsect;
-int part_start_lba;
-int part_length;
-	part_start_lba = 33543720;
-	part_length = 2*8385930;
+fat_volume_t fat_volumes[FAT_MAX_VOLUMES]; //mount table; slot 0 is C:, slot 1 is D:, and so on
+unsigned int fat_alloc_spread_clusters = FAT_ALLOC_SPREAD_CLUSTERS;
+#ifdef __is_kernel
+unsigned long fat_disk_read_location;
+unsigned long fat_disk_write_location;
+static dma_buffer_t fat_disk_read_buffer;
+static dma_buffer_t fat_disk_write_buffer;
+static kmem_cache_t* fat_sector_cache; //the FAT cache sectors of every volume
+#endif
 
 //uint16_t inw(uint16_t port) {
 //    uint16_t result;
@@ -34,216 +42,351 @@ const char keyboard_layouta[128] = {
     'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '/', '|' 
 };
 
-int int13h_read_o(unsigned long sector_offset, unsigned char num_blocks, unsigned long readLocationOffset) {
-
-	// Bounds check; only read sectors on the booted partition
-	if (sector_offset + num_blocks > part_length)
+//Reads "count" sectors of the volume into "buffer". Sectors are relative to the start of the volume.
+//Returns 0 on success and non-zero on failure
+int volumeRead(fat_volume_t* vol, unsigned long sector, unsigned int count, void* buffer)
+{
+	// Bounds check; only read sectors on this volume's partition
+	if (sector + count > vol->part_length || sector + count < sector)
 		return -1;
 
-	//Size check; only read blocks if the resulting size read will still be between 0x40000 and 0x80000
-	//if (readLocationOffset + num_blocks * 512 > (0x80000 - DISK_READ_LOCATION))
-		//return -1;
+	while (count > 0)
+	{
+		unsigned int chunk = count > 0x7F ? 0x7F : count;
 
-	// Sanity check; BIOS int13h can only read up to 0x7F blocks
-	if (num_blocks > 0x7F)
+		if (ataReadSectors(vol->drive, vol->part_start_lba + sector, chunk, buffer) != 0)
+			return -1;
+
+		sector += chunk;
+		count -= chunk;
+		buffer = (char*)buffer + chunk * ATA_SECTOR_SIZE;
+	}
+	return 0;
+}
+
+//Writes "count" sectors from "buffer" to the volume. Sectors are relative to the start of the volume.
+//Returns 0 on success and non-zero on failure
+int volumeWrite(fat_volume_t* vol, unsigned long sector, unsigned int count, const void* buffer)
+{
+	// Bounds check; only write sectors on this volume's partition
+	if (sector + count > vol->part_length || sector + count < sector)
 		return -1;
 
-	sector_offset = sector_offset + part_start_lba;
-   
-   //Implementing LBA28
- 
-   //Send out LBA and read instructions to disk
-   outb(0x1F1, NULL);
-   outb(0x1F2, num_blocks);
-   outb(0x1F3, (unsigned char)sector_offset);
-   outb(0x1F4, (unsigned char)(sector_offset >> 8));
-   outb(0x1F5, (unsigned char)(sector_offset >> 16));
-   outb(0x1F6, 0xE0 | (0 << 4) | ((sector_offset >> 24) & 0x0F));
-   outb(0x1F7, 0x20);
-  
-   unsigned char iterator = 0;
-   unsigned short* buffer = DISK_READ_LOCATION + readLocationOffset;
-
-   for (iterator = 0; iterator < num_blocks; iterator++)
-   {
-		int timeout = 0;
-		terminal_newline();
-    	terminal_writestring("[      ] Waiting for device to be ready...");
-		while (!(inb(0x1F7) & 0x08)) {
-				for (volatile int i = 0; i < 60000000; i++);
-    			terminal_writestring(".");
-				timeout += 1;
-				if (timeout == 100) {
-					terminal_newline();
-					terminal_writestring("[ FAIL ] Attempting to initialize FAT...");
-					return -1;
-				}
-			}
-		
-		// for read:
+	while (count > 0)
+	{
+		unsigned int chunk = count > 0x7F ? 0x7F : count;
 
-		unsigned short idx = 0;
-		//read in bytes from disk
-		for (idx = 0; idx < 256; idx++)
-		{
-			buffer[idx] = inw(0x1F0);
-		}
-		buffer += idx;
+		if (ataWriteSectors(vol->drive, vol->part_start_lba + sector, chunk, buffer) != 0)
+			return -1;
+
+		sector += chunk;
+		count -= chunk;
+		buffer = (const char*)buffer + chunk * ATA_SECTOR_SIZE;
 	}
-   return 0;
-   
+	return 0;
 }
 
-int int13h_write_o(unsigned long sector_offset, unsigned char num_blocks, unsigned long writeLocationOffset) {
-	// Bounds check; only write sectors on the booted partition
-	if (sector_offset + num_blocks > part_length)
+// Read sector(s) from the volume to DISK_READ_LOCATION + readLocationOffset
+// Returns 0 on success and non-zero on failure
+int int13h_read_o(fat_volume_t* vol, unsigned long sector_offset, unsigned char num_blocks, unsigned long readLocationOffset) {
+
+	// Sanity check; BIOS int13h can only read up to 0x7F blocks
+	if (num_blocks > 0x7F)
 		return -1;
 
-	//Size check; only write blocks if the resulting size written will still be between 0x40000 and 0x80000
-	//if (writeLocationOffset + num_blocks * 512 > (0x80000 - DISK_WRITE_LOCATION))
-		//return -1;
+	return volumeRead(vol, sector_offset, num_blocks, (char*)DISK_READ_LOCATION + readLocationOffset);
+}
+
+// Write sector(s) to the volume from DISK_WRITE_LOCATION + writeLocationOffset
+// Returns 0 on success and non-zero on failure
+int int13h_write_o(fat_volume_t* vol, unsigned long sector_offset, unsigned char num_blocks, unsigned long writeLocationOffset) {
 
 	// Sanity check; BIOS int13h can only write up to 0x7F blocks
 	if (num_blocks > 0x7F)
 		return -1;
 
-	sector_offset = sector_offset + part_start_lba;
-   
-   //Implementing LBA28
-   
-   //Send out LBA and write instructions to disk
-   outb(0x1F1, NULL);
-   outb(0x1F2, num_blocks);
-   outb(0x1F3, (unsigned char)sector_offset);
-   outb(0x1F4, (unsigned char)(sector_offset >> 8));
-   outb(0x1F5, (unsigned char)(sector_offset >> 16));
-   outb(0x1F6, 0xE0 | (0 << 4) | ((sector_offset >> 24) & 0x0F));
-   outb(0x1F7, 0x30);
-   
-   
-   unsigned char iterator = 0;
-   unsigned short* buffer = DISK_WRITE_LOCATION + writeLocationOffset;
-
-   for (iterator = 0; iterator < num_blocks; iterator++)
-   {
-		//check for errors before writing
-		while (1) {
-			if ((inb(0x1F7) & 0x01) == 0x01)
-				printss ("error1\n");
-			else if ((inb(0x1F7) & 0x40) != 0x40)
-				printss ("Not ready!\n");
-			else if ((inb(0x1F7) & 0x80) == 0x80)
-				printss ("Busy!\n");
-			else if ((inb(0x1F7) & 0x08) != 0x08)
-				printss ("Have no data/not ready to recieve PIO!\n");
-			else
-			break;
-		}
+	return volumeWrite(vol, sector_offset, num_blocks, (char*)DISK_WRITE_LOCATION + writeLocationOffset);
+}
+
+// Read sector(s) from the volume to 0x4000:0000
+// Returns 0 on success and non-zero on failure
+int int13h_read(fat_volume_t* vol, unsigned long sector_offset, unsigned char num_blocks ) {
+   return int13h_read_o(vol, sector_offset, num_blocks, 0); 
+}
+
+// Write sector(s) to the volume from 0x4000:0000
+// Returns 0 on success and non-zero on failure
+int int13h_write(fat_volume_t* vol, unsigned long sector_offset, unsigned char num_blocks ) {
+	return int13h_write_o(vol, sector_offset, num_blocks, 0);
+}
 
-		unsigned short idx = 0;
-		//send out data to disk
-		for (idx = 0; idx < 256; idx++)
+//Returns a sector's worth of memory for a FAT cache slot, or NULL if there's none
+static unsigned char* FATCacheBlockAlloc(void)
+{
+#ifdef __is_kernel
+	if (fat_sector_cache == NULL && (fat_sector_cache = kmemCacheCreate("fat_sector", ATA_SECTOR_SIZE)) == NULL)
+		return NULL;
+	return kmemCacheAlloc(fat_sector_cache);
+#else
+	return malloc(ATA_SECTOR_SIZE);
+#endif
+}
+
+static void FATCacheBlockFree(unsigned char* block)
+{
+#ifdef __is_kernel
+	kmemCacheFree(fat_sector_cache, block);
+#else
+	free(block);
+#endif
+}
+
+//Returns a pointer to a cached copy of FAT sector "fat_sector" (relative to the volume), reading it in on a miss.
+//The cache is direct mapped, so consecutive FAT sectors never evict each other while a chain or the allocator walks forward.
+//Returns NULL if the sector couldn't be read or there was no memory to cache it in
+unsigned char* FATCacheSector(fat_volume_t* vol, unsigned int fat_sector)
+{
+	unsigned int slot = fat_sector % FAT_CACHE_SECTORS;
+
+	if (vol->fat_cache_sector[slot] != fat_sector)
+	{
+		if (vol->fat_cache[slot] == NULL && (vol->fat_cache[slot] = FATCacheBlockAlloc()) == NULL)
+			return NULL;
+		if (volumeRead(vol, fat_sector, 1, vol->fat_cache[slot]) != 0)
 		{
-			outw(0x1F0, buffer[idx]);
-			
-			//short delay
-			inb(0x323);
-			inb(0x323);
-			inb(0x323);
+			vol->fat_cache_sector[slot] = 0;
+			return NULL;
 		}
-		buffer += idx;
+		vol->fat_cache_sector[slot] = fat_sector;
+	}
+
+	return vol->fat_cache[slot];
+}
+
+//Drops every cached FAT sector of the volume; needed after something else (e.g. fatcheck) rewrote the FAT behind the driver's back
+void FATCacheInvalidate(fat_volume_t* vol)
+{
+	memset(vol->fat_cache_sector, 0, sizeof(vol->fat_cache_sector)); //sector 0 is the boot sector, so it never names a FAT sector
+}
+
+//Initializes the volume's "bootsect" and geometry from the boot sector of the volume
+//part_start_lba, part_length and drive have to be filled in before calling this
+int FATInitialize(fat_volume_t* vol)
+{
+	unsigned char boot_sector[ATA_SECTOR_SIZE];
+
+	//reads the first sector of the FAT
+	if (volumeRead(vol, 0, 1, boot_sector) != 0)
+	{
+		d_printss("Function FATInitialize: Error reading the first sector of FAT!\n");
+		return -1;
 	}
-	outb(0x1F7, 0xE7); //send cache clear
-	while (inb(0x1F7) & 0x80) //wait for drive to finish clearing cache
+
+	fat_BS_t* bootstruct = (fat_BS_t*)boot_sector;
+
+	if (bootstruct->bytes_per_sector != ATA_SECTOR_SIZE || bootstruct->sectors_per_cluster == 0 || bootstruct->table_count == 0)
 	{
+		d_printss("Function FATInitialize: not a FAT boot sector, or the sector size isn't 512 bytes!\n");
+		return -1;
 	}
-   return 0; 
+
+	unsigned int total_sectors = bootstruct->total_sectors_16;
+	if (total_sectors == 0) //there's more than 65535 sectors, find the real number
+		total_sectors = bootstruct->total_sectors_32;
+
+	unsigned int table_size = bootstruct->table_size_16;
+	if (table_size == 0) //FAT32 keeps the FAT size in the extended section
+		table_size = ((fat_extBS_32_t*)(bootstruct->extended_section))->table_size_32;
+
+	vol->first_data_sector = bootstruct->reserved_sector_count + bootstruct->table_count * table_size + (bootstruct->root_entry_count * 32 + bootstruct->bytes_per_sector - 1) / bootstruct->bytes_per_sector; //Explanation: the first data sector is after the reserved sectors, the FAT table sectors, and the root directory sectors. The size of the root directory is found by multiplying the amount of root entries by the size of each entry (32 bytes), then adding bytes per sector - 1 so that when divided by bytes per sector, the calculation starts at 1 sector, not zero, while also maintaining 1 sector when there are exactly 512 bytes worth of entries. FAT32 has no root directory sectors, since root_entry_count is 0.
+
+	if (total_sectors <= vol->first_data_sector || total_sectors > vol->part_length)
+	{
+		d_printss("Function FATInitialize: the volume size in the boot sector doesn't fit the partition!\n");
+		return -1;
+	}
+
+	//only the data area holds clusters, and the FAT type is decided by how many there are
+	unsigned int data_clusters = (total_sectors - vol->first_data_sector) / bootstruct->sectors_per_cluster;
+
+	if (data_clusters < 4085)
+		vol->fat_type = 12;
+	else if (data_clusters < 65525)
+		vol->fat_type = 16;
+	else
+		vol->fat_type = 32;
+
+	vol->total_clusters = data_clusters + 2; //clusters are numbered from 2, so this is one past the last valid cluster
+
+	memcpy(&vol->bootsect, bootstruct, sizeof(fat_BS_t));
+
+	vol->first_fat_sector = bootstruct->reserved_sector_count;
+	vol->alloc_last = 1;
+	vol->alloc_spread_group = 0;
+	FATCacheInvalidate(vol);
+
+	return 0;
 }
 
-// Read sector(s) from booted partition to 0x4000:0000
-// Returns 0 on success and non-zero on failure
-int int13h_read( unsigned long sector_offset, unsigned char num_blocks ) {
-   return int13h_read_o(sector_offset, num_blocks, 0); 
+//Returns the mounted volume a drive letter refers to (case insensitive), or NULL
+fat_volume_t* FATGetVolume(char letter)
+{
+	if (letter >= 'a' && letter <= 'z')
+		letter -= 'a' - 'A';
+
+	if (letter < 'C' || letter >= 'C' + FAT_MAX_VOLUMES)
+		return NULL;
+
+	fat_volume_t* vol = &fat_volumes[letter - 'C'];
+	return vol->mounted ? vol : NULL;
 }
 
-// Write sector(s) to booted partition from 0x4000:0000
-// Returns 0 on success and non-zero on failure
-int int13h_write( unsigned long sector_offset, unsigned char num_blocks ) {
-	return int13h_write_o (sector_offset, num_blocks, 0);
+//Returns the volume a path like "C:\DIR\FILE.TXT" lives on, or NULL
+fat_volume_t* FATVolumeFromPath(const char* filePath)
+{
+	if (filePath == NULL || filePath[0] == '\0' || filePath[1] != ':' || filePath[2] != '\\')
+		return NULL;
+
+	return FATGetVolume(filePath[0]);
 }
 
-//Initializes struct "bootsect" to store critical data from the boot sector of the volume
-int FATInitialize()
+//Mounts the FAT volume found at "start_lba" on an ATA drive in the first free mount table slot
+//Returns: the drive letter the volume was given, or -1 if the table is full or the partition doesn't hold a FAT16/FAT32 volume
+int FATMount(unsigned char drive, unsigned long start_lba, unsigned long length)
 {
-	//reads the first sector of the FAT
-	if (int13h_read(0, 1) != 0)
+	unsigned int slot;
+	for (slot = 0; slot < FAT_MAX_VOLUMES; slot++)
 	{
-		terminal_newline();
-		printf(" -> Function FATInitialize: Error reading the first sector of FAT!");
+		if (!fat_volumes[slot].mounted)
+			break;
+	}
+
+	if (slot == FAT_MAX_VOLUMES)
+	{
+		d_printss("Function FATMount: the mount table is full!\n");
 		return -1;
 	}
 
-	fat_BS_t* bootstruct = (fat_BS_t*)DISK_READ_LOCATION;
+	fat_volume_t* vol = &fat_volumes[slot];
+	memset(vol, 0, sizeof(fat_volume_t));
+	vol->drive = drive;
+	vol->part_start_lba = start_lba;
+	vol->part_length = length;
 
-	total_clusters = bootstruct->total_sectors_16 / bootstruct->sectors_per_cluster;
+	if (FATInitialize(vol) != 0)
+		return -1;
 
-	if (total_clusters == 0) //there's more than 65535 sectors, find the real number
+	if (vol->fat_type == 12)
 	{
-		total_clusters = bootstruct->total_sectors_32 / bootstruct->sectors_per_cluster;
+		d_printss("Function FATMount: FAT12 is not supported!\n");
+		return -1;
 	}
 
-	if (total_clusters < 4085)
+	vol->letter = 'C' + slot;
+	vol->mounted = TRUE;
+	return vol->letter;
+}
+
+//Forgets a mounted volume and gives back its FAT cache. Nothing is cached dirty, so there's nothing to flush
+int FATUnmount(char letter)
+{
+	fat_volume_t* vol = FATGetVolume(letter);
+	if (vol == NULL)
+		return -1;
+
+	unsigned int slot;
+	for (slot = 0; slot < FAT_CACHE_SECTORS; slot++)
 	{
-		fat_type = 12;
-		first_data_sector = bootstruct->reserved_sector_count + bootstruct->table_count * bootstruct->table_size_16 + (bootstruct->root_entry_count * 32 + bootstruct->bytes_per_sector - 1) / bootstruct->bytes_per_sector; //Explanation: the first data sector is after the reserved sectors, the FAT table sectors, and the root directory sectors. The size of the root directory is found by multiplying the amount of root entries by the size of each entry (32 bytes), then adding bytes per sector - 1 so that when divided by bytes per sector, the calculation starts at 1 sector, not zero, while also maintaining 1 sector when there are exactly 512 bytes worth of entries.
+		if (vol->fat_cache[slot] != NULL)
+			FATCacheBlockFree(vol->fat_cache[slot]);
+		vol->fat_cache[slot] = NULL;
+		vol->fat_cache_sector[slot] = 0;
 	}
-	else
+	vol->mounted = FALSE;
+	return 0;
+}
+
+//Scans every ATA drive for partitions and mounts each FAT volume found, in drive then partition order
+//Returns: how many volumes are mounted afterwards
+int FATMountAll()
+{
+	partition_t partitions[PARTITION_MAX_PER_DRIVE];
+	unsigned char drive;
+	int mounted = 0;
+
+#ifdef __is_kernel
+	//the windows used to both be physical 0x40000, so a cluster staged for writing clobbered whatever was read
+	if (fat_disk_read_location == 0)
 	{
-		if (total_clusters < 65525)
-		{
-			fat_type = 16;
-			first_data_sector = bootstruct->reserved_sector_count + bootstruct->table_count * bootstruct->table_size_16 + (bootstruct->root_entry_count * 32 + bootstruct->bytes_per_sector - 1) / bootstruct->bytes_per_sector; //Explanation: the first data sector is after the reserved sectors, the FAT table sectors, and the root directory sectors. The size of the root directory is found by multiplying the amount of root entries by the size of each entry (32 bytes), then adding bytes per sector - 1 so that when divided by bytes per sector, the calculation starts at 1 sector, not zero, while also maintaining 1 sector when there are exactly 512 bytes worth of entries.
-		}
-		else
+		if (dmaAlloc(&fat_disk_read_buffer, FAT_DISK_READ_SIZE, PMM_FRAME_SIZE, DMA_LIMIT_16M) != 0)
+			return 0;
+		if (dmaAlloc(&fat_disk_write_buffer, FAT_DISK_WRITE_SIZE, PMM_FRAME_SIZE, DMA_LIMIT_16M) != 0)
 		{
-			fat_type = 32;
-			first_data_sector = bootstruct->reserved_sector_count + bootstruct->table_count * ((fat_extBS_32_t*)(bootstruct->extended_section))->table_size_32;
+			dmaFree(&fat_disk_read_buffer);
+			return 0;
 		}
+		fat_disk_read_location = (unsigned long)fat_disk_read_buffer.virt;
+		fat_disk_write_location = (unsigned long)fat_disk_write_buffer.virt;
 	}
+#endif
 
-	memcpy(&bootsect, bootstruct, 512);
+	for (drive = 0; drive < ATA_MAX_DRIVES; drive++)
+	{
+		if (ataIdentify(drive, NULL) != 0) //no disk there
+			continue;
 
-	first_fat_sector = bootstruct->reserved_sector_count;
+		int found = partitionScan(drive, partitions, PARTITION_MAX_PER_DRIVE);
+		int part;
+		for (part = 0; part < found; part++)
+		{
+			if (!partitionIsFAT(&partitions[part]))
+				continue;
 
-	return 0;
+			unsigned int slot;
+			BOOL already_mounted = FALSE;
+			for (slot = 0; slot < FAT_MAX_VOLUMES; slot++)
+			{
+				if (fat_volumes[slot].mounted && fat_volumes[slot].drive == drive && fat_volumes[slot].part_start_lba == partitions[part].start_lba)
+					already_mounted = TRUE;
+			}
+
+			if (!already_mounted)
+				FATMount(drive, partitions[part].start_lba, partitions[part].length);
+		}
+	}
+
+	unsigned int slot;
+	for (slot = 0; slot < FAT_MAX_VOLUMES; slot++)
+	{
+		if (fat_volumes[slot].mounted)
+			mounted++;
+	}
+	return mounted;
 }
 
 //read FAT table
 //This function deals in absolute data clusters
-int FATRead(unsigned int clusterNum)
+int FATRead(fat_volume_t* vol, unsigned int clusterNum)
 {
-	if (clusterNum < 2 || clusterNum >= total_clusters)
+	if (clusterNum < 2 || clusterNum >= vol->total_clusters)
 	{
 		d_printss("Function FATRead: invalid cluster number!\n");
 		return -1;
 	}
 
-	if (fat_type == 32)
+	if (vol->fat_type == 32)
 	{
-		unsigned int cluster_size = bootsect.bytes_per_sector * bootsect.sectors_per_cluster;
-		unsigned char FAT_table[32 * 1024] = { '\0' }; //Takes into consideration the largest standard cluster size (32kB) since arrays can't be dynamically allocated without "new" :/
 		unsigned int fat_offset = clusterNum * 4;
-		unsigned int fat_sector = first_fat_sector + (fat_offset / cluster_size);
-		unsigned int ent_offset = fat_offset % cluster_size;
+		unsigned int fat_sector = vol->first_fat_sector + (fat_offset / vol->bootsect.bytes_per_sector);
+		unsigned int ent_offset = fat_offset % vol->bootsect.bytes_per_sector;
 
-		//at this point you need to read from sector "fat_sector" on the disk into "FAT_table".
-		if (int13h_read(fat_sector, 1) != 0)
+		//get the sector that holds the entry, from the cache if it's there
+		unsigned char* FAT_table = FATCacheSector(vol, fat_sector);
+		if (FAT_table == NULL)
 		{
 			d_printss("Function FATRead: Could not read sector that contains FAT32 table entry needed.\n");
 			return -1;
 		}
-		memcpy(&FAT_table, (char*)DISK_READ_LOCATION, bootsect.bytes_per_sector);
-
 
 		//remember to ignore the high 4 bits.
 		unsigned int table_value = *(unsigned int*)&FAT_table[ent_offset] & 0x0FFFFFFF;
@@ -251,36 +394,32 @@ int FATRead(unsigned int clusterNum)
 		//the variable "table_value" now has the information you need about the next cluster in the chain.
 		return table_value;
 	}
-	else if (fat_type == 16)
+	else if (vol->fat_type == 16)
 	{
-		unsigned int cluster_size = bootsect.bytes_per_sector * bootsect.sectors_per_cluster;
-		unsigned char FAT_table[32 * 1024]; //Takes into consideration the largest standard cluster size (32kB) since arrays can't be dynamically allocated without "new" :/
 		unsigned int fat_offset = clusterNum * 2;
-		unsigned int fat_sector = first_fat_sector + (fat_offset / cluster_size);
-		unsigned int ent_offset = fat_offset % cluster_size;
+		unsigned int fat_sector = vol->first_fat_sector + (fat_offset / vol->bootsect.bytes_per_sector);
+		unsigned int ent_offset = fat_offset % vol->bootsect.bytes_per_sector;
 
-		//at this point you need to read from sector "fat_sector" on the disk into "FAT_table".
-		if (int13h_read(fat_sector, 1) != 0)
+		//get the sector that holds the entry, from the cache if it's there
+		unsigned char* FAT_table = FATCacheSector(vol, fat_sector);
+		if (FAT_table == NULL)
 		{
 			d_printss("Function FATRead: Could not read sector that contains FAT16 table entry needed.\n");
 			return -1;
 		}
-		memcpy(&FAT_table, (char*)DISK_READ_LOCATION, bootsect.bytes_per_sector);
 
 		unsigned short table_value = *(unsigned short*)&FAT_table[ent_offset];
 
 		//the variable "table_value" now has the information you need about the next cluster in the chain.
 		return table_value;
 	}
-	/*else if (fat_type == 12)
+	/*else if (vol->fat_type == 12)
 	{
-	unsigned int cluster_size = bootsect.bytes_per_sector * bootsect.sectors_per_cluster;
-	unsigned char FAT_table[32 * 1024]; //Takes into consideration the largest standard cluster size (32kB) since arrays can't be dynamically allocated without "new" :/
 	unsigned int fat_offset = clusterNum + (clusterNum / 2);// multiply by 1.5
-	unsigned int fat_sector = first_fat_sector + (fat_offset / cluster_size);
-	unsigned int ent_offset = fat_offset % cluster_size;
+	unsigned int fat_sector = vol->first_fat_sector + (fat_offset / vol->bootsect.bytes_per_sector);
+	unsigned int ent_offset = fat_offset % vol->bootsect.bytes_per_sector;
 
-	//at this point you need to read from sector "fat_sector" on the disk into "FAT_table".
+	//an entry can straddle two sectors, so both have to be fetched here.
 
 	unsigned short table_value = *(unsigned short*)&FAT_table[ent_offset];
 
@@ -292,96 +431,92 @@ int FATRead(unsigned int clusterNum)
 	else
 	{
 		d_printss("Function FATRead: Invalid fat_type value. The value was (in hex): ");
-		d_printhex(fat_type, 8);
+		d_printhex(vol->fat_type, 8);
 		d_printss("\n");
 		return -1;
 	}
 }
 
-int FATWrite(unsigned int clusterNum, unsigned int clusterVal)
+//The cache is write-through: the entry is changed in the cached sector and the sector goes straight back to disk
+int FATWrite(fat_volume_t* vol, unsigned int clusterNum, unsigned int clusterVal)
 {
 	//clusterVal does not need to be checked, since all values from 0 - 0xFFFFFFFF are valid.
 
-	if (clusterNum < 2 || clusterNum >= total_clusters)
+	if (clusterNum < 2 || clusterNum >= vol->total_clusters)
 	{
 		d_printss("Function FATWrite: invalid cluster number!\n");
 		return -1;
 	}
 
-	if (fat_type == 32)
+	if (vol->fat_type == 32)
 	{
-		unsigned int cluster_size = bootsect.bytes_per_sector * bootsect.sectors_per_cluster;
-		unsigned char FAT_table[32 * 1024] = { '\0' }; //Takes into consideration the largest standard cluster size (32kB) since arrays can't be dynamically allocated without "new" :/
 		unsigned int fat_offset = clusterNum * 4;
-		unsigned int fat_sector = first_fat_sector + (fat_offset / cluster_size);
-		unsigned int ent_offset = fat_offset % cluster_size;
+		unsigned int fat_sector = vol->first_fat_sector + (fat_offset / vol->bootsect.bytes_per_sector);
+		unsigned int ent_offset = fat_offset % vol->bootsect.bytes_per_sector;
 
-		//at this point you need to read from sector "fat_sector" on the disk into "FAT_table".
-		if (int13h_read(fat_sector, 1) != 0)
+		unsigned char* FAT_table = FATCacheSector(vol, fat_sector);
+		if (FAT_table == NULL)
 		{
 			d_printss("Function FATWrite: Could not read sector that contains FAT32 table entry needed.\n");
 			return -1;
 		}
-		memcpy(&FAT_table, (char*)DISK_READ_LOCATION, bootsect.bytes_per_sector);
 
-		//copy clusterVal into FAT_table
-		*(unsigned int*)&FAT_table[ent_offset] = clusterVal;
+		//copy clusterVal into FAT_table, keeping the reserved high 4 bits
+		*(unsigned int*)&FAT_table[ent_offset] = (*(unsigned int*)&FAT_table[ent_offset] & 0xF0000000) | (clusterVal & 0x0FFFFFFF);
 
 		//send modified FAT_table back to disk
-		memcpy((char*)DISK_WRITE_LOCATION, &FAT_table, bootsect.bytes_per_sector);
-
-		if (int13h_write(fat_sector, 1) != 0)
+		if (volumeWrite(vol, fat_sector, 1, FAT_table) != 0)
 		{
+			FATCacheInvalidate(vol); //the cached sector no longer matches the disk
 			d_printss("Function FATWrite: Could not write new FAT32 cluster number to sector.\n");
 			return -1;
 		}
 
 		return 0;
 	}
-	else if (fat_type == 16)
+	else if (vol->fat_type == 16)
 	{
-		unsigned int cluster_size = bootsect.bytes_per_sector * bootsect.sectors_per_cluster;
-		unsigned char FAT_table[32 * 1024]; //Takes into consideration the largest standard cluster size (32kB) since arrays can't be dynamically allocated without "new" :/
 		unsigned int fat_offset = clusterNum * 2;
-		unsigned int fat_sector = first_fat_sector + (fat_offset / cluster_size);
-		unsigned int ent_offset = fat_offset % cluster_size;
+		unsigned int fat_sector = vol->first_fat_sector + (fat_offset / vol->bootsect.bytes_per_sector);
+		unsigned int ent_offset = fat_offset % vol->bootsect.bytes_per_sector;
 
-		//at this point you need to read from sector "fat_sector" on the disk into "FAT_table".
-		if (int13h_read(fat_sector, 1) != 0)
+		unsigned char* FAT_table = FATCacheSector(vol, fat_sector);
+		if (FAT_table == NULL)
 		{
 			d_printss("Function FATWrite: Could not read sector that contains FAT16 table entry needed.\n");
 			return -1;
 		}
-		memcpy(&FAT_table, (char*)DISK_READ_LOCATION, bootsect.bytes_per_sector);
 
 		//copy clusterVal into FAT_table
 		*(unsigned short*)&FAT_table[ent_offset] = (unsigned short)clusterVal;
 
 		//send modified FAT_table back to disk
-		memcpy((char*)DISK_WRITE_LOCATION, &FAT_table, bootsect.bytes_per_sector);
-
-		if (int13h_write(fat_sector, 1) != 0)
+		if (volumeWrite(vol, fat_sector, 1, FAT_table) != 0)
 		{
+			FATCacheInvalidate(vol); //the cached sector no longer matches the disk
 			d_printss("Function FATWrite: Could not write new FAT16 cluster number to sector.\n");
 			return -1;
 		}
 
 		return 0;
 	}
-	/*else if (fat_type == 12)
+	/*else if (vol->fat_type == 12)
 	{
 	NULL; //Not Implemented!
 	}*/
 	else
 	{
 		d_printss("Function FATWrite: Invalid fat_type value. The value was (in hex): ");
-		d_printhex(fat_type, 8);
+		d_printhex(vol->fat_type, 8);
 		d_printss("\n");
 		return -1;
 	}
 }
 
-unsigned int allocateFreeFAT()
+//Allocates the first free cluster at or after "goal", wrapping around to cluster 2 if the end of the volume is reached.
+//The FAT is scanned a whole sector at a time out of the volume's FAT cache, so a nearby free cluster costs at most a single disk read.
+//Returns the allocated cluster (already marked as end of chain), or the bad cluster value of the FAT type on failure.
+unsigned int allocateFreeFATNear(fat_volume_t* vol, unsigned int goal)
 {
 	//use generic variables so that the function can work with either FAT32, FAT16, or FAT12 without any code modifications.
 	unsigned int free_cluster = BAD_CLUSTER_12;
@@ -389,66 +524,116 @@ unsigned int allocateFreeFAT()
 	unsigned int end_cluster = BAD_CLUSTER_12;
 
 	//Associate the generic variables with the appropriate values depending on FAT type.
-	if (fat_type == 32)
+	if (vol->fat_type == 32)
 	{
 		free_cluster = FREE_CLUSTER_32;
 		bad_cluster = BAD_CLUSTER_32;
 		end_cluster = END_CLUSTER_32;
 	}
-	else if (fat_type == 16)
+	else if (vol->fat_type == 16)
 	{
 		free_cluster = FREE_CLUSTER_16;
 		bad_cluster = BAD_CLUSTER_16;
 		end_cluster = END_CLUSTER_16;
 	}
-	else if (fat_type == 12)
-	{
-		free_cluster = FREE_CLUSTER_12;
-		bad_cluster = BAD_CLUSTER_12;
-		end_cluster = END_CLUSTER_12;
-	}
 	else
 	{
-		d_printss("Function allocateFreeFAT: fat_type is not valid!\n");
+		d_printss("Function allocateFreeFATNear: fat_type is not valid!\n");
 		return BAD_CLUSTER_12;
 	}
 
-	unsigned int cluster = 2;
-	unsigned int clusterStatus = free_cluster;
+	if (goal < 2 || goal >= vol->total_clusters)
+		goal = 2;
+
+	unsigned int entry_size = vol->fat_type / 8; //bytes per FAT entry
+	unsigned int entries_per_sector = vol->bootsect.bytes_per_sector / entry_size;
+	unsigned int clusters_to_scan = vol->total_clusters - 2;
+	unsigned int scanned = 0;
+	unsigned int cluster = goal;
 
-	//iterate through the clusters, looking for a free cluster
-	while (cluster < total_clusters)
+	//iterate through the FAT one sector at a time, starting with the sector that holds the goal's entry
+	while (scanned < clusters_to_scan)
 	{
-		clusterStatus = FATRead(cluster);
+		unsigned int fat_sector = vol->first_fat_sector + (cluster * entry_size) / vol->bootsect.bytes_per_sector;
 
-		if (clusterStatus == free_cluster)
+		unsigned char* FAT_table = FATCacheSector(vol, fat_sector);
+		if (FAT_table == NULL)
 		{
-			//cluster found, allocate it.
-			if (FATWrite(cluster, end_cluster) == 0)
-				return cluster;
+			d_printss("Function allocateFreeFATNear: Could not read FAT sector, aborting operations...\n");
+			return bad_cluster;
+		}
+
+		do
+		{
+			unsigned int ent_offset = (cluster % entries_per_sector) * entry_size;
+			unsigned int clusterStatus;
+
+			if (vol->fat_type == 32)
+				clusterStatus = *(unsigned int*)&FAT_table[ent_offset] & 0x0FFFFFFF; //remember to ignore the high 4 bits.
 			else
+				clusterStatus = *(unsigned short*)&FAT_table[ent_offset];
+
+			if (clusterStatus == free_cluster)
 			{
-				d_printss("Function allocateFreeFAT: Error occurred with FATWrite, aborting operations...\n");
-				return bad_cluster;
+				//cluster found, allocate it.
+				if (FATWrite(vol, cluster, end_cluster) != 0)
+				{
+					d_printss("Function allocateFreeFATNear: Error occurred with FATWrite, aborting operations...\n");
+					return bad_cluster;
+				}
+
+				vol->alloc_last = cluster;
+				return cluster;
 			}
-		}
-		else if (clusterStatus < 0)
-		{
-			d_printss("Function allocateFreeFAT: Error occurred with FATRead, aborting operations...\n");
-			return bad_cluster;
-		}
 
-		cluster++; //cluster is taken, check the next one
+			cluster++; //cluster is taken, check the next one
+			scanned++;
+
+			if (cluster >= vol->total_clusters) //wrap around; cluster 2's entry lives in a different sector
+			{
+				cluster = 2;
+				break;
+			}
+		} while ((cluster % entries_per_sector) != 0 && scanned < clusters_to_scan);
 	}
 
 	return bad_cluster; //no free clusters were found, return bad_cluster as a signal
 }
 
+//Picks where the search for a new file's first cluster should start.
+//Small files go right after their directory so a directory and its contents share an allocation group (like ext2's block groups).
+//Files bigger than fat_alloc_spread_clusters are started at the beginning of another group instead, rotating through the volume,
+//so one large file doesn't eat the free space that the directory's small files would otherwise get.
+unsigned int allocationGoal(fat_volume_t* vol, unsigned int dir_cluster, unsigned int file_size)
+{
+	unsigned int cluster_size = vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster;
+	unsigned int file_clusters = (file_size + cluster_size - 1) / cluster_size;
+
+	if (fat_alloc_spread_clusters == 0 || file_clusters <= fat_alloc_spread_clusters)
+		return dir_cluster + 1;
+
+	unsigned int group_count = (vol->total_clusters + FAT_ALLOC_GROUP_CLUSTERS - 1) / FAT_ALLOC_GROUP_CLUSTERS;
+	if (group_count < 2)
+		return dir_cluster + 1;
+
+	vol->alloc_spread_group = (vol->alloc_spread_group + 1) % group_count;
+	if (vol->alloc_spread_group == dir_cluster / FAT_ALLOC_GROUP_CLUSTERS) //never put a large file in its directory's own group
+		vol->alloc_spread_group = (vol->alloc_spread_group + 1) % group_count;
+
+	return vol->alloc_spread_group * FAT_ALLOC_GROUP_CLUSTERS;
+}
+
+//Allocates a free cluster with no particular placement, continuing from the last cluster handed out
+unsigned int allocateFreeFAT(fat_volume_t* vol)
+{
+	return allocateFreeFATNear(vol, vol->alloc_last + 1);
+}
+
 //Reads one cluster and dumps it to DISK_READ_LOCATION, offset "cluster_size" number of bytes from DISK_READ_LOCATION
 //This function deals in absolute data clusters
-int clusterRead(unsigned int clusterNum, unsigned int clusterOffset)
+int clusterRead(fat_volume_t* vol, unsigned int clusterNum, unsigned int clusterOffset)
 {
-	if (clusterNum < 2 || clusterNum >= total_clusters)
+	if (clusterNum < 2 || clusterNum >= vol->total_clusters)
 	{
 		d_printss("Function clusterRead: Invalid cluster number!\n");
 		return -1;
@@ -456,9 +641,9 @@ int clusterRead(unsigned int clusterNum, unsigned int clusterOffset)
 
 	//not sure how to error-check clusterOffset, leave it to int13h_read_o to error check for me.
 
-	unsigned int start_sect = (clusterNum - 2) * (unsigned short)bootsect.sectors_per_cluster + first_data_sector; //Explanation: Since the root cluster is cluster 2, but data starts at first_data_sector, subtract 2 to get the proper cluster offset from zero.
+	unsigned int start_sect = (clusterNum - 2) * (unsigned short)vol->bootsect.sectors_per_cluster + vol->first_data_sector; //Explanation: Since the root cluster is cluster 2, but data starts at first_data_sector, subtract 2 to get the proper cluster offset from zero.
 
-	if (int13h_read_o(start_sect, (unsigned short)bootsect.sectors_per_cluster, clusterOffset * (unsigned short)bootsect.sectors_per_cluster * (unsigned short)bootsect.bytes_per_sector) != 0)
+	if (int13h_read_o(vol, start_sect, (unsigned short)vol->bootsect.sectors_per_cluster, clusterOffset * (unsigned short)vol->bootsect.sectors_per_cluster * (unsigned short)vol->bootsect.bytes_per_sector) != 0)
 	{
 		d_printss("Function clusterRead: An error occured with int13h_read_o, the area in DISK_READ_LOCATION + 0x");
 		d_printhex(clusterOffset, 8);
@@ -474,9 +659,9 @@ int clusterRead(unsigned int clusterNum, unsigned int clusterOffset)
 //contentSize: contains how big contentsToWrite's data is (in bytes)
 //contentBuffOffset: sets how far offset from DISK_WRITE_LOCATION to place the data from contentsToWrite in preparation for writing to disk (in clusters)
 //clusterNum: Specifies the on-disk cluster to write the data to
-int clusterWrite(void* contentsToWrite, unsigned int contentSize, unsigned int contentBuffOffset, unsigned int clusterNum)
+int clusterWrite(fat_volume_t* vol, void* contentsToWrite, unsigned int contentSize, unsigned int contentBuffOffset, unsigned int clusterNum)
 {
-	if (clusterNum < 2 || clusterNum >= total_clusters)
+	if (clusterNum < 2 || clusterNum >= vol->total_clusters)
 	{
 		d_printss("Function clusterWrite: Invalid cluster number!\n");
 		return -1;
@@ -484,19 +669,19 @@ int clusterWrite(void* contentsToWrite, unsigned int contentSize, unsigned int c
 
 	//not sure how to error-check contnetBuffOffset, leave it to int13h_write_o to error check for me.
 
-	unsigned int byteOffset = contentBuffOffset * (unsigned short)bootsect.sectors_per_cluster * (unsigned short)bootsect.bytes_per_sector; //converts cluster memory offset into bytes
+	unsigned int byteOffset = contentBuffOffset * (unsigned short)vol->bootsect.sectors_per_cluster * (unsigned short)vol->bootsect.bytes_per_sector; //converts cluster memory offset into bytes
 
 	//copy contents to be written to disk to the memory write location
 	memcpy((char*)DISK_WRITE_LOCATION + byteOffset, contentsToWrite, contentSize);
 
-	unsigned int start_sect = (clusterNum - 2) * (unsigned short)bootsect.sectors_per_cluster + first_data_sector; //Explanation: Since the root cluster is cluster 2, but data starts at first_data_sector, subtract 2 to get the proper cluster offset from zero.
+	unsigned int start_sect = (clusterNum - 2) * (unsigned short)vol->bootsect.sectors_per_cluster + vol->first_data_sector; //Explanation: Since the root cluster is cluster 2, but data starts at first_data_sector, subtract 2 to get the proper cluster offset from zero.
 
-	if (int13h_write_o(start_sect, (unsigned short)bootsect.sectors_per_cluster, byteOffset) != 0)
+	if (int13h_write_o(vol, start_sect, (unsigned short)vol->bootsect.sectors_per_cluster, byteOffset) != 0)
 	{
 		d_printss("Function clusterWrite: An error occured with int13h_write_o, the area in sector ");
 		d_printhex(start_sect, 8);
 		d_printss(" through to sector ");
-		d_printhex(((unsigned short)bootsect.sectors_per_cluster) + start_sect, 2);
+		d_printhex(((unsigned short)vol->bootsect.sectors_per_cluster) + start_sect, 2);
 		d_printss(" are now in an unknown state.\n");
 		return -1;
 	}
@@ -508,9 +693,9 @@ int clusterWrite(void* contentsToWrite, unsigned int contentSize, unsigned int c
 
 //receives the cluster to list, and will list all regular entries and directories, plus whatever attributes are passed in
 //returns: -1 is a general error
-int directoryList(const unsigned int cluster, unsigned char attributesToAdd, BOOL exclusive)
+int directoryList(fat_volume_t* vol, const unsigned int cluster, unsigned char attributesToAdd, BOOL exclusive)
 {
-	if (cluster < 2 || cluster >= total_clusters)
+	if (cluster < 2 || cluster >= vol->total_clusters)
 	{
 		d_printss("Function directoryList: Invalid cluster number!\n");
 		return -1;
@@ -528,7 +713,7 @@ int directoryList(const unsigned int cluster, unsigned char attributesToAdd, BOO
 
 
 	//read cluster of the directory/subdirectory
-	if (clusterRead(cluster, 0) != 0)
+	if (clusterRead(vol, cluster, 0) != 0)
 	{
 		d_printss("Function directoryList: clusterRead encountered an error. Aborting...\n");
 		return -1;
@@ -543,7 +728,7 @@ int directoryList(const unsigned int cluster, unsigned char attributesToAdd, BOO
 		{
 			break;
 		}
-		else if (strncmp(file_metadata->file_name, "..", 2) == 0 || strncmp(file_metadata->file_name, ".", 1) == 0)
+		else if (strncmp((char*)file_metadata->file_name, "..", 2) == 0 || strncmp((char*)file_metadata->file_name, ".", 1) == 0)
 		{
 			if (file_metadata->file_name[1] == '.')
 				d_printss("..");
@@ -561,16 +746,16 @@ int directoryList(const unsigned int cluster, unsigned char attributesToAdd, BOO
 		}
 		else if (((file_metadata->file_name)[0] == ENTRY_FREE) || ((file_metadata->attributes & FILE_LONG_NAME) == FILE_LONG_NAME) || ((file_metadata->attributes & attributes_to_hide) != 0)) //if the entry is a free entry, a long name, or it contains an attribute not wanted
 		{	
-			if (meta_pointer_iterator_count < bootsect.bytes_per_sector * bootsect.sectors_per_cluster / sizeof(directory_entry_t) - 1) //if the pointer hasn't iterated outside of what that cluster can hold (the 1 is to prevent the comparisons from the line above from reading past the cluster boundary)
+			if (meta_pointer_iterator_count < vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster / sizeof(directory_entry_t) - 1) //if the pointer hasn't iterated outside of what that cluster can hold (the 1 is to prevent the comparisons from the line above from reading past the cluster boundary)
 			{
 				file_metadata++;
 				meta_pointer_iterator_count++;
 			}
 			else //search next cluster in directory
 			{
-				unsigned int next_cluster = FATRead(cluster);
+				int next_cluster = FATRead(vol, cluster);
 
-				if ((next_cluster >= END_CLUSTER_32 && fat_type == 32) || (next_cluster >= END_CLUSTER_16 && fat_type == 16) || (next_cluster >= END_CLUSTER_12 && fat_type == 12))
+				if ((next_cluster >= END_CLUSTER_32 && vol->fat_type == 32) || (next_cluster >= END_CLUSTER_16 && vol->fat_type == 16) || (next_cluster >= END_CLUSTER_12 && vol->fat_type == 12))
 					break;
 				else if (next_cluster < 0)
 				{
@@ -578,7 +763,7 @@ int directoryList(const unsigned int cluster, unsigned char attributesToAdd, BOO
 					return -1;
 				}
 				else
-					return directoryList(next_cluster, attributesToAdd, exclusive); //search next cluster
+					return directoryList(vol, next_cluster, attributesToAdd, exclusive); //search next cluster
 			}
 		}
 		else
@@ -611,9 +796,9 @@ int directoryList(const unsigned int cluster, unsigned char attributesToAdd, BOO
 //return value holds success or failure code, file holds directory entry if file is found
 //entryOffset points to where the directory entry was found in sizeof(directory_entry_t) starting from zero (can be NULL)
 //returns: -1 is a general error, -2 is a "not found" error
-int directorySearch(const char* filepart, const unsigned int cluster, directory_entry_t* file, unsigned int* entryOffset)
+int directorySearch(fat_volume_t* vol, const char* filepart, const unsigned int cluster, directory_entry_t* file, unsigned int* entryOffset)
 {
-	if (cluster < 2 || cluster >= total_clusters)
+	if (cluster < 2 || cluster >= vol->total_clusters)
 	{
 		d_printss("Function directorySearch: Invalid cluster number!\n");
 		return -1;
@@ -627,7 +812,7 @@ int directorySearch(const char* filepart, const unsigned int cluster, directory_
 		convertToFATFormat(searchName);
 
 	//read cluster of the directory/subdirectory
-	if (clusterRead(cluster, 0) != 0)
+	if (clusterRead(vol, cluster, 0) != 0)
 	{
 		d_printss("Function directorySearch: clusterRead encountered an error. Aborting...\n");
 		return -1;
@@ -642,16 +827,16 @@ int directorySearch(const char* filepart, const unsigned int cluster, directory_
 			break;
 		else if (strncmp((char*)file_metadata->file_name, searchName, 11) != 0) //if the file doesn't match 
 		{
-			if (meta_pointer_iterator_count < bootsect.bytes_per_sector * bootsect.sectors_per_cluster / sizeof(directory_entry_t) - 1) //if the pointer hasn't iterated outside of what that cluster can hold (the 1 is to prevent strncmp from the line above from reading past the cluster boundary)
+			if (meta_pointer_iterator_count < vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster / sizeof(directory_entry_t) - 1) //if the pointer hasn't iterated outside of what that cluster can hold (the 1 is to prevent strncmp from the line above from reading past the cluster boundary)
 			{
 				file_metadata++;
 				meta_pointer_iterator_count++;
 			}
 			else
 			{
-				int next_cluster = FATRead(cluster);
+				int next_cluster = FATRead(vol, cluster);
 
-				if ((next_cluster >= END_CLUSTER_32 && fat_type == 32) || (next_cluster >= END_CLUSTER_16 && fat_type == 16) || (next_cluster >= END_CLUSTER_12 && fat_type == 12))
+				if ((next_cluster >= END_CLUSTER_32 && vol->fat_type == 32) || (next_cluster >= END_CLUSTER_16 && vol->fat_type == 16) || (next_cluster >= END_CLUSTER_12 && vol->fat_type == 12))
 					break; // no more clusters to search
 				else if (next_cluster < 0)
 				{
@@ -659,7 +844,7 @@ int directorySearch(const char* filepart, const unsigned int cluster, directory_
 					return -1;
 				}
 				else
-					return directorySearch(filepart, next_cluster, file, entryOffset); //search next cluster
+					return directorySearch(vol, filepart, next_cluster, file, entryOffset); //search next cluster
 			}
 		}
 		else //found a file match!
@@ -683,16 +868,16 @@ int directorySearch(const char* filepart, const unsigned int cluster, directory_
 
 //pass in the cluster to write the directory to and the directory struct to write.
 //struct should only have a file name, attributes, and size. the rest will be filled in automatically
-int directoryAdd(const unsigned int cluster, directory_entry_t* file_to_add)
+int directoryAdd(fat_volume_t* vol, const unsigned int cluster, directory_entry_t* file_to_add)
 {
-	if (testIfFATFormat(file_to_add->file_name) != 0)
+	if (testIfFATFormat((char*)file_to_add->file_name) != 0)
 	{
 		d_printss("Function directoryAdd: file name supplied is invalid!");
 		return -1;
 	}
 
 	//read cluster of the directory/subdirectory
-	if (clusterRead(cluster, 0) != 0)
+	if (clusterRead(vol, cluster, 0) != 0)
 	{
 		d_printss("Function directoryAdd: clusterRead encountered an error. Aborting...\n");
 		return -1;
@@ -704,36 +889,44 @@ int directoryAdd(const unsigned int cluster, directory_entry_t* file_to_add)
 	{
 		if (file_metadata->file_name[0] != ENTRY_FREE && file_metadata->file_name[0] != ENTRY_END) //if the file directory slot isn't free
 		{
-			if (meta_pointer_iterator_count < bootsect.bytes_per_sector * bootsect.sectors_per_cluster / sizeof(directory_entry_t) - 1) //if the pointer hasn't iterated outside of what that cluster can hold (the 1 is to prevent strncmp from the line above from reading past the cluster boundary)
+			if (meta_pointer_iterator_count < vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster / sizeof(directory_entry_t) - 1) //if the pointer hasn't iterated outside of what that cluster can hold (the 1 is to prevent strncmp from the line above from reading past the cluster boundary)
 			{
 				file_metadata++;
 				meta_pointer_iterator_count++;
 			}
 			else
 			{
-				unsigned int next_cluster = FATRead(cluster);
+				unsigned int next_cluster = FATRead(vol, cluster);
 				d_printhex(next_cluster, 8);
 				d_printss("\n");
 
-				if ((next_cluster >= END_CLUSTER_32 && fat_type == 32) || (next_cluster >= END_CLUSTER_16 && fat_type == 16) || (next_cluster >= END_CLUSTER_12 && fat_type == 12)) //no free spaces left in the directory cluster, and no more clusters to search. Allocate a new one.
+				if ((next_cluster >= END_CLUSTER_32 && vol->fat_type == 32) || (next_cluster >= END_CLUSTER_16 && vol->fat_type == 16) || (next_cluster >= END_CLUSTER_12 && vol->fat_type == 12)) //no free spaces left in the directory cluster, and no more clusters to search. Allocate a new one.
 				{
-					next_cluster = allocateFreeFAT();
+					next_cluster = allocateFreeFATNear(vol, cluster + 1); //keep the directory's clusters together
 
-					if ((next_cluster == BAD_CLUSTER_32 && fat_type == 32) || (next_cluster == BAD_CLUSTER_16 && fat_type == 16) || (next_cluster == BAD_CLUSTER_12 && fat_type == 12)) //allocation unsuccessful
+					if ((next_cluster == BAD_CLUSTER_32 && vol->fat_type == 32) || (next_cluster == BAD_CLUSTER_16 && vol->fat_type == 16) || (next_cluster == BAD_CLUSTER_12 && vol->fat_type == 12)) //allocation unsuccessful
 					{
 						d_printss("Function directoryAdd: allocation of new cluster failed. Aborting...\n");
 						return -1;
 					}
 
 					//write the new cluster number to the previous cluster's FAT
-					if (FATWrite(cluster, next_cluster) != 0)
+					if (FATWrite(vol, cluster, next_cluster) != 0)
 					{
 						d_printss("Function directoryAdd: extension of the cluster chain with new cluster failed. Aborting...\n");
 						return -1;
 					}
+
+					//a new directory cluster has to start out empty, or whatever was on disk would be read as entries
+					memset((char*)DISK_WRITE_LOCATION, 0, vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster);
+					if (clusterWrite(vol, (void*)DISK_WRITE_LOCATION, vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster, 0, next_cluster) != 0)
+					{
+						d_printss("Function directoryAdd: clearing the new directory cluster failed. Aborting...\n");
+						return -1;
+					}
 				}
 
-				return directoryAdd(next_cluster, file_to_add);//search next cluster
+				return directoryAdd(vol, next_cluster, file_to_add);//search next cluster
 			}
 		}
 		else
@@ -757,21 +950,23 @@ int directoryAdd(const unsigned int cluster, directory_entry_t* file_to_add)
 			file_to_add->last_modification_date = file_to_add->creation_date;
 			file_to_add->last_modification_time = file_to_add->creation_time;
 
-			//allocate new cluster for new file
-			unsigned int new_cluster = allocateFreeFAT();
+			//allocate new cluster for new file, close to the directory that holds it; an empty file has none, like the spec says
+			unsigned int new_cluster = 0;
+			if (file_to_add->file_size != 0 || (file_to_add->attributes & FILE_DIRECTORY) == FILE_DIRECTORY)
+				new_cluster = allocateFreeFATNear(vol, allocationGoal(vol, cluster, file_to_add->file_size));
 			
 			d_printss("Function directoryAdd: the new cluster for the file is ");
 			d_printhex (new_cluster, 8);
 			d_printss("\n");
 
-			if ((new_cluster == BAD_CLUSTER_32 && fat_type == 32) || (new_cluster == BAD_CLUSTER_16 && fat_type ==16) || (new_cluster == BAD_CLUSTER_12 && fat_type == 12)) //allocation unsuccessful
+			if ((new_cluster == BAD_CLUSTER_32 && vol->fat_type == 32) || (new_cluster == BAD_CLUSTER_16 && vol->fat_type ==16) || (new_cluster == BAD_CLUSTER_12 && vol->fat_type == 12)) //allocation unsuccessful
 			{
 				d_printss("Function directoryAdd: allocation of new cluster failed. Aborting...\n");
 				return -1;
 			}
 
-			file_to_add->low_bits = GET_ENTRY_LOW_BITS(new_cluster);
-			file_to_add->high_bits = GET_ENTRY_HIGH_BITS(new_cluster);
+			file_to_add->low_bits = GET_ENTRY_LOW_BITS(new_cluster, vol->fat_type);
+			file_to_add->high_bits = GET_ENTRY_HIGH_BITS(new_cluster, vol->fat_type);
 			
 			d_printss("\nHigh bits are: ");
 			d_printhex(file_to_add->low_bits, 4);
@@ -782,7 +977,7 @@ int directoryAdd(const unsigned int cluster, directory_entry_t* file_to_add)
 			//copy data to empty location
 			memcpy(file_metadata, file_to_add, sizeof(directory_entry_t));
 
-			if (clusterWrite((void *)DISK_WRITE_LOCATION, bootsect.bytes_per_sector * bootsect.sectors_per_cluster, 0, cluster) != 0)
+			if (clusterWrite(vol, (void *)DISK_READ_LOCATION, vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster, 0, cluster) != 0)
 			{
 				d_printss("Function directoryAdd: Writing new directory entry failed. Aborting...\n");
 				return -1;
@@ -804,12 +999,19 @@ int getFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 		return -1;
 	}
 
+	fat_volume_t* vol = FATVolumeFromPath(filePath);
+	if (vol == NULL)
+	{
+		d_printss("Function getFile: no volume is mounted at that drive letter!\n");
+		return -2;
+	}
+
 	char fileNamePart[256]; //holds the part of the path to be searched
 
-	unsigned short start = 3; //starting at 3 to skip the "C:\" bit
+	unsigned short start = 3; //starting at 3 to skip the "C:\" bit (the letter picks the volume)
 	unsigned int active_cluster;
-	if (fat_type == 32)
-		active_cluster = ((fat_extBS_32_t*)bootsect.extended_section)->root_cluster; //holds the cluster to be searched for directory entries related to the path
+	if (vol->fat_type == 32)
+		active_cluster = ((fat_extBS_32_t*)vol->bootsect.extended_section)->root_cluster; //holds the cluster to be searched for directory entries related to the path
 	else
 	{
 		d_printss("Function getFile: FAT16 and FAT12 are not supported!\n");
@@ -830,7 +1032,7 @@ int getFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 			//hacked-together strcpy derivative...
 			memcpy(fileNamePart, filePath + start, iterator - start);
 
-			int retVal = directorySearch(fileNamePart, active_cluster, &file_info, NULL); //go looking for a directory in the specified cluster with the specified name
+			int retVal = directorySearch(vol, fileNamePart, active_cluster, &file_info, NULL); //go looking for a directory in the specified cluster with the specified name
 
 			if (retVal == -2) //no directory matching found
 				return -2;
@@ -841,7 +1043,7 @@ int getFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 			}
 
 			start = iterator + 1;
-			active_cluster = GET_CLUSTER_FROM_ENTRY(file_info); //shift the high bits into their appropriate spots, and OR with low_bits (could also add, I think) in prep for next search
+			active_cluster = GET_CLUSTER_FROM_ENTRY(file_info, vol->fat_type); //shift the high bits into their appropriate spots, and OR with low_bits (could also add, I think) in prep for next search
 		}
 	}
 
@@ -849,16 +1051,16 @@ int getFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 
 	if ((file_info.attributes & FILE_DIRECTORY) != FILE_DIRECTORY) //if final directory listing found isn't a directory
 	{
-		if (readInOffset < 1 || (readInOffset * (unsigned short)bootsect.bytes_per_sector * (unsigned short)bootsect.sectors_per_cluster) + file_info.file_size > 262144) //prevent offsets that extend into FATRead's working range or outside the allocated BIOS int13h space
+		if (readInOffset < 1 || (readInOffset * (unsigned short)vol->bootsect.bytes_per_sector * (unsigned short)vol->bootsect.sectors_per_cluster) + file_info.file_size > 262144) //prevent offsets that extend into FATRead's working range or outside the allocated BIOS int13h space
 			return -3; //you cannot have an offset below 1, nor can you read in more than 256kB
 
-		int cluster = GET_CLUSTER_FROM_ENTRY(file_info); //initialize file read-in with first cluster of file
+		int cluster = GET_CLUSTER_FROM_ENTRY(file_info, vol->fat_type); //initialize file read-in with first cluster of file
 		unsigned int clusterReadCount = 0;
-		while (cluster < END_CLUSTER_32)
+		while (cluster >= 2 && cluster < END_CLUSTER_32) //an empty file has no first cluster
 		{
-			clusterRead(cluster, clusterReadCount + readInOffset); //Always offset by at least one, so any file operations happening exactly at DISK_READ_LOCATION (e.g. FAT Table lookups) don't overwrite the data (this is essentially backwards compatibility with previously written code)
+			clusterRead(vol, cluster, clusterReadCount + readInOffset); //Always offset by at least one, so any file operations happening exactly at DISK_READ_LOCATION (e.g. FAT Table lookups) don't overwrite the data (this is essentially backwards compatibility with previously written code)
 			clusterReadCount++;
-			cluster = FATRead(cluster);
+			cluster = FATRead(vol, cluster);
 			if (cluster == BAD_CLUSTER_32)
 			{
 				d_printss("Function getFile: the cluster chain is corrupted with a bad cluster. Aborting...\n");
@@ -871,7 +1073,7 @@ int getFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 			}
 		}
 
-		*fileContents = (char *)(DISK_READ_LOCATION + (unsigned short)bootsect.sectors_per_cluster * (unsigned short)bootsect.bytes_per_sector * readInOffset); //return a pointer in the BIOS read-in space where the file is.
+		*fileContents = (char *)(DISK_READ_LOCATION + (unsigned short)vol->bootsect.sectors_per_cluster * (unsigned short)vol->bootsect.bytes_per_sector * readInOffset); //return a pointer in the BIOS read-in space where the file is.
 
 		return 0; //file successfully found
 	}
@@ -886,21 +1088,28 @@ int getFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 //returns: -1 is general error, -2 indicates a bad path/file name, -3 indicates file with same name already exists, -4 indicates file size error
 int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMeta)
 {
-	if (testIfFATFormat(fileMeta->file_name) != 0)
+	if (testIfFATFormat((char*)fileMeta->file_name) != 0)
 	{
-		d_printhex(testIfFATFormat(fileMeta->file_name), 8);
-		d_printss(fileMeta->file_name);
+		d_printhex(testIfFATFormat((char*)fileMeta->file_name), 8);
+		d_printss((char*)fileMeta->file_name);
 		d_printss("\n");
 		d_printss("\nFunction putFile: Invalid file name!\n");
 		return -2;
 	}
 
+	fat_volume_t* vol = FATVolumeFromPath(filePath);
+	if (vol == NULL)
+	{
+		d_printss("Function putFile: no volume is mounted at that drive letter!\n");
+		return -2;
+	}
+
 	char fileNamePart[256]; //holds the part of the path to be searched
 
-	unsigned short start = 3; //starting at 3 to skip the "C:\" bit
+	unsigned short start = 3; //starting at 3 to skip the "C:\" bit (the letter picks the volume)
 	unsigned int active_cluster; //holds the cluster to be searched for directory entries related to the path
-	if (fat_type == 32)
-		active_cluster = ((fat_extBS_32_t*)bootsect.extended_section)->root_cluster;
+	if (vol->fat_type == 32)
+		active_cluster = ((fat_extBS_32_t*)vol->bootsect.extended_section)->root_cluster;
 	else
 	{
 		d_printss("Function putFile: FAT16 and FAT12 are not supported!\n");
@@ -911,15 +1120,15 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 
 	//starting at 3 to skip the "C:\" bit
 	unsigned int iterator = 3;
-	if (strcmp(filePath, "C:\\") == 0)
+	if (strcmp(filePath + 1, ":\\") == 0)
 	{
-		if (fat_type == 32)
+		if (vol->fat_type == 32)
 		{
-			active_cluster = ((fat_extBS_32_t*)bootsect.extended_section)->root_cluster;
+			active_cluster = ((fat_extBS_32_t*)vol->bootsect.extended_section)->root_cluster;
 			file_info.attributes = FILE_DIRECTORY | FILE_VOLUME_ID;
 			file_info.file_size = 0;
-			file_info.high_bits = GET_ENTRY_HIGH_BITS(active_cluster);
-			file_info.low_bits = GET_ENTRY_LOW_BITS(active_cluster);
+			file_info.high_bits = GET_ENTRY_HIGH_BITS(active_cluster, vol->fat_type);
+			file_info.low_bits = GET_ENTRY_LOW_BITS(active_cluster, vol->fat_type);
 		}
 		else
 		{
@@ -940,7 +1149,7 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 				memcpy(fileNamePart, filePath + start, iterator - start);
 
 
-				int retVal = directorySearch(fileNamePart, active_cluster, &file_info, NULL); //go looking for a directory in the specified cluster with the specified name
+				int retVal = directorySearch(vol, fileNamePart, active_cluster, &file_info, NULL); //go looking for a directory in the specified cluster with the specified name
 
 				if (retVal == -2) //no directory matching found
 				{
@@ -954,7 +1163,7 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 				}
 
 				start = iterator + 1;
-				active_cluster = GET_CLUSTER_FROM_ENTRY(file_info); //prep for next search
+				active_cluster = GET_CLUSTER_FROM_ENTRY(file_info, vol->fat_type); //prep for next search
 			}
 		}
 	}
@@ -962,7 +1171,7 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 	//directory to receive the file is now found, and its cluster is stored in active_cluster. Search the directory to ensure the specified file name is not already in use
 	char output [13];
 		convertFromFATFormat((char *)fileMeta->file_name, output);
-	int retVal = directorySearch(output, active_cluster, NULL, NULL);
+	int retVal = directorySearch(vol, output, active_cluster, NULL, NULL);
 	if (retVal == -1)
 	{
 		d_printss("Function putFile: directorySearch encountered an error. Aborting...\n");
@@ -976,10 +1185,10 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 
 	if ((file_info.attributes & FILE_DIRECTORY) == FILE_DIRECTORY) //if final directory listing found is a directory
 	{
-		d_printsss(fileMeta->file_name, 11);
+		d_printsss((char*)fileMeta->file_name, 11);
 		d_printhex (active_cluster, 8);
 		d_printss("\n");
-		if (directoryAdd(active_cluster, fileMeta) != 0)
+		if (directoryAdd(vol, active_cluster, fileMeta) != 0)
 		{
 			d_printss("Function putFile: directoryAdd encountered an error. Aborting...\n");
 			return -1;
@@ -991,7 +1200,7 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 		d_printsss(output, 11);
 		d_printhex (active_cluster, 8);
 		d_printss("\n");
-		retVal = directorySearch(output, active_cluster, &file_info, NULL);
+		retVal = directorySearch(vol, output, active_cluster, &file_info, NULL);
 		if (retVal == -2)                                        
 		{
 			d_printss("Function putFile: directoryAdd did not properly write the new file's entry to disk. Aborting...\n");
@@ -1003,7 +1212,7 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 			return -1;
 		}
 
-		active_cluster = GET_CLUSTER_FROM_ENTRY(file_info);
+		active_cluster = GET_CLUSTER_FROM_ENTRY(file_info, vol->fat_type);
 		
 		d_printss("Cluster of Entry: ");
 		d_printhex(active_cluster, 8);
@@ -1016,13 +1225,13 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 			d_printhex(dataLeftToWrite, 8);
 			d_printss("\n");
 			unsigned int dataWrite = 0;
-			if (dataLeftToWrite >= bootsect.bytes_per_sector * bootsect.sectors_per_cluster)
-				dataWrite = bootsect.bytes_per_sector * bootsect.sectors_per_cluster + 1;
+			if (dataLeftToWrite >= vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster)
+				dataWrite = vol->bootsect.bytes_per_sector * vol->bootsect.sectors_per_cluster;
 			else
 				dataWrite = dataLeftToWrite;
 
 			//Always offset by at least one, so any file operations happening exactly at DISK_READ_LOCATION (e.g. FAT Table lookups) don't overwrite the data (this is essentially backwards compatibility with previously written code)
-			if (clusterWrite(*fileContents + (fileMeta->file_size - dataLeftToWrite), dataWrite, 1, active_cluster) != 0)
+			if (clusterWrite(vol, *fileContents + (fileMeta->file_size - dataLeftToWrite), dataWrite, 1, active_cluster) != 0)
 			{
 				d_printss("Function putFile: clusterWrite encountered an error. Aborting...\n");
 				return -1;
@@ -1033,22 +1242,17 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 			//if there's no data left to write, exit
 			if (dataLeftToWrite == 0)
 				break;
-			else if (dataLeftToWrite < 0)
-			{
-				d_printss("Function putFile: An undefined value has been detected. Aborting...\n");
-				return -1;
-			}
 
 			//there's more data to write, so allocate new cluster, change fat of current cluster to point to new cluster, and change active cluster to new cluster
 
-			unsigned int new_cluster = allocateFreeFAT();
+			unsigned int new_cluster = allocateFreeFATNear(vol, active_cluster + 1); //extend the file right after its last cluster if possible
 
-			if ((new_cluster == BAD_CLUSTER_32 && fat_type == 32) || (new_cluster == BAD_CLUSTER_16 && fat_type == 16) || (new_cluster == BAD_CLUSTER_12 && fat_type == 12)) //allocation error
+			if ((new_cluster == BAD_CLUSTER_32 && vol->fat_type == 32) || (new_cluster == BAD_CLUSTER_16 && vol->fat_type == 16) || (new_cluster == BAD_CLUSTER_12 && vol->fat_type == 12)) //allocation error
 			{
-				d_printss("Function putFile: allocateFreeFAT encountered an error. Aborting...\n");
+				d_printss("Function putFile: allocateFreeFATNear encountered an error. Aborting...\n");
 				return -1;
 			}
-			if (FATWrite(active_cluster, new_cluster) != 0)
+			if (FATWrite(vol, active_cluster, new_cluster) != 0)
 			{
 				d_printss("Function putFile: FATWrite encountered an error. Aborting...\n");
 				return -1;
@@ -1066,6 +1270,34 @@ int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMe
 	}
 }
 
+#ifdef __is_kernel
+//Returns: the time of day in directory entry form, hour << 11 | minute << 5 | second / 2
+unsigned short CurrentTime()
+{
+	ktime_date_t date;
+	ktimeGetDate(&date);
+	return (date.hour << 11) | (date.minute << 5) | (date.second / 2);
+}
+
+//Returns: the date in directory entry form, (year - 1980) << 9 | month << 5 | day, or 1980-01-01 before the clock
+//is running
+unsigned short CurrentDate()
+{
+	ktime_date_t date;
+	ktimeGetDate(&date);
+	if (date.year < 1980)
+		return 0x21;
+	return ((date.year - 1980) << 9) | (date.month << 5) | date.day;
+}
+
+//Returns: hundredths of a second past CurrentTime's even second (0-199)
+unsigned char CurrentTimeTenths()
+{
+	ktime_date_t date;
+	ktimeGetDate(&date);
+	return (date.second % 2) * 100 + date.nanosecond / 10000000;
+}
+#else
 //clock hasn't been implemented yet
 unsigned short CurrentTime()
 {
@@ -1083,6 +1315,7 @@ unsigned char CurrentTimeTenths()
 {
 	return 0x0;
 }
+#endif
 
 /*-----------------------------------------------------------------------------
 ChkSum()
@@ -1299,7 +1532,7 @@ void d_printhex( unsigned long num, int digits ) {
          buf += '0';
      else
          buf += 'A' - 10;
-      printf( buf );
+      FAT_DEBUG_PUTCHAR( buf );
    
    }
   
@@ -1310,7 +1543,7 @@ void d_printss( char *s ) {
 
    while ( *s ) {
 
-      printf( *s );
+      FAT_DEBUG_PUTCHAR( *s );
       s++;
    
    }
@@ -1324,9 +1557,9 @@ void d_printsss( char *s, int n ) {
    while ( n-- ) {
 
       if ( *s > ' ' )
-         printf( *s );
+         FAT_DEBUG_PUTCHAR( *s );
       else
-         printf( '.' );
+         FAT_DEBUG_PUTCHAR( '.' );
 
       s++;
 
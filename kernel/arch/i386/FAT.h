@@ -41,10 +41,11 @@
 #define NOT_CONVERTED_YET 0x08 //still contains a dot: E.g."test.txt"
 #define TOO_MANY_DOTS 0x10 //E.g.: "test..txt"; may or may not have already been converted
 
-#define GET_CLUSTER_FROM_ENTRY(x) (x.low_bits | (x.high_bits << (fat_type / 2)))
-#define GET_ENTRY_LOW_BITS(x) (x & ((fat_type /2) -1))
-#define GET_ENTRY_HIGH_BITS(x) (x >> (fat_type / 2))
-#define CONCAT_ENTRY_HL_BITS(high, low) ((high << (fat_type / 2)) | low)
+//only FAT32 uses the high 16 bits of a directory entry's cluster number
+#define GET_CLUSTER_FROM_ENTRY(x, fat_type) (x.low_bits | ((fat_type) == 32 ? (unsigned int)x.high_bits << 16 : 0))
+#define GET_ENTRY_LOW_BITS(x, fat_type) ((x) & 0xFFFF)
+#define GET_ENTRY_HIGH_BITS(x, fat_type) ((fat_type) == 32 ? (x) >> 16 : 0)
+#define CONCAT_ENTRY_HL_BITS(high, low, fat_type) (((fat_type) == 32 ? (high) << 16 : 0) | (low))
 
 #ifndef NULL
 #define NULL 0
@@ -62,18 +63,33 @@
 #define FALSE 0
 #endif
 
+//Cluster allocation policy
+#define FAT_ALLOC_GROUP_CLUSTERS 4096 //clusters per allocation group; new files land in their directory's group
+#ifndef FAT_ALLOC_SPREAD_CLUSTERS
+#define FAT_ALLOC_SPREAD_CLUSTERS 64 //files bigger than this (in clusters) are started in another group. 0 disables spreading
+#endif
+
+//Mount table
+#define FAT_MAX_VOLUMES 4 //mounted as C: through F:
+#define FAT_CACHE_SECTORS 8 //FAT sectors cached per volume
+
+//where d_printss and friends send their output
+#ifndef FAT_DEBUG_PUTCHAR
+#define FAT_DEBUG_PUTCHAR(c) putchar(c)
+#endif
+
+//separate read and write windows, DMA buffers FATMountAll allocates below 16MB (see dma.h)
+#define FAT_DISK_READ_SIZE 0x50000 //getFile can fill 256kB past a one cluster offset
+#define FAT_DISK_WRITE_SIZE 0x20000 //clusterWrite stages at most one 64kB cluster, one cluster in
 #ifndef DISK_READ_LOCATION
-#define DISK_READ_LOCATION 0x40000
+extern unsigned long fat_disk_read_location;
+#define DISK_READ_LOCATION fat_disk_read_location
 #endif
 #ifndef DISK_WRITE_LOCATION
-#define DISK_WRITE_LOCATION 0x40000
+extern unsigned long fat_disk_write_location;
+#define DISK_WRITE_LOCATION fat_disk_write_location
 #endif
 
-extern int int13h_read(unsigned long sector, unsigned char num);
-extern int int13h_read_o(unsigned long sector, unsigned char num, unsigned long memoffset);
-extern int int13h_write(unsigned long sector, unsigned char num);
-extern int int13h_write_o(unsigned long sector, unsigned char num, unsigned long memoffset);
-
 extern void drawtext(int charnum);
 extern int height;
 extern int width;
@@ -188,28 +204,62 @@ typedef struct long_entry
 __attribute__((packed))
 long_entry_t;
 
+//Everything the driver knows about one mounted FAT volume. Each volume has its own geometry, allocator hints and FAT cache,
+//so several can be mounted at once without sharing any state.
+typedef struct fat_volume
+{
+	BOOL mounted;
+	char letter; //'C', 'D', ...
+	unsigned char drive; //ATA drive number, see ata.h
+	unsigned long part_start_lba; //absolute sector the volume starts at
+	unsigned long part_length; //in sectors
+
+	//filled in by FATInitialize
+	unsigned int fat_type;
+	unsigned int first_fat_sector;
+	unsigned int first_data_sector;
+	unsigned int total_clusters; //one past the last valid cluster number
+	fat_BS_t bootsect;
+
+	//allocator hints
+	unsigned int alloc_last; //last cluster handed out by the allocator; same idea as FSInfo's last_written hint
+	unsigned int alloc_spread_group; //allocation group the last large file was started in
+
+	//write-through cache of FAT sectors, direct mapped by sector number
+	unsigned int fat_cache_sector[FAT_CACHE_SECTORS]; //which FAT sector each slot holds (0 = empty)
+	unsigned char* fat_cache[FAT_CACHE_SECTORS]; //a sector each, allocated the first time the slot is used
+}
+fat_volume_t;
+
 //Global variables
-extern unsigned int fat_type;
-extern unsigned int first_fat_sector;
-extern unsigned int first_data_sector;
-extern unsigned int total_clusters;
-extern fat_BS_t bootsect;
-//unsigned int fat_type;
-//unsigned int first_fat_sector;
-//unsigned int first_data_sector;
-//unsigned int total_clusters;
-//fat_BS_t bootsect;
+extern fat_volume_t fat_volumes[FAT_MAX_VOLUMES];
+extern unsigned int fat_alloc_spread_clusters; //tunable, see FAT_ALLOC_SPREAD_CLUSTERS
 
 //FAT functions (see the .c file for function descriptions)
-int FATInitialize(); 
-int FATRead(unsigned int clusterNum);
-int FATWrite(unsigned int clusterNum, unsigned int clusterVal);
-unsigned int allocateFreeFAT();
-int clusterRead(unsigned int clusterNum, unsigned int clusterOffset);
-int clusterWrite(void* contentsToWrite, unsigned int contentSize, unsigned int contentBuffOffset, unsigned int clusterNum);
-int directoryList(const unsigned int cluster, unsigned char attributesToAdd, short exclusive);
-int directorySearch(const char* filepart, const unsigned int cluster, directory_entry_t* file, unsigned int* entryOffset);
-int directoryAdd(const unsigned int cluster, directory_entry_t* file_to_add);
+int volumeRead(fat_volume_t* vol, unsigned long sector, unsigned int count, void* buffer);
+int volumeWrite(fat_volume_t* vol, unsigned long sector, unsigned int count, const void* buffer);
+int int13h_read(fat_volume_t* vol, unsigned long sector, unsigned char num);
+int int13h_read_o(fat_volume_t* vol, unsigned long sector, unsigned char num, unsigned long memoffset);
+int int13h_write(fat_volume_t* vol, unsigned long sector, unsigned char num);
+int int13h_write_o(fat_volume_t* vol, unsigned long sector, unsigned char num, unsigned long memoffset);
+unsigned char* FATCacheSector(fat_volume_t* vol, unsigned int fat_sector);
+void FATCacheInvalidate(fat_volume_t* vol);
+int FATInitialize(fat_volume_t* vol);
+fat_volume_t* FATGetVolume(char letter);
+fat_volume_t* FATVolumeFromPath(const char* filePath);
+int FATMount(unsigned char drive, unsigned long start_lba, unsigned long length);
+int FATUnmount(char letter);
+int FATMountAll();
+int FATRead(fat_volume_t* vol, unsigned int clusterNum);
+int FATWrite(fat_volume_t* vol, unsigned int clusterNum, unsigned int clusterVal);
+unsigned int allocateFreeFAT(fat_volume_t* vol);
+unsigned int allocateFreeFATNear(fat_volume_t* vol, unsigned int goal);
+unsigned int allocationGoal(fat_volume_t* vol, unsigned int dir_cluster, unsigned int file_size);
+int clusterRead(fat_volume_t* vol, unsigned int clusterNum, unsigned int clusterOffset);
+int clusterWrite(fat_volume_t* vol, void* contentsToWrite, unsigned int contentSize, unsigned int contentBuffOffset, unsigned int clusterNum);
+int directoryList(fat_volume_t* vol, const unsigned int cluster, unsigned char attributesToAdd, short exclusive);
+int directorySearch(fat_volume_t* vol, const char* filepart, const unsigned int cluster, directory_entry_t* file, unsigned int* entryOffset);
+int directoryAdd(fat_volume_t* vol, const unsigned int cluster, directory_entry_t* file_to_add);
 int getFile(const char* filePath, char** fileContents, directory_entry_t* fileMeta, unsigned int readInOffset);
 int putFile(const char* filePath, char** fileContents, directory_entry_t* fileMeta);
 unsigned short CurrentTime();
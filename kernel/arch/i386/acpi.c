@@ -0,0 +1,348 @@
+#include "acpi.h"
+#include "paging.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "timer.h"
+#include "cpu.h"
+#include "lib_asm.h"
+#include "lib_c.h"
+
+#include <string.h>
+
+//AML bytes the \_S5 search looks for
+#define ACPI_AML_NAME 0x08
+#define ACPI_AML_PACKAGE 0x12
+#define ACPI_AML_BYTE_PREFIX 0x0A
+
+static const acpi_header_t* acpi_tables[ACPI_MAX_TABLES];
+static acpi_cpu_t acpi_cpus[ACPI_MAX_CPUS];
+static acpi_ioapic_t acpi_ioapics[ACPI_MAX_IOAPICS];
+static acpi_override_t acpi_overrides[ACPI_MAX_OVERRIDES];
+static acpi_info_t acpi_info;
+static int acpi_initialised;
+
+//Returns: 1 if the "length" bytes at "data" add up to 0
+static int acpiChecksum(const void* data, unsigned long length)
+{
+	const unsigned char* bytes = data;
+	unsigned char sum = 0;
+
+	while (length-- > 0)
+		sum += *bytes++;
+	return sum == 0;
+}
+
+//Returns: a pointer "size" bytes can be read through at "physical", or NULL
+static void* acpiMap(unsigned long physical, unsigned long size)
+{
+	if (physical + size <= pagingDirectMapTop())
+		return PHYS_TO_VIRT(physical);
+	return vmmMapPhysical(physical, size, "acpi table");
+}
+
+static void acpiUnmap(void* address)
+{
+	if ((unsigned long)address >= KERNEL_VIRTUAL_BASE + pagingDirectMapTop())
+		vmmRelease((void*)((unsigned long)address & ~(PMM_FRAME_SIZE - 1)));
+}
+
+//maps the header to learn the length, then the whole table
+//Returns: the table, or NULL if it couldn't be mapped or its checksum is wrong
+static const acpi_header_t* acpiMapTable(unsigned long physical)
+{
+	acpi_header_t* header = acpiMap(physical, sizeof(acpi_header_t));
+	unsigned long length;
+
+	if (header == NULL)
+		return NULL;
+	length = header->length;
+	acpiUnmap(header);
+	if (length < sizeof(acpi_header_t))
+		return NULL;
+
+	header = acpiMap(physical, length);
+	if (header == NULL)
+		return NULL;
+	if (!acpiChecksum(header, length))
+	{
+		acpiUnmap(header);
+		return NULL;
+	}
+	return header;
+}
+
+//Returns: the RSDP in the "length" bytes at "physical" (looked for on 16 byte boundaries), or NULL
+static const acpi_rsdp_t* acpiScanRSDP(unsigned long physical, unsigned long length)
+{
+	unsigned long offset;
+
+	for (offset = 0; offset + 20 <= length; offset += 16)
+	{
+		const acpi_rsdp_t* rsdp = PHYS_TO_VIRT(physical + offset);
+		if (memcmp(rsdp->signature, ACPI_RSDP_SIGNATURE, 8) != 0 || !acpiChecksum(rsdp, 20))
+			continue;
+		if (rsdp->revision >= 2 && (offset + sizeof(acpi_rsdp_t) > length || !acpiChecksum(rsdp, sizeof(acpi_rsdp_t))))
+			continue;
+		return rsdp;
+	}
+	return NULL;
+}
+
+static const acpi_rsdp_t* acpiFindRSDP(void)
+{
+	unsigned long ebda = (unsigned long)*(unsigned short*)PHYS_TO_VIRT(ACPI_EBDA_POINTER) << 4;
+	const acpi_rsdp_t* rsdp = NULL;
+
+	if (ebda != 0 && ebda < ACPI_BIOS_END)
+		rsdp = acpiScanRSDP(ebda, ACPI_EBDA_SEARCH_SIZE);
+	if (rsdp == NULL)
+		rsdp = acpiScanRSDP(ACPI_BIOS_START, ACPI_BIOS_END - ACPI_BIOS_START);
+	return rsdp;
+}
+
+static void acpiAddTable(unsigned long long physical)
+{
+	const acpi_header_t* table;
+
+	//above 4GB is out of reach without PAE
+	if (physical >> 32 || acpi_info.tables == ACPI_MAX_TABLES || (table = acpiMapTable(physical)) == NULL)
+	{
+		acpi_info.bad_tables++;
+		return;
+	}
+	acpi_tables[acpi_info.tables++] = table;
+}
+
+//Finds the \_S5 package in the DSDT: NameOp, optionally a root prefix, "_S5_", PackageOp, the package length
+//(1-4 bytes, the count of extra ones in the top two bits of the first), the element count and then the SLP_TYPa
+//and SLP_TYPb values, each either a bare ZeroOp/OneOp or BytePrefix and a byte
+static void acpiParseS5(const acpi_header_t* dsdt)
+{
+	const unsigned char* aml = (const unsigned char*)dsdt + sizeof(acpi_header_t);
+	const unsigned char* end = (const unsigned char*)dsdt + dsdt->length;
+	unsigned short values[2];
+	int i;
+
+	for (; aml + 5 <= end; aml++)
+	{
+		if (memcmp(aml, "_S5_", 4) == 0 && aml[4] == ACPI_AML_PACKAGE && (aml[-1] == ACPI_AML_NAME || (aml[-1] == '\\' && aml[-2] == ACPI_AML_NAME)))
+			break;
+	}
+	if (aml + 5 > end)
+		return;
+
+	aml += 5;
+	aml += ((*aml & 0xC0) >> 6) + 1; //package length
+	aml++; //element count
+	for (i = 0; i < 2; i++)
+	{
+		if (aml + 2 > end)
+			return;
+		if (*aml == ACPI_AML_BYTE_PREFIX)
+			aml++;
+		values[i] = *aml++;
+	}
+
+	acpi_info.slp_typa = values[0];
+	acpi_info.slp_typb = values[1];
+	acpi_info.s5 = 1;
+}
+
+static void acpiParseFADT(const acpi_fadt_t* fadt)
+{
+	unsigned long long dsdt_address = fadt->dsdt;
+	const acpi_header_t* dsdt;
+
+	acpi_info.pm1a_control = fadt->pm1a_control_block;
+	acpi_info.pm1b_control = fadt->pm1b_control_block;
+	acpi_info.smi_command = fadt->smi_command;
+	acpi_info.acpi_enable = fadt->acpi_enable;
+	acpi_info.century = fadt->century;
+
+	if (fadt->header.length >= sizeof(acpi_fadt_t) && fadt->x_dsdt != 0 && !(fadt->x_dsdt >> 32))
+		dsdt_address = fadt->x_dsdt;
+	if (dsdt_address == 0)
+		return;
+
+	//the DSDT isn't in the root table, so it's kept alongside the others for acpiFindTable
+	acpiAddTable(dsdt_address);
+	dsdt = acpiFindTable("DSDT", 0);
+	if (dsdt != NULL)
+		acpiParseS5(dsdt);
+}
+
+static void acpiParseMADT(const acpi_madt_t* madt)
+{
+	const unsigned char* entry = (const unsigned char*)madt + sizeof(acpi_madt_t);
+	const unsigned char* end = (const unsigned char*)madt + madt->header.length;
+
+	acpi_info.lapic_address = madt->lapic_address;
+
+	for (; entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end; entry += entry[1])
+	{
+		if (entry[0] == ACPI_MADT_LAPIC && entry[1] >= 8 && acpi_info.cpus < ACPI_MAX_CPUS)
+		{
+			acpi_cpu_t* cpu = &acpi_cpus[acpi_info.cpus++];
+			cpu->acpi_id = entry[2];
+			cpu->apic_id = entry[3];
+			cpu->flags = *(const unsigned int*)(entry + 4);
+		}
+		else if (entry[0] == ACPI_MADT_IOAPIC && entry[1] >= 12 && acpi_info.ioapics < ACPI_MAX_IOAPICS)
+		{
+			acpi_ioapic_t* ioapic = &acpi_ioapics[acpi_info.ioapics++];
+			ioapic->id = entry[2];
+			ioapic->address = *(const unsigned int*)(entry + 4);
+			ioapic->gsi_base = *(const unsigned int*)(entry + 8);
+		}
+		else if (entry[0] == ACPI_MADT_OVERRIDE && entry[1] >= 10 && acpi_info.overrides < ACPI_MAX_OVERRIDES)
+		{
+			acpi_override_t* override = &acpi_overrides[acpi_info.overrides++];
+			override->source = entry[3];
+			override->gsi = *(const unsigned int*)(entry + 4);
+			override->flags = *(const unsigned short*)(entry + 8);
+		}
+		else if (entry[0] == ACPI_MADT_LAPIC_ADDRESS && entry[1] >= 12)
+		{
+			unsigned long long address = *(const unsigned long long*)(entry + 4);
+			if (!(address >> 32))
+				acpi_info.lapic_address = address;
+		}
+	}
+}
+
+//Finds and checks the ACPI tables and parses the FADT, MADT and HPET ones. vmmInit has to have run
+//Returns: 0 on success, -1 if there's no RSDP or root table
+int acpiInit(void)
+{
+	const acpi_rsdp_t* rsdp;
+	const acpi_header_t* root;
+	const acpi_header_t* table;
+	unsigned int entry_size = 4;
+	unsigned int entries;
+	unsigned int i;
+
+	if (acpi_initialised)
+		return acpi_info.tables > 0 ? 0 : -1;
+	acpi_initialised = 1;
+
+	rsdp = acpiFindRSDP();
+	if (rsdp == NULL)
+		return -1;
+	acpi_info.revision = rsdp->revision;
+	memcpy(acpi_info.oem_id, rsdp->oem_id, 6);
+
+	root = NULL;
+	if (rsdp->revision >= 2 && rsdp->xsdt_address != 0 && !(rsdp->xsdt_address >> 32))
+	{
+		root = acpiMapTable(rsdp->xsdt_address);
+		entry_size = 8;
+	}
+	if (root == NULL)
+	{
+		root = acpiMapTable(rsdp->rsdt_address);
+		entry_size = 4;
+	}
+	if (root == NULL)
+		return -1;
+
+	entries = (root->length - sizeof(acpi_header_t)) / entry_size;
+	for (i = 0; i < entries; i++)
+	{
+		const unsigned char* entry = (const unsigned char*)root + sizeof(acpi_header_t) + i * entry_size;
+		acpiAddTable(entry_size == 8 ? *(const unsigned long long*)entry : *(const unsigned int*)entry);
+	}
+
+	table = acpiFindTable("FACP", 0);
+	if (table != NULL)
+		acpiParseFADT((const acpi_fadt_t*)table);
+	table = acpiFindTable("APIC", 0);
+	if (table != NULL)
+		acpiParseMADT((const acpi_madt_t*)table);
+	table = acpiFindTable("HPET", 0);
+	if (table != NULL && table->length >= sizeof(acpi_hpet_t) && ((const acpi_hpet_t*)table)->address.space == 0)
+		acpi_info.hpet_address = ((const acpi_hpet_t*)table)->address.address;
+
+	return 0;
+}
+
+const acpi_header_t* acpiGetTable(unsigned int index)
+{
+	if (index >= acpi_info.tables)
+		return NULL;
+	return acpi_tables[index];
+}
+
+//Returns: the "instance"th table (counting from 0) with "signature", or NULL
+const acpi_header_t* acpiFindTable(const char* signature, unsigned int instance)
+{
+	unsigned int i;
+
+	for (i = 0; i < acpi_info.tables; i++)
+	{
+		if (memcmp(acpi_tables[i]->signature, signature, 4) == 0 && instance-- == 0)
+			return acpi_tables[i];
+	}
+	return NULL;
+}
+
+const acpi_cpu_t* acpiGetCpu(unsigned int index)
+{
+	if (index >= acpi_info.cpus)
+		return NULL;
+	return &acpi_cpus[index];
+}
+
+const acpi_ioapic_t* acpiGetIOAPIC(unsigned int index)
+{
+	if (index >= acpi_info.ioapics)
+		return NULL;
+	return &acpi_ioapics[index];
+}
+
+const acpi_override_t* acpiGetOverride(unsigned int index)
+{
+	if (index >= acpi_info.overrides)
+		return NULL;
+	return &acpi_overrides[index];
+}
+
+//Returns: the CMOS register the RTC keeps the century in, 0 if the FADT doesn't name one (or before acpiInit)
+unsigned char acpiCenturyRegister(void)
+{
+	return acpi_info.century;
+}
+
+//Puts the machine in S5. Only returns if it didn't work
+//Returns: -1
+int acpiShutdown(void)
+{
+	unsigned long waited;
+	unsigned long flags;
+
+	if (!acpi_info.s5 || acpi_info.pm1a_control == 0)
+		return -1;
+
+	//with SCI_EN clear the firmware still owns the power management registers; ACPI_ENABLE on the SMI port asks
+	//for them, and the handover is done when SCI_EN comes on
+	if (!(inw(acpi_info.pm1a_control) & ACPI_PM1_SCI_EN) && acpi_info.smi_command != 0 && acpi_info.acpi_enable != 0)
+	{
+		outb(acpi_info.smi_command, acpi_info.acpi_enable);
+		for (waited = 0; waited < ACPI_ENABLE_TIMEOUT_MS && !(inw(acpi_info.pm1a_control) & ACPI_PM1_SCI_EN); waited++)
+			timerSleepMs(1);
+	}
+
+	flags = cpuIrqSave();
+	outw(acpi_info.pm1a_control, (acpi_info.slp_typa << ACPI_PM1_SLP_TYP_SHIFT) | ACPI_PM1_SLP_EN);
+	if (acpi_info.pm1b_control != 0)
+		outw(acpi_info.pm1b_control, (acpi_info.slp_typb << ACPI_PM1_SLP_TYP_SHIFT) | ACPI_PM1_SLP_EN);
+
+	//the write takes a moment to land on real hardware
+	timerSleepMs(ACPI_ENABLE_TIMEOUT_MS);
+	cpuIrqRestore(flags);
+	return -1;
+}
+
+void acpiGetInfo(acpi_info_t* info)
+{
+	*info = acpi_info;
+}
@@ -0,0 +1,204 @@
+#ifndef ACPI_H_
+#define ACPI_H_
+
+//ACPI table discovery. acpiInit finds the RSDP in the EBDA or the BIOS area, walks the XSDT (the RSDT on ACPI 1.0)
+//and keeps every table whose checksum adds up. Tables inside the direct map are used where they are; the rest get
+//a vmm mapping each. Out of the tables it pulls what the rest of the kernel needs:
+//FADT: the PM1 control ports and the CMOS century register. The SLP_TYP values for soft-off come from the \_S5
+//package in the DSDT; there's no AML interpreter, so the package is found by its byte pattern.
+//MADT: the local APIC address, the processors, the I/O APICs and the ISA interrupt overrides.
+//HPET: the HPET's register block.
+//acpiShutdown switches the chipset into ACPI mode if the firmware left it out and writes SLP_TYP | SLP_EN.
+
+#define ACPI_MAX_TABLES 32
+#define ACPI_MAX_CPUS 16
+#define ACPI_MAX_IOAPICS 4
+#define ACPI_MAX_OVERRIDES 16
+
+#define ACPI_RSDP_SIGNATURE "RSD PTR "
+#define ACPI_EBDA_POINTER 0x40E //real mode segment of the extended BIOS data area
+#define ACPI_EBDA_SEARCH_SIZE 0x400
+#define ACPI_BIOS_START 0xE0000
+#define ACPI_BIOS_END 0x100000
+
+//PM1 control register
+#define ACPI_PM1_SCI_EN 0x0001 //the chipset is in ACPI mode
+#define ACPI_PM1_SLP_TYP_SHIFT 10
+#define ACPI_PM1_SLP_EN 0x2000
+
+#define ACPI_ENABLE_TIMEOUT_MS 300 //how long the firmware gets to hand over after ACPI_ENABLE
+
+//MADT entry types
+#define ACPI_MADT_LAPIC 0
+#define ACPI_MADT_IOAPIC 1
+#define ACPI_MADT_OVERRIDE 2
+#define ACPI_MADT_LAPIC_ADDRESS 5
+
+#define ACPI_MADT_CPU_ENABLED 0x1
+
+typedef struct __attribute__((packed)) acpi_rsdp
+{
+	char signature[8];
+	unsigned char checksum; //first 20 bytes
+	char oem_id[6];
+	unsigned char revision; //0 for ACPI 1.0, which ends at rsdt_address
+	unsigned int rsdt_address;
+	unsigned int length;
+	unsigned long long xsdt_address;
+	unsigned char extended_checksum; //whole structure
+	unsigned char reserved[3];
+}
+acpi_rsdp_t;
+
+typedef struct __attribute__((packed)) acpi_header
+{
+	char signature[4];
+	unsigned int length; //header included
+	unsigned char revision;
+	unsigned char checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	unsigned int oem_revision;
+	unsigned int creator_id;
+	unsigned int creator_revision;
+}
+acpi_header_t;
+
+typedef struct __attribute__((packed)) acpi_address
+{
+	unsigned char space; //0 memory, 1 I/O ports
+	unsigned char bit_width;
+	unsigned char bit_offset;
+	unsigned char access_size;
+	unsigned long long address;
+}
+acpi_address_t;
+
+//only as far as the fields we read; acpiParseFADT checks the length before reading anything past the ACPI 1.0 ones
+typedef struct __attribute__((packed)) acpi_fadt
+{
+	acpi_header_t header;
+	unsigned int firmware_ctrl;
+	unsigned int dsdt;
+	unsigned char reserved_0;
+	unsigned char preferred_pm_profile;
+	unsigned short sci_interrupt;
+	unsigned int smi_command;
+	unsigned char acpi_enable;
+	unsigned char acpi_disable;
+	unsigned char s4bios_request;
+	unsigned char pstate_control;
+	unsigned int pm1a_event_block;
+	unsigned int pm1b_event_block;
+	unsigned int pm1a_control_block;
+	unsigned int pm1b_control_block;
+	unsigned int pm2_control_block;
+	unsigned int pm_timer_block;
+	unsigned int gpe0_block;
+	unsigned int gpe1_block;
+	unsigned char pm1_event_length;
+	unsigned char pm1_control_length;
+	unsigned char pm2_control_length;
+	unsigned char pm_timer_length;
+	unsigned char gpe0_length;
+	unsigned char gpe1_length;
+	unsigned char gpe1_base;
+	unsigned char cstate_control;
+	unsigned short c2_latency;
+	unsigned short c3_latency;
+	unsigned short flush_size;
+	unsigned short flush_stride;
+	unsigned char duty_offset;
+	unsigned char duty_width;
+	unsigned char day_alarm;
+	unsigned char month_alarm;
+	unsigned char century; //CMOS register, 0 if the RTC has none
+	unsigned short boot_architecture;
+	unsigned char reserved_1;
+	unsigned int flags;
+	acpi_address_t reset_register;
+	unsigned char reset_value;
+	unsigned short arm_boot_architecture;
+	unsigned char minor_version;
+	unsigned long long x_firmware_ctrl;
+	unsigned long long x_dsdt; //ACPI 2.0 on
+}
+acpi_fadt_t;
+
+typedef struct __attribute__((packed)) acpi_madt
+{
+	acpi_header_t header;
+	unsigned int lapic_address;
+	unsigned int flags;
+	//variable length entries follow, each starting with its type and length
+}
+acpi_madt_t;
+
+typedef struct __attribute__((packed)) acpi_hpet
+{
+	acpi_header_t header;
+	unsigned int block_id;
+	acpi_address_t address;
+	unsigned char number;
+	unsigned short minimum_tick;
+	unsigned char page_protection;
+}
+acpi_hpet_t;
+
+typedef struct acpi_cpu
+{
+	unsigned char acpi_id;
+	unsigned char apic_id;
+	unsigned int flags; //ACPI_MADT_CPU_ENABLED
+}
+acpi_cpu_t;
+
+typedef struct acpi_ioapic
+{
+	unsigned char id;
+	unsigned long address;
+	unsigned int gsi_base; //first global system interrupt it takes
+}
+acpi_ioapic_t;
+
+typedef struct acpi_override
+{
+	unsigned char source; //ISA IRQ
+	unsigned int gsi; //what it's wired to instead
+	unsigned short flags; //polarity and trigger mode
+}
+acpi_override_t;
+
+typedef struct acpi_info
+{
+	unsigned int revision; //of the RSDP
+	char oem_id[7];
+	unsigned int tables;
+	unsigned int bad_tables; //listed but failed their checksum or couldn't be mapped
+	unsigned short pm1a_control;
+	unsigned short pm1b_control;
+	unsigned short slp_typa; //for S5, valid if s5 is set
+	unsigned short slp_typb;
+	int s5;
+	unsigned int smi_command;
+	unsigned char acpi_enable;
+	unsigned char century;
+	unsigned long lapic_address;
+	unsigned int cpus;
+	unsigned int ioapics;
+	unsigned int overrides;
+	unsigned long long hpet_address; //0 without an HPET table
+}
+acpi_info_t;
+
+int acpiInit(void);
+const acpi_header_t* acpiGetTable(unsigned int index);
+const acpi_header_t* acpiFindTable(const char* signature, unsigned int instance);
+const acpi_cpu_t* acpiGetCpu(unsigned int index);
+const acpi_ioapic_t* acpiGetIOAPIC(unsigned int index);
+const acpi_override_t* acpiGetOverride(unsigned int index);
+unsigned char acpiCenturyRegister(void);
+int acpiShutdown(void);
+void acpiGetInfo(acpi_info_t* info);
+
+#endif
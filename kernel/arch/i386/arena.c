@@ -0,0 +1,151 @@
+#include "arena.h"
+#include "vmm.h"
+#include "lib_c.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//Reserves "size" bytes of address space for the arena
+//Returns: 0 on success, -1 if the vmm had no room
+int arenaCreate(arena_t* arena, const char* name, unsigned long size)
+{
+	memset(arena, 0, sizeof(arena_t));
+	arena->name = name;
+	arena->base = vmmReserve(size, VMM_REGION_WRITE, name);
+	if (arena->base == NULL)
+		return -1;
+	arena->size = (size + 0xFFF) & ~0xFFFul;
+	return 0;
+}
+
+void arenaDestroy(arena_t* arena)
+{
+	if (arena->base != NULL)
+		vmmRelease(arena->base);
+	arena->base = NULL;
+	arena->size = 0;
+	arena->used = 0;
+	arena->dirty = 0;
+}
+
+//Returns: "size" bytes aligned to ARENA_ALIGN, or NULL if the arena is full
+void* arenaAlloc(arena_t* arena, unsigned long size)
+{
+	unsigned long start = (arena->used + ARENA_ALIGN - 1) & ~(unsigned long)(ARENA_ALIGN - 1);
+
+	if (start > arena->size || size > arena->size - start)
+	{
+		arena->failures++;
+		return NULL;
+	}
+
+	arena->used = start + size;
+	if (arena->used > arena->dirty)
+	{
+		arena->dirty = arena->used;
+		if (arena->dirty > arena->peak)
+			arena->peak = arena->dirty;
+	}
+	return arena->base + start;
+}
+
+//released pages come back zeroed, but anything released only back to a mark doesn't, so this still clears
+void* arenaZalloc(arena_t* arena, unsigned long size)
+{
+	void* pointer = arenaAlloc(arena, size);
+	if (pointer != NULL)
+		memset(pointer, 0, size);
+	return pointer;
+}
+
+//Returns: a null terminated copy of the first "length" characters of "string", or NULL if it doesn't fit
+char* arenaStrndup(arena_t* arena, const char* string, unsigned long length)
+{
+	char* copy = arenaAlloc(arena, length + 1);
+	if (copy != NULL)
+	{
+		memcpy(copy, string, length);
+		copy[length] = '\0';
+	}
+	return copy;
+}
+
+static int arenaIsDelimiter(char c, const char* delimiters)
+{
+	while (*delimiters != '\0')
+	{
+		if (*delimiters++ == c)
+			return 1;
+	}
+	return 0;
+}
+
+//Splits "string" into words separated by runs of "delimiters", copying them into the arena; "string" itself is
+//left alone. "count" gets the number of words
+//Returns: a NULL terminated array of the words, or NULL if they don't fit
+char** arenaSplit(arena_t* arena, const char* string, const char* delimiters, int* count)
+{
+	const char* cursor = string;
+	int words = 0, i;
+
+	//count first so the array comes out in one piece ahead of the words
+	while (*cursor != '\0')
+	{
+		while (*cursor != '\0' && arenaIsDelimiter(*cursor, delimiters))
+			cursor++;
+		if (*cursor == '\0')
+			break;
+		words++;
+		while (*cursor != '\0' && !arenaIsDelimiter(*cursor, delimiters))
+			cursor++;
+	}
+
+	arena_mark_t mark = arenaMark(arena);
+	char** list = arenaAlloc(arena, (words + 1) * sizeof(char*));
+	if (list == NULL)
+		return NULL;
+
+	cursor = string;
+	for (i = 0; i < words; i++)
+	{
+		while (arenaIsDelimiter(*cursor, delimiters))
+			cursor++;
+		const char* word = cursor;
+		while (*cursor != '\0' && !arenaIsDelimiter(*cursor, delimiters))
+			cursor++;
+
+		list[i] = arenaStrndup(arena, word, cursor - word);
+		if (list[i] == NULL)
+		{
+			arenaRelease(arena, mark);
+			return NULL;
+		}
+	}
+	list[words] = NULL;
+
+	if (count != NULL)
+		*count = words;
+	return list;
+}
+
+//Returns: a mark to come back to with arenaRelease
+arena_mark_t arenaMark(arena_t* arena)
+{
+	return arena->used;
+}
+
+//frees everything allocated since "mark" was taken
+void arenaRelease(arena_t* arena, arena_mark_t mark)
+{
+	if (mark <= arena->used)
+		arena->used = mark;
+}
+
+//frees everything, and gives the frames behind all but the first ARENA_KEEP_SIZE bytes back
+void arenaReset(arena_t* arena)
+{
+	if (arena->dirty > ARENA_KEEP_SIZE && arena->base != NULL)
+		vmmDecommit(arena->base + ARENA_KEEP_SIZE, ((arena->dirty + 0xFFF) & ~0xFFFul) - ARENA_KEEP_SIZE);
+	arena->used = 0;
+	arena->dirty = 0;
+}
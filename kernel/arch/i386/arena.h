@@ -0,0 +1,37 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+//Scratch arenas: bump allocation out of a lazily backed vmm region, for data that lives exactly as long as one
+//shell command or one boot step. Allocating is a pointer bump, there is no per-object free, and everything is
+//dropped at once by arenaReset (or back to an arenaMark with arenaRelease).
+//The whole reservation is address space only; pages get frames when they're first written, and arenaReset hands
+//back everything past ARENA_KEEP_SIZE so one big command doesn't pin its memory afterwards.
+
+#define ARENA_ALIGN 8
+#define ARENA_KEEP_SIZE 0x4000 //bytes that stay backed across resets
+
+typedef unsigned long arena_mark_t;
+
+typedef struct arena
+{
+	const char* name;
+	char* base; //NULL until arenaCreate succeeds
+	unsigned long size; //reserved bytes
+	unsigned long used;
+	unsigned long dirty; //most bytes in use since the last reset, i.e. how far pages may be backed
+	unsigned long peak; //most bytes in use at once, ever
+	unsigned int failures; //allocations that didn't fit
+}
+arena_t;
+
+int arenaCreate(arena_t* arena, const char* name, unsigned long size);
+void arenaDestroy(arena_t* arena);
+void* arenaAlloc(arena_t* arena, unsigned long size);
+void* arenaZalloc(arena_t* arena, unsigned long size);
+char* arenaStrndup(arena_t* arena, const char* string, unsigned long length);
+char** arenaSplit(arena_t* arena, const char* string, const char* delimiters, int* count);
+arena_mark_t arenaMark(arena_t* arena);
+void arenaRelease(arena_t* arena, arena_mark_t mark);
+void arenaReset(arena_t* arena);
+
+#endif
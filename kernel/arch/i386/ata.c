@@ -0,0 +1,177 @@
+#include "ata.h"
+#include "lib_c.h"
+#include "lib_asm.h"
+
+static unsigned short ataIOBase(unsigned char drive)
+{
+	return (drive < 2) ? ATA_PRIMARY_IO : ATA_SECONDARY_IO;
+}
+
+static unsigned short ataControlBase(unsigned char drive)
+{
+	return (drive < 2) ? ATA_PRIMARY_CONTROL : ATA_SECONDARY_CONTROL;
+}
+
+//reading the alternate status register four times gives the drive the 400ns it needs after a drive select
+static void ataDelay(unsigned char drive)
+{
+	unsigned short control = ataControlBase(drive);
+	inb(control);
+	inb(control);
+	inb(control);
+	inb(control);
+}
+
+//waits for BSY to clear, then for DRQ if "want_data" is set
+//Returns: 0 when ready, -1 on a drive error or timeout
+static int ataPoll(unsigned char drive, int want_data)
+{
+	unsigned short io = ataIOBase(drive);
+	unsigned long timeout = 0;
+	unsigned char status;
+
+	do
+	{
+		status = inb(io + ATA_REG_STATUS);
+		if (++timeout == ATA_TIMEOUT)
+			return -1;
+	} while (status & ATA_STATUS_BSY);
+
+	if (status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+		return -1;
+
+	while (want_data && !(status & ATA_STATUS_DRQ))
+	{
+		status = inb(io + ATA_REG_STATUS);
+		if (status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+			return -1;
+		if (++timeout == ATA_TIMEOUT)
+			return -1;
+	}
+
+	return 0;
+}
+
+//selects the drive and loads the LBA28 address and sector count
+static int ataSetup(unsigned char drive, unsigned long lba, unsigned char count)
+{
+	unsigned short io = ataIOBase(drive);
+
+	if (drive >= ATA_MAX_DRIVES || count == 0 || lba + count - 1 > ATA_MAX_LBA28)
+		return -1;
+
+	outb(io + ATA_REG_DRIVE, 0xE0 | ((drive & 1) << 4) | ((lba >> 24) & 0x0F));
+	ataDelay(drive);
+
+	if (ataPoll(drive, 0) != 0)
+		return -1;
+
+	outb(io + ATA_REG_FEATURES, 0);
+	outb(io + ATA_REG_SECTOR_COUNT, count);
+	outb(io + ATA_REG_LBA_LOW, (unsigned char)lba);
+	outb(io + ATA_REG_LBA_MID, (unsigned char)(lba >> 8));
+	outb(io + ATA_REG_LBA_HIGH, (unsigned char)(lba >> 16));
+	return 0;
+}
+
+//Checks whether an ATA disk is attached, and how many sectors it has (can be NULL)
+//Returns: 0 if the drive is present, -1 if there's no drive or it isn't an ATA disk (e.g. ATAPI)
+int ataIdentify(unsigned char drive, unsigned long* sectors)
+{
+	if (drive >= ATA_MAX_DRIVES)
+		return -1;
+
+	unsigned short io = ataIOBase(drive);
+
+	if (inb(io + ATA_REG_STATUS) == 0xFF) //floating bus, nothing on this channel
+		return -1;
+
+	outb(io + ATA_REG_DRIVE, 0xA0 | ((drive & 1) << 4));
+	ataDelay(drive);
+	outb(io + ATA_REG_SECTOR_COUNT, 0);
+	outb(io + ATA_REG_LBA_LOW, 0);
+	outb(io + ATA_REG_LBA_MID, 0);
+	outb(io + ATA_REG_LBA_HIGH, 0);
+	outb(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+	if (inb(io + ATA_REG_STATUS) == 0) //no drive
+		return -1;
+
+	unsigned long timeout = 0;
+	while (inb(io + ATA_REG_STATUS) & ATA_STATUS_BSY)
+	{
+		if (++timeout == ATA_TIMEOUT)
+			return -1;
+	}
+
+	if (inb(io + ATA_REG_LBA_MID) != 0 || inb(io + ATA_REG_LBA_HIGH) != 0) //ATAPI or SATA signature, not a PATA disk
+		return -1;
+
+	if (ataPoll(drive, 1) != 0)
+		return -1;
+
+	unsigned short identify[256];
+	unsigned short idx;
+	for (idx = 0; idx < 256; idx++)
+		identify[idx] = inw(io + ATA_REG_DATA);
+
+	if (sectors != NULL)
+		*sectors = identify[60] | ((unsigned long)identify[61] << 16); //words 60-61 hold the LBA28 sector count
+
+	return 0;
+}
+
+//Reads "count" sectors starting at absolute sector "lba" into "buffer"
+//Returns: 0 on success, -1 on failure
+int ataReadSectors(unsigned char drive, unsigned long lba, unsigned char count, void* buffer)
+{
+	if (ataSetup(drive, lba, count) != 0)
+		return -1;
+
+	unsigned short io = ataIOBase(drive);
+	unsigned short* words = (unsigned short*)buffer;
+	outb(io + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
+
+	unsigned char iterator;
+	for (iterator = 0; iterator < count; iterator++)
+	{
+		ataDelay(drive);
+		if (ataPoll(drive, 1) != 0)
+			return -1;
+
+		unsigned short idx;
+		for (idx = 0; idx < 256; idx++)
+			words[idx] = inw(io + ATA_REG_DATA);
+		words += 256;
+	}
+
+	return 0;
+}
+
+//Writes "count" sectors from "buffer" starting at absolute sector "lba", then flushes the drive's write cache
+//Returns: 0 on success, -1 on failure
+int ataWriteSectors(unsigned char drive, unsigned long lba, unsigned char count, const void* buffer)
+{
+	if (ataSetup(drive, lba, count) != 0)
+		return -1;
+
+	unsigned short io = ataIOBase(drive);
+	const unsigned short* words = (const unsigned short*)buffer;
+	outb(io + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
+
+	unsigned char iterator;
+	for (iterator = 0; iterator < count; iterator++)
+	{
+		ataDelay(drive);
+		if (ataPoll(drive, 1) != 0)
+			return -1;
+
+		unsigned short idx;
+		for (idx = 0; idx < 256; idx++)
+			outw(io + ATA_REG_DATA, words[idx]);
+		words += 256;
+	}
+
+	outb(io + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+	return ataPoll(drive, 0);
+}
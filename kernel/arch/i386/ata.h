@@ -0,0 +1,46 @@
+#ifndef ATA_H_
+#define ATA_H_
+
+//ATA PIO driver (LBA28). Drives are numbered 0 - 3: primary master, primary slave, secondary master, secondary slave.
+//Sectors are absolute on the drive; partition offsets are handled by the callers.
+
+#define ATA_MAX_DRIVES 4
+#define ATA_SECTOR_SIZE 512
+#define ATA_MAX_LBA28 0x0FFFFFFF //highest sector LBA28 can address
+
+#define ATA_PRIMARY_IO 0x1F0
+#define ATA_PRIMARY_CONTROL 0x3F6
+#define ATA_SECONDARY_IO 0x170
+#define ATA_SECONDARY_CONTROL 0x376
+
+//register offsets from the I/O base
+#define ATA_REG_DATA 0
+#define ATA_REG_FEATURES 1
+#define ATA_REG_SECTOR_COUNT 2
+#define ATA_REG_LBA_LOW 3
+#define ATA_REG_LBA_MID 4
+#define ATA_REG_LBA_HIGH 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_RDY 0x40
+#define ATA_STATUS_BSY 0x80
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+#ifndef ATA_TIMEOUT
+#define ATA_TIMEOUT 1000000 //status polls before a drive is considered hung
+#endif
+
+int ataIdentify(unsigned char drive, unsigned long* sectors);
+int ataReadSectors(unsigned char drive, unsigned long lba, unsigned char count, void* buffer);
+int ataWriteSectors(unsigned char drive, unsigned long lba, unsigned char count, const void* buffer);
+
+#endif
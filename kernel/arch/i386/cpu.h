@@ -0,0 +1,75 @@
+#ifndef CPU_H_
+#define CPU_H_
+
+//CPUID, model specific register access, the time stamp counter and the interrupt flag
+
+//CPUID leaf 1 EDX feature bits
+#define CPUID_EDX_TSC 0x00000010
+#define CPUID_EDX_MSR 0x00000020
+#define CPUID_EDX_APIC 0x00000200
+#define CPUID_EDX_MTRR 0x00001000
+#define CPUID_EDX_PGE 0x00002000
+#define CPUID_EDX_PAT 0x00010000
+
+#define CPUID_LEAF_EXTENDED_MAX 0x80000000 //EAX is the highest extended leaf
+#define CPUID_LEAF_POWER 0x80000007
+#define CPUID_POWER_EDX_INVARIANT_TSC 0x00000100 //the TSC runs at one rate through P-, C- and T-states
+
+typedef struct cpuid_regs
+{
+	unsigned int eax;
+	unsigned int ebx;
+	unsigned int ecx;
+	unsigned int edx;
+}
+cpuid_regs_t;
+
+static inline void cpuid(unsigned int leaf, cpuid_regs_t* regs)
+{
+	asm volatile("cpuid" : "=a"(regs->eax), "=b"(regs->ebx), "=c"(regs->ecx), "=d"(regs->edx) : "a"(leaf), "c"(0));
+}
+
+static inline unsigned int cpuFeatures(void)
+{
+	cpuid_regs_t regs;
+	cpuid(1, &regs);
+	return regs.edx;
+}
+
+static inline unsigned long long cpuReadMSR(unsigned int msr)
+{
+	unsigned int low, high;
+	asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+	return ((unsigned long long)high << 32) | low;
+}
+
+static inline void cpuWriteMSR(unsigned int msr, unsigned long long value)
+{
+	asm volatile("wrmsr" : : "c"(msr), "a"((unsigned int)value), "d"((unsigned int)(value >> 32)) : "memory");
+}
+
+static inline unsigned long long cpuReadTSC(void)
+{
+	unsigned int low, high;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((unsigned long long)high << 32) | low;
+}
+
+#define CPU_EFLAGS_IF 0x200
+
+//Turns interrupts off
+//Returns: EFLAGS from before, for cpuIrqRestore
+static inline unsigned long cpuIrqSave(void)
+{
+	unsigned long flags;
+	asm volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+//Puts the interrupt flag back the way cpuIrqSave found it
+static inline void cpuIrqRestore(unsigned long flags)
+{
+	asm volatile("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "dma.h"
+#include "pmm.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "lib_c.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static dma_buffer_t dma_bounce[DMA_MAX_BOUNCE];
+static unsigned int dma_bounce_free; //bitmap of the pool's free buffers
+static dma_stats_t dma_stats;
+static spinlock_t dma_lock; //the pool's bitmap and dma_stats; never held across a call into the pmm
+
+//Allocates "size" bytes of physically contiguous memory aligned to "align" (a power of two, at most the largest
+//buddy block) that ends at or below "limit"
+//Returns: 0 on success, -1 if there's no such memory
+int dmaAlloc(dma_buffer_t* buffer, unsigned long size, unsigned long align, unsigned long limit)
+{
+	unsigned int count = (size + PMM_FRAME_SIZE - 1) >> PMM_FRAME_SHIFT;
+	unsigned long physical;
+	unsigned long flags;
+
+	memset(buffer, 0, sizeof(dma_buffer_t));
+
+	//buddy blocks are aligned to their own size, so a big enough alignment takes a whole block
+	if (align > ((unsigned long)count << PMM_FRAME_SHIFT))
+	{
+		unsigned int order = pmmOrderForSize(align);
+		physical = pmmAllocFramesBelow(order, limit);
+		if (physical != 0)
+			pmmFreeExact(physical + ((unsigned long)count << PMM_FRAME_SHIFT), (1u << order) - count);
+	}
+	else
+		physical = pmmAllocExact(count, limit);
+
+	flags = spinLockIrqSave(&dma_lock);
+	if (physical == 0)
+	{
+		dma_stats.failures++;
+		spinUnlockIrqRestore(&dma_lock, flags);
+		return -1;
+	}
+
+	buffer->phys = physical;
+	buffer->virt = PHYS_TO_VIRT(physical);
+	buffer->size = (unsigned long)count << PMM_FRAME_SHIFT;
+	dma_stats.buffers++;
+	dma_stats.bytes += buffer->size;
+	spinUnlockIrqRestore(&dma_lock, flags);
+	return 0;
+}
+
+void dmaFree(dma_buffer_t* buffer)
+{
+	unsigned long flags;
+
+	if (buffer->size == 0)
+		return;
+
+	pmmFreeExact(buffer->phys, buffer->size >> PMM_FRAME_SHIFT);
+	flags = spinLockIrqSave(&dma_lock);
+	dma_stats.buffers--;
+	dma_stats.bytes -= buffer->size;
+	spinUnlockIrqRestore(&dma_lock, flags);
+	memset(buffer, 0, sizeof(dma_buffer_t));
+}
+
+//Returns: the physical address of [address, address + size) if it's contiguous (i.e. in the direct map), or 0 if
+//a device can't be pointed at it and the data has to go through a bounce buffer
+unsigned long dmaVirtToPhys(const void* address, unsigned long size)
+{
+	unsigned long start = (unsigned long)address;
+
+	if (start < KERNEL_VIRTUAL_BASE || start - KERNEL_VIRTUAL_BASE + size > PAGING_DIRECT_MAP_SIZE || start + size < start)
+		return 0;
+	return VIRT_TO_PHYS(start);
+}
+
+//Sets aside "count" buffers of "size" bytes below "limit"
+//Returns: how many buffers the pool got
+int dmaBouncePoolInit(unsigned int count, unsigned long size, unsigned long limit)
+{
+	unsigned long flags;
+	unsigned int i;
+
+	//only ever run once, at boot, so nothing else adds slots between the check and the add
+	for (i = 0; i < count && dma_stats.bounce_total < DMA_MAX_BOUNCE; i++)
+	{
+		unsigned int slot = dma_stats.bounce_total;
+
+		//aligned to their size, so none crosses a boundary of that size
+		if (dmaAlloc(&dma_bounce[slot], size, size, limit) != 0)
+			break;
+		flags = spinLockIrqSave(&dma_lock);
+		dma_bounce_free |= 1u << slot;
+		dma_stats.bounce_total++;
+		dma_stats.bounce_free++;
+		spinUnlockIrqRestore(&dma_lock, flags);
+	}
+	return i;
+}
+
+//Returns: a free bounce buffer, or NULL if they're all in use
+dma_buffer_t* dmaBounceGet(void)
+{
+	unsigned long flags = spinLockIrqSave(&dma_lock);
+
+	if (dma_bounce_free == 0)
+	{
+		dma_stats.bounce_misses++;
+		spinUnlockIrqRestore(&dma_lock, flags);
+		return NULL;
+	}
+
+	unsigned int slot = __builtin_ctz(dma_bounce_free);
+	dma_bounce_free &= ~(1u << slot);
+	dma_stats.bounce_free--;
+	spinUnlockIrqRestore(&dma_lock, flags);
+	return &dma_bounce[slot];
+}
+
+void dmaBouncePut(dma_buffer_t* buffer)
+{
+	unsigned long flags = spinLockIrqSave(&dma_lock);
+	unsigned int slot = buffer - dma_bounce;
+
+	if (buffer < dma_bounce || slot >= dma_stats.bounce_total || (dma_bounce_free & (1u << slot)))
+	{
+		spinUnlockIrqRestore(&dma_lock, flags);
+		printf("dma: bad bounce buffer put back%n");
+		return;
+	}
+
+	dma_bounce_free |= 1u << slot;
+	dma_stats.bounce_free++;
+	spinUnlockIrqRestore(&dma_lock, flags);
+}
+
+void dmaGetStats(dma_stats_t* stats)
+{
+	unsigned long flags = spinLockIrqSave(&dma_lock);
+	*stats = dma_stats;
+	spinUnlockIrqRestore(&dma_lock, flags);
+}
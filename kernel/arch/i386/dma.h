@@ -0,0 +1,46 @@
+#ifndef DMA_H_
+#define DMA_H_
+
+//Buffers devices can reach: physically contiguous, aligned, and below whatever address the device can drive.
+//They come from the frame allocator (exact size, the buddy block's tail is given back) and are used through the
+//direct map, so a buffer carries both its addresses and nobody has to convert between them by hand.
+//The bounce pool is a handful of such buffers set aside at boot, for drivers that are handed memory a device can't
+//reach (a vmm region, or RAM above the device's limit) and have to copy through something that it can.
+
+#define DMA_LIMIT_16M 0x1000000 //ISA DMA and other 24-bit devices
+#define DMA_LIMIT_4G 0xFFFFFFFF //32-bit devices; the frame allocator has nothing above this anyway
+
+#define DMA_MAX_BOUNCE 16
+#define DMA_BOUNCE_COUNT 4 //what kernel_main sets aside
+#define DMA_BOUNCE_SIZE 0x10000 //64kB, so one never crosses an ISA DMA page boundary
+
+typedef struct dma_buffer
+{
+	void* virt; //through the direct map
+	unsigned long phys;
+	unsigned long size; //rounded up to whole frames
+}
+dma_buffer_t;
+
+typedef struct dma_stats
+{
+	unsigned int buffers; //allocated right now, bounce buffers included
+	unsigned long bytes;
+	unsigned int failures;
+	unsigned int bounce_total;
+	unsigned int bounce_free;
+	unsigned int bounce_misses; //dmaBounceGet calls that found the pool empty
+}
+dma_stats_t;
+
+int dmaAlloc(dma_buffer_t* buffer, unsigned long size, unsigned long align, unsigned long limit);
+void dmaFree(dma_buffer_t* buffer);
+unsigned long dmaVirtToPhys(const void* address, unsigned long size);
+
+int dmaBouncePoolInit(unsigned int count, unsigned long size, unsigned long limit);
+dma_buffer_t* dmaBounceGet(void);
+void dmaBouncePut(dma_buffer_t* buffer);
+
+void dmaGetStats(dma_stats_t* stats);
+
+#endif
@@ -0,0 +1,659 @@
+#include "fatcheck.h"
+#include <stdio.h>
+#include <string.h>
+
+//Reads the boot sector and works out the volume geometry. Only FAT16 and FAT32 are supported.
+//Returns: 0 on success, -1 on an I/O error, -2 if the volume isn't a supported FAT volume
+int fatcheckOpen(fatcheck_volume_t* vol)
+{
+	unsigned char sector[512];
+
+	if (vol->read(vol->io_ctx, 0, 1, sector) != 0)
+		return -1;
+
+	memcpy(&vol->bootsect, sector, sizeof(fat_BS_t));
+	fat_BS_t* bs = &vol->bootsect;
+
+	if (bs->bytes_per_sector != 512 || bs->sectors_per_cluster == 0 || bs->table_count == 0)
+		return -2;
+
+	unsigned int total_sectors = bs->total_sectors_16 != 0 ? bs->total_sectors_16 : bs->total_sectors_32;
+
+	vol->bytes_per_sector = bs->bytes_per_sector;
+	vol->cluster_size = bs->bytes_per_sector * bs->sectors_per_cluster;
+	vol->fat_size = bs->table_size_16 != 0 ? bs->table_size_16 : ((fat_extBS_32_t*)bs->extended_section)->table_size_32;
+	vol->first_fat_sector = bs->reserved_sector_count;
+	vol->root_dir_sector = vol->first_fat_sector + bs->table_count * vol->fat_size;
+	vol->root_dir_sectors = (bs->root_entry_count * sizeof(directory_entry_t) + bs->bytes_per_sector - 1) / bs->bytes_per_sector;
+	vol->first_data_sector = vol->root_dir_sector + vol->root_dir_sectors;
+
+	if (total_sectors <= vol->first_data_sector)
+		return -2;
+
+	unsigned int data_clusters = (total_sectors - vol->first_data_sector) / bs->sectors_per_cluster;
+	vol->cluster_limit = data_clusters + 2;
+
+	if (data_clusters < 4085)
+		return -2; //FAT12 isn't supported
+	else if (data_clusters < 65525)
+	{
+		vol->fat_type = 16;
+		vol->root_cluster = 0;
+		vol->end_cluster = END_CLUSTER_16;
+		vol->bad_cluster = BAD_CLUSTER_16;
+	}
+	else
+	{
+		vol->fat_type = 32;
+		vol->root_cluster = ((fat_extBS_32_t*)bs->extended_section)->root_cluster;
+		vol->end_cluster = END_CLUSTER_32;
+		vol->bad_cluster = BAD_CLUSTER_32;
+	}
+
+	//the FAT has to be big enough to describe every data cluster
+	if ((unsigned long long)vol->cluster_limit * (vol->fat_type / 8) > (unsigned long long)vol->fat_size * vol->bytes_per_sector)
+		return -2;
+
+	return 0;
+}
+
+static unsigned int fatcheckFATBytes(fatcheck_volume_t* vol)
+{
+	//rounded up to a whole sector, since the FAT is loaded a sector at a time
+	unsigned int bytes = vol->cluster_limit * sizeof(unsigned int);
+	return (bytes + vol->bytes_per_sector - 1) / vol->bytes_per_sector * vol->bytes_per_sector;
+}
+
+static unsigned int fatcheckBlockBytes(fatcheck_volume_t* vol)
+{
+	unsigned int root_bytes = vol->root_dir_sectors * vol->bytes_per_sector;
+	return root_bytes > vol->cluster_size ? root_bytes : vol->cluster_size;
+}
+
+//Bytes of working memory fatcheckAttach expects, valid after fatcheckOpen
+unsigned int fatcheckMemoryNeeded(fatcheck_volume_t* vol)
+{
+	return fatcheckFATBytes(vol) + fatcheckBlockBytes(vol) + vol->cluster_limit;
+}
+
+void fatcheckAttach(fatcheck_volume_t* vol, void* memory)
+{
+	unsigned char* next = memory;
+
+	vol->fat = (unsigned int*)next;
+	next += fatcheckFATBytes(vol);
+	vol->block = next;
+	next += fatcheckBlockBytes(vol);
+	vol->refs = next;
+	memset(vol->refs, 0, vol->cluster_limit);
+}
+
+void fatcheckReportInit(fatcheck_report_t* report)
+{
+	memset(report, 0, sizeof(fatcheck_report_t));
+	report->dirty_first = 0xFFFFFFFF;
+	report->dirty_last = 0;
+}
+
+void fatcheckReportMerge(fatcheck_report_t* into, const fatcheck_report_t* from)
+{
+	into->clusters_checked += from->clusters_checked;
+	into->entries_checked += from->entries_checked;
+	into->directories_checked += from->directories_checked;
+	into->free_clusters += from->free_clusters;
+	into->bad_clusters += from->bad_clusters;
+	into->out_of_range += from->out_of_range;
+	into->broken_chains += from->broken_chains;
+	into->cross_linked += from->cross_linked;
+	into->lost_clusters += from->lost_clusters;
+	into->size_mismatches += from->size_mismatches;
+	into->too_deep += from->too_deep;
+	into->repaired += from->repaired;
+	if (from->dirty_first < into->dirty_first)
+		into->dirty_first = from->dirty_first;
+	if (from->dirty_last > into->dirty_last)
+		into->dirty_last = from->dirty_last;
+}
+
+//Counts everything that is actually wrong with the volume
+unsigned int fatcheckProblems(const fatcheck_report_t* report)
+{
+	return report->out_of_range + report->broken_chains + report->cross_linked + report->lost_clusters + report->size_mismatches;
+}
+
+static void fatcheckSetEntry(fatcheck_volume_t* vol, unsigned int cluster, unsigned int value, fatcheck_report_t* report)
+{
+	vol->fat[cluster] = value;
+	if (cluster < report->dirty_first)
+		report->dirty_first = cluster;
+	if (cluster > report->dirty_last)
+		report->dirty_last = cluster;
+	report->repaired++;
+}
+
+//Loads the first FAT copy into vol->fat
+int fatcheckLoadFAT(fatcheck_volume_t* vol)
+{
+	unsigned int entry_size = vol->fat_type / 8;
+	unsigned int sectors = (vol->cluster_limit * entry_size + vol->bytes_per_sector - 1) / vol->bytes_per_sector;
+	unsigned char* raw = (unsigned char*)vol->fat;
+	unsigned int sector = 0;
+
+	while (sector < sectors)
+	{
+		unsigned int count = sectors - sector;
+		if (count > FATCHECK_IO_SECTORS)
+			count = FATCHECK_IO_SECTORS;
+
+		if (vol->read(vol->io_ctx, vol->first_fat_sector + sector, count, raw + sector * vol->bytes_per_sector) != 0)
+			return -1;
+
+		sector += count;
+	}
+
+	if (vol->fat_type == 16)
+	{
+		//widen in place, from the end so nothing is overwritten before it's been read
+		unsigned int cluster = vol->cluster_limit;
+		while (cluster-- > 0)
+			vol->fat[cluster] = ((unsigned short*)raw)[cluster];
+	}
+	else
+	{
+		unsigned int cluster;
+		for (cluster = 0; cluster < vol->cluster_limit; cluster++)
+			vol->fat[cluster] &= 0x0FFFFFFF; //remember to ignore the high 4 bits.
+	}
+
+	return 0;
+}
+
+//Phase 1: checks the FAT entries of clusters first through last - 1 on their own.
+//Only touches vol->fat[first..last) and the report, so disjoint ranges can be checked at the same time.
+void fatcheckScanFAT(fatcheck_volume_t* vol, unsigned int first, unsigned int last, fatcheck_report_t* report)
+{
+	if (first < 2)
+		first = 2;
+	if (last > vol->cluster_limit)
+		last = vol->cluster_limit;
+
+	unsigned int cluster;
+	for (cluster = first; cluster < last; cluster++)
+	{
+		unsigned int value = vol->fat[cluster];
+
+		report->clusters_checked++;
+
+		if (value == 0)
+			report->free_clusters++;
+		else if (value == vol->bad_cluster)
+			report->bad_clusters++;
+		else if (value >= vol->end_cluster)
+			continue;
+		else if (value < 2 || value >= vol->cluster_limit)
+		{
+			report->out_of_range++;
+			if (vol->flags & FATCHECK_REPAIR)
+				fatcheckSetEntry(vol, cluster, vol->end_cluster, report);
+		}
+	}
+}
+
+//Follows a chain from "start", counting a reference for every cluster in it.
+//The chain is cut short where it leaves the data area, runs into a free or bad cluster, or reaches a cluster that has
+//already been reached, so a chain that loops can't be followed forever.
+//Returns the number of clusters in the chain
+static unsigned int fatcheckMarkChain(fatcheck_volume_t* vol, unsigned int start, fatcheck_report_t* report)
+{
+	unsigned int length = 0;
+	unsigned int cluster = start;
+	BOOL repair = (vol->flags & FATCHECK_REPAIR) != 0;
+
+	//the caller makes sure "start" itself hasn't been reached yet
+	while (1)
+	{
+		vol->refs[cluster] = 1;
+		length++;
+
+		unsigned int next = vol->fat[cluster];
+
+		if (next >= vol->end_cluster)
+			return length;
+		else if (next == 0 || next == vol->bad_cluster)
+		{
+			report->broken_chains++;
+			if (repair)
+				fatcheckSetEntry(vol, cluster, vol->end_cluster, report);
+			return length;
+		}
+		else if (next < 2 || next >= vol->cluster_limit)
+		{
+			//already counted by fatcheckScanFAT
+			if (repair)
+				fatcheckSetEntry(vol, cluster, vol->end_cluster, report);
+			return length;
+		}
+		else if (vol->refs[next] != 0)
+		{
+			if (vol->refs[next] < 255)
+				vol->refs[next]++;
+			report->cross_linked++;
+			if (repair)
+				fatcheckSetEntry(vol, cluster, vol->end_cluster, report);
+			return length;
+		}
+
+		cluster = next;
+	}
+}
+
+//Cuts a chain after "keep" clusters. The clusters after the cut are no longer referenced, so fatcheckFindLost frees them.
+static void fatcheckTruncateChain(fatcheck_volume_t* vol, unsigned int start, unsigned int keep, fatcheck_report_t* report)
+{
+	unsigned int cluster = start;
+	unsigned int position = 1;
+
+	while (position < keep)
+	{
+		cluster = vol->fat[cluster];
+		position++;
+	}
+
+	unsigned int next = vol->fat[cluster];
+	fatcheckSetEntry(vol, cluster, vol->end_cluster, report);
+
+	while (next >= 2 && next < vol->cluster_limit && vol->refs[next] == 1)
+	{
+		vol->refs[next] = 0;
+		next = vol->fat[next];
+	}
+}
+
+//Unmarks the "length" clusters fatcheckMarkChain just counted from "start", so fatcheckFindLost frees them
+static void fatcheckReleaseChain(fatcheck_volume_t* vol, unsigned int start, unsigned int length)
+{
+	unsigned int cluster = start;
+
+	while (length-- > 0 && cluster >= 2 && cluster < vol->cluster_limit && vol->refs[cluster] == 1)
+	{
+		vol->refs[cluster] = 0;
+		cluster = vol->fat[cluster];
+	}
+}
+
+static int fatcheckReadBlock(fatcheck_volume_t* vol, unsigned int cluster)
+{
+	if (cluster == 0) //FAT16 fixed root directory
+		return vol->read(vol->io_ctx, vol->root_dir_sector, vol->root_dir_sectors, vol->block);
+
+	return vol->read(vol->io_ctx, vol->first_data_sector + (cluster - 2) * vol->bootsect.sectors_per_cluster, vol->bootsect.sectors_per_cluster, vol->block);
+}
+
+static int fatcheckWriteBlock(fatcheck_volume_t* vol, unsigned int cluster)
+{
+	if (cluster == 0)
+		return vol->write(vol->io_ctx, vol->root_dir_sector, vol->root_dir_sectors, vol->block);
+
+	return vol->write(vol->io_ctx, vol->first_data_sector + (cluster - 2) * vol->bootsect.sectors_per_cluster, vol->bootsect.sectors_per_cluster, vol->block);
+}
+
+//Phase 2: walks the directory tree depth first and builds the reference map.
+//Directories are walked with an explicit stack instead of recursion; returning to a parent costs one re-read of its current cluster.
+//Returns: 0 on success, -1 on an I/O error
+int fatcheckWalk(fatcheck_volume_t* vol, fatcheck_report_t* report)
+{
+	struct
+	{
+		unsigned int cluster; //cluster of the directory currently being read (0 for the FAT16 root)
+		unsigned int entry; //next entry to look at in that cluster
+		unsigned int clusters_left; //guards against walking a looping chain forever
+	} stack[FATCHECK_MAX_DEPTH];
+	unsigned int depth = 0;
+	unsigned int loaded = 0xFFFFFFFF; //which cluster vol->block currently holds
+	BOOL repair = (vol->flags & FATCHECK_REPAIR) != 0;
+
+	if (vol->fat_type == 32)
+	{
+		if (vol->root_cluster < 2 || vol->root_cluster >= vol->cluster_limit)
+		{
+			report->out_of_range++;
+			return 0;
+		}
+		stack[0].cluster = vol->root_cluster;
+		stack[0].clusters_left = fatcheckMarkChain(vol, vol->root_cluster, report);
+	}
+	else
+	{
+		stack[0].cluster = 0;
+		stack[0].clusters_left = 1;
+	}
+	stack[0].entry = 0;
+	depth = 1;
+	report->directories_checked++;
+
+	while (depth > 0)
+	{
+		unsigned int level = depth - 1;
+		unsigned int cluster = stack[level].cluster;
+		unsigned int entries = (cluster == 0 ? vol->root_dir_sectors * vol->bytes_per_sector : vol->cluster_size) / sizeof(directory_entry_t);
+		BOOL descended = FALSE;
+		BOOL finished = FALSE;
+
+		if (loaded != cluster)
+		{
+			if (fatcheckReadBlock(vol, cluster) != 0)
+				return -1;
+			loaded = cluster;
+		}
+
+		directory_entry_t* entry_list = (directory_entry_t*)vol->block;
+
+		while (stack[level].entry < entries)
+		{
+			directory_entry_t* entry = &entry_list[stack[level].entry++];
+
+			if (entry->file_name[0] == ENTRY_END)
+			{
+				finished = TRUE;
+				break;
+			}
+			else if (entry->file_name[0] == ENTRY_FREE || entry->file_name[0] == '.' || (entry->attributes & FILE_LONG_NAME) == FILE_LONG_NAME || (entry->attributes & FILE_VOLUME_ID) == FILE_VOLUME_ID)
+				continue;
+
+			report->entries_checked++;
+
+			BOOL is_directory = (entry->attributes & FILE_DIRECTORY) == FILE_DIRECTORY;
+			unsigned int start = entry->low_bits | (vol->fat_type == 32 ? (unsigned int)entry->high_bits << 16 : 0);
+			unsigned int expected = (entry->file_size + vol->cluster_size - 1) / vol->cluster_size;
+			BOOL rewrite = FALSE;
+
+			if (start == 0)
+			{
+				if (!is_directory && entry->file_size != 0)
+				{
+					report->size_mismatches++;
+					if (repair)
+					{
+						entry->file_size = 0;
+						rewrite = TRUE;
+					}
+				}
+			}
+			else if (start < 2 || start >= vol->cluster_limit || vol->refs[start] != 0)
+			{
+				if (start < 2 || start >= vol->cluster_limit)
+					report->out_of_range++;
+				else
+				{
+					if (vol->refs[start] < 255)
+						vol->refs[start]++;
+					report->cross_linked++;
+				}
+
+				if (repair) //the entry can't be trusted; detach it from the chain
+				{
+					entry->low_bits = 0;
+					entry->high_bits = 0;
+					entry->file_size = 0;
+					rewrite = TRUE;
+				}
+			}
+			else
+			{
+				unsigned int length = fatcheckMarkChain(vol, start, report);
+
+				if (is_directory)
+				{
+					if (depth < FATCHECK_MAX_DEPTH)
+					{
+						stack[depth].cluster = start;
+						stack[depth].entry = 0;
+						stack[depth].clusters_left = length;
+						depth++;
+						report->directories_checked++;
+						descended = TRUE;
+					}
+					else
+					{
+						report->too_deep++;
+						vol->walk_incomplete = TRUE; //whatever is below here will look lost
+					}
+				}
+				else if (length != expected)
+				{
+					report->size_mismatches++;
+					if (repair)
+					{
+						if (expected == 0)
+						{
+							//an empty file with clusters (older drivers gave every new file one): the size is right and the
+							//chain is the leak, so let it go instead of growing the file over whatever the clusters hold
+							fatcheckReleaseChain(vol, start, length);
+							entry->low_bits = 0;
+							entry->high_bits = 0;
+							rewrite = TRUE;
+						}
+						else if (length > expected)
+							fatcheckTruncateChain(vol, start, expected, report);
+						else
+						{
+							entry->file_size = length * vol->cluster_size;
+							rewrite = TRUE;
+						}
+					}
+				}
+			}
+
+			if (rewrite)
+			{
+				if (fatcheckWriteBlock(vol, cluster) != 0)
+					return -1;
+				report->repaired++;
+			}
+
+			if (descended)
+				break;
+		}
+
+		if (descended)
+			continue;
+
+		//this cluster is done; move on to the next cluster of the directory, or back up to the parent
+		if (!finished && cluster != 0 && --stack[level].clusters_left > 0)
+		{
+			unsigned int next = vol->fat[cluster];
+			if (next >= 2 && next < vol->cluster_limit)
+			{
+				stack[level].cluster = next;
+				stack[level].entry = 0;
+				continue;
+			}
+		}
+
+		depth--;
+	}
+
+	return 0;
+}
+
+//Phase 3: allocated clusters that fatcheckWalk never reached are lost. Freed when repairing.
+//Like fatcheckScanFAT, disjoint ranges can be checked at the same time.
+void fatcheckFindLost(fatcheck_volume_t* vol, unsigned int first, unsigned int last, fatcheck_report_t* report)
+{
+	if (first < 2)
+		first = 2;
+	if (last > vol->cluster_limit)
+		last = vol->cluster_limit;
+
+	unsigned int cluster;
+	for (cluster = first; cluster < last; cluster++)
+	{
+		unsigned int value = vol->fat[cluster];
+
+		if (value != 0 && value != vol->bad_cluster && vol->refs[cluster] == 0)
+		{
+			report->lost_clusters++;
+			if ((vol->flags & FATCHECK_REPAIR) && !vol->walk_incomplete) //never free clusters of directories that weren't walked
+			{
+				fatcheckSetEntry(vol, cluster, 0, report);
+				report->free_clusters++;
+			}
+		}
+	}
+}
+
+//Writes the repaired part of the FAT to every FAT copy, and updates the FAT32 FSInfo free cluster count
+int fatcheckWriteBack(fatcheck_volume_t* vol, const fatcheck_report_t* report)
+{
+	if (report->dirty_first > report->dirty_last)
+		return 0;
+
+	unsigned int entry_size = vol->fat_type / 8;
+	unsigned int entries_per_sector = vol->bytes_per_sector / entry_size;
+	unsigned int first_sector = report->dirty_first / entries_per_sector;
+	unsigned int last_sector = report->dirty_last / entries_per_sector;
+	unsigned int sector;
+
+	for (sector = first_sector; sector <= last_sector; sector++)
+	{
+		unsigned int index;
+		for (index = 0; index < entries_per_sector; index++)
+		{
+			unsigned int cluster = sector * entries_per_sector + index;
+			unsigned int value = cluster < vol->cluster_limit ? vol->fat[cluster] : 0;
+
+			if (vol->fat_type == 32)
+				((unsigned int*)vol->block)[index] = value;
+			else
+				((unsigned short*)vol->block)[index] = (unsigned short)value;
+		}
+
+		//entries 0 and 1 are reserved and aren't part of the cluster map; keep what is on disk
+		if (sector == 0)
+		{
+			unsigned char first[512];
+			if (vol->read(vol->io_ctx, vol->first_fat_sector, 1, first) != 0)
+				return -1;
+			memcpy(vol->block, first, entry_size * 2);
+		}
+
+		unsigned int copy;
+		for (copy = 0; copy < vol->bootsect.table_count; copy++)
+		{
+			if (vol->write(vol->io_ctx, vol->first_fat_sector + copy * vol->fat_size + sector, 1, vol->block) != 0)
+				return -1;
+		}
+	}
+
+	if (vol->fat_type == 32)
+	{
+		unsigned int fsinfo_sector = ((fat_extBS_32_t*)vol->bootsect.extended_section)->fat_info;
+		FSInfo_t fsinfo;
+
+		if (fsinfo_sector != 0 && fsinfo_sector != 0xFFFF && vol->read(vol->io_ctx, fsinfo_sector, 1, &fsinfo) == 0 && fsinfo.lead_signature == 0x41615252 && fsinfo.structure_signature == 0x61417272)
+		{
+			fsinfo.free_space = report->free_clusters;
+			if (vol->write(vol->io_ctx, fsinfo_sector, 1, &fsinfo) != 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+//Runs every phase on the whole volume, one after the other.
+//vol must already be opened and have its working memory attached.
+//Returns: 0 if the check ran (see the report for what was found), -1 on an I/O error
+int fatcheckRun(fatcheck_volume_t* vol, fatcheck_report_t* report)
+{
+	fatcheckReportInit(report);
+
+	if (fatcheckLoadFAT(vol) != 0)
+		return -1;
+
+	fatcheckScanFAT(vol, 2, vol->cluster_limit, report);
+
+	if (fatcheckWalk(vol, report) != 0)
+		return -1;
+
+	//free clusters were already counted by the FAT scan; the lost scan only adds the ones it frees
+	fatcheckFindLost(vol, 2, vol->cluster_limit, report);
+
+	if (vol->flags & FATCHECK_REPAIR)
+		return fatcheckWriteBack(vol, report);
+
+	return 0;
+}
+
+#ifdef __is_kernel
+
+static int fatcheckDiskRead(void* ctx, unsigned long sector, unsigned int count, void* buffer)
+{
+	return volumeRead((fat_volume_t*)ctx, sector, count, buffer);
+}
+
+static int fatcheckDiskWrite(void* ctx, unsigned long sector, unsigned int count, void* buffer)
+{
+	return volumeWrite((fat_volume_t*)ctx, sector, count, buffer);
+}
+
+//Checks (and with FATCHECK_REPAIR, fixes) a mounted volume, printing a report. The FAT copy and the reference
+//map come out of "scratch"; the caller resets it afterwards
+//Returns: number of problems found, or -1 if the check couldn't run
+int fatcheck(fat_volume_t* volume, unsigned int flags, arena_t* scratch)
+{
+	fatcheck_volume_t vol;
+	fatcheck_report_t report;
+
+	memset(&vol, 0, sizeof(vol));
+	vol.read = fatcheckDiskRead;
+	vol.write = fatcheckDiskWrite;
+	vol.io_ctx = volume;
+	vol.flags = flags;
+
+	int retVal = fatcheckOpen(&vol);
+	if (retVal == -1)
+	{
+		printf("fatcheck: could not read the boot sector.");
+		return -1;
+	}
+	else if (retVal != 0)
+	{
+		printf("fatcheck: not a FAT16 or FAT32 volume.");
+		return -1;
+	}
+
+	if (fatcheckMemoryNeeded(&vol) > FATCHECK_WORK_SIZE)
+	{
+		printf("fatcheck: volume too large to check in the kernel, use the host fatcheck tool.");
+		return -1;
+	}
+	void* work = arenaAlloc(scratch, fatcheckMemoryNeeded(&vol));
+	if (work == NULL)
+	{
+		printf("fatcheck: not enough scratch memory.");
+		return -1;
+	}
+	fatcheckAttach(&vol, work);
+
+	int run = fatcheckRun(&vol, &report);
+	if (flags & FATCHECK_REPAIR)
+		FATCacheInvalidate(volume); //repairs rewrote the FAT underneath the driver
+
+	if (run != 0)
+	{
+		printf("fatcheck: disk error, check aborted.");
+		return -1;
+	}
+
+	printf("%c: FAT%u: %u clusters, %u free, %u bad%n", volume->letter, vol.fat_type, report.clusters_checked, report.free_clusters, report.bad_clusters);
+	printf("%u directories, %u entries%n", report.directories_checked, report.entries_checked);
+	printf("out of range: %u  broken chains: %u  cross-linked: %u%n", report.out_of_range, report.broken_chains, report.cross_linked);
+	printf("lost clusters: %u  size mismatches: %u  too deep: %u", report.lost_clusters, report.size_mismatches, report.too_deep);
+	if (flags & FATCHECK_REPAIR)
+		printf("%nrepairs made: %u", report.repaired);
+
+	return fatcheckProblems(&report);
+}
+
+#endif
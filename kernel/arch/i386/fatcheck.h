@@ -0,0 +1,90 @@
+#ifndef FATCHECK_H_
+#define FATCHECK_H_
+
+#include "FAT.h"
+#include "arena.h"
+
+//fatcheck: FAT volume consistency checker.
+//The whole FAT is loaded once and a per-cluster reference map is built by walking every directory, so a check costs
+//O(clusters + directory entries) with one read per FAT chunk and one read per directory cluster.
+//The FAT scan and the lost cluster scan only touch their own cluster range, so callers can split them across workers.
+
+#define FATCHECK_REPAIR 0x01 //fix what can be fixed and write the FAT copies back
+
+#define FATCHECK_MAX_DEPTH 64 //deepest directory nesting that will be walked
+#define FATCHECK_IO_SECTORS 64 //sectors requested per read while loading the FAT
+
+#ifndef FATCHECK_WORK_SIZE
+#define FATCHECK_WORK_SIZE 0x200000 //most scratch memory (FAT copy and reference map) a check in the kernel may take
+#endif
+
+//reads or writes "count" 512-byte sectors, relative to the start of the volume. Returns 0 on success
+typedef int (*fatcheck_io_t)(void* ctx, unsigned long sector, unsigned int count, void* buffer);
+
+typedef struct fatcheck_report
+{
+	unsigned int clusters_checked;
+	unsigned int entries_checked;
+	unsigned int directories_checked;
+	unsigned int free_clusters;
+	unsigned int bad_clusters; //marked bad in the FAT; counted, not an error
+	unsigned int out_of_range; //FAT or directory entries pointing outside the data area
+	unsigned int broken_chains; //chains that run into a free or bad cluster
+	unsigned int cross_linked; //clusters reached from more than one place (includes chains that loop back on themselves)
+	unsigned int lost_clusters; //allocated clusters that no directory entry reaches
+	unsigned int size_mismatches; //file size doesn't match the length of its chain
+	unsigned int too_deep; //directories skipped because of FATCHECK_MAX_DEPTH
+	unsigned int repaired;
+	unsigned int dirty_first; //range of FAT entries changed by repairs (dirty_first > dirty_last if none)
+	unsigned int dirty_last;
+}
+fatcheck_report_t;
+
+typedef struct fatcheck_volume
+{
+	fatcheck_io_t read;
+	fatcheck_io_t write; //only needed for FATCHECK_REPAIR
+	void* io_ctx;
+	unsigned int flags;
+
+	//geometry, filled in by fatcheckOpen
+	fat_BS_t bootsect;
+	unsigned int fat_type;
+	unsigned int bytes_per_sector;
+	unsigned int cluster_size; //in bytes
+	unsigned int fat_size; //sectors per FAT copy
+	unsigned int first_fat_sector;
+	unsigned int root_dir_sector; //FAT12/16 fixed root directory
+	unsigned int root_dir_sectors;
+	unsigned int first_data_sector;
+	unsigned int cluster_limit; //valid cluster numbers are 2 through cluster_limit - 1
+	unsigned int root_cluster; //0 for the FAT16 fixed root directory
+	unsigned int end_cluster; //smallest end of chain marker
+	unsigned int bad_cluster;
+	BOOL walk_incomplete; //set when directories were skipped, so lost clusters must not be freed
+
+	//working memory, handed in by fatcheckAttach
+	unsigned int* fat; //the whole FAT, one entry per cluster (FAT16 entries are widened)
+	unsigned char* refs; //how many times each cluster was reached while walking directories (saturates at 255)
+	unsigned char* block; //one directory cluster, or the whole FAT16 root directory
+}
+fatcheck_volume_t;
+
+int fatcheckOpen(fatcheck_volume_t* vol);
+unsigned int fatcheckMemoryNeeded(fatcheck_volume_t* vol);
+void fatcheckAttach(fatcheck_volume_t* vol, void* memory);
+void fatcheckReportInit(fatcheck_report_t* report);
+void fatcheckReportMerge(fatcheck_report_t* into, const fatcheck_report_t* from);
+int fatcheckLoadFAT(fatcheck_volume_t* vol);
+void fatcheckScanFAT(fatcheck_volume_t* vol, unsigned int first, unsigned int last, fatcheck_report_t* report);
+int fatcheckWalk(fatcheck_volume_t* vol, fatcheck_report_t* report);
+void fatcheckFindLost(fatcheck_volume_t* vol, unsigned int first, unsigned int last, fatcheck_report_t* report);
+int fatcheckWriteBack(fatcheck_volume_t* vol, const fatcheck_report_t* report);
+int fatcheckRun(fatcheck_volume_t* vol, fatcheck_report_t* report);
+unsigned int fatcheckProblems(const fatcheck_report_t* report);
+
+#ifdef __is_kernel
+int fatcheck(fat_volume_t* volume, unsigned int flags, arena_t* scratch); //checks a mounted volume and prints a report
+#endif
+
+#endif
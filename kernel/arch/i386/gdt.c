@@ -0,0 +1,109 @@
+#include "gdt.h"
+#include "stack.h"
+#include "smp.h"
+#include "lib_asm.h"
+#include "lib_c.h"
+#include "panic.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct __attribute__((packed)) gdt_entry
+{
+	unsigned short limit_low;
+	unsigned short base_low;
+	unsigned char base_middle;
+	unsigned char access;
+	unsigned char granularity; //flags in the high nibble, limit bits 16-19 in the low one
+	unsigned char base_high;
+}
+gdt_entry_t;
+
+static gdt_entry_t gdt_entries[GDT_ENTRIES];
+static tss_t cpu_tss[GDT_MAX_CPUS];
+static tss_t double_fault_tss;
+static unsigned char double_fault_stack[GDT_DOUBLE_FAULT_STACK_SIZE] __attribute__((aligned(16)));
+
+static void gdtSetEntry(unsigned int index, unsigned long base, unsigned long limit, unsigned char access, unsigned char flags)
+{
+	gdt_entries[index].limit_low = limit & 0xFFFF;
+	gdt_entries[index].base_low = base & 0xFFFF;
+	gdt_entries[index].base_middle = (base >> 16) & 0xFF;
+	gdt_entries[index].access = access;
+	gdt_entries[index].granularity = ((limit >> 16) & 0x0F) | (flags & 0xF0);
+	gdt_entries[index].base_high = (base >> 24) & 0xFF;
+}
+
+//Entered through the double fault task gate, on double_fault_stack. The faulting CPU's TSS, which the task switch
+//left in the link field, holds the registers of whatever was running, so the overflowing stack can be named
+//before giving up
+static void gdtDoubleFault(void)
+{
+	const tss_t* tss = &cpu_tss[(double_fault_tss.link - GDT_CPU_TSS(0)) / 16 % GDT_MAX_CPUS];
+	const kstack_t* stack = stackFindOverflow(tss->esp);
+
+	printf("double fault at eip %x, esp %x%n", tss->eip, tss->esp);
+	if (stack != NULL)
+	{
+		printf("kernel stack overflow: %s (%u bytes)%n", stack->name, (unsigned int)(stack->top - stack->bottom));
+		panic("Kernel stack overflow");
+	}
+	panic("Double fault");
+}
+
+//Builds the GDT and loads it on the BSP, with CPU 0's TSS and per-CPU area, reloading every segment register. Has
+//to run before idtInit, whose gates use GDT_KERNEL_CODE, and before anything takes a spinlock
+void gdtInit(void)
+{
+	unsigned long cr3;
+	unsigned int cpu;
+
+	gdtSetEntry(0, 0, 0, 0, 0);
+	gdtSetEntry(GDT_KERNEL_CODE / 8, 0, 0xFFFFF, 0x9A, 0xC0); //present, ring 0, code, readable; 4kB granularity, 32-bit
+	gdtSetEntry(GDT_KERNEL_DATA / 8, 0, 0xFFFFF, 0x92, 0xC0); //present, ring 0, data, writable
+	gdtSetEntry(GDT_DOUBLE_FAULT_TSS / 8, (unsigned long)&double_fault_tss, sizeof(tss_t) - 1, 0x89, 0x00); //present, available 32-bit TSS
+
+	for (cpu = 0; cpu < GDT_MAX_CPUS; cpu++)
+	{
+		memset(&cpu_tss[cpu], 0, sizeof(tss_t));
+		cpu_tss[cpu].ss0 = GDT_KERNEL_DATA;
+		cpu_tss[cpu].iomap_base = sizeof(tss_t);
+		gdtSetEntry(GDT_CPU_TSS(cpu) / 8, (unsigned long)&cpu_tss[cpu], sizeof(tss_t) - 1, 0x89, 0x00);
+	}
+
+	asm volatile("mov %%cr3, %0" : "=r"(cr3));
+	memset(&double_fault_tss, 0, sizeof(tss_t));
+	double_fault_tss.cr3 = cr3;
+	double_fault_tss.eip = (unsigned long)gdtDoubleFault;
+	double_fault_tss.eflags = 0x2; //interrupts off
+	double_fault_tss.esp = (unsigned long)(double_fault_stack + sizeof(double_fault_stack));
+	double_fault_tss.cs = GDT_KERNEL_CODE;
+	double_fault_tss.ss = GDT_KERNEL_DATA;
+	double_fault_tss.ds = GDT_KERNEL_DATA;
+	double_fault_tss.es = GDT_KERNEL_DATA;
+	double_fault_tss.fs = GDT_KERNEL_DATA;
+	double_fault_tss.gs = GDT_CPU_DATA(0); //some per-CPU area, so smpSelf doesn't fault; not necessarily the right one
+	double_fault_tss.iomap_base = sizeof(tss_t);
+
+	gdtLoadCpu(0, smpCpuArea(0));
+}
+
+//Loads the GDT on the calling CPU, as CPU "cpu" with its per-CPU area at "area": reloads every segment register,
+//GS with the CPU's own data segment, and its TSS
+void gdtLoadCpu(unsigned int cpu, void* area)
+{
+	GDTR gdtr;
+
+	gdtSetEntry(GDT_CPU_DATA(cpu) / 8, (unsigned long)area, 0xFFFFF, 0x92, 0xC0);
+
+	gdtr.limit = sizeof(gdt_entries) - 1;
+	gdtr.base = gdt_entries;
+	asm volatile("lgdt %0" : : "m"(gdtr));
+	asm volatile("ljmp %0, $1f\n1:" : : "i"(GDT_KERNEL_CODE));
+	asm volatile("mov %0, %%ds\n"
+		"mov %0, %%es\n"
+		"mov %0, %%fs\n"
+		"mov %0, %%ss" : : "r"(GDT_KERNEL_DATA));
+	asm volatile("mov %0, %%gs" : : "r"(GDT_CPU_DATA(cpu)));
+	asm volatile("ltr %w0" : : "r"(GDT_CPU_TSS(cpu)));
+}
@@ -0,0 +1,56 @@
+#ifndef GDT_H_
+#define GDT_H_
+
+//Global descriptor table: flat ring 0 code and data segments, the double fault TSS, and for every CPU a TSS of
+//its own and a data segment based at its per-CPU area (see smp.h), which gdtLoadCpu puts in GS. A CPU's TSS is
+//only there so it has somewhere to save the running state on a task switch; the double fault TSS is what the
+//double fault vector's task gate switches to, so a double fault (typically a kernel stack overflowing into its
+//guard page, where the page fault handler can't even push its frame) runs on a stack of its own. There's only
+//one, so two CPUs double faulting at once would triple fault, which is where the second would be headed anyway.
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_DOUBLE_FAULT_TSS 0x18
+#define GDT_MAX_CPUS 16
+#define GDT_CPU_TSS(cpu) (0x20 + (cpu) * 16)
+#define GDT_CPU_DATA(cpu) (0x28 + (cpu) * 16)
+#define GDT_ENTRIES (4 + 2 * GDT_MAX_CPUS)
+
+#define GDT_DOUBLE_FAULT_STACK_SIZE 4096
+
+typedef struct __attribute__((packed)) tss
+{
+	unsigned int link;
+	unsigned int esp0;
+	unsigned int ss0;
+	unsigned int esp1;
+	unsigned int ss1;
+	unsigned int esp2;
+	unsigned int ss2;
+	unsigned int cr3;
+	unsigned int eip;
+	unsigned int eflags;
+	unsigned int eax;
+	unsigned int ecx;
+	unsigned int edx;
+	unsigned int ebx;
+	unsigned int esp;
+	unsigned int ebp;
+	unsigned int esi;
+	unsigned int edi;
+	unsigned int es;
+	unsigned int cs;
+	unsigned int ss;
+	unsigned int ds;
+	unsigned int fs;
+	unsigned int gs;
+	unsigned int ldt;
+	unsigned short trap;
+	unsigned short iomap_base;
+}
+tss_t;
+
+void gdtInit(void);
+void gdtLoadCpu(unsigned int cpu, void* area);
+
+#endif
@@ -0,0 +1,64 @@
+#include "hpet.h"
+#include "acpi.h"
+#include "vmm.h"
+#include "lib_c.h"
+
+static volatile unsigned int* hpet_registers;
+static hpet_stats_t hpet_stats;
+
+//Finds the HPET through ACPI, maps it and starts its counter. acpiInit and vmmInit have to have run
+//Returns: 0 on success, -1 if there isn't a usable HPET
+int hpetInit(void)
+{
+	acpi_info_t info;
+	unsigned int period;
+
+	if (hpet_registers != NULL)
+		return 0;
+
+	acpiGetInfo(&info);
+	if (info.hpet_address == 0 || info.hpet_address >> 32)
+		return -1;
+
+	hpet_registers = vmmMapPhysical(info.hpet_address, HPET_REGISTERS_SIZE, "hpet");
+	if (hpet_registers == NULL)
+		return -1;
+
+	period = hpet_registers[HPET_CAPABILITIES / 4 + 1];
+	if (period == 0 || period > HPET_MAX_PERIOD)
+	{
+		vmmRelease((void*)hpet_registers); //the block is page aligned
+		hpet_registers = NULL;
+		return -1;
+	}
+
+	hpet_stats.frequency = HPET_FEMTOSECONDS_PER_SECOND / period;
+	hpet_stats.counter_64 = (hpet_registers[HPET_CAPABILITIES / 4] & HPET_CAP_COUNTER_64) != 0;
+	hpet_stats.timers = ((hpet_registers[HPET_CAPABILITIES / 4] >> 8) & 0x1F) + 1;
+	hpet_registers[HPET_CONFIG / 4] |= HPET_CONFIG_ENABLE;
+	return 0;
+}
+
+//Returns: the main counter, 0 before hpetInit
+unsigned long long hpetRead(void)
+{
+	unsigned int high, low;
+
+	if (hpet_registers == NULL)
+		return 0;
+	if (!hpet_stats.counter_64)
+		return hpet_registers[HPET_COUNTER / 4];
+
+	do
+	{
+		high = hpet_registers[HPET_COUNTER / 4 + 1];
+		low = hpet_registers[HPET_COUNTER / 4];
+	}
+	while (high != hpet_registers[HPET_COUNTER / 4 + 1]);
+	return ((unsigned long long)high << 32) | low;
+}
+
+void hpetGetStats(hpet_stats_t* stats)
+{
+	*stats = hpet_stats;
+}
@@ -0,0 +1,34 @@
+#ifndef HPET_H_
+#define HPET_H_
+
+//The HPET's main counter, as a clock. hpetInit maps the register block the ACPI HPET table points at and starts
+//the counter if the firmware hasn't; its comparators aren't used, the local APIC timer does the interrupting.
+//A 64 bit counter is read high, low, high so a carry between the two halves can't be torn; a 32 bit one wraps
+//every few minutes and is only good for measuring short intervals (ktimeInit's calibration).
+
+#define HPET_REGISTERS_SIZE 0x400
+
+//register offsets
+#define HPET_CAPABILITIES 0x000 //high half: counter period in femtoseconds
+#define HPET_CONFIG 0x010
+#define HPET_COUNTER 0x0F0
+
+#define HPET_CAP_COUNTER_64 0x2000
+#define HPET_CONFIG_ENABLE 0x1
+
+#define HPET_FEMTOSECONDS_PER_SECOND 1000000000000000ull
+#define HPET_MAX_PERIOD 100000000 //femtoseconds; the spec's upper bound, anything slower is a broken table
+
+typedef struct hpet_stats
+{
+	unsigned long long frequency; //counter ticks per second, 0 without an HPET
+	unsigned int counter_64;
+	unsigned int timers; //comparators the block has
+}
+hpet_stats_t;
+
+int hpetInit(void);
+unsigned long long hpetRead(void);
+void hpetGetStats(hpet_stats_t* stats);
+
+#endif
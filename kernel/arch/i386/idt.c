@@ -0,0 +1,214 @@
+#include "idt.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "softirq.h"
+#include "sched.h"
+#include "smp.h"
+#include "lib_asm.h"
+#include "lib_c.h"
+#include "panic.h"
+
+#include <stdio.h>
+
+typedef struct __attribute__((packed)) idt_entry
+{
+	unsigned short handler_low;
+	unsigned short selector;
+	unsigned char zero;
+	unsigned char type;
+	unsigned short handler_high;
+}
+idt_entry_t;
+
+static idt_entry_t idt_entries[IDT_VECTORS];
+static idt_handler_t idt_handlers[IDT_VECTORS];
+static idt_vector_stats_t idt_stats[IDT_VECTORS];
+static int idt_tsc; //whether there's a TSC to time handlers with
+
+extern void (*const isr_stub_table[IDT_VECTORS])(void);
+
+static void idtSetGate(unsigned int vector, void (*entry)(void), unsigned short selector, unsigned char type)
+{
+	unsigned long address = (unsigned long)entry;
+
+	idt_entries[vector].handler_low = address & 0xFFFF;
+	idt_entries[vector].selector = selector;
+	idt_entries[vector].zero = 0;
+	idt_entries[vector].type = type;
+	idt_entries[vector].handler_high = address >> 16;
+}
+
+//Fills in the IDT and loads it; gdtInit has to have run
+void idtInit(void)
+{
+	unsigned int vector;
+
+	for (vector = 0; vector < IDT_VECTORS; vector++)
+	{
+		idtSetGate(vector, isr_stub_table[vector], GDT_KERNEL_CODE, IDT_GATE_INTERRUPT);
+		if (idt_handlers[vector] == NULL)
+			idt_handlers[vector] = idtUnhandled;
+	}
+
+	idt_tsc = (cpuFeatures() & CPUID_EDX_TSC) != 0;
+
+	//a task gate has no handler address, just the TSS to switch to
+	idtSetGate(IDT_VECTOR_DOUBLE_FAULT, NULL, GDT_DOUBLE_FAULT_TSS, IDT_GATE_TASK);
+	idtLoad();
+}
+
+//Loads the IDT idtInit filled in on this CPU, for the other processors as they start
+void idtLoad(void)
+{
+	IDTR idtr;
+
+	idtr.limit = sizeof(idt_entries) - 1;
+	idtr.base = idt_entries;
+	asm volatile("lidt %0" : : "m"(idtr));
+}
+
+//Registers the C handler for "vector"; NULL puts idtUnhandled back
+void idtSetHandler(unsigned int vector, idt_handler_t handler)
+{
+	if (vector < IDT_VECTORS)
+		idt_handlers[vector] = handler != NULL ? handler : idtUnhandled;
+}
+
+//what every vector nobody has claimed ends up in
+void idtUnhandled(interrupt_frame_t* frame)
+{
+	printf("unhandled interrupt %u (error %x) at eip %x%n", frame->vector, frame->error_code, frame->eip);
+	panic("Unhandled interrupt");
+}
+
+//Returns: the histogram bucket for a handler run of "cycles"
+static unsigned int idtLatencyBucket(unsigned long long cycles)
+{
+	unsigned int bucket;
+
+	if (cycles >> 32)
+		return IDT_LATENCY_BUCKETS - 1;
+	bucket = cycles != 0 ? 31 - __builtin_clz((unsigned int)cycles) : 0;
+	return bucket < IDT_LATENCY_BUCKETS ? bucket : IDT_LATENCY_BUCKETS - 1;
+}
+
+//Called by isrCommon for every interrupt and exception: runs the vector's handler and charges it to the vector.
+//The count goes up first, so a handler that never returns (a panic) still shows. Every CPU charges the same
+//counters, hence the atomic adds
+void idtDispatch(interrupt_frame_t* frame)
+{
+	idt_vector_stats_t* stats = &idt_stats[frame->vector];
+	unsigned long long start, cycles;
+	unsigned int max;
+	cpu_t* self = smpSelf(); //a handler never moves to another CPU
+
+	self->irq_depth++;
+	__atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+	if (!idt_tsc)
+	{
+		idt_handlers[frame->vector](frame);
+	}
+	else
+	{
+		start = cpuReadTSC();
+		idt_handlers[frame->vector](frame);
+		cycles = cpuReadTSC() - start;
+		if (cycles > 0xFFFFFFFF)
+			cycles = 0xFFFFFFFF;
+
+		__atomic_fetch_add(&stats->cycles, cycles, __ATOMIC_RELAXED);
+		max = __atomic_load_n(&stats->max_cycles, __ATOMIC_RELAXED);
+		while (cycles > max && !__atomic_compare_exchange_n(&stats->max_cycles, &max, (unsigned int)cycles, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+		__atomic_fetch_add(&stats->latency[idtLatencyBucket(cycles)], 1, __ATOMIC_RELAXED);
+	}
+	self->irq_depth--;
+
+	//the handler has sent its EOI by now; leaving the outermost hardware interrupt into code that had interrupts
+	//on is where the deferred half of its work gets done (not counted in the handler's cycles), and where the
+	//interrupted thread can be switched away from if its slice is up or something more deserving woke up
+	if (self->irq_depth == 0 && frame->vector >= IDT_VECTOR_EXCEPTIONS && (frame->eflags & CPU_EFLAGS_IF))
+	{
+		if (softirqPending())
+			softirqRun();
+		schedPreempt();
+	}
+}
+
+//Copies "vector"'s counters a field at a time; other CPUs can still add to them in between, but no field is
+//ever half written
+//Returns: 0, or -1 past the last vector
+int idtGetVectorStats(unsigned int vector, idt_vector_stats_t* stats)
+{
+	const idt_vector_stats_t* source;
+	unsigned int bucket;
+
+	if (vector >= IDT_VECTORS)
+		return -1;
+	source = &idt_stats[vector];
+	stats->count = __atomic_load_n(&source->count, __ATOMIC_RELAXED);
+	stats->cycles = __atomic_load_n(&source->cycles, __ATOMIC_RELAXED);
+	stats->max_cycles = __atomic_load_n(&source->max_cycles, __ATOMIC_RELAXED);
+	for (bucket = 0; bucket < IDT_LATENCY_BUCKETS; bucket++)
+		stats->latency[bucket] = __atomic_load_n(&source->latency[bucket], __ATOMIC_RELAXED);
+	return 0;
+}
+
+//Zeroes every vector's counters, which all CPUs share; a handler finishing on another CPU meanwhile may still
+//land in the new totals
+void idtResetStats(void)
+{
+	unsigned int vector, bucket;
+
+	for (vector = 0; vector < IDT_VECTORS; vector++)
+	{
+		idt_vector_stats_t* stats = &idt_stats[vector];
+
+		__atomic_store_n(&stats->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&stats->cycles, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&stats->max_cycles, 0, __ATOMIC_RELAXED);
+		for (bucket = 0; bucket < IDT_LATENCY_BUCKETS; bucket++)
+			__atomic_store_n(&stats->latency[bucket], 0, __ATOMIC_RELAXED);
+	}
+}
+
+static void idtSerialLine(unsigned int vector, const char* field, unsigned long long value)
+{
+	putstring("irqstat.");
+	printdec(vector);
+	putcc('.');
+	putstring((char*)field);
+	putcc(' ');
+	printdec(value);
+	putcc('\n');
+}
+
+//Writes the counters of every vector that has fired to the serial port as "irqstat.<vector>.<field> value" lines
+//between "irqstat.begin" and "irqstat.end"; latency.<n> lines are only there for buckets with something in them
+void idtDumpSerial(void)
+{
+	idt_vector_stats_t stats;
+	unsigned int vector, bucket;
+	char field[] = "latency.00";
+
+	putstring("irqstat.begin\n");
+	for (vector = 0; vector < IDT_VECTORS; vector++)
+	{
+		//a copy, so an interrupt halfway through doesn't make the lines disagree
+		idtGetVectorStats(vector, &stats);
+		if (stats.count == 0)
+			continue;
+		idtSerialLine(vector, "count", stats.count);
+		idtSerialLine(vector, "cycles", stats.cycles);
+		idtSerialLine(vector, "max_cycles", stats.max_cycles);
+		for (bucket = 0; bucket < IDT_LATENCY_BUCKETS; bucket++)
+		{
+			if (stats.latency[bucket] == 0)
+				continue;
+			field[8] = '0' + bucket / 10;
+			field[9] = '0' + bucket % 10;
+			idtSerialLine(vector, field, stats.latency[bucket]);
+		}
+	}
+	putstring("irqstat.end\n");
+}
@@ -0,0 +1,68 @@
+#ifndef IDT_H_
+#define IDT_H_
+
+//Interrupt descriptor table. Every vector gets an interrupt gate to its entry stub in isr.S; the stubs save the
+//registers into an interrupt_frame_t and call idtDispatch, which runs the vector's handler (idtUnhandled until
+//something registers one). The double fault vector is a task gate instead (see gdt.h).
+//Hardware interrupts from the PICs arrive on IDT_VECTOR_IRQ_BASE onwards (see pic.h).
+//idtDispatch also keeps, per vector, how often it fired, the TSC cycles its handler took in total and at most, and
+//a histogram of those cycle counts in powers of two (bucket n: 2^n up to 2^(n+1) - 1, the last one open ended).
+//The cycles include nothing of the entry stub, so they're the handler's cost alone. Every CPU shares the one
+//table and the one set of counters, which are bumped without a lock, so with several CPUs they're near enough.
+
+#define IDT_VECTORS 256
+#define IDT_GATE_INTERRUPT 0x8E //present, ring 0, 32-bit interrupt gate (interrupts stay off in the handler)
+#define IDT_GATE_TASK 0x85 //present, ring 0, task gate
+
+#define IDT_VECTOR_DOUBLE_FAULT 8
+#define IDT_VECTOR_PAGE_FAULT 14
+#define IDT_VECTOR_EXCEPTIONS 32 //0-31 are the CPU's
+#define IDT_VECTOR_IRQ_BASE 0x20 //where picInit moves IRQ 0-15
+#define IDT_VECTOR_LAPIC_TIMER 0xF0
+#define IDT_VECTOR_IPI_RESCHEDULE 0xF1 //see smp.h
+#define IDT_VECTOR_IPI_TLB 0xF2
+#define IDT_VECTOR_IPI_TIMER 0xF3 //another CPU moved the earliest timer (see timer.h)
+#define IDT_VECTOR_SPURIOUS 0xFF //the local APIC's spurious interrupt
+
+#define IDT_LATENCY_BUCKETS 24
+
+//what the entry stubs leave on the stack, lowest address first
+typedef struct interrupt_frame
+{
+	unsigned int edi; //pusha
+	unsigned int esi;
+	unsigned int ebp;
+	unsigned int esp; //before pusha; not restored
+	unsigned int ebx;
+	unsigned int edx;
+	unsigned int ecx;
+	unsigned int eax;
+	unsigned int vector; //pushed by the stub
+	unsigned int error_code; //pushed by the CPU, or 0 by the stub for vectors without one
+	unsigned int eip; //pushed by the CPU
+	unsigned int cs;
+	unsigned int eflags;
+}
+interrupt_frame_t;
+
+typedef void (*idt_handler_t)(interrupt_frame_t* frame);
+
+typedef struct idt_vector_stats
+{
+	unsigned int count;
+	unsigned long long cycles; //in the handler, all told; 0 without a TSC
+	unsigned int max_cycles;
+	unsigned int latency[IDT_LATENCY_BUCKETS]; //handler runs by log2 of their cycles
+}
+idt_vector_stats_t;
+
+void idtInit(void);
+void idtLoad(void);
+void idtSetHandler(unsigned int vector, idt_handler_t handler);
+void idtUnhandled(interrupt_frame_t* frame);
+void idtDispatch(interrupt_frame_t* frame);
+int idtGetVectorStats(unsigned int vector, idt_vector_stats_t* stats);
+void idtResetStats(void);
+void idtDumpSerial(void);
+
+#endif
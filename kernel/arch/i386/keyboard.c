@@ -0,0 +1,199 @@
+#include "keyboard.h"
+#include "pic.h"
+#include "cpu.h"
+#include "sched.h"
+#include "smp.h"
+#include "lib_asm.h"
+#include "lib_c.h"
+
+#define KBD_LAYOUT_SIZE 0x3A //scancodes up to the space bar have characters
+
+static const char kbd_layout[KBD_LAYOUT_SIZE] = {
+	0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+	'\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+	0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+	0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+	'*', 0, ' '
+};
+
+static const char kbd_layout_shift[KBD_LAYOUT_SIZE] = {
+	0, 0, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+	'\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+	0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
+	0, '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
+	'*', 0, ' '
+};
+
+static unsigned char kbd_ring[KBD_RING_SIZE];
+static wait_queue_t kbd_wait = { NULL, NULL, SCHED_BOOST_IO, { 0 } }; //threads in kbdGetChar
+static volatile unsigned int kbd_head; //written by the interrupt only
+static volatile unsigned int kbd_tail; //written by the reader only
+static int kbd_initialised;
+
+//translation state, the reader's alone
+static int kbd_shift; //one bit per shift key
+static int kbd_caps;
+static int kbd_extended;
+
+static kbd_stats_t kbd_stats;
+
+static void kbdInterrupt(interrupt_frame_t* frame)
+{
+	(void)frame;
+	kbd_stats.interrupts++;
+
+	while ((inb(KBD_STATUS) & (KBD_STATUS_OUTPUT | KBD_STATUS_AUX)) == KBD_STATUS_OUTPUT)
+	{
+		unsigned char scancode = inb(KBD_DATA);
+		unsigned int head = kbd_head;
+
+		if (head - kbd_tail == KBD_RING_SIZE)
+		{
+			kbd_stats.dropped++;
+			continue;
+		}
+		kbd_ring[head % KBD_RING_SIZE] = scancode;
+		asm volatile("" : : : "memory"); //the slot has to be filled before the reader can see it
+		kbd_head = head + 1;
+	}
+	schedWakeAll(&kbd_wait);
+}
+
+//Installs the IRQ 1 handler, after throwing away whatever the controller is holding. picInit has to have run
+void kbdInit(void)
+{
+	while (inb(KBD_STATUS) & KBD_STATUS_OUTPUT)
+		inb(KBD_DATA);
+
+	kbd_initialised = 1;
+	picSetHandler(KBD_IRQ, kbdInterrupt);
+}
+
+//feeds one scancode through the shift/caps state machine
+//Returns: the character or KBD_KEY_* it makes, 0 if none (releases, modifiers, keys we don't map)
+static unsigned char kbdTranslate(unsigned char scancode)
+{
+	unsigned char key = scancode & ~KBD_SC_RELEASE;
+	int release = scancode & KBD_SC_RELEASE;
+	int extended = kbd_extended;
+	int shifted;
+	char c;
+
+	kbd_stats.scancodes++;
+	if (scancode == KBD_SC_EXTENDED)
+	{
+		kbd_extended = 1;
+		return 0;
+	}
+	kbd_extended = 0;
+
+	if (key == KBD_SC_LEFT_SHIFT || key == KBD_SC_RIGHT_SHIFT)
+	{
+		//E0 2A and E0 AA are fake shifts some keyboards wrap around the navigation keys
+		if (!extended)
+		{
+			int bit = key == KBD_SC_LEFT_SHIFT ? 1 : 2;
+			kbd_shift = release ? kbd_shift & ~bit : kbd_shift | bit;
+		}
+		return 0;
+	}
+	if (release)
+		return 0;
+
+	if (key == KBD_SC_CAPS_LOCK)
+	{
+		kbd_caps = !kbd_caps;
+		return 0;
+	}
+	if (extended)
+	{
+		if (key == KBD_SC_UP)
+			return KBD_KEY_UP;
+		if (key == KBD_SC_DOWN)
+			return KBD_KEY_DOWN;
+		if (key == KBD_SC_LEFT)
+			return KBD_KEY_LEFT;
+		if (key == KBD_SC_RIGHT)
+			return KBD_KEY_RIGHT;
+		if (key == KBD_SC_ENTER)
+			return '\n';
+		return 0;
+	}
+	if (key >= KBD_LAYOUT_SIZE)
+		return 0;
+
+	//caps lock only reaches the letters, and shift undoes it
+	shifted = kbd_shift != 0;
+	c = kbd_layout[key];
+	if (kbd_caps && c >= 'a' && c <= 'z')
+		shifted = !shifted;
+	return shifted ? kbd_layout_shift[key] : c;
+}
+
+//Returns: 1 if scancodes are waiting on the ring
+int kbdPending(void)
+{
+	return kbd_head != kbd_tail;
+}
+
+//Waits for a key and returns its character, or KBD_KEY_* for the arrows. The calling thread blocks in between,
+//until the keyboard interrupt wakes it
+unsigned char kbdGetChar(void)
+{
+	for (;;)
+	{
+		unsigned long flags;
+
+		while (kbd_head != kbd_tail)
+		{
+			unsigned int tail = kbd_tail;
+			unsigned char scancode = kbd_ring[tail % KBD_RING_SIZE];
+			unsigned char c;
+
+			asm volatile("" : : : "memory"); //the slot has to be read before the handler may reuse it
+			kbd_tail = tail + 1;
+			c = kbdTranslate(scancode);
+			if (c != 0)
+				return c;
+		}
+
+		flags = cpuIrqSave();
+		if (!kbd_initialised || !(flags & CPU_EFLAGS_IF))
+		{
+			//no interrupt is going to fill the ring, so go to the controller
+			unsigned char status;
+			while (((status = inb(KBD_STATUS)) & KBD_STATUS_OUTPUT) == 0)
+				smpTlbPoll(); //nor will a shootdown's
+			if (!(status & KBD_STATUS_AUX))
+			{
+				unsigned char c = kbdTranslate(inb(KBD_DATA));
+				if (c != 0)
+				{
+					cpuIrqRestore(flags);
+					return c;
+				}
+			}
+			else
+			{
+				inb(KBD_DATA);
+			}
+			cpuIrqRestore(flags);
+			continue;
+		}
+
+		//checked again under the wait queue's lock, so a scancode can't arrive between the check and the wait
+		spinLock(&kbd_wait.lock);
+		if (kbd_head == kbd_tail)
+		{
+			kbd_stats.halts++;
+			schedWait(&kbd_wait);
+		}
+		spinUnlock(&kbd_wait.lock);
+		cpuIrqRestore(flags);
+	}
+}
+
+void kbdGetStats(kbd_stats_t* stats)
+{
+	*stats = kbd_stats;
+}
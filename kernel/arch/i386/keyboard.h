@@ -0,0 +1,52 @@
+#ifndef KEYBOARD_H_
+#define KEYBOARD_H_
+
+//The PS/2 keyboard. The IRQ 1 handler only moves scancodes from the controller into a ring; kbdGetChar, on the
+//other side, turns them into characters (scancode set 1, US layout, shift and caps lock) and blocks the calling
+//thread while the ring is empty, until the handler wakes it. With one writer (the interrupt) and one reader, head and tail each belong to one side and the
+//ring needs no lock: the handler fills a slot before moving head past it, the reader empties one before moving
+//tail. It only drops a scancode when KBD_RING_SIZE of them are waiting, which kbd_stats counts.
+//Before kbdInit, or with interrupts off (setup runs before the IDT exists), kbdGetChar polls the controller
+//instead, through the same translation.
+
+#define KBD_DATA 0x60
+#define KBD_STATUS 0x64
+#define KBD_STATUS_OUTPUT 0x01 //a byte is waiting in KBD_DATA
+#define KBD_STATUS_AUX 0x20 //and it's from the mouse
+#define KBD_IRQ 1
+
+#define KBD_RING_SIZE 256 //a power of two, so the free running indices can wrap
+
+//scancode set 1
+#define KBD_SC_RELEASE 0x80
+#define KBD_SC_ENTER 0x1C //the keypad's, after KBD_SC_EXTENDED
+#define KBD_SC_EXTENDED 0xE0
+#define KBD_SC_LEFT_SHIFT 0x2A
+#define KBD_SC_RIGHT_SHIFT 0x36
+#define KBD_SC_CAPS_LOCK 0x3A
+#define KBD_SC_UP 0x48
+#define KBD_SC_LEFT 0x4B
+#define KBD_SC_RIGHT 0x4D
+#define KBD_SC_DOWN 0x50
+
+//what kbdGetChar returns for keys without a character, above ASCII
+#define KBD_KEY_UP 0x80
+#define KBD_KEY_DOWN 0x81
+#define KBD_KEY_LEFT 0x82
+#define KBD_KEY_RIGHT 0x83
+
+typedef struct kbd_stats
+{
+	unsigned int interrupts;
+	unsigned int scancodes; //taken off the ring (or polled)
+	unsigned int dropped; //arrived to a full ring
+	unsigned int halts; //times kbdGetChar blocked for input
+}
+kbd_stats_t;
+
+void kbdInit(void);
+unsigned char kbdGetChar(void);
+int kbdPending(void);
+void kbdGetStats(kbd_stats_t* stats);
+
+#endif
@@ -0,0 +1,311 @@
+#include "kheap.h"
+#include "pmm.h"
+#include "paging.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static kmem_cache_t kmem_caches[KMEM_MAX_CACHES];
+static unsigned int kmem_cache_count;
+
+//kmalloc size classes, smallest first
+static const unsigned int kmem_class_sizes[] = { 16, 32, 64, 96, 128, 192, 256, 512, 1024 };
+#define KMEM_CLASS_COUNT (sizeof(kmem_class_sizes) / sizeof(kmem_class_sizes[0]))
+static kmem_cache_t* kmem_classes[KMEM_CLASS_COUNT];
+static const char* const kmem_class_names[KMEM_CLASS_COUNT] = { "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-96", "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-512", "kmalloc-1024" };
+
+static kmem_cache_stats_t kmem_large_stats; //allocations too big for a size class; "slabs" counts their frames
+
+static void kmemSlabUnlink(kmem_slab_t** list, kmem_slab_t* slab)
+{
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+}
+
+static void kmemSlabPush(kmem_slab_t** list, kmem_slab_t* slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list != NULL)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+//takes a frame and carves it into free objects
+static kmem_slab_t* kmemSlabCreate(kmem_cache_t* cache)
+{
+	unsigned long physical = pmmAllocFrame();
+	if (physical == 0)
+		return NULL;
+
+	unsigned long frame = (unsigned long)PHYS_TO_VIRT(physical);
+	kmem_slab_t* slab = (kmem_slab_t*)frame;
+	slab->magic = KMEM_SLAB_MAGIC;
+	slab->cache = cache;
+	slab->in_use = 0;
+	slab->free = NULL;
+
+	//chain the objects back to front so the first one handed out is at the lowest address
+	unsigned int i = cache->objects_per_slab;
+	while (i-- > 0)
+	{
+		void** object = (void**)(frame + cache->first_offset + i * cache->object_size);
+		*object = slab->free;
+		slab->free = object;
+	}
+
+	cache->stats.slabs++;
+	return slab;
+}
+
+//Sets up a cache of "object_size" byte objects. "name" isn't copied, so it should be a string literal
+//Returns: the cache, or NULL if the cache table is full or the objects don't fit in a slab
+kmem_cache_t* kmemCacheCreate(const char* name, unsigned int object_size)
+{
+	unsigned int first_offset = (sizeof(kmem_slab_t) + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+
+	if (kmem_cache_count == KMEM_MAX_CACHES || object_size == 0 || object_size > PMM_FRAME_SIZE - first_offset)
+		return NULL;
+
+	if (object_size < sizeof(void*)) //free objects hold the free list link
+		object_size = sizeof(void*);
+	object_size = (object_size + 7) & ~7u;
+
+	kmem_cache_t* cache = &kmem_caches[kmem_cache_count++];
+	memset(cache, 0, sizeof(kmem_cache_t));
+	cache->name = name;
+	cache->object_size = object_size;
+	cache->first_offset = first_offset;
+	cache->objects_per_slab = (PMM_FRAME_SIZE - first_offset) / object_size;
+	return cache;
+}
+
+//Returns: an object from the cache, or NULL if no frame was free for a new slab
+void* kmemCacheAlloc(kmem_cache_t* cache)
+{
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	kmem_slab_t* slab = cache->partial;
+
+	if (slab == NULL)
+	{
+		slab = cache->empty;
+		if (slab != NULL)
+		{
+			kmemSlabUnlink(&cache->empty, slab);
+			cache->empty_count--;
+		}
+		else if ((slab = kmemSlabCreate(cache)) == NULL)
+		{
+			cache->stats.failures++;
+			rspinUnlockIrqRestore(&mm_lock, flags);
+			return NULL;
+		}
+		kmemSlabPush(&cache->partial, slab);
+	}
+
+	void** object = slab->free;
+	slab->free = *object;
+	slab->in_use++;
+
+	if (slab->in_use == cache->objects_per_slab)
+	{
+		kmemSlabUnlink(&cache->partial, slab);
+		kmemSlabPush(&cache->full, slab);
+	}
+
+	cache->stats.allocs++;
+	cache->stats.active++;
+	if (cache->stats.active > cache->stats.peak_active)
+		cache->stats.peak_active = cache->stats.active;
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return object;
+}
+
+void kmemCacheFree(kmem_cache_t* cache, void* object)
+{
+	if (object == NULL)
+		return;
+
+	kmem_slab_t* slab = (kmem_slab_t*)((unsigned long)object & ~(unsigned long)(PMM_FRAME_SIZE - 1));
+	if (slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache || slab->in_use == 0)
+	{
+		printf("kheap: bad free of %x in %s%n", (unsigned int)(unsigned long)object, cache->name);
+		return;
+	}
+
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+
+	if (slab->in_use == cache->objects_per_slab)
+	{
+		kmemSlabUnlink(&cache->full, slab);
+		kmemSlabPush(&cache->partial, slab);
+	}
+
+	*(void**)object = slab->free;
+	slab->free = object;
+	slab->in_use--;
+	cache->stats.frees++;
+	cache->stats.active--;
+
+	if (slab->in_use == 0)
+	{
+		kmemSlabUnlink(&cache->partial, slab);
+		if (cache->empty_count < KMEM_MAX_EMPTY_SLABS)
+		{
+			kmemSlabPush(&cache->empty, slab);
+			cache->empty_count++;
+		}
+		else
+		{
+			slab->magic = 0;
+			cache->stats.slabs--;
+			pmmFreeFrame(VIRT_TO_PHYS(slab));
+		}
+	}
+	rspinUnlockIrqRestore(&mm_lock, flags);
+}
+
+static unsigned int kmemShrinkCount(void)
+{
+	unsigned int i, empty = 0;
+
+	for (i = 0; i < kmem_cache_count; i++)
+		empty += kmem_caches[i].empty_count;
+	return empty;
+}
+
+//gives back up to "count" empty slabs, taking from whichever caches hold the most
+static unsigned int kmemShrinkScan(unsigned int count)
+{
+	unsigned int released = 0;
+
+	while (released < count)
+	{
+		kmem_cache_t* fattest = NULL;
+		unsigned int i;
+
+		for (i = 0; i < kmem_cache_count; i++)
+		{
+			if (kmem_caches[i].empty_count != 0 && (fattest == NULL || kmem_caches[i].empty_count > fattest->empty_count))
+				fattest = &kmem_caches[i];
+		}
+		if (fattest == NULL)
+			break;
+
+		kmem_slab_t* slab = fattest->empty;
+		kmemSlabUnlink(&fattest->empty, slab);
+		fattest->empty_count--;
+		slab->magic = 0;
+		fattest->stats.slabs--;
+		pmmFreeFrame(VIRT_TO_PHYS(slab));
+		released++;
+	}
+	return released;
+}
+
+static pmm_shrinker_t kmem_shrinker = { "slab", KMEM_SHRINK_PRIORITY, kmemShrinkCount, kmemShrinkScan, 0, 0 };
+
+//Returns: the index'th cache, for listing them, or NULL past the last one
+kmem_cache_t* kmemCacheGet(unsigned int index)
+{
+	return index < kmem_cache_count ? &kmem_caches[index] : NULL;
+}
+
+void kheapInit(void)
+{
+	unsigned int i;
+
+	if (kmem_classes[0] != NULL)
+		return;
+
+	for (i = 0; i < KMEM_CLASS_COUNT; i++)
+		kmem_classes[i] = kmemCacheCreate(kmem_class_names[i], kmem_class_sizes[i]);
+	pmmRegisterShrinker(&kmem_shrinker);
+}
+
+//Returns: at least "size" bytes, aligned to KMEM_ALIGN, or NULL if there's no memory (or kheapInit hasn't run)
+void* kmalloc(unsigned int size)
+{
+	unsigned int i;
+
+	if (size == 0 || kmem_classes[0] == NULL)
+		return NULL;
+
+	for (i = 0; i < KMEM_CLASS_COUNT; i++)
+	{
+		if (size <= kmem_class_sizes[i])
+			return kmemCacheAlloc(kmem_classes[i]);
+	}
+
+	unsigned int order = pmmOrderForSize((unsigned long)size + sizeof(kmem_large_t));
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	unsigned long block = pmmAllocFrames(order);
+	if (block == 0)
+	{
+		kmem_large_stats.failures++;
+		rspinUnlockIrqRestore(&mm_lock, flags);
+		return NULL;
+	}
+
+	kmem_large_t* header = (kmem_large_t*)PHYS_TO_VIRT(block);
+	header->magic = KMEM_LARGE_MAGIC;
+	header->order = order;
+	header->size = size;
+
+	kmem_large_stats.allocs++;
+	kmem_large_stats.active++;
+	if (kmem_large_stats.active > kmem_large_stats.peak_active)
+		kmem_large_stats.peak_active = kmem_large_stats.active;
+	kmem_large_stats.slabs += 1u << order;
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return header + 1;
+}
+
+void* kzalloc(unsigned int size)
+{
+	void* pointer = kmalloc(size);
+	if (pointer != NULL)
+		memset(pointer, 0, size);
+	return pointer;
+}
+
+void kfree(void* pointer)
+{
+	if (pointer == NULL)
+		return;
+
+	//slab objects and large blocks both have their header at the start of the frame the pointer is in
+	unsigned long frame = (unsigned long)pointer & ~(unsigned long)(PMM_FRAME_SIZE - 1);
+
+	if (*(unsigned int*)frame == KMEM_SLAB_MAGIC)
+	{
+		kmemCacheFree(((kmem_slab_t*)frame)->cache, pointer);
+		return;
+	}
+
+	kmem_large_t* header = (kmem_large_t*)frame;
+	if (header->magic != KMEM_LARGE_MAGIC || (void*)(header + 1) != pointer)
+	{
+		printf("kheap: kfree of %x, which kmalloc didn't hand out%n", (unsigned int)(unsigned long)pointer);
+		return;
+	}
+
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	header->magic = 0;
+	kmem_large_stats.frees++;
+	kmem_large_stats.active--;
+	kmem_large_stats.slabs -= 1u << header->order;
+	pmmFreeFrames(VIRT_TO_PHYS(frame), header->order);
+	rspinUnlockIrqRestore(&mm_lock, flags);
+}
+
+void kmallocGetLargeStats(kmem_cache_stats_t* stats)
+{
+	*stats = kmem_large_stats;
+}
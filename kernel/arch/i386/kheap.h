@@ -0,0 +1,78 @@
+#ifndef KHEAP_H_
+#define KHEAP_H_
+
+//Kernel heap: slab caches on top of the frame allocator.
+//A slab is one frame holding a header and a run of equal sized objects; free objects are chained through their
+//first word. Each cache keeps partial, full and empty slab lists, so alloc and free are O(1) and only touch the
+//slab the object lives in. kmalloc picks a size class cache; anything bigger than KMEM_MAX_CLASS_SIZE gets whole
+//frames with a small header in front.
+//Hot fixed size objects get caches of their own from their owners (kmemCacheCreate), which keeps them packed
+//together and gives each its own line in slabinfo.
+
+#define KMEM_MAX_CACHES 32
+#define KMEM_MAX_CLASS_SIZE 1024 //largest kmalloc size class; bigger requests go straight to the frame allocator
+#define KMEM_ALIGN 16 //kmalloc'd memory is aligned at least this much
+#define KMEM_MAX_EMPTY_SLABS 4 //empty slabs a cache holds on to before giving frames back; the shrinker takes them under pressure
+#define KMEM_SHRINK_PRIORITY 0 //empty slabs cost nothing to give back
+
+#define KMEM_SLAB_MAGIC 0x51AB51AB
+#define KMEM_LARGE_MAGIC 0x1A26E000
+
+typedef struct kmem_cache_stats
+{
+	unsigned int allocs;
+	unsigned int frees;
+	unsigned int failures; //allocations that found no free frame
+	unsigned int active; //objects handed out right now
+	unsigned int peak_active;
+	unsigned int slabs; //frames the cache holds, including empty ones
+}
+kmem_cache_stats_t;
+
+typedef struct kmem_slab
+{
+	unsigned int magic;
+	struct kmem_cache* cache;
+	struct kmem_slab* next;
+	struct kmem_slab* prev;
+	void* free; //first free object
+	unsigned int in_use;
+}
+kmem_slab_t;
+
+typedef struct kmem_cache
+{
+	const char* name;
+	unsigned int object_size;
+	unsigned int objects_per_slab;
+	unsigned int first_offset; //where the first object starts, past the slab header
+	kmem_slab_t* partial;
+	kmem_slab_t* full;
+	kmem_slab_t* empty;
+	unsigned int empty_count;
+	kmem_cache_stats_t stats;
+}
+kmem_cache_t;
+
+//large allocations; the pointer handed out is right after this header
+typedef struct kmem_large
+{
+	unsigned int magic;
+	unsigned int order;
+	unsigned int size;
+	unsigned int reserved;
+}
+kmem_large_t;
+
+void kheapInit(void);
+kmem_cache_t* kmemCacheCreate(const char* name, unsigned int object_size);
+void* kmemCacheAlloc(kmem_cache_t* cache);
+void kmemCacheFree(kmem_cache_t* cache, void* object);
+kmem_cache_t* kmemCacheGet(unsigned int index);
+
+void* kmalloc(unsigned int size);
+void* kzalloc(unsigned int size);
+void kfree(void* pointer);
+void kmallocGetLargeStats(kmem_cache_stats_t* stats);
+
+#endif
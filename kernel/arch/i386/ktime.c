@@ -0,0 +1,363 @@
+#include "ktime.h"
+#include "timer.h"
+#include "hpet.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "lib_asm.h"
+#include "lib_c.h"
+
+#include <string.h>
+
+#define KTIME_NS_PER_US 1000
+#define KTIME_NS_PER_SECOND 1000000000ull
+#define KTIME_SECONDS_PER_DAY 86400
+
+#define KTIME_CMOS_ADDRESS 0x70
+#define KTIME_CMOS_DATA 0x71
+
+//RTC registers
+#define KTIME_RTC_SECOND 0x00
+#define KTIME_RTC_MINUTE 0x02
+#define KTIME_RTC_HOUR 0x04
+#define KTIME_RTC_DAY 0x07
+#define KTIME_RTC_MONTH 0x08
+#define KTIME_RTC_YEAR 0x09
+#define KTIME_RTC_STATUS_A 0x0A
+#define KTIME_RTC_STATUS_B 0x0B
+
+#define KTIME_RTC_UPDATING 0x80 //status A: the registers are being updated
+#define KTIME_RTC_24_HOUR 0x02 //status B
+#define KTIME_RTC_BINARY 0x04 //status B: not BCD
+#define KTIME_RTC_PM 0x80 //hour register, in 12 hour mode
+
+static ktime_stats_t ktime_stats;
+static unsigned long long ktime_counter_base; //TSC or HPET at ktime_offset
+static unsigned long long ktime_offset; //nanoseconds on the timerNow clock when the TSC took over
+static unsigned long long ktime_boot_mono; //ktimeGet when the RTC was read
+
+//Returns: TSC ticks per second, the lowest of KTIME_CALIBRATE_RUNS measurements against PIT channel 2
+static unsigned long long ktimeCalibrateAgainstPIT(void)
+{
+	unsigned long count = (unsigned long long)KTIME_CALIBRATE_US * TIMER_PIT_HZ / 1000000;
+	unsigned long long best = 0;
+	unsigned int run;
+
+	for (run = 0; run < KTIME_CALIBRATE_RUNS; run++)
+	{
+		unsigned long flags = cpuIrqSave();
+		unsigned char gate = timerPitArm(count);
+		unsigned long long start = cpuReadTSC();
+		unsigned long long ticks;
+
+		timerPitRun(gate);
+		ticks = cpuReadTSC() - start;
+		cpuIrqRestore(flags);
+
+		if (best == 0 || ticks < best)
+			best = ticks;
+	}
+	return best * TIMER_PIT_HZ / count;
+}
+
+//Returns: the TSC halfway through reading the HPET into "hpet", which is as close as the two can be read together
+static unsigned long long ktimeSampleHPET(unsigned long long* hpet)
+{
+	unsigned long long before = cpuReadTSC();
+	*hpet = hpetRead();
+	return before + (cpuReadTSC() - before) / 2;
+}
+
+//Both counters keep going through anything that interrupts the measurement, so unlike against the PIT one run is
+//enough; the only error is how long the HPET takes to read, at either end
+//Returns: TSC ticks per second
+static unsigned long long ktimeCalibrateAgainstHPET(const hpet_stats_t* hpet)
+{
+	unsigned long long window = hpet->frequency * KTIME_CALIBRATE_US / 1000000;
+	unsigned long long hpet_start, hpet_end, elapsed;
+	unsigned long long tsc_start, tsc_end;
+	unsigned long flags = cpuIrqSave();
+
+	tsc_start = ktimeSampleHPET(&hpet_start);
+	do
+	{
+		tsc_end = ktimeSampleHPET(&hpet_end);
+		elapsed = hpet_end - hpet_start;
+		if (!hpet->counter_64)
+			elapsed &= 0xFFFFFFFF; //across a wrap
+	}
+	while (elapsed < window);
+	cpuIrqRestore(flags);
+
+	return (tsc_end - tsc_start) * hpet->frequency / elapsed;
+}
+
+//picks the largest shift that keeps the multiplier within 32 bits, for the most precision
+static void ktimeSetScale(unsigned long long frequency)
+{
+	unsigned int shift = 32;
+	unsigned long long mult;
+
+	while ((mult = (KTIME_NS_PER_SECOND << shift) / frequency) > 0xFFFFFFFF)
+		shift--;
+	ktime_stats.mult = mult;
+	ktime_stats.shift = shift;
+}
+
+//Returns: "ticks" of the TSC or HPET in nanoseconds, without a 64 bit division or a 96 bit product
+static unsigned long long ktimeScale(unsigned long long ticks)
+{
+	unsigned long long low = (ticks & 0xFFFFFFFF) * ktime_stats.mult;
+	unsigned long long high = (ticks >> 32) * ktime_stats.mult;
+	return (high << (32 - ktime_stats.shift)) + (low >> ktime_stats.shift);
+}
+
+static unsigned char ktimeReadCMOS(unsigned char reg)
+{
+	outb(KTIME_CMOS_ADDRESS, reg);
+	return inb(KTIME_CMOS_DATA);
+}
+
+static void ktimeReadRTCRegisters(unsigned char* registers)
+{
+	while (ktimeReadCMOS(KTIME_RTC_STATUS_A) & KTIME_RTC_UPDATING)
+		;
+	registers[0] = ktimeReadCMOS(KTIME_RTC_SECOND);
+	registers[1] = ktimeReadCMOS(KTIME_RTC_MINUTE);
+	registers[2] = ktimeReadCMOS(KTIME_RTC_HOUR);
+	registers[3] = ktimeReadCMOS(KTIME_RTC_DAY);
+	registers[4] = ktimeReadCMOS(KTIME_RTC_MONTH);
+	registers[5] = ktimeReadCMOS(KTIME_RTC_YEAR);
+	registers[6] = acpiCenturyRegister() != 0 ? ktimeReadCMOS(acpiCenturyRegister()) : 0;
+}
+
+static unsigned int ktimeFromBCD(unsigned char value)
+{
+	return (value & 0x0F) + (value >> 4) * 10;
+}
+
+//reads the registers until two reads in a row agree, so an update in the middle can't mix up old and new values
+static void ktimeReadRTC(ktime_date_t* date)
+{
+	unsigned char registers[7];
+	unsigned char last[7];
+	unsigned char status;
+	unsigned int century = 0;
+	unsigned int pm;
+	int i;
+
+	ktimeReadRTCRegisters(registers);
+	do
+	{
+		for (i = 0; i < 7; i++)
+			last[i] = registers[i];
+		ktimeReadRTCRegisters(registers);
+		for (i = 0; i < 7 && last[i] == registers[i]; i++)
+			;
+	}
+	while (i < 7);
+
+	status = ktimeReadCMOS(KTIME_RTC_STATUS_B);
+	pm = registers[2] & KTIME_RTC_PM;
+	registers[2] &= ~KTIME_RTC_PM;
+
+	if (status & KTIME_RTC_BINARY)
+	{
+		date->second = registers[0];
+		date->minute = registers[1];
+		date->hour = registers[2];
+		date->day = registers[3];
+		date->month = registers[4];
+		date->year = registers[5];
+		century = registers[6];
+	}
+	else
+	{
+		date->second = ktimeFromBCD(registers[0]);
+		date->minute = ktimeFromBCD(registers[1]);
+		date->hour = ktimeFromBCD(registers[2]);
+		date->day = ktimeFromBCD(registers[3]);
+		date->month = ktimeFromBCD(registers[4]);
+		date->year = ktimeFromBCD(registers[5]);
+		century = ktimeFromBCD(registers[6]);
+	}
+	date->nanosecond = 0;
+
+	//12 hour mode counts 12, 1, ..., 11 in both halves of the day
+	if (!(status & KTIME_RTC_24_HOUR))
+	{
+		date->hour %= 12;
+		if (pm)
+			date->hour += 12;
+	}
+
+	if (century != 0)
+	{
+		date->year += century * 100;
+	}
+	else
+	{
+		date->year += (KTIME_RTC_MIN_YEAR / 100) * 100;
+		if (date->year < KTIME_RTC_MIN_YEAR)
+			date->year += 100;
+	}
+}
+
+//Returns: days from 1970-01-01 to "date"
+static unsigned long ktimeDaysFromDate(const ktime_date_t* date)
+{
+	unsigned long year = date->year - (date->month <= 2);
+	unsigned long era = year / 400;
+	unsigned long year_of_era = year - era * 400;
+	unsigned long day_of_year = (153 * (date->month > 2 ? date->month - 3 : date->month + 9) + 2) / 5 + date->day - 1;
+	unsigned long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + day_of_era - 719468;
+}
+
+//starts the clock on "counter" from where the timerNow clock is, so ktimeGet doesn't jump
+static void ktimeSwitch(unsigned int source, unsigned long long frequency, unsigned long long counter)
+{
+	unsigned long flags = cpuIrqSave();
+
+	ktimeSetScale(frequency);
+	ktime_offset = timerNow() * KTIME_NS_PER_US;
+	ktime_counter_base = counter;
+	ktime_stats.source = source;
+	cpuIrqRestore(flags);
+}
+
+//Works out the clock's rate and reads the time of day from the RTC. timerInit (and acpiInit and hpetInit, for the
+//HPET) have to have run
+//Returns: KTIME_SOURCE_TSC, KTIME_SOURCE_HPET or KTIME_SOURCE_TIMER
+int ktimeInit(void)
+{
+	ktime_date_t date;
+	cpuid_regs_t regs;
+	hpet_stats_t hpet;
+
+	if (ktime_stats.source != KTIME_SOURCE_NONE)
+		return ktime_stats.source;
+
+	hpetGetStats(&hpet);
+	ktime_stats.hpet_frequency = hpet.frequency;
+
+	if (cpuFeatures() & CPUID_EDX_TSC)
+	{
+		cpuid(CPUID_LEAF_EXTENDED_MAX, &regs);
+		if (regs.eax >= CPUID_LEAF_POWER)
+		{
+			cpuid(CPUID_LEAF_POWER, &regs);
+			ktime_stats.invariant_tsc = (regs.edx & CPUID_POWER_EDX_INVARIANT_TSC) != 0;
+		}
+		if (hpet.frequency != 0)
+		{
+			ktime_stats.tsc_frequency = ktimeCalibrateAgainstHPET(&hpet);
+			ktime_stats.reference = KTIME_REFERENCE_HPET;
+		}
+		else
+		{
+			ktime_stats.tsc_frequency = ktimeCalibrateAgainstPIT();
+			ktime_stats.reference = KTIME_REFERENCE_PIT;
+		}
+	}
+
+	if (ktime_stats.invariant_tsc && ktime_stats.tsc_frequency != 0)
+		ktimeSwitch(KTIME_SOURCE_TSC, ktime_stats.tsc_frequency, cpuReadTSC());
+	else if (hpet.frequency != 0 && hpet.counter_64)
+		ktimeSwitch(KTIME_SOURCE_HPET, hpet.frequency, hpetRead());
+	else
+		ktime_stats.source = KTIME_SOURCE_TIMER;
+
+	ktimeReadRTC(&date);
+	ktime_boot_mono = ktimeGet();
+	ktime_stats.boot_time = (unsigned long long)ktimeDaysFromDate(&date) * KTIME_SECONDS_PER_DAY + date.hour * 3600 + date.minute * 60 + date.second;
+	return ktime_stats.source;
+}
+
+//Returns: nanoseconds since timerInit
+unsigned long long ktimeGet(void)
+{
+	if (ktime_stats.source == KTIME_SOURCE_TSC)
+		return ktime_offset + ktimeScale(cpuReadTSC() - ktime_counter_base);
+	if (ktime_stats.source == KTIME_SOURCE_HPET)
+		return ktime_offset + ktimeScale(hpetRead() - ktime_counter_base);
+	return timerNow() * KTIME_NS_PER_US;
+}
+
+//Returns: 1 if ktimeGet has a counter of its own (the TSC or HPET) rather than timerNow, so timerNow can go by it
+int ktimeIndependent(void)
+{
+	return ktime_stats.source == KTIME_SOURCE_TSC || ktime_stats.source == KTIME_SOURCE_HPET;
+}
+
+//Returns: nanoseconds since 1970, or 0 before ktimeInit
+unsigned long long ktimeGetRealtime(void)
+{
+	if (ktime_stats.source == KTIME_SOURCE_NONE)
+		return 0;
+	return ktime_stats.boot_time * KTIME_NS_PER_SECOND + (ktimeGet() - ktime_boot_mono);
+}
+
+void ktimeToDate(unsigned long long realtime, ktime_date_t* date)
+{
+	unsigned long long seconds = realtime / KTIME_NS_PER_SECOND;
+	unsigned long days = seconds / KTIME_SECONDS_PER_DAY;
+	unsigned long rest = seconds % KTIME_SECONDS_PER_DAY;
+	unsigned long era, day_of_era, year_of_era, day_of_year, month;
+
+	date->nanosecond = realtime % KTIME_NS_PER_SECOND;
+	date->hour = rest / 3600;
+	date->minute = rest / 60 % 60;
+	date->second = rest % 60;
+
+	//the inverse of ktimeDaysFromDate, with years starting in March so the leap day comes last
+	days += 719468;
+	era = days / 146097;
+	day_of_era = days - era * 146097;
+	year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	month = (5 * day_of_year + 2) / 153;
+	date->day = day_of_year - (153 * month + 2) / 5 + 1;
+	date->month = month < 10 ? month + 3 : month - 9;
+	date->year = year_of_era + era * 400 + (date->month <= 2);
+}
+
+//Fills in "date" with the time of day, all zeroes before ktimeInit
+void ktimeGetDate(ktime_date_t* date)
+{
+	if (ktime_stats.source == KTIME_SOURCE_NONE)
+	{
+		memset(date, 0, sizeof(ktime_date_t));
+		return;
+	}
+	ktimeToDate(ktimeGetRealtime(), date);
+}
+
+static void ktimeSpin(unsigned long long nanoseconds)
+{
+	unsigned long long deadline = ktimeGet() + nanoseconds;
+
+	while (ktimeGet() < deadline)
+		asm volatile("pause");
+}
+
+//Spins for at least "nanoseconds". On the timer clock this is timerSleep, so rounded up to whole microseconds
+void ndelay(unsigned long nanoseconds)
+{
+	if (ktime_stats.source == KTIME_SOURCE_TSC || ktime_stats.source == KTIME_SOURCE_HPET)
+		ktimeSpin(nanoseconds);
+	else
+		timerSleep((nanoseconds + KTIME_NS_PER_US - 1) / KTIME_NS_PER_US);
+}
+
+void udelay(unsigned long microseconds)
+{
+	if (ktime_stats.source == KTIME_SOURCE_TSC || ktime_stats.source == KTIME_SOURCE_HPET)
+		ktimeSpin((unsigned long long)microseconds * KTIME_NS_PER_US);
+	else
+		timerSleep(microseconds);
+}
+
+void ktimeGetStats(ktime_stats_t* stats)
+{
+	*stats = ktime_stats;
+}
@@ -0,0 +1,61 @@
+#ifndef KTIME_H_
+#define KTIME_H_
+
+//The nanosecond clock and the time of day. When the CPU's time stamp counter is invariant it's the clock: ktimeInit
+//measures its rate against the HPET (PIT channel 2 without one) and works out a multiplier and shift for it, so
+//ktimeGet is an rdtsc, two multiplies and a shift. Without an invariant TSC (its rate would change with the CPU's)
+//the clock is a 64 bit HPET, read the same way only slower, and failing that timerNow, at microsecond resolution.
+//The time of day is read from the RTC once, in ktimeInit, and from then on advanced by ktimeGet; the CMOS isn't
+//touched again.
+//udelay and ndelay spin, for the short waits hardware asks for; timerSleep is the one to use for anything longer.
+
+#define KTIME_CALIBRATE_US 20000 //length of each TSC measurement against the HPET or PIT channel 2
+#define KTIME_CALIBRATE_RUNS 3 //measurements taken against the PIT; the shortest is kept, the others having been interrupted by something
+#define KTIME_RTC_MIN_YEAR 2023 //two digit RTC years below this one are taken to be in the next century
+
+//ktimeInit's pick
+#define KTIME_SOURCE_NONE 0
+#define KTIME_SOURCE_TIMER 1
+#define KTIME_SOURCE_TSC 2
+#define KTIME_SOURCE_HPET 3
+
+//what the TSC was measured against
+#define KTIME_REFERENCE_PIT 0
+#define KTIME_REFERENCE_HPET 1
+
+typedef struct ktime_date
+{
+	unsigned int year;
+	unsigned int month; //1-12
+	unsigned int day; //1-31
+	unsigned int hour;
+	unsigned int minute;
+	unsigned int second;
+	unsigned long nanosecond;
+}
+ktime_date_t;
+
+typedef struct ktime_stats
+{
+	unsigned int source;
+	unsigned int invariant_tsc;
+	unsigned long long tsc_frequency; //ticks per second, 0 without a TSC
+	unsigned int reference;
+	unsigned long long hpet_frequency; //0 without an HPET
+	unsigned long mult; //nanoseconds = ticks * mult >> shift, for the TSC or HPET
+	unsigned int shift;
+	unsigned long long boot_time; //seconds since 1970 when the RTC was read
+}
+ktime_stats_t;
+
+int ktimeInit(void);
+unsigned long long ktimeGet(void);
+int ktimeIndependent(void);
+unsigned long long ktimeGetRealtime(void);
+void ktimeGetDate(ktime_date_t* date);
+void ktimeToDate(unsigned long long realtime, ktime_date_t* date);
+void ndelay(unsigned long nanoseconds);
+void udelay(unsigned long microseconds);
+void ktimeGetStats(ktime_stats_t* stats);
+
+#endif
@@ -0,0 +1,74 @@
+#include "lapic.h"
+#include "idt.h"
+#include "vmm.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+volatile unsigned int* lapic_registers;
+
+//the APIC doesn't want an EOI for these
+static void lapicSpurious(interrupt_frame_t* frame)
+{
+	(void)frame;
+}
+
+//Maps and enables the local APIC; vmmInit has to have run
+//Returns: 0 on success, -1 if the CPU has none (or it couldn't be mapped)
+int lapicInit(void)
+{
+	unsigned long long base;
+
+	if (lapic_registers != NULL)
+		return 0;
+	if (!(cpuFeatures() & CPUID_EDX_APIC) || !(cpuFeatures() & CPUID_EDX_MSR))
+		return -1;
+
+	base = cpuReadMSR(LAPIC_BASE_MSR);
+	if (!(base & LAPIC_BASE_ENABLE))
+		cpuWriteMSR(LAPIC_BASE_MSR, base | LAPIC_BASE_ENABLE);
+
+	lapic_registers = vmmMapPhysical(base & LAPIC_BASE_MASK, 0x1000, "local APIC");
+	if (lapic_registers == NULL)
+		return -1;
+
+	idtSetHandler(IDT_VECTOR_SPURIOUS, lapicSpurious);
+	lapicWrite(LAPIC_SPURIOUS, LAPIC_SPURIOUS_ENABLE | IDT_VECTOR_SPURIOUS);
+	return 0;
+}
+
+//Enables the calling CPU's local APIC, for the processors smpInit starts; lapicInit has to have run on the BSP
+void lapicInitCpu(void)
+{
+	unsigned long long base = cpuReadMSR(LAPIC_BASE_MSR);
+
+	if (!(base & LAPIC_BASE_ENABLE))
+		cpuWriteMSR(LAPIC_BASE_MSR, base | LAPIC_BASE_ENABLE);
+	lapicWrite(LAPIC_SPURIOUS, LAPIC_SPURIOUS_ENABLE | IDT_VECTOR_SPURIOUS);
+}
+
+//Sends "command" (an LAPIC_ICR_* delivery mode with its vector) to the local APIC with ID "apic_id"
+void lapicSendIpi(unsigned int apic_id, unsigned int command)
+{
+	//both halves have to go in together, or an IPI sent from an interrupt in between would take our destination
+	unsigned long flags = cpuIrqSave();
+
+	while (lapicRead(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+		asm volatile("pause");
+	lapicWrite(LAPIC_ICR_HIGH, apic_id << 24);
+	lapicWrite(LAPIC_ICR_LOW, command);
+	while (lapicRead(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+		asm volatile("pause");
+	cpuIrqRestore(flags);
+}
+
+//Resets the processor with ID "apic_id" into waiting for a STARTUP
+void lapicSendInit(unsigned int apic_id)
+{
+	lapicSendIpi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+//Starts a processor waiting after INIT at physical address page * 4096, in real mode
+void lapicSendStartup(unsigned int apic_id, unsigned int page)
+{
+	lapicSendIpi(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | (page & 0xFF));
+}
@@ -0,0 +1,67 @@
+#ifndef LAPIC_H_
+#define LAPIC_H_
+
+//The local APIC of the CPU we're running on. lapicInit maps its registers (they sit above the direct map, usually
+//at 0xFEE00000) and software-enables it with IDT_VECTOR_SPURIOUS as the spurious vector. LINT0 and LINT1 are left
+//the way the BIOS set them up, which is virtual wire mode: the 8259s keep delivering through LINT0, so the PIC
+//driver works the same with the APIC on.
+//Every CPU's local APIC sits at the same physical address and answers only its own CPU, so the one mapping serves
+//them all; the other processors just enable theirs with lapicInitCpu. lapicSendIpi and friends go through the
+//interrupt command register, waiting for the previous IPI to have been accepted first.
+
+#define LAPIC_BASE_MSR 0x1B
+#define LAPIC_BASE_ENABLE 0x800
+#define LAPIC_BASE_MASK 0xFFFFF000
+
+//register offsets
+#define LAPIC_ID 0x020
+#define LAPIC_VERSION 0x030
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SPURIOUS 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310 //destination APIC ID in bits 24-31
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SPURIOUS_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+//interrupt command register, low half
+#define LAPIC_ICR_FIXED 0x000 //deliver the vector in bits 0-7
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600 //start at vector * 4096, in real mode
+#define LAPIC_ICR_PENDING 0x1000 //delivery status: not accepted yet
+#define LAPIC_ICR_ASSERT 0x4000
+
+extern volatile unsigned int* lapic_registers; //NULL until lapicInit finds one
+
+int lapicInit(void);
+void lapicInitCpu(void);
+void lapicSendIpi(unsigned int apic_id, unsigned int command);
+void lapicSendInit(unsigned int apic_id);
+void lapicSendStartup(unsigned int apic_id, unsigned int page);
+
+static inline unsigned int lapicRead(unsigned int reg)
+{
+	return lapic_registers[reg / 4];
+}
+
+static inline void lapicWrite(unsigned int reg, unsigned int value)
+{
+	lapic_registers[reg / 4] = value;
+}
+
+static inline void lapicEOI(void)
+{
+	lapicWrite(LAPIC_EOI, 0);
+}
+
+static inline unsigned int lapicId(void)
+{
+	return lapicRead(LAPIC_ID) >> 24;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include "meminfo.h"
+#include "pmm.h"
+#include "kheap.h"
+#include "vmm.h"
+#include "dma.h"
+#include "stack.h"
+#include "FAT.h"
+#include "ata.h"
+#include "lib_c.h"
+
+#include <string.h>
+
+extern char _kernel_start[];
+extern char _kernel_bss_start[];
+extern char _kernel_end[];
+
+void meminfoCollect(meminfo_t* info)
+{
+	pmm_stats_t frames;
+	kmem_cache_stats_t large;
+	vmm_stats_t vmm;
+	dma_stats_t dma;
+	kmem_cache_t* cache;
+	const kstack_t* stack;
+	unsigned long accounted;
+	unsigned int i, slot;
+
+	memset(info, 0, sizeof(meminfo_t));
+
+	pmmGetStats(&frames);
+	info->total = (unsigned long)frames.total_frames * PMM_FRAME_SIZE;
+	info->free = (unsigned long)frames.free_frames * PMM_FRAME_SIZE;
+	info->used = info->total - info->free;
+	info->boot_reserved = (unsigned long)frames.reserved_frames * PMM_FRAME_SIZE;
+	info->low_watermark = (unsigned long)frames.low_watermark * PMM_FRAME_SIZE;
+	info->high_watermark = (unsigned long)frames.high_watermark * PMM_FRAME_SIZE;
+	info->reclaims = frames.reclaims;
+	info->reclaimed = (unsigned long)frames.reclaimed_frames * PMM_FRAME_SIZE;
+
+	for (i = 0; (cache = kmemCacheGet(i)) != NULL; i++)
+	{
+		info->slab += (unsigned long)cache->stats.slabs * PMM_FRAME_SIZE;
+		info->slab_objects += (unsigned long)cache->stats.active * cache->object_size;
+	}
+	kmallocGetLargeStats(&large);
+	info->kmalloc_large = (unsigned long)large.slabs * PMM_FRAME_SIZE;
+
+	vmmGetStats(&vmm);
+	info->vmm_resident = (unsigned long)vmm.resident_pages * PMM_FRAME_SIZE;
+	info->vmm_page_tables = (unsigned long)vmm.page_tables * PMM_FRAME_SIZE;
+	info->vmm_reserved = (unsigned long)vmm.reserved_pages * PMM_FRAME_SIZE;
+
+	dmaGetStats(&dma);
+	info->dma = dma.bytes;
+
+	accounted = info->boot_reserved + info->slab + info->kmalloc_large + info->vmm_resident + info->vmm_page_tables + info->dma;
+	info->other = info->used > accounted ? info->used - accounted : 0;
+
+	info->image = _kernel_bss_start - _kernel_start;
+	info->bss = _kernel_end - _kernel_bss_start;
+
+	for (i = 0; i < FAT_MAX_VOLUMES; i++)
+	{
+		if (fat_volumes[i].mounted)
+		{
+			for (slot = 0; slot < FAT_CACHE_SECTORS; slot++)
+			{
+				if (fat_volumes[i].fat_cache[slot] != NULL)
+					info->fat_cache += ATA_SECTOR_SIZE;
+			}
+			info->fat_volumes++;
+		}
+	}
+
+	for (i = 0; (stack = stackGet(i)) != NULL; i++)
+	{
+		info->stacks += stack->top - stack->bottom;
+		info->stacks_peak += stackPeak(stack);
+		info->stack_count++;
+	}
+}
+
+//one "key value" line; "name" goes in the middle of the key when it's not NULL (key.name.field)
+static void meminfoSerialLine(const char* key, const char* name, const char* field, unsigned long value)
+{
+	putstring((char*)key);
+	if (name != NULL)
+	{
+		putcc('.');
+		putstring((char*)name);
+	}
+	if (field != NULL)
+	{
+		putcc('.');
+		putstring((char*)field);
+	}
+	putcc(' ');
+	printdec(value);
+	putcc('\n');
+}
+
+//Writes everything meminfoCollect gathers, plus the per-cache, per-shrinker, per-region and per-stack detail behind
+//it, to the serial port as "key value" lines between "meminfo.begin" and "meminfo.end". Sizes are in bytes. Cache,
+//region and stack names can have spaces in them, so the value is whatever follows the last space
+void meminfoDumpSerial(void)
+{
+	meminfo_t info;
+	kmem_cache_t* cache;
+	const kstack_t* stack;
+	const vmm_region_t* region;
+	const pmm_shrinker_t* shrinker;
+	unsigned int i;
+
+	meminfoCollect(&info);
+
+	putstring("meminfo.begin\n");
+	meminfoSerialLine("total", NULL, NULL, info.total);
+	meminfoSerialLine("free", NULL, NULL, info.free);
+	meminfoSerialLine("used", NULL, NULL, info.used);
+	meminfoSerialLine("used", NULL, "boot_reserved", info.boot_reserved);
+	meminfoSerialLine("used", NULL, "slab", info.slab);
+	meminfoSerialLine("used", NULL, "kmalloc_large", info.kmalloc_large);
+	meminfoSerialLine("used", NULL, "vmm_resident", info.vmm_resident);
+	meminfoSerialLine("used", NULL, "vmm_page_tables", info.vmm_page_tables);
+	meminfoSerialLine("used", NULL, "dma", info.dma);
+	meminfoSerialLine("used", NULL, "other", info.other);
+	meminfoSerialLine("image", NULL, NULL, info.image);
+	meminfoSerialLine("bss", NULL, NULL, info.bss);
+	meminfoSerialLine("vmm", NULL, "reserved", info.vmm_reserved);
+	meminfoSerialLine("cache", "fat", "bytes", info.fat_cache);
+	meminfoSerialLine("cache", "fat", "volumes", info.fat_volumes);
+	meminfoSerialLine("reclaim", NULL, "low_watermark", info.low_watermark);
+	meminfoSerialLine("reclaim", NULL, "high_watermark", info.high_watermark);
+	meminfoSerialLine("reclaim", NULL, "runs", info.reclaims);
+	meminfoSerialLine("reclaim", NULL, "bytes", info.reclaimed);
+
+	for (i = 0; (shrinker = pmmGetShrinker(i)) != NULL; i++)
+	{
+		meminfoSerialLine("shrinker", shrinker->name, "priority", shrinker->priority);
+		meminfoSerialLine("shrinker", shrinker->name, "runs", shrinker->runs);
+		meminfoSerialLine("shrinker", shrinker->name, "released", shrinker->released);
+	}
+
+	for (i = 0; (cache = kmemCacheGet(i)) != NULL; i++)
+	{
+		meminfoSerialLine("slab", cache->name, "object_size", cache->object_size);
+		meminfoSerialLine("slab", cache->name, "active", cache->stats.active);
+		meminfoSerialLine("slab", cache->name, "peak", cache->stats.peak_active);
+		meminfoSerialLine("slab", cache->name, "slabs", cache->stats.slabs);
+		meminfoSerialLine("slab", cache->name, "failures", cache->stats.failures);
+	}
+
+	for (i = 0; (region = vmmGetRegion(i)) != NULL; i++)
+	{
+		meminfoSerialLine("region", region->name, "size", region->end - region->start);
+		meminfoSerialLine("region", region->name, "resident", (unsigned long)vmmRegionResident(region) * PMM_FRAME_SIZE);
+	}
+
+	for (i = 0; (stack = stackGet(i)) != NULL; i++)
+	{
+		meminfoSerialLine("stack", stack->name, "size", stack->top - stack->bottom);
+		meminfoSerialLine("stack", stack->name, "peak", stackPeak(stack));
+	}
+	putstring("meminfo.end\n");
+}
@@ -0,0 +1,45 @@
+#ifndef MEMINFO_H_
+#define MEMINFO_H_
+
+//Where the memory went, gathered from each subsystem's own counters. Everything is in bytes.
+//"used" is every frame the frame allocator isn't holding; the named lines below it are the part of that each owner
+//can account for, and "other" is the remainder (page tables split by pagingSplitPage, frames taken straight from
+//pmmAllocFrames). vmm pages shared copy-on-write are counted once per mapping, so "other" can come out at 0 when
+//the named lines overcount.
+
+typedef struct meminfo
+{
+	unsigned long total; //usable RAM the frame allocator manages
+	unsigned long free;
+	unsigned long used;
+	unsigned long boot_reserved; //taken before pmmInit returned: kernel image, multiboot data, the frame table
+	unsigned long slab; //frames holding slab caches, empty slabs included
+	unsigned long slab_objects; //of which handed out as objects
+	unsigned long kmalloc_large; //frames behind kmallocs too big for a size class
+	unsigned long vmm_resident; //frames mapped into vmm regions (arenas, lazily backed stacks, ...)
+	unsigned long vmm_page_tables;
+	unsigned long dma; //DMA buffers, bounce pool and disk windows included
+	unsigned long other;
+
+	unsigned long image; //kernel text, rodata and data
+	unsigned long bss; //static arrays: boot stacks, the FAT volume table, ...
+	unsigned long vmm_reserved; //address space reserved in vmm regions, backed or not
+
+	unsigned long fat_cache; //FAT sector caches of mounted volumes (in the "fat_sector" slab cache)
+	unsigned int fat_volumes;
+
+	unsigned long low_watermark; //reclaim starts under this much free memory
+	unsigned long high_watermark;
+	unsigned int reclaims;
+	unsigned long reclaimed;
+
+	unsigned long stacks; //all registered kernel stacks
+	unsigned long stacks_peak; //the most each has used, added up
+	unsigned int stack_count;
+}
+meminfo_t;
+
+void meminfoCollect(meminfo_t* info);
+void meminfoDumpSerial(void);
+
+#endif
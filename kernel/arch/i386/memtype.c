@@ -0,0 +1,157 @@
+#include "memtype.h"
+#include "paging.h"
+#include "smp.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+#define MSR_MTRR_CAP 0x0FE
+#define MSR_PAT 0x277
+#define MSR_MTRR_FIX16K_A0000 0x259 //eight 16kB ranges, 0xA0000-0xBFFFF, one type per byte
+#define MSR_MTRR_DEF_TYPE 0x2FF
+
+#define MTRR_CAP_FIX 0x100 //fixed range MTRRs exist
+#define MTRR_CAP_WC 0x400 //write-combining is a valid type
+#define MTRR_DEF_FE 0x400 //fixed ranges enabled
+#define MTRR_DEF_E 0x800 //MTRRs enabled
+
+#define CR0_CD 0x40000000
+#define CR0_NW 0x20000000
+
+#define MEMTYPE_PAGE_SIZE 0x1000
+
+//PA0-PA7: the power-on values, except PA1 and PA5 (PWT without PCD) are write-combining instead of write-through.
+//PCD alone and PCD|PWT still pick UC- and UC, so entries that already used them mean the same thing
+#define MEMTYPE_PAT_VALUE ( \
+	((unsigned long long)MEMTYPE_WB << 0) | ((unsigned long long)MEMTYPE_WC << 8) | \
+	((unsigned long long)MEMTYPE_UC_MINUS << 16) | ((unsigned long long)MEMTYPE_UC << 24) | \
+	((unsigned long long)MEMTYPE_WB << 32) | ((unsigned long long)MEMTYPE_WC << 40) | \
+	((unsigned long long)MEMTYPE_UC_MINUS << 48) | ((unsigned long long)MEMTYPE_UC << 56))
+
+static int memtype_via;
+static unsigned long long memtype_fix16k; //what memtypeSetWriteCombining last wrote there, 0 if nothing
+
+static void memtypeFlushTLB(void)
+{
+	unsigned long cr3;
+	asm volatile("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+//The MTRR update sequence from the SDM: caches off and flushed around the change, so no line is cached under
+//the old type, with interrupts off throughout
+static void memtypeWriteMTRR(unsigned int msr, unsigned long long value)
+{
+	unsigned long cr0, cr4, flags;
+	unsigned long long def_type;
+
+	flags = cpuIrqSave();
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	asm volatile("mov %0, %%cr0" : : "r"((cr0 | CR0_CD) & ~CR0_NW) : "memory");
+	asm volatile("wbinvd" : : : "memory");
+
+	//with global pages on, a CR3 load wouldn't flush everything
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	asm volatile("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+	memtypeFlushTLB();
+
+	def_type = cpuReadMSR(MSR_MTRR_DEF_TYPE);
+	cpuWriteMSR(MSR_MTRR_DEF_TYPE, def_type & ~(unsigned long long)MTRR_DEF_E);
+	cpuWriteMSR(msr, value);
+	cpuWriteMSR(MSR_MTRR_DEF_TYPE, def_type | MTRR_DEF_E | MTRR_DEF_FE);
+
+	asm volatile("wbinvd" : : : "memory");
+	memtypeFlushTLB();
+	asm volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+	asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+	cpuIrqRestore(flags);
+}
+
+//Picks PAT if the CPU has it, otherwise fixed range MTRRs if they can do write-combining.
+//Runs before anything maps pages with PWT set, so there's nothing cached under the old PAT entry 1 to flush
+//Returns: MEMTYPE_VIA_PAT, MEMTYPE_VIA_MTRR, or MEMTYPE_VIA_NONE if write-combining isn't available
+int memtypeInit(void)
+{
+	unsigned int features = cpuFeatures();
+
+	memtype_via = MEMTYPE_VIA_NONE;
+
+	if (features & CPUID_EDX_PAT)
+	{
+		asm volatile("wbinvd" : : : "memory");
+		cpuWriteMSR(MSR_PAT, MEMTYPE_PAT_VALUE);
+		memtypeFlushTLB();
+		memtype_via = MEMTYPE_VIA_PAT;
+	}
+	else if (features & CPUID_EDX_MTRR)
+	{
+		unsigned long long cap = cpuReadMSR(MSR_MTRR_CAP);
+		if ((cap & MTRR_CAP_FIX) && (cap & MTRR_CAP_WC))
+			memtype_via = MEMTYPE_VIA_MTRR;
+	}
+
+	return memtype_via;
+}
+
+//Makes [address, address + size) of the direct map write-combining
+//Returns: 0 on success, -1 if write-combining isn't available for that range
+int memtypeSetWriteCombining(void* address, unsigned long size)
+{
+	unsigned long start = (unsigned long)address & ~(unsigned long)(MEMTYPE_PAGE_SIZE - 1);
+	unsigned long end = (unsigned long)address + size;
+	unsigned long page;
+
+	if (memtype_via == MEMTYPE_VIA_PAT)
+	{
+		for (page = start; page < end; page += MEMTYPE_PAGE_SIZE)
+		{
+			unsigned int* entry = pagingSplitPage(page);
+			if (entry == NULL)
+				return -1;
+			*entry = (*entry & ~(PAGE_WRITE_THROUGH | PAGE_CACHE_DISABLE)) | PAGE_WRITE_COMBINING;
+			asm volatile("invlpg (%0)" : : "r"(page) : "memory");
+		}
+		smpFlushTlb(start, end);
+		//lines cached under the old type mustn't be written back over newer combined writes
+		asm volatile("wbinvd" : : : "memory");
+		return 0;
+	}
+
+	if (memtype_via == MEMTYPE_VIA_MTRR)
+	{
+		unsigned long physical_start = VIRT_TO_PHYS(start);
+		unsigned long physical_end = VIRT_TO_PHYS(end);
+		unsigned long long types;
+		unsigned int i;
+
+		if (physical_start < MEMTYPE_VGA_START || physical_end > MEMTYPE_VGA_END)
+			return -1;
+
+		types = cpuReadMSR(MSR_MTRR_FIX16K_A0000);
+		for (i = 0; i < 8; i++)
+		{
+			unsigned long range = MEMTYPE_VGA_START + i * 0x4000;
+			if (range < physical_end && range + 0x4000 > physical_start)
+				types = (types & ~(0xFFull << (i * 8))) | ((unsigned long long)MEMTYPE_WC << (i * 8));
+		}
+		memtypeWriteMTRR(MSR_MTRR_FIX16K_A0000, types);
+		memtype_fix16k = types;
+		return 0;
+	}
+
+	return -1;
+}
+
+//Sets the calling processor up the way memtypeInit and memtypeSetWriteCombining set the BSP, for the others as
+//they start
+void memtypeInitCpu(void)
+{
+	if (memtype_via == MEMTYPE_VIA_PAT)
+	{
+		asm volatile("wbinvd" : : : "memory");
+		cpuWriteMSR(MSR_PAT, MEMTYPE_PAT_VALUE);
+		memtypeFlushTLB();
+	}
+	else if (memtype_via == MEMTYPE_VIA_MTRR && memtype_fix16k != 0)
+	{
+		memtypeWriteMTRR(MSR_MTRR_FIX16K_A0000, memtype_fix16k);
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef MEMTYPE_H_
+#define MEMTYPE_H_
+
+//Memory types for video memory. Plain stores to the VGA windows are uncached, so every byte or word written is its
+//own bus transaction; write-combining lets the CPU gather them into full line bursts.
+//With PAT, memtypeInit reprograms PAT entry 1 (selected by PWT alone) from write-through to write-combining, and
+//pages opt in through PAGE_WRITE_COMBINING. Without PAT, the fixed range MTRRs that cover the legacy VGA window
+//(0xA0000-0xBFFFF) are set to write-combining instead, which only works for that window.
+//Every processor has to agree on the types, so memtypeInitCpu gives the others the same PAT, or MTRR, as the BSP.
+
+#define MEMTYPE_UC 0x00
+#define MEMTYPE_WC 0x01
+#define MEMTYPE_WT 0x04
+#define MEMTYPE_WP 0x05
+#define MEMTYPE_WB 0x06
+#define MEMTYPE_UC_MINUS 0x07
+
+#define MEMTYPE_VGA_START 0xA0000 //legacy VGA window, physical
+#define MEMTYPE_VGA_END 0xC0000
+
+//how write-combining is done, from memtypeInit
+#define MEMTYPE_VIA_NONE 0
+#define MEMTYPE_VIA_PAT 1
+#define MEMTYPE_VIA_MTRR 2
+
+int memtypeInit(void);
+int memtypeSetWriteCombining(void* address, unsigned long size);
+void memtypeInitCpu(void);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef MULTIBOOT_H_
+#define MULTIBOOT_H_
+
+//Multiboot (version 1) information handed over by the bootloader in %ebx. boot.S passes it to kernel_main.
+//Only the parts the kernel reads are spelled out.
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002 //in %eax when a multiboot loader started the kernel
+
+#define MULTIBOOT_INFO_MEMORY 0x00000001 //mem_lower and mem_upper are valid
+#define MULTIBOOT_INFO_BOOTDEV 0x00000002
+#define MULTIBOOT_INFO_CMDLINE 0x00000004
+#define MULTIBOOT_INFO_MODS 0x00000008
+#define MULTIBOOT_INFO_MEM_MAP 0x00000040 //mmap_length and mmap_addr are valid
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED 2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS 4
+#define MULTIBOOT_MEMORY_BADRAM 5
+
+typedef struct multiboot_info
+{
+	unsigned int flags;
+	unsigned int mem_lower; //kB below 1MB
+	unsigned int mem_upper; //kB from 1MB up to the first hole
+	unsigned int boot_device;
+	unsigned int cmdline;
+	unsigned int mods_count;
+	unsigned int mods_addr;
+	unsigned int syms[4];
+	unsigned int mmap_length; //bytes, not entries
+	unsigned int mmap_addr;
+	unsigned int drives_length;
+	unsigned int drives_addr;
+	unsigned int config_table;
+	unsigned int boot_loader_name;
+	unsigned int apm_table;
+}
+__attribute__((packed))
+multiboot_info_t;
+
+//"size" doesn't count itself, so the next entry is at (char*)entry + entry->size + 4
+typedef struct multiboot_mmap_entry
+{
+	unsigned int size;
+	unsigned long long addr;
+	unsigned long long len;
+	unsigned int type;
+}
+__attribute__((packed))
+multiboot_mmap_entry_t;
+
+#endif
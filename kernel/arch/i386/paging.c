@@ -0,0 +1,93 @@
+#include "paging.h"
+#include "pmm.h"
+#include "smp.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+static unsigned long paging_direct_top = PAGING_BOOT_MAP_SIZE;
+
+//Extends the direct map from boot.S's 16MB to cover physical memory up to "memory_top" (capped at
+//PAGING_DIRECT_MAP_SIZE), and turns on global pages when the CPU has them
+void pagingInit(unsigned long memory_top)
+{
+	unsigned int global = 0;
+	unsigned int pde;
+	unsigned long cr4;
+
+	if (cpuFeatures() & CPUID_EDX_PGE)
+	{
+		global = PAGE_GLOBAL;
+		asm volatile("mov %%cr4, %0" : "=r"(cr4));
+		asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PGE));
+	}
+
+	if (memory_top < PAGING_BOOT_MAP_SIZE)
+		memory_top = PAGING_BOOT_MAP_SIZE;
+	if (memory_top > PAGING_DIRECT_MAP_SIZE)
+		memory_top = PAGING_DIRECT_MAP_SIZE;
+
+	//one 4MB page per directory entry, no page tables needed
+	for (pde = 0; pde < (memory_top + PAGING_LARGE_PAGE_SIZE - 1) / PAGING_LARGE_PAGE_SIZE; pde++)
+		boot_page_directory[KERNEL_PDE_INDEX + pde] = (pde * PAGING_LARGE_PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE | global;
+
+	paging_direct_top = pde * PAGING_LARGE_PAGE_SIZE;
+
+	//reloading CR3 drops the boot entries' non-global TLB copies
+	asm volatile("mov %0, %%cr3" : : "r"(VIRT_TO_PHYS(boot_page_directory)) : "memory");
+}
+
+//Gets the page table entry for "address" in the direct map, so a single page can be changed. The 4MB page it's
+//in is split into a page table mapping the same frames the first time
+//Returns: the entry, or NULL if "address" isn't mapped or no frame was free for the page table
+unsigned int* pagingSplitPage(unsigned long address)
+{
+	unsigned int* pde = &boot_page_directory[address >> 22];
+	unsigned int i;
+
+	if (!(*pde & PAGE_PRESENT))
+		return NULL;
+
+	if (*pde & PAGE_LARGE)
+	{
+		unsigned long table = pmmAllocFrame();
+		if (table == 0)
+			return NULL;
+
+		unsigned int* entries = PHYS_TO_VIRT(table);
+		unsigned long base = *pde & ~(unsigned long)(PAGING_LARGE_PAGE_SIZE - 1);
+		unsigned int flags = *pde & (PAGE_PRESENT | PAGE_WRITE | PAGE_WRITE_THROUGH | PAGE_CACHE_DISABLE | PAGE_GLOBAL);
+		for (i = 0; i < 1024; i++)
+			entries[i] = (base + i * 0x1000) | flags;
+
+		*pde = table | PAGE_PRESENT | PAGE_WRITE;
+		//one invlpg anywhere in the old large page drops its TLB entry, global or not
+		asm volatile("invlpg (%0)" : : "r"(address & ~(unsigned long)(PAGING_LARGE_PAGE_SIZE - 1)) : "memory");
+	}
+
+	return (unsigned int*)PHYS_TO_VIRT(*pde & ~0xFFFu) + ((address >> 12) & 0x3FF);
+}
+
+//Unmaps the single page at "address" in the direct map, for guard pages, on every CPU
+//Returns: 0 on success, -1 if no frame was free for the page table
+int pagingUnmapPage(unsigned long address)
+{
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	unsigned int* entry = pagingSplitPage(address);
+	if (entry == NULL)
+	{
+		rspinUnlockIrqRestore(&mm_lock, flags);
+		return -1;
+	}
+
+	*entry = 0;
+	asm volatile("invlpg (%0)" : : "r"(address) : "memory");
+	smpFlushTlb(address, address + PMM_FRAME_SIZE);
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return 0;
+}
+
+//Returns: the physical address the direct map ends at; anything below it can be reached through PHYS_TO_VIRT
+unsigned long pagingDirectMapTop(void)
+{
+	return paging_direct_top;
+}
@@ -0,0 +1,48 @@
+#ifndef PAGING_H_
+#define PAGING_H_
+
+//The kernel is linked at KERNEL_VIRTUAL_BASE + 1MB and runs in the top quarter of the address space.
+//Physical memory from 0 up is mapped at KERNEL_VIRTUAL_BASE (the direct map) with 4MB pages, marked global so the
+//kernel's TLB entries survive CR3 reloads. boot.S maps the first PAGING_BOOT_MAP_SIZE; pagingInit extends that
+//to all the RAM the frame allocator manages. Everything below KERNEL_VIRTUAL_BASE is left for user space.
+//This header is also included by boot.S, so only #defines outside the __ASSEMBLER__ block.
+
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+#define KERNEL_PDE_INDEX (KERNEL_VIRTUAL_BASE >> 22) //first page directory entry of kernel space
+
+#define PAGING_LARGE_PAGE_SIZE 0x400000
+#define PAGING_BOOT_MAP_SIZE 0x1000000 //16MB: the kernel image, low memory and the frame table fit in this
+#define PAGING_DIRECT_MAP_SIZE 0x30000000 //768MB; RAM above this isn't mapped and isn't handed out
+
+//page directory / table entry flags
+#define PAGE_PRESENT 0x001
+#define PAGE_WRITE 0x002
+#define PAGE_USER 0x004
+#define PAGE_WRITE_THROUGH 0x008
+#define PAGE_CACHE_DISABLE 0x010
+#define PAGE_ACCESSED 0x020
+#define PAGE_DIRTY 0x040
+#define PAGE_LARGE 0x080 //PDE maps a 4MB page (needs CR4.PSE)
+#define PAGE_GLOBAL 0x100 //not flushed on CR3 loads (needs CR4.PGE)
+#define PAGE_WRITE_COMBINING PAGE_WRITE_THROUGH //selects PAT entry 1, which memtypeInit makes write-combining
+
+#define CR0_PG 0x80000000
+#define CR0_WP 0x00010000 //ring 0 honours read-only pages too
+#define CR4_PSE 0x00000010
+#define CR4_PGE 0x00000080
+
+#ifndef __ASSEMBLER__
+
+#define PHYS_TO_VIRT(address) ((void*)((unsigned long)(address) + KERNEL_VIRTUAL_BASE))
+#define VIRT_TO_PHYS(address) ((unsigned long)(address) - KERNEL_VIRTUAL_BASE)
+
+extern unsigned int boot_page_directory[1024];
+
+void pagingInit(unsigned long memory_top);
+unsigned int* pagingSplitPage(unsigned long address);
+int pagingUnmapPage(unsigned long address);
+unsigned long pagingDirectMapTop(void);
+
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+#include "partition.h"
+#include "ata.h"
+#include "FAT.h"
+
+#include <string.h>
+
+static unsigned char partition_sector[ATA_SECTOR_SIZE]; //scratch sector, kept apart from DISK_READ_LOCATION so mounted volumes aren't disturbed
+
+//GPT type GUIDs, in their on-disk (mixed endian) byte order
+static const unsigned char gpt_basic_data_guid[16] = { 0xA2, 0xA0, 0xD0, 0xEB, 0xE5, 0xB9, 0x33, 0x44, 0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7 }; //EBD0A0A2-B9E5-4433-87C0-68B6B72699C7
+static const unsigned char gpt_efi_system_guid[16] = { 0x28, 0x73, 0x2A, 0xC1, 0x1F, 0xF8, 0xD2, 0x11, 0xBA, 0x4B, 0x00, 0xA0, 0xC9, 0x3E, 0xC9, 0x3B }; //C12A7328-F81F-11D2-BA4B-00A0C93EC93B
+
+static BOOL partitionHasSignature(const unsigned char* sector)
+{
+	return sector[510] == 0x55 && sector[511] == 0xAA;
+}
+
+//an unpartitioned disk (e.g. an mformat image) starts with a FAT boot sector instead of an MBR
+static BOOL partitionIsBootSector(const unsigned char* sector)
+{
+	const fat_BS_t* bs = (const fat_BS_t*)sector;
+
+	if (bs->bootjmp[0] != 0xEB && bs->bootjmp[0] != 0xE9)
+		return FALSE;
+	if (bs->bytes_per_sector != ATA_SECTOR_SIZE)
+		return FALSE;
+	if (bs->sectors_per_cluster == 0 || (bs->sectors_per_cluster & (bs->sectors_per_cluster - 1)) != 0)
+		return FALSE;
+	if (bs->reserved_sector_count == 0 || bs->table_count == 0 || bs->table_count > 2)
+		return FALSE;
+	if (bs->total_sectors_16 == 0 && bs->total_sectors_32 == 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL partitionIsExtended(unsigned char type)
+{
+	return type == PARTITION_TYPE_EXTENDED || type == PARTITION_TYPE_EXTENDED_LBA || type == PARTITION_TYPE_EXTENDED_LINUX;
+}
+
+static int partitionAdd(partition_t* found, int count, int max_found, unsigned char drive, unsigned char type, unsigned long start_lba, unsigned long length)
+{
+	if (count >= max_found || length == 0 || start_lba > ATA_MAX_LBA28)
+		return count;
+
+	found[count].drive = drive;
+	found[count].index = count + 1;
+	found[count].type = type;
+	found[count].start_lba = start_lba;
+	found[count].length = length;
+	return count + 1;
+}
+
+//follows the chain of extended boot records that hold the logical partitions
+static int partitionScanExtended(unsigned char drive, unsigned long extended_start, partition_t* found, int count, int max_found)
+{
+	unsigned long ebr_lba = extended_start;
+	int links = 0;
+
+	while (links < PARTITION_MAX_LOGICAL)
+	{
+		if (ataReadSectors(drive, ebr_lba, 1, partition_sector) != 0 || !partitionHasSignature(partition_sector))
+			break;
+
+		mbr_entry_t* entries = (mbr_entry_t*)(partition_sector + 446);
+
+		//first entry is the logical partition (relative to this EBR), second links to the next EBR (relative to the extended partition)
+		if (entries[0].type != PARTITION_TYPE_EMPTY)
+			count = partitionAdd(found, count, max_found, drive, entries[0].type, ebr_lba + entries[0].lba_first, entries[0].sector_count);
+
+		if (!partitionIsExtended(entries[1].type) || entries[1].lba_first == 0)
+			break;
+
+		ebr_lba = extended_start + entries[1].lba_first;
+		links++;
+	}
+
+	return count;
+}
+
+static int partitionScanGPT(unsigned char drive, partition_t* found, int count, int max_found)
+{
+	if (ataReadSectors(drive, 1, 1, partition_sector) != 0)
+		return -1;
+
+	gpt_header_t* header = (gpt_header_t*)partition_sector;
+	if (memcmp(header->signature, "EFI PART", 8) != 0)
+	{
+		d_printss("Function partitionScanGPT: protective MBR without a GPT header!\n");
+		return -1;
+	}
+
+	if (header->entry_size < sizeof(gpt_entry_t) || ATA_SECTOR_SIZE % header->entry_size != 0 || header->entries_lba > ATA_MAX_LBA28)
+	{
+		d_printss("Function partitionScanGPT: unsupported partition entry layout!\n");
+		return -1;
+	}
+
+	unsigned int entry_size = header->entry_size;
+	unsigned int entry_count = header->entry_count;
+	unsigned long entries_lba = (unsigned long)header->entries_lba;
+	unsigned int entries_per_sector = ATA_SECTOR_SIZE / entry_size;
+	unsigned int entry;
+
+	for (entry = 0; entry < entry_count && count < max_found; entry++)
+	{
+		if (entry % entries_per_sector == 0 && ataReadSectors(drive, entries_lba + entry / entries_per_sector, 1, partition_sector) != 0)
+			return -1;
+
+		gpt_entry_t* part = (gpt_entry_t*)(partition_sector + (entry % entries_per_sector) * entry_size);
+
+		if (memcmp(part->type_guid, gpt_basic_data_guid, 16) != 0 && memcmp(part->type_guid, gpt_efi_system_guid, 16) != 0)
+			continue;
+		if (part->last_lba < part->first_lba || part->last_lba > ATA_MAX_LBA28) //out of LBA28's reach
+			continue;
+
+		count = partitionAdd(found, count, max_found, drive, PARTITION_TYPE_GPT_DATA, (unsigned long)part->first_lba, (unsigned long)(part->last_lba - part->first_lba + 1));
+	}
+
+	return count;
+}
+
+//Finds the partitions on an ATA drive and stores up to "max_found" of them in "found"
+//Returns: the number of partitions found, or -1 if the drive couldn't be read or has no recognizable layout
+int partitionScan(unsigned char drive, partition_t* found, int max_found)
+{
+	if (ataReadSectors(drive, 0, 1, partition_sector) != 0)
+		return -1;
+
+	if (!partitionHasSignature(partition_sector))
+		return -1;
+
+	if (partitionIsBootSector(partition_sector))
+	{
+		const fat_BS_t* bs = (const fat_BS_t*)partition_sector;
+		unsigned long length = bs->total_sectors_16 != 0 ? bs->total_sectors_16 : bs->total_sectors_32;
+
+		if (max_found < 1)
+			return 0;
+
+		found[0].drive = drive;
+		found[0].index = 0;
+		found[0].type = PARTITION_TYPE_SUPERFLOPPY;
+		found[0].start_lba = 0;
+		found[0].length = length;
+		return 1;
+	}
+
+	mbr_entry_t entries[4];
+	memcpy(entries, partition_sector + 446, sizeof(entries));
+
+	unsigned int entry;
+	for (entry = 0; entry < 4; entry++)
+	{
+		if (entries[entry].status != 0x00 && entries[entry].status != 0x80) //boot code, not a partition table
+			return -1;
+	}
+
+	int count = 0;
+	for (entry = 0; entry < 4; entry++)
+	{
+		unsigned char type = entries[entry].type;
+
+		if (type == PARTITION_TYPE_EMPTY)
+			continue;
+		else if (type == PARTITION_TYPE_GPT_PROTECTIVE)
+			return partitionScanGPT(drive, found, 0, max_found);
+		else if (partitionIsExtended(type))
+			count = partitionScanExtended(drive, entries[entry].lba_first, found, count, max_found);
+		else
+			count = partitionAdd(found, count, max_found, drive, type, entries[entry].lba_first, entries[entry].sector_count);
+	}
+
+	return count;
+}
+
+//TRUE for the partition types a FAT volume is expected on
+int partitionIsFAT(const partition_t* part)
+{
+	switch (part->type)
+	{
+	case PARTITION_TYPE_FAT12:
+	case PARTITION_TYPE_FAT16_SMALL:
+	case PARTITION_TYPE_FAT16:
+	case PARTITION_TYPE_FAT32:
+	case PARTITION_TYPE_FAT32_LBA:
+	case PARTITION_TYPE_FAT16_LBA:
+	case PARTITION_TYPE_GPT_DATA:
+	case PARTITION_TYPE_SUPERFLOPPY:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
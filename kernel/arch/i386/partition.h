@@ -0,0 +1,84 @@
+#ifndef PARTITION_H_
+#define PARTITION_H_
+
+//Partition discovery: MBR (including logical partitions in an extended partition), GPT behind a protective MBR,
+//and unpartitioned "superfloppy" disks where sector 0 is already a FAT boot sector.
+
+#define PARTITION_MAX_PER_DRIVE 16
+#define PARTITION_MAX_LOGICAL 32 //EBR links followed before the chain is treated as a loop
+
+//MBR partition types
+#define PARTITION_TYPE_EMPTY 0x00
+#define PARTITION_TYPE_FAT12 0x01
+#define PARTITION_TYPE_FAT16_SMALL 0x04
+#define PARTITION_TYPE_EXTENDED 0x05
+#define PARTITION_TYPE_FAT16 0x06
+#define PARTITION_TYPE_FAT32 0x0B
+#define PARTITION_TYPE_FAT32_LBA 0x0C
+#define PARTITION_TYPE_FAT16_LBA 0x0E
+#define PARTITION_TYPE_EXTENDED_LBA 0x0F
+#define PARTITION_TYPE_EXTENDED_LINUX 0x85
+#define PARTITION_TYPE_GPT_PROTECTIVE 0xEE
+
+//not real MBR types; used for entries that didn't come from an MBR
+#define PARTITION_TYPE_GPT_DATA 0xF0 //GPT basic data or EFI system partition
+#define PARTITION_TYPE_SUPERFLOPPY 0xF1 //whole disk, no partition table
+
+typedef struct mbr_entry
+{
+	unsigned char status; //0x80 = bootable, 0x00 = not
+	unsigned char chs_first[3];
+	unsigned char type;
+	unsigned char chs_last[3];
+	unsigned int lba_first;
+	unsigned int sector_count;
+}
+__attribute__((packed))
+mbr_entry_t;
+
+typedef struct gpt_header
+{
+	unsigned char signature[8]; //"EFI PART"
+	unsigned int revision;
+	unsigned int header_size;
+	unsigned int header_crc32;
+	unsigned int reserved;
+	unsigned long long current_lba;
+	unsigned long long backup_lba;
+	unsigned long long first_usable_lba;
+	unsigned long long last_usable_lba;
+	unsigned char disk_guid[16];
+	unsigned long long entries_lba;
+	unsigned int entry_count;
+	unsigned int entry_size;
+	unsigned int entries_crc32;
+}
+__attribute__((packed))
+gpt_header_t;
+
+typedef struct gpt_entry
+{
+	unsigned char type_guid[16];
+	unsigned char unique_guid[16];
+	unsigned long long first_lba;
+	unsigned long long last_lba; //inclusive
+	unsigned long long attributes;
+	unsigned short name[36]; //UTF-16LE
+}
+__attribute__((packed))
+gpt_entry_t;
+
+typedef struct partition
+{
+	unsigned char drive; //ATA drive number
+	unsigned char index; //partition number on the drive, starting from 1 (0 for a superfloppy)
+	unsigned char type; //MBR type byte, or one of the PARTITION_TYPE_GPT_DATA / PARTITION_TYPE_SUPERFLOPPY values
+	unsigned long start_lba; //absolute sector on the drive
+	unsigned long length; //in sectors
+}
+partition_t;
+
+int partitionScan(unsigned char drive, partition_t* found, int max_found);
+int partitionIsFAT(const partition_t* part);
+
+#endif
@@ -0,0 +1,108 @@
+#include "pic.h"
+#include "lib_asm.h"
+#include "lib_c.h"
+
+static idt_handler_t pic_handlers[PIC_IRQS];
+static unsigned int pic_mask = 0xFFFF; //bit n masks IRQ n; the slave's lines are the high byte
+static pic_stats_t pic_stats;
+
+static void picWriteMask(void)
+{
+	outb(PIC_MASTER_DATA, pic_mask & 0xFF);
+	outb(PIC_SLAVE_DATA, pic_mask >> 8);
+}
+
+//Returns: the in-service register of the PIC at "command"
+static unsigned char picReadISR(unsigned short command)
+{
+	outb(command, PIC_OCW3_READ_ISR);
+	return inb(command);
+}
+
+//installed on all sixteen IRQ vectors
+static void picDispatch(interrupt_frame_t* frame)
+{
+	unsigned int irq = frame->vector - IDT_VECTOR_IRQ_BASE;
+
+	if (irq == 7 && !(picReadISR(PIC_MASTER_COMMAND) & 0x80))
+	{
+		pic_stats.spurious_master++;
+		return;
+	}
+	if (irq == 15 && !(picReadISR(PIC_SLAVE_COMMAND) & 0x80))
+	{
+		//the master did see its cascade line raised, so it still wants an EOI
+		pic_stats.spurious_slave++;
+		outb(PIC_MASTER_COMMAND, PIC_EOI);
+		return;
+	}
+
+	if (pic_handlers[irq] != NULL)
+		pic_handlers[irq](frame);
+	else
+		pic_stats.unclaimed++;
+
+	if (irq >= 8)
+		outb(PIC_SLAVE_COMMAND, PIC_EOI);
+	outb(PIC_MASTER_COMMAND, PIC_EOI);
+}
+
+//Remaps both PICs to IDT_VECTOR_IRQ_BASE and masks every line but the cascade; idtInit has to have run
+void picInit(void)
+{
+	unsigned int irq;
+
+	outb(PIC_MASTER_DATA, 0xFF);
+	outb(PIC_SLAVE_DATA, 0xFF);
+
+	outb(PIC_MASTER_COMMAND, PIC_ICW1_INIT);
+	outb(PIC_SLAVE_COMMAND, PIC_ICW1_INIT);
+	outb(PIC_MASTER_DATA, IDT_VECTOR_IRQ_BASE);
+	outb(PIC_SLAVE_DATA, IDT_VECTOR_IRQ_BASE + 8);
+	outb(PIC_MASTER_DATA, 1 << PIC_IRQ_CASCADE); //where the slave hangs off the master
+	outb(PIC_SLAVE_DATA, PIC_IRQ_CASCADE); //and which line that is, as a number
+	outb(PIC_MASTER_DATA, PIC_ICW4_8086);
+	outb(PIC_SLAVE_DATA, PIC_ICW4_8086);
+
+	for (irq = 0; irq < PIC_IRQS; irq++)
+		idtSetHandler(IDT_VECTOR_IRQ_BASE + irq, picDispatch);
+
+	pic_mask = 0xFFFF & ~(1u << PIC_IRQ_CASCADE);
+	picWriteMask();
+}
+
+//Makes "handler" the one for "irq" and unmasks the line, or masks it again if "handler" is NULL
+void picSetHandler(unsigned int irq, idt_handler_t handler)
+{
+	if (irq >= PIC_IRQS)
+		return;
+
+	pic_handlers[irq] = handler;
+	if (handler != NULL)
+		picUnmask(irq);
+	else
+		picMask(irq);
+}
+
+void picMask(unsigned int irq)
+{
+	if (irq < PIC_IRQS && irq != PIC_IRQ_CASCADE)
+	{
+		pic_mask |= 1u << irq;
+		picWriteMask();
+	}
+}
+
+void picUnmask(unsigned int irq)
+{
+	if (irq < PIC_IRQS)
+	{
+		pic_mask &= ~(1u << irq);
+		picWriteMask();
+	}
+}
+
+void picGetStats(pic_stats_t* stats)
+{
+	*stats = pic_stats;
+}
@@ -0,0 +1,39 @@
+#ifndef PIC_H_
+#define PIC_H_
+
+#include "idt.h"
+
+//The two 8259 interrupt controllers. picInit moves IRQ 0-15 off the CPU exception vectors, where the BIOS leaves
+//them, to IDT_VECTOR_IRQ_BASE onwards and masks every line. picSetHandler claims a line and unmasks it; the
+//handler runs with interrupts off and the end of interrupt is sent after it returns.
+//Spurious IRQ 7 and 15 (a line that dropped before the CPU acknowledged it) are recognised from the in-service
+//register and dropped without a handler call or an EOI to the PIC that didn't raise them.
+
+#define PIC_MASTER_COMMAND 0x20
+#define PIC_MASTER_DATA 0x21
+#define PIC_SLAVE_COMMAND 0xA0
+#define PIC_SLAVE_DATA 0xA1
+
+#define PIC_IRQS 16
+#define PIC_IRQ_CASCADE 2 //the slave is wired to this line of the master
+
+#define PIC_ICW1_INIT 0x11 //initialise, ICW4 follows
+#define PIC_ICW4_8086 0x01
+#define PIC_OCW3_READ_ISR 0x0B
+#define PIC_EOI 0x20
+
+typedef struct pic_stats
+{
+	unsigned int spurious_master; //IRQ 7s nobody raised
+	unsigned int spurious_slave; //IRQ 15s nobody raised
+	unsigned int unclaimed; //IRQs that arrived on a line with no handler
+}
+pic_stats_t;
+
+void picInit(void);
+void picSetHandler(unsigned int irq, idt_handler_t handler);
+void picMask(unsigned int irq);
+void picUnmask(unsigned int irq);
+void picGetStats(pic_stats_t* stats);
+
+#endif
@@ -0,0 +1,562 @@
+#include "pmm.h"
+#include "paging.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PMM_MAX_RESERVED 8
+#define PMM_MAX_FRAMES (PAGING_DIRECT_MAP_SIZE >> PMM_FRAME_SHIFT) //frames must be reachable through the direct map
+
+typedef struct pmm_range
+{
+	unsigned int start; //frame numbers, end exclusive
+	unsigned int end;
+}
+pmm_range_t;
+
+extern char _kernel_start[];
+extern char _kernel_end[];
+
+rspinlock_t mm_lock;
+
+static pmm_frame_t* pmm_frames; //one entry per frame below the top of RAM
+static unsigned int pmm_frame_count;
+static unsigned int pmm_free_head[PMM_MAX_ORDER + 1];
+static pmm_stats_t pmm_stats;
+
+static pmm_range_t pmm_reserved[PMM_MAX_RESERVED];
+static unsigned int pmm_reserved_count;
+
+static pmm_shrinker_t* pmm_shrinkers[PMM_MAX_SHRINKERS]; //sorted by priority
+static unsigned int pmm_shrinker_count;
+static int pmm_reclaiming; //a shrinker that allocates anyway mustn't start another round
+
+static unsigned int pmmFrameDown(unsigned long long address)
+{
+	return (unsigned int)(address >> PMM_FRAME_SHIFT);
+}
+
+static unsigned int pmmFrameUp(unsigned long long address)
+{
+	return (unsigned int)((address + PMM_FRAME_SIZE - 1) >> PMM_FRAME_SHIFT);
+}
+
+static void pmmReserve(unsigned long long start, unsigned long long end)
+{
+	if (pmm_reserved_count == PMM_MAX_RESERVED || end <= start)
+		return;
+
+	pmm_reserved[pmm_reserved_count].start = pmmFrameDown(start);
+	pmm_reserved[pmm_reserved_count].end = pmmFrameUp(end);
+	pmm_reserved_count++;
+}
+
+//Returns: the first reserved range overlapping frames [start, end), or NULL
+static const pmm_range_t* pmmFindReserved(unsigned int start, unsigned int end)
+{
+	unsigned int r;
+	for (r = 0; r < pmm_reserved_count; r++)
+	{
+		if (pmm_reserved[r].start < end && pmm_reserved[r].end > start)
+			return &pmm_reserved[r];
+	}
+	return NULL;
+}
+
+static void pmmListPush(unsigned int frame, unsigned int order)
+{
+	unsigned int head = pmm_free_head[order];
+
+	pmm_frames[frame].next = head;
+	pmm_frames[frame].prev = PMM_NO_FRAME;
+	pmm_frames[frame].order = order;
+	pmm_frames[frame].flags = PMM_FRAME_FREE;
+	if (head != PMM_NO_FRAME)
+		pmm_frames[head].prev = frame;
+	pmm_free_head[order] = frame;
+
+	pmm_stats.free_blocks[order]++;
+	pmm_stats.free_frames += 1u << order;
+}
+
+static void pmmListRemove(unsigned int frame)
+{
+	pmm_frame_t* entry = &pmm_frames[frame];
+
+	if (entry->prev != PMM_NO_FRAME)
+		pmm_frames[entry->prev].next = entry->next;
+	else
+		pmm_free_head[entry->order] = entry->next;
+	if (entry->next != PMM_NO_FRAME)
+		pmm_frames[entry->next].prev = entry->prev;
+
+	entry->flags = 0;
+	pmm_stats.free_blocks[entry->order]--;
+	pmm_stats.free_frames -= 1u << entry->order;
+}
+
+//puts a block back, merging it with its buddy for as long as the buddy is free and whole
+static void pmmFreeBlock(unsigned int frame, unsigned int order)
+{
+	while (order < PMM_MAX_ORDER)
+	{
+		unsigned int buddy = frame ^ (1u << order);
+
+		if (buddy >= pmm_frame_count || pmm_frames[buddy].flags != PMM_FRAME_FREE || pmm_frames[buddy].order != order)
+			break;
+
+		pmmListRemove(buddy);
+		frame &= ~(1u << order);
+		order++;
+	}
+
+	pmmListPush(frame, order);
+}
+
+//hands frames [start, end) to the allocator in the largest aligned blocks that fit
+static void pmmFreeRange(unsigned int start, unsigned int end)
+{
+	while (start < end)
+	{
+		unsigned int order = 0;
+		unsigned int frame;
+
+		while (order < PMM_MAX_ORDER && (start & ((2u << order) - 1)) == 0 && start + (2u << order) <= end)
+			order++;
+
+		for (frame = start; frame < start + (1u << order); frame++)
+			pmm_frames[frame].flags = 0;
+
+		pmmFreeBlock(start, order);
+		start += 1u << order;
+	}
+}
+
+//frees the RAM in [start, end) that isn't covered by a reserved range
+static void pmmAddRange(unsigned int start, unsigned int end)
+{
+	const pmm_range_t* hole;
+
+	while (start < end && (hole = pmmFindReserved(start, end)) != NULL)
+	{
+		unsigned int hole_end = hole->end < end ? hole->end : end;
+
+		if (hole->start > start)
+			pmmAddRange(start, hole->start);
+
+		//RAM that was in use before pmmInit still counts towards the total
+		pmm_stats.reserved_frames += hole_end - (hole->start > start ? hole->start : start);
+		start = hole_end;
+	}
+
+	if (start < end)
+	{
+		pmm_stats.total_frames += end - start;
+		pmmFreeRange(start, end);
+	}
+}
+
+static int pmmMapUsable(const multiboot_mmap_entry_t* entry, unsigned int* start, unsigned int* end)
+{
+	unsigned long long top = entry->addr + entry->len;
+
+	if (entry->type != MULTIBOOT_MEMORY_AVAILABLE || entry->addr >= ((unsigned long long)PMM_MAX_FRAMES << PMM_FRAME_SHIFT))
+		return 0;
+	if (top > ((unsigned long long)PMM_MAX_FRAMES << PMM_FRAME_SHIFT))
+		top = (unsigned long long)PMM_MAX_FRAMES << PMM_FRAME_SHIFT;
+
+	*start = pmmFrameUp(entry->addr);
+	*end = pmmFrameDown(top);
+	return *start < *end;
+}
+
+//first "count" frames in [start, end) clear of every reserved range, or PMM_NO_FRAME
+static unsigned int pmmFindSpace(unsigned int start, unsigned int end, unsigned int count)
+{
+	const pmm_range_t* hole;
+
+	while (start + count <= end && (hole = pmmFindReserved(start, start + count)) != NULL)
+		start = hole->end;
+	return start + count <= end ? start : PMM_NO_FRAME;
+}
+
+#define PMM_FOR_EACH_MMAP(entry, map, map_end) \
+	for (entry = (const multiboot_mmap_entry_t*)(map); (unsigned long)entry < (map_end); \
+		entry = (const multiboot_mmap_entry_t*)((unsigned long)entry + entry->size + 4))
+
+//Builds the allocator from the multiboot memory map (or mem_upper, if the loader gave no map).
+//"info" is read through the direct map, so it has to sit in boot.S's first 16MB, which is where loaders put it
+//Returns: 0 on success, -1 if the kernel wasn't started by a multiboot loader or no usable RAM was found
+int pmmInit(unsigned int magic, const multiboot_info_t* info)
+{
+	const multiboot_mmap_entry_t* entry;
+	multiboot_mmap_entry_t fallback;
+	unsigned long map, map_end;
+	unsigned int start, end, frame, order;
+
+	if (magic != MULTIBOOT_BOOTLOADER_MAGIC || info == NULL)
+		return -1;
+
+	pmm_reserved_count = 0;
+	pmmReserve(0, PMM_LOW_MEMORY);
+	pmmReserve(VIRT_TO_PHYS(_kernel_start), VIRT_TO_PHYS(_kernel_end));
+	pmmReserve(VIRT_TO_PHYS(info), VIRT_TO_PHYS(info) + sizeof(multiboot_info_t));
+
+	if (info->flags & MULTIBOOT_INFO_MEM_MAP)
+	{
+		pmmReserve(info->mmap_addr, (unsigned long long)info->mmap_addr + info->mmap_length);
+		map = (unsigned long)PHYS_TO_VIRT(info->mmap_addr);
+		map_end = map + info->mmap_length;
+	}
+	else if (info->flags & MULTIBOOT_INFO_MEMORY)
+	{
+		fallback.size = sizeof(fallback) - 4;
+		fallback.addr = PMM_LOW_MEMORY;
+		fallback.len = (unsigned long long)info->mem_upper * 1024;
+		fallback.type = MULTIBOOT_MEMORY_AVAILABLE;
+		map = (unsigned long)&fallback;
+		map_end = map + sizeof(fallback);
+	}
+	else
+		return -1;
+
+	//the frame table covers everything up to the highest usable frame...
+	pmm_frame_count = 0;
+	PMM_FOR_EACH_MMAP(entry, map, map_end)
+	{
+		if (pmmMapUsable(entry, &start, &end) && end > pmm_frame_count)
+			pmm_frame_count = end;
+	}
+
+	//...and goes in the lowest usable RAM that isn't already taken, which has to be inside the boot mapping
+	unsigned int table_frames = pmmFrameUp((unsigned long long)pmm_frame_count * sizeof(pmm_frame_t));
+	unsigned int table_start = PMM_NO_FRAME;
+
+	PMM_FOR_EACH_MMAP(entry, map, map_end)
+	{
+		if (table_start == PMM_NO_FRAME && pmmMapUsable(entry, &start, &end))
+			table_start = pmmFindSpace(start, end < PAGING_BOOT_MAP_SIZE >> PMM_FRAME_SHIFT ? end : PAGING_BOOT_MAP_SIZE >> PMM_FRAME_SHIFT, table_frames);
+	}
+
+	if (pmm_frame_count == 0 || table_start == PMM_NO_FRAME)
+		return -1;
+
+	pmm_frames = (pmm_frame_t*)PHYS_TO_VIRT((unsigned long)table_start << PMM_FRAME_SHIFT);
+	pmmReserve((unsigned long long)table_start << PMM_FRAME_SHIFT, (unsigned long long)(table_start + table_frames) << PMM_FRAME_SHIFT);
+
+	memset(&pmm_stats, 0, sizeof(pmm_stats));
+	for (order = 0; order <= PMM_MAX_ORDER; order++)
+		pmm_free_head[order] = PMM_NO_FRAME;
+	for (frame = 0; frame < pmm_frame_count; frame++)
+	{
+		pmm_frames[frame].next = PMM_NO_FRAME;
+		pmm_frames[frame].prev = PMM_NO_FRAME;
+		pmm_frames[frame].order = 0;
+		pmm_frames[frame].flags = PMM_FRAME_RESERVED;
+		pmm_frames[frame].refs = 0;
+	}
+
+	PMM_FOR_EACH_MMAP(entry, map, map_end)
+	{
+		if (pmmMapUsable(entry, &start, &end))
+			pmmAddRange(start, end);
+	}
+	pmm_stats.total_frames += pmm_stats.reserved_frames;
+	pmmSetWatermarks(pmm_stats.total_frames / PMM_WATERMARK_DIVISOR, pmm_stats.total_frames / PMM_WATERMARK_DIVISOR * 2);
+
+	return pmm_stats.free_frames != 0 ? 0 : -1;
+}
+
+//takes free block "frame" of order "current" off its list and returns the first 2^order frames of it
+static unsigned long pmmTakeBlock(unsigned int frame, unsigned int current, unsigned int order)
+{
+	pmmListRemove(frame);
+
+	//split off the upper halves until the block is the size asked for
+	while (current > order)
+	{
+		current--;
+		pmmListPush(frame + (1u << current), current);
+	}
+
+	pmm_frames[frame].order = order;
+	pmm_frames[frame].flags = 0;
+	pmm_frames[frame].refs = 0;
+	return (unsigned long)frame << PMM_FRAME_SHIFT;
+}
+
+static unsigned long pmmTryAllocFrames(unsigned int order)
+{
+	unsigned int current;
+
+	for (current = order; current <= PMM_MAX_ORDER; current++)
+	{
+		if (pmm_free_head[current] != PMM_NO_FRAME)
+			return pmmTakeBlock(pmm_free_head[current], current, order);
+	}
+	return 0;
+}
+
+//runs the shrinkers if an allocation of 2^order frames leaves free memory under the low watermark
+static void pmmCheckWatermark(unsigned int order)
+{
+	if (pmm_stats.free_frames < pmm_stats.low_watermark + (1u << order) && !pmm_reclaiming)
+		pmmReclaim(pmm_stats.high_watermark + (1u << order) - pmm_stats.free_frames);
+}
+
+//Allocates 2^order physically contiguous frames, aligned to their size
+//Returns: the physical address of the first frame, or 0 if no block that large is free
+unsigned long pmmAllocFrames(unsigned int order)
+{
+	if (order > PMM_MAX_ORDER)
+		return 0;
+
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	pmmCheckWatermark(order);
+	unsigned long address = pmmTryAllocFrames(order);
+	if (address == 0 && pmmReclaim(1u << order) != 0)
+		address = pmmTryAllocFrames(order);
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return address;
+}
+
+static unsigned long pmmTryAllocFramesBelow(unsigned int order, unsigned long limit)
+{
+	unsigned int current, frame;
+	unsigned int limit_frame = limit >> PMM_FRAME_SHIFT;
+
+	for (current = order; current <= PMM_MAX_ORDER; current++)
+	{
+		//only the block's first 2^order frames get used, the rest is split off and freed again
+		for (frame = pmm_free_head[current]; frame != PMM_NO_FRAME; frame = pmm_frames[frame].next)
+		{
+			if (frame + (1u << order) <= limit_frame)
+				return pmmTakeBlock(frame, current, order);
+		}
+	}
+	return 0;
+}
+
+//Like pmmAllocFrames, but the block has to end at or below physical address "limit" (for devices that can't reach
+//all of RAM). This walks the free lists, so it's O(free blocks) rather than O(1); it's meant for driver setup
+//Returns: the physical address of the first frame, or 0 if no block that large is free below "limit"
+unsigned long pmmAllocFramesBelow(unsigned int order, unsigned long limit)
+{
+	if (order > PMM_MAX_ORDER)
+		return 0;
+
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	pmmCheckWatermark(order);
+	unsigned long address = pmmTryAllocFramesBelow(order, limit);
+	if (address == 0 && pmmReclaim(1u << order) != 0)
+		address = pmmTryAllocFramesBelow(order, limit);
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return address;
+}
+
+//Allocates exactly "count" contiguous frames below "limit": the smallest block that holds them, with the frames
+//past "count" given straight back. Free it with pmmFreeExact
+//Returns: the physical address of the first frame, or 0 if there's no room
+unsigned long pmmAllocExact(unsigned int count, unsigned long limit)
+{
+	if (count == 0)
+		return 0;
+
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	unsigned int order = pmmOrderForSize((unsigned long)count << PMM_FRAME_SHIFT);
+	unsigned long address = pmmAllocFramesBelow(order, limit);
+	if (address != 0)
+	{
+		unsigned int frame = address >> PMM_FRAME_SHIFT;
+		pmmFreeRange(frame + count, frame + (1u << order));
+		pmm_frames[frame].order = 0;
+	}
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return address;
+}
+
+void pmmFreeExact(unsigned long address, unsigned int count)
+{
+	unsigned int frame = address >> PMM_FRAME_SHIFT;
+
+	if ((address & (PMM_FRAME_SIZE - 1)) != 0 || frame + count > pmm_frame_count || pmm_frames[frame].flags != 0)
+	{
+		printf("pmm: bad exact free of %x (%u frames)%n", (unsigned int)address, count);
+		return;
+	}
+
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	pmmFreeRange(frame, frame + count);
+	rspinUnlockIrqRestore(&mm_lock, flags);
+}
+
+void pmmFreeFrames(unsigned long address, unsigned int order)
+{
+	unsigned int frame = address >> PMM_FRAME_SHIFT;
+
+	if ((address & (PMM_FRAME_SIZE - 1)) != 0 || frame >= pmm_frame_count || order > PMM_MAX_ORDER || (frame & ((1u << order) - 1)) != 0)
+	{
+		printf("pmm: bad free of %x (order %u)%n", (unsigned int)address, order);
+		return;
+	}
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	if (pmm_frames[frame].flags != 0 || pmm_frames[frame].order != order)
+	{
+		rspinUnlockIrqRestore(&mm_lock, flags);
+		printf("pmm: double free or wrong order at %x (order %u)%n", (unsigned int)address, order);
+		return;
+	}
+
+	pmmFreeBlock(frame, order);
+	rspinUnlockIrqRestore(&mm_lock, flags);
+}
+
+unsigned long pmmAllocFrame(void)
+{
+	return pmmAllocFrames(0);
+}
+
+void pmmFreeFrame(unsigned long address)
+{
+	pmmFreeFrames(address, 0);
+}
+
+//smallest order whose block holds "bytes"
+unsigned int pmmOrderForSize(unsigned long bytes)
+{
+	unsigned int order = 0;
+	while (order <= PMM_MAX_ORDER && ((unsigned long)PMM_FRAME_SIZE << order) < bytes)
+		order++;
+	return order;
+}
+
+//Returns: the end of the highest frame the allocator manages; everything below it needs to be mapped
+unsigned long pmmMemoryTop(void)
+{
+	return (unsigned long)pmm_frame_count << PMM_FRAME_SHIFT;
+}
+
+//Reference counts are only kept for the first frame of a block and only mean something to whoever maps it;
+//the allocator itself never looks at them
+//Returns: the frame's count after the change
+unsigned int pmmFrameRef(unsigned long address)
+{
+	return ++pmm_frames[address >> PMM_FRAME_SHIFT].refs;
+}
+
+unsigned int pmmFrameUnref(unsigned long address)
+{
+	pmm_frame_t* entry = &pmm_frames[address >> PMM_FRAME_SHIFT];
+	if (entry->refs == 0)
+	{
+		printf("pmm: unbalanced unref of %x%n", (unsigned int)address);
+		return 0;
+	}
+	return --entry->refs;
+}
+
+unsigned int pmmFrameRefs(unsigned long address)
+{
+	return pmm_frames[address >> PMM_FRAME_SHIFT].refs;
+}
+
+void pmmGetStats(pmm_stats_t* stats)
+{
+	*stats = pmm_stats;
+}
+
+//Sets the free frame counts reclaim starts under and stops at
+void pmmSetWatermarks(unsigned int low, unsigned int high)
+{
+	if (low < PMM_WATERMARK_MIN)
+		low = PMM_WATERMARK_MIN;
+	if (high < low)
+		high = low;
+	pmm_stats.low_watermark = low;
+	pmm_stats.high_watermark = high;
+}
+
+//Adds a shrinker, after any already registered with the same priority. The shrinker isn't copied
+//Returns: 0 on success, -1 if the table is full
+int pmmRegisterShrinker(pmm_shrinker_t* shrinker)
+{
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	unsigned int i;
+
+	if (pmm_shrinker_count == PMM_MAX_SHRINKERS)
+	{
+		rspinUnlockIrqRestore(&mm_lock, flags);
+		return -1;
+	}
+
+	for (i = pmm_shrinker_count; i > 0 && pmm_shrinkers[i - 1]->priority > shrinker->priority; i--)
+		pmm_shrinkers[i] = pmm_shrinkers[i - 1];
+	pmm_shrinkers[i] = shrinker;
+	pmm_shrinker_count++;
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return 0;
+}
+
+void pmmUnregisterShrinker(pmm_shrinker_t* shrinker)
+{
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	unsigned int i;
+
+	for (i = 0; i < pmm_shrinker_count; i++)
+	{
+		if (pmm_shrinkers[i] == shrinker)
+		{
+			memmove(&pmm_shrinkers[i], &pmm_shrinkers[i + 1], (pmm_shrinker_count - i - 1) * sizeof(pmm_shrinker_t*));
+			pmm_shrinker_count--;
+			break;
+		}
+	}
+	rspinUnlockIrqRestore(&mm_lock, flags);
+}
+
+//Returns: the index'th shrinker in priority order, for listing them, or NULL past the last one
+const pmm_shrinker_t* pmmGetShrinker(unsigned int index)
+{
+	return index < pmm_shrinker_count ? pmm_shrinkers[index] : NULL;
+}
+
+//Asks the shrinkers, lowest priority value first, to release objects in batches until "frames" frames have come
+//back or none of them has anything left to give. Takes mm_lock itself, so the allocators can call it holding it
+//Returns: how many frames came back
+unsigned int pmmReclaim(unsigned int frames)
+{
+	unsigned long flags = rspinLockIrqSave(&mm_lock);
+	unsigned int start_free = pmm_stats.free_frames;
+	unsigned int i;
+
+	if (pmm_reclaiming)
+	{
+		rspinUnlockIrqRestore(&mm_lock, flags);
+		return 0;
+	}
+	pmm_reclaiming = 1;
+	pmm_stats.reclaims++;
+
+	for (i = 0; i < pmm_shrinker_count && pmm_stats.free_frames < start_free + frames; i++)
+	{
+		pmm_shrinker_t* shrinker = pmm_shrinkers[i];
+		unsigned int available;
+
+		while (pmm_stats.free_frames < start_free + frames && (available = shrinker->count()) != 0)
+		{
+			unsigned int released = shrinker->scan(available < PMM_SHRINK_BATCH ? available : PMM_SHRINK_BATCH);
+			shrinker->runs++;
+			shrinker->released += released;
+			if (released == 0)
+				break;
+		}
+	}
+
+	pmm_reclaiming = 0;
+	frames = pmm_stats.free_frames > start_free ? pmm_stats.free_frames - start_free : 0;
+	pmm_stats.reclaimed_frames += frames;
+	rspinUnlockIrqRestore(&mm_lock, flags);
+	return frames;
+}
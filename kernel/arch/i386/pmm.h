@@ -0,0 +1,90 @@
+#ifndef PMM_H_
+#define PMM_H_
+
+#include "multiboot.h"
+#include "spinlock.h"
+
+//Physical frame allocator: a binary buddy allocator over the RAM the multiboot memory map reports.
+//Addresses going in and out are physical; use PHYS_TO_VIRT to touch the memory.
+//Blocks are 2^order frames, naturally aligned. Each order keeps a doubly linked free list threaded through a
+//per-frame table (not through the frames themselves, so it keeps working whatever is or isn't mapped),
+//which makes alloc and free O(PMM_MAX_ORDER).
+//mm_lock covers this, the kernel heap, the vmm and the stack table together: they call into each other, a page
+//fault included, so it's one lock and the CPU holding it can take it again.
+
+#define PMM_FRAME_SIZE 4096
+#define PMM_FRAME_SHIFT 12
+#define PMM_MAX_ORDER 10 //largest block is 2^10 frames = 4MB
+#define PMM_LOW_MEMORY 0x100000 //everything below 1MB (BIOS data, VGA, the legacy disk buffers) is never handed out
+#define PMM_MAX_SHRINKERS 16
+#define PMM_SHRINK_BATCH 32 //objects asked of a shrinker at a time
+#define PMM_WATERMARK_DIVISOR 64 //the low watermark defaults to 1/64 of RAM, the high one to twice that
+#define PMM_WATERMARK_MIN 32 //frames, for machines small enough that 1/64 is next to nothing
+
+#define PMM_NO_FRAME 0xFFFFFFFF //end of a free list
+
+//frame flags
+#define PMM_FRAME_FREE 0x01 //first frame of a free block; "order" is the block's order
+#define PMM_FRAME_RESERVED 0x02 //not RAM, or in use since before pmmInit (kernel image, multiboot data, this table)
+
+typedef struct pmm_frame
+{
+	unsigned int next; //free list links, as frame numbers
+	unsigned int prev;
+	unsigned char order;
+	unsigned char flags;
+	unsigned short refs; //mappings of an allocated frame, for frames the vmm shares copy-on-write
+}
+pmm_frame_t;
+
+typedef struct pmm_stats
+{
+	unsigned int total_frames; //usable RAM, including what's allocated
+	unsigned int free_frames;
+	unsigned int reserved_frames; //usable RAM taken before pmmInit returned
+	unsigned int free_blocks[PMM_MAX_ORDER + 1];
+	unsigned int low_watermark; //free frames below which allocations start reclaiming
+	unsigned int high_watermark; //free frames reclaim stops at
+	unsigned int reclaims; //times the shrinkers were run
+	unsigned int reclaimed_frames;
+}
+pmm_stats_t;
+
+//A cache that can give memory back. Under the low watermark, and before an allocation fails, the frame allocator
+//runs the registered shrinkers in priority order until free memory is back at the high watermark.
+//Shrinkers run in the middle of whatever allocation triggered them, on whichever CPU it was, with mm_lock held and
+//interrupts off. count and scan must not allocate frames, sleep or take any other lock; freeing memory is fine
+typedef struct pmm_shrinker
+{
+	const char* name;
+	unsigned int priority; //lower runs first; caches that are cheap to refill should go first
+	unsigned int (*count)(void); //objects that could be released right now
+	unsigned int (*scan)(unsigned int count); //releases up to "count" objects, returns how many it did
+	unsigned int runs;
+	unsigned int released; //objects
+}
+pmm_shrinker_t;
+
+extern rspinlock_t mm_lock;
+
+int pmmInit(unsigned int magic, const multiboot_info_t* info);
+unsigned long pmmAllocFrames(unsigned int order);
+unsigned long pmmAllocFramesBelow(unsigned int order, unsigned long limit);
+unsigned long pmmAllocExact(unsigned int count, unsigned long limit);
+void pmmFreeExact(unsigned long address, unsigned int count);
+void pmmFreeFrames(unsigned long address, unsigned int order);
+unsigned long pmmAllocFrame(void);
+void pmmFreeFrame(unsigned long address);
+unsigned int pmmOrderForSize(unsigned long bytes);
+unsigned long pmmMemoryTop(void);
+unsigned int pmmFrameRef(unsigned long address);
+unsigned int pmmFrameUnref(unsigned long address);
+unsigned int pmmFrameRefs(unsigned long address);
+void pmmGetStats(pmm_stats_t* stats);
+void pmmSetWatermarks(unsigned int low, unsigned int high);
+int pmmRegisterShrinker(pmm_shrinker_t* shrinker);
+void pmmUnregisterShrinker(pmm_shrinker_t* shrinker);
+const pmm_shrinker_t* pmmGetShrinker(unsigned int index);
+unsigned int pmmReclaim(unsigned int frames);
+
+#endif
@@ -0,0 +1,873 @@
+#include "sched.h"
+#include "smp.h"
+#include "idt.h"
+#include "timer.h"
+#include "softirq.h"
+#include "stack.h"
+#include "vmm.h"
+#include "kheap.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+#include <string.h>
+
+#define SCHED_EFLAGS_NEW 0x2 //what a new thread starts with: just the always-set bit, so interrupts are off
+
+//One per CPU. Everything in it is under its lock, and so are the state and queue links of the threads whose "cpu"
+//it is. The lock is held across switchTask: taken by the thread switching away and released by the one switched
+//to, so a thread another CPU takes off the queue or wakes up has always finished saving its registers
+typedef struct run_queue
+{
+	spinlock_t lock;
+	Task* current;
+	Task* idle;
+	Task* heads[SCHED_PRIORITIES];
+	Task* tails[SCHED_PRIORITIES];
+	unsigned long bitmap; //bit n: heads[n] isn't empty
+	unsigned int queued; //threads on the queues, for picking whom to steal from
+	unsigned long long charged; //timerNow up to which current has been charged
+	Task* dead; //exited here, for this CPU's idle thread to reap
+	ktimer_t slice_timer;
+	volatile int need_resched;
+	volatile unsigned int preempt_count;
+	sched_stats_t stats;
+}
+run_queue_t;
+
+static Task sched_boot; //the code that called initTasking, on the boot stack
+static run_queue_t sched_queues[SMP_MAX_CPUS];
+static volatile unsigned long sched_idle_cpus; //bit n: CPU n is running its idle thread and nobody has kicked it yet
+static spinlock_t sched_lock; //the thread table
+static Task* sched_threads[SCHED_MAX_THREADS];
+static unsigned int sched_thread_count;
+static unsigned int sched_next_id;
+static kmem_cache_t* sched_task_cache; //every Task but sched_boot
+
+//Returns: the calling CPU's run queue; interrupts have to be off, or the caller could be moved off it
+static run_queue_t* schedRq(void)
+{
+	return &sched_queues[smpCpuIndex()];
+}
+
+static unsigned int schedRqIndex(const run_queue_t* rq)
+{
+	return rq - sched_queues;
+}
+
+//Returns: the most urgent priority anything is queued at on "rq"; its bitmap can't be 0
+static unsigned int schedFirstPriority(const run_queue_t* rq)
+{
+	unsigned long priority;
+	asm("bsf %1, %0" : "=r"(priority) : "rm"(rq->bitmap) : "cc");
+	return priority;
+}
+
+//puts "task" at the back of its priority's run queue on "rq"; rq's lock has to be held
+static void schedEnqueue(run_queue_t* rq, Task* task)
+{
+	unsigned int priority = task->priority;
+
+	task->state = SCHED_READY;
+	task->next = NULL;
+	if (rq->tails[priority] != NULL)
+		rq->tails[priority]->next = task;
+	else
+		rq->heads[priority] = task;
+	rq->tails[priority] = task;
+	rq->bitmap |= 1ul << priority;
+	rq->queued++;
+}
+
+//the same at the front, for a thread that was preempted before its slice was up
+static void schedEnqueueFront(run_queue_t* rq, Task* task)
+{
+	unsigned int priority = task->priority;
+
+	task->state = SCHED_READY;
+	task->next = rq->heads[priority];
+	if (task->next == NULL)
+		rq->tails[priority] = task;
+	rq->heads[priority] = task;
+	rq->bitmap |= 1ul << priority;
+	rq->queued++;
+}
+
+//takes the head of the most urgent non-empty queue
+static Task* schedDequeue(run_queue_t* rq)
+{
+	unsigned int priority;
+	Task* task;
+
+	if (rq->bitmap == 0)
+		return NULL;
+
+	priority = schedFirstPriority(rq);
+	task = rq->heads[priority];
+	rq->heads[priority] = task->next;
+	if (task->next == NULL)
+	{
+		rq->tails[priority] = NULL;
+		rq->bitmap &= ~(1ul << priority);
+	}
+	task->next = NULL;
+	rq->queued--;
+	return task;
+}
+
+//takes a READY thread off its queue, wherever it is in it
+static void schedUnqueue(run_queue_t* rq, Task* task)
+{
+	unsigned int priority = task->priority;
+	Task** link = &rq->heads[priority];
+	Task* previous = NULL;
+
+	while (*link != NULL && *link != task)
+	{
+		previous = *link;
+		link = &(*link)->next;
+	}
+	if (*link == NULL)
+		return;
+
+	*link = task->next;
+	if (rq->tails[priority] == task)
+		rq->tails[priority] = previous;
+	if (rq->heads[priority] == NULL)
+		rq->bitmap &= ~(1ul << priority);
+	task->next = NULL;
+	rq->queued--;
+}
+
+//Locks the run queue "task" is on (or last ran on), which can change until that lock is held
+//Returns: the run queue, locked, with interrupts off and EFLAGS from before in "flags"
+static run_queue_t* schedLockTask(Task* task, unsigned long* flags)
+{
+	for (;;)
+	{
+		run_queue_t* rq = &sched_queues[task->cpu];
+
+		*flags = spinLockIrqSave(&rq->lock);
+		if (rq == &sched_queues[task->cpu])
+			return rq;
+		spinUnlockIrqRestore(&rq->lock, *flags);
+	}
+}
+
+//Has rq's CPU switch on the way out of its next interrupt, sending it one if it isn't the calling CPU; rq's lock
+//has to be held
+static void schedResched(run_queue_t* rq)
+{
+	rq->need_resched = 1;
+	if (rq != schedRq())
+	{
+		rq->stats.ipis++;
+		smpSendIpi(schedRqIndex(rq), IDT_VECTOR_IPI_RESCHEDULE);
+	}
+}
+
+//Something was queued on "busy" that its CPU won't get to straight away: wakes an idle CPU, if there is one, to
+//steal it. The CPU is taken out of sched_idle_cpus as it's kicked, so a burst of wake-ups spreads over all the
+//idle CPUs instead of kicking the same one over and over; it goes back in if it finds nothing to steal
+static void schedKickIdle(run_queue_t* busy)
+{
+	for (;;)
+	{
+		unsigned long idle = sched_idle_cpus & ~(1ul << schedRqIndex(busy));
+		unsigned int cpu;
+
+		if (idle == 0)
+			return;
+		cpu = __builtin_ctzl(idle);
+		if (__atomic_fetch_and(&sched_idle_cpus, ~(1ul << cpu), __ATOMIC_SEQ_CST) & (1ul << cpu))
+		{
+			busy->stats.ipis++;
+			smpSendIpi(cpu, IDT_VECTOR_IPI_RESCHEDULE);
+			return;
+		}
+	}
+}
+
+//charges rq's running thread for the CPU it has had since it was last charged; rq's lock has to be held
+static void schedCharge(run_queue_t* rq, unsigned long long now)
+{
+	Task* self = rq->current;
+	unsigned long long ran = now > rq->charged ? now - rq->charged : 0;
+
+	self->runtime += ran;
+	self->slice = ran < self->slice ? self->slice - ran : 0;
+	rq->charged = now;
+}
+
+//a thread that has used up its slice gets a new one and loses its boost
+static void schedSliceUsed(run_queue_t* rq, Task* task)
+{
+	task->slice = SCHED_SLICE_US;
+	task->priority = task->base_priority;
+	rq->stats.slices++;
+}
+
+//Arms rq's slice timer for its running thread if its slice running out would change anything: something of the
+//same priority is waiting for its turn, or its boost is due to end. Cancels it otherwise
+static void schedArmSlice(run_queue_t* rq, unsigned long long now)
+{
+	Task* self = rq->current;
+
+	if (self != rq->idle && ((rq->bitmap != 0 && schedFirstPriority(rq) <= self->priority) || self->priority != self->base_priority))
+		timerAdd(&rq->slice_timer, now + self->slice);
+	else
+		timerCancel(&rq->slice_timer);
+}
+
+//runs in SOFTIRQ_TIMER, on whichever CPU got to it; the switch itself happens in schedPreempt, on the way out of an
+//interrupt on the run queue's own CPU
+static void schedSliceExpired(ktimer_t* timer)
+{
+	run_queue_t* rq = timer->data;
+	unsigned long flags = spinLockIrqSave(&rq->lock);
+
+	schedResched(rq);
+	spinUnlockIrqRestore(&rq->lock, flags);
+}
+
+//Gives the CPU to the head of rq's most urgent run queue, or to its idle thread if they're all empty. "rq" has to
+//be the calling CPU's, locked, with interrupts off, and the current thread has to have been put wherever it's going
+//(run queue, wait queue, dead list) already. Returns once the thread is switched back to, maybe on another CPU,
+//with interrupts still off and the lock released
+static void schedSwitch(run_queue_t* rq)
+{
+	Task* previous = rq->current;
+	Task* next = schedDequeue(rq);
+	unsigned long long now = timerNow();
+
+	schedCharge(rq, now);
+	if (next == NULL)
+		next = rq->idle;
+	rq->need_resched = 0;
+	next->state = SCHED_RUNNING;
+
+	if (next != previous)
+	{
+		if (previous == rq->idle)
+		{
+			previous->state = SCHED_READY;
+			__atomic_fetch_and(&sched_idle_cpus, ~(1ul << schedRqIndex(rq)), __ATOMIC_SEQ_CST);
+		}
+		if (next == rq->idle)
+			__atomic_fetch_or(&sched_idle_cpus, 1ul << schedRqIndex(rq), __ATOMIC_SEQ_CST);
+		if (next->woken != 0)
+		{
+			unsigned long long latency = now > next->woken ? now - next->woken : 0;
+			next->latency_total += latency;
+			if (latency > next->latency_max)
+				next->latency_max = latency;
+			next->woken = 0;
+		}
+		next->switches++;
+		rq->stats.switches++;
+		rq->current = next;
+	}
+	schedArmSlice(rq, now);
+
+	if (next != previous)
+		switchTask(&previous->regs, &next->regs);
+
+	//whoever switched to us left the run queue of the CPU we're on now locked
+	spinUnlock(&schedRq()->lock);
+}
+
+//Makes a blocked thread runnable on the run queue it last ran on, "boost" levels more urgent than its own priority,
+//and has that CPU switch if it's more urgent than what's running there; otherwise an idle CPU is asked to steal
+//it. "rq" has to be the thread's, locked
+static void schedWake(run_queue_t* rq, Task* task, unsigned int boost)
+{
+	Task* current = rq->current;
+	unsigned long long now;
+
+	if (task->state != SCHED_BLOCKED)
+		return;
+
+	if (boost != 0)
+	{
+		unsigned int boosted = task->base_priority > boost ? task->base_priority - boost : 0;
+		if (boosted < task->priority)
+		{
+			task->priority = boosted;
+			rq->stats.boosts++;
+		}
+		task->slice = SCHED_SLICE_US;
+	}
+
+	now = timerNow();
+	task->woken = now != 0 ? now : 1;
+	task->wakeups++;
+	rq->stats.wakeups++;
+	schedEnqueue(rq, task);
+
+	if (current == rq->idle || task->priority < current->priority)
+	{
+		schedResched(rq);
+		return;
+	}
+	if (task->priority == current->priority && !rq->slice_timer.pending)
+	{
+		//the running thread has had the CPU to itself; now its slice counts
+		schedCharge(rq, now);
+		schedArmSlice(rq, now);
+	}
+	if (!task->pinned)
+		schedKickIdle(rq);
+}
+
+//Moves the most urgent thread another CPU has waiting, and that isn't pinned there, onto "rq", the calling CPU's,
+//which has nothing to run. Interrupts have to be off and rq's lock not held; it's held on return
+//Returns: 1 if a thread was moved
+static int schedSteal(run_queue_t* rq)
+{
+	run_queue_t* victim = NULL;
+	unsigned int most = 0;
+	unsigned int i;
+	unsigned long bitmap;
+	Task* task = NULL;
+
+	//the busiest queue, going by counts read without its lock; they only pick where to look
+	for (i = 0; i < SMP_MAX_CPUS; i++)
+	{
+		if (&sched_queues[i] != rq && sched_queues[i].queued > most)
+		{
+			most = sched_queues[i].queued;
+			victim = &sched_queues[i];
+		}
+	}
+	if (victim == NULL)
+	{
+		spinLock(&rq->lock);
+		return 0;
+	}
+
+	//two run queues are always locked lower index first
+	if (victim < rq)
+	{
+		spinLock(&victim->lock);
+		spinLock(&rq->lock);
+	}
+	else
+	{
+		spinLock(&rq->lock);
+		spinLock(&victim->lock);
+	}
+
+	for (bitmap = victim->bitmap; bitmap != 0 && task == NULL; bitmap &= bitmap - 1)
+	{
+		for (task = victim->heads[__builtin_ctzl(bitmap)]; task != NULL && task->pinned; task = task->next)
+			;
+	}
+	if (task != NULL)
+	{
+		schedUnqueue(victim, task);
+		task->cpu = schedRqIndex(rq);
+		task->migrations++;
+		rq->stats.steals++;
+		schedEnqueue(rq, task);
+	}
+	spinUnlock(&victim->lock);
+	return task != NULL;
+}
+
+//frees the stacks and Tasks of the threads that exited on rq's CPU; for its idle thread, with interrupts on
+static void schedReap(run_queue_t* rq)
+{
+	for (;;)
+	{
+		unsigned long flags = spinLockIrqSave(&rq->lock);
+		Task* task = rq->dead;
+		unsigned int i;
+
+		if (task == NULL)
+		{
+			spinUnlockIrqRestore(&rq->lock, flags);
+			return;
+		}
+		rq->dead = task->next;
+		spinUnlock(&rq->lock);
+
+		spinLock(&sched_lock);
+		for (i = 0; i < sched_thread_count && sched_threads[i] != task; i++)
+			;
+		for (; i + 1 < sched_thread_count; i++)
+			sched_threads[i] = sched_threads[i + 1];
+		sched_thread_count--;
+		rq->stats.reaped++;
+		spinUnlockIrqRestore(&sched_lock, flags);
+
+		if (task->stack != 0)
+		{
+			stackUnregister(task->stack);
+			vmmRelease((void*)task->stack);
+		}
+		if (task != &sched_boot)
+			kmemCacheFree(sched_task_cache, task);
+	}
+}
+
+//where every new thread starts, with interrupts still off and the run queue still locked from the switch to it
+static void schedTrampoline(void)
+{
+	run_queue_t* rq = schedRq();
+	Task* self = rq->current;
+
+	spinUnlock(&rq->lock);
+	asm volatile("sti");
+	self->entry(self->arg);
+	schedExit();
+}
+
+//Runs when nothing else can on its CPU: reaps exited threads, finishes softirqs that were left over, steals a
+//thread from a busier CPU if there's one to steal and halts otherwise. "arg" is the CPU's run queue
+static void schedIdle(void* arg)
+{
+	run_queue_t* rq = arg;
+
+	for (;;)
+	{
+		schedReap(rq);
+		if (softirqPending())
+			softirqRun();
+
+		asm volatile("cli");
+		spinLock(&rq->lock);
+		if (rq->bitmap == 0)
+		{
+			spinUnlock(&rq->lock);
+			schedSteal(rq);
+		}
+		if (rq->bitmap != 0)
+		{
+			schedSwitch(rq);
+		}
+		else
+		{
+			spinUnlock(&rq->lock);
+			__atomic_fetch_or(&sched_idle_cpus, 1ul << schedRqIndex(rq), __ATOMIC_SEQ_CST); //kickable again
+			if (rq->dead == NULL && !softirqPending())
+				asm volatile("sti\n\thlt" : : : "memory"); //sti holds interrupts off until after the hlt
+		}
+		asm volatile("sti");
+	}
+}
+
+//Sets up a thread that will start at "entry" once it's first switched to; it isn't on any queue yet
+//Returns: the thread, or NULL if there's no memory or the thread table is full
+static Task* schedNew(const char* name, void (*entry)(void* arg), void* arg, unsigned int priority)
+{
+	Task* task = kmemCacheAlloc(sched_task_cache);
+	unsigned long stack, top, flags;
+	unsigned int* word;
+
+	if (task == NULL)
+		return NULL;
+	memset(task, 0, sizeof(Task));
+	stack = (unsigned long)vmmReserve(SCHED_STACK_SIZE, VMM_REGION_WRITE, name);
+	if (stack == 0)
+	{
+		kmemCacheFree(sched_task_cache, task);
+		return NULL;
+	}
+	top = stack + SCHED_STACK_SIZE;
+
+	//painting it backs every page now, which has to happen anyway: a demand-zero fault on the page the stack is
+	//in can't be delivered (the CPU would push the fault's frame onto that same page) and ends in a double fault
+	for (word = (unsigned int*)stack; (unsigned long)word < top; word++)
+		*word = STACK_PAINT;
+
+	//switchTask "returns" into the trampoline with esp at this dummy return address
+	*(unsigned long*)(top - sizeof(unsigned long)) = 0;
+	task->regs.esp = top - sizeof(unsigned long);
+	task->regs.eip = (unsigned long)schedTrampoline;
+	task->regs.eflags = SCHED_EFLAGS_NEW;
+	asm volatile("mov %%cr3, %0" : "=r"(task->regs.cr3));
+	task->name = name;
+	task->entry = entry;
+	task->arg = arg;
+	task->stack = stack;
+	task->state = SCHED_BLOCKED;
+	task->base_priority = priority;
+	task->priority = priority;
+	task->slice = SCHED_SLICE_US;
+
+	flags = spinLockIrqSave(&sched_lock);
+	if (sched_thread_count == SCHED_MAX_THREADS)
+	{
+		spinUnlockIrqRestore(&sched_lock, flags);
+		vmmRelease((void*)stack);
+		kmemCacheFree(sched_task_cache, task);
+		return NULL;
+	}
+	task->id = sched_next_id++;
+	sched_threads[sched_thread_count++] = task;
+	schedRq()->stats.created++;
+	spinUnlockIrqRestore(&sched_lock, flags);
+
+	stackRegister(name, stack, top, STACK_PAINTED);
+	return task;
+}
+
+//Sets up CPU "cpu"'s run queue with an idle thread pinned to it
+//Returns: the idle thread, or NULL if there's no memory for it
+static Task* schedNewQueue(unsigned int cpu)
+{
+	run_queue_t* rq = &sched_queues[cpu];
+	Task* idle;
+
+	rq->slice_timer.callback = schedSliceExpired;
+	rq->slice_timer.data = rq;
+	rq->slice_timer.pending = 0;
+
+	idle = schedNew("idle", schedIdle, rq, SCHED_PRIORITY_IDLE);
+	if (idle == NULL)
+		return NULL;
+	idle->cpu = cpu;
+	idle->pinned = 1;
+	idle->state = SCHED_READY;
+	rq->idle = idle;
+	return idle;
+}
+
+//Turns the caller into the first thread ("main", pinned to the BSP) and starts the BSP's idle thread. timerInit,
+//kheapInit and vmmInit have to have run
+//Returns: 0 on success, -1 if the task cache or the idle thread couldn't be set up
+int initTasking(void)
+{
+	run_queue_t* rq = &sched_queues[0];
+
+	if (rq->current != NULL)
+		return 0;
+	if (sched_task_cache == NULL && (sched_task_cache = kmemCacheCreate("task", sizeof(Task))) == NULL)
+		return -1;
+
+	sched_boot.name = "main";
+	sched_boot.state = SCHED_RUNNING;
+	sched_boot.base_priority = SCHED_PRIORITY_DEFAULT;
+	sched_boot.priority = SCHED_PRIORITY_DEFAULT;
+	sched_boot.slice = SCHED_SLICE_US;
+	sched_boot.pinned = 1;
+	rq->charged = timerNow();
+	sched_threads[sched_thread_count++] = &sched_boot;
+	sched_next_id = 1;
+	rq->stats.created = 1;
+	rq->current = &sched_boot;
+
+	if (schedNewQueue(0) == NULL)
+	{
+		rq->current = NULL;
+		sched_thread_count = 0;
+		return -1;
+	}
+	return 0;
+}
+
+//Sets up the run queue and idle thread of CPU "cpu", for smpInit to start it on. initTasking has to have run
+//Returns: the stack pointer the CPU starts with, on its idle thread's stack, or 0 if there's no memory
+unsigned long schedPrepareCpu(unsigned int cpu)
+{
+	Task* idle;
+
+	if (cpu >= SMP_MAX_CPUS)
+		return 0;
+	idle = sched_queues[cpu].idle;
+	if (idle == NULL && (idle = schedNewQueue(cpu)) == NULL)
+		return 0;
+	return idle->regs.esp;
+}
+
+//For a CPU smpInit started, on the stack schedPrepareCpu gave it, with interrupts off: becomes its idle thread,
+//which from then on runs whatever it can take from the other CPUs
+void schedRunCpu(void)
+{
+	run_queue_t* rq = schedRq();
+
+	spinLock(&rq->lock);
+	rq->charged = timerNow();
+	rq->idle->state = SCHED_RUNNING;
+	rq->current = rq->idle;
+	__atomic_fetch_or(&sched_idle_cpus, 1ul << schedRqIndex(rq), __ATOMIC_SEQ_CST);
+	spinUnlock(&rq->lock);
+
+	asm volatile("sti");
+	schedIdle(rq);
+	for (;;)
+		asm volatile("hlt");
+}
+
+//Starts a thread running entry(arg) at "priority" (0 the most urgent, SCHED_PRIORITIES - 1 the least) on a stack
+//of its own; it goes to the back of its priority's run queue on the calling CPU, where an idle CPU may take it from
+//Returns: the thread, or NULL if there's no memory, the thread table is full or initTasking hasn't run
+Task* schedCreate(const char* name, void (*entry)(void* arg), void* arg, unsigned int priority)
+{
+	run_queue_t* rq;
+	Task* task;
+	unsigned long flags;
+
+	if (sched_queues[0].current == NULL)
+		return NULL;
+	if (priority >= SCHED_PRIORITIES)
+		priority = SCHED_PRIORITIES - 1;
+	task = schedNew(name, entry, arg, priority);
+	if (task == NULL)
+		return NULL;
+
+	flags = cpuIrqSave();
+	rq = schedRq();
+	spinLock(&rq->lock);
+	task->cpu = schedRqIndex(rq);
+	schedWake(rq, task, 0);
+	spinUnlockIrqRestore(&rq->lock, flags);
+	return task;
+}
+
+//Returns: the thread running on the calling CPU, or NULL before initTasking
+Task* schedCurrent(void)
+{
+	unsigned long flags = cpuIrqSave();
+	Task* current = schedRq()->current;
+
+	cpuIrqRestore(flags);
+	return current;
+}
+
+//Changes a thread's priority, ending any boost it has. Its CPU switches away from what it's running at the next
+//interrupt if that leaves something more urgent waiting there
+void schedSetPriority(Task* task, unsigned int priority)
+{
+	run_queue_t* rq;
+	unsigned long flags;
+
+	if (task->base_priority == SCHED_PRIORITY_IDLE)
+		return;
+	if (priority >= SCHED_PRIORITIES)
+		priority = SCHED_PRIORITIES - 1;
+
+	rq = schedLockTask(task, &flags);
+	if (task->state == SCHED_READY)
+	{
+		schedUnqueue(rq, task);
+		task->base_priority = priority;
+		task->priority = priority;
+		schedEnqueue(rq, task);
+		if (task->priority < rq->current->priority)
+			schedResched(rq);
+	}
+	else
+	{
+		task->base_priority = priority;
+		task->priority = priority;
+		if (task == rq->current && rq->bitmap != 0 && schedFirstPriority(rq) < priority)
+			schedResched(rq);
+	}
+	spinUnlockIrqRestore(&rq->lock, flags);
+}
+
+//Goes to the back of its run queue if anything as urgent is waiting for the CPU
+void schedYield(void)
+{
+	unsigned long flags = cpuIrqSave();
+	run_queue_t* rq = schedRq();
+	Task* self = rq->current;
+
+	if (self == NULL)
+	{
+		cpuIrqRestore(flags);
+		return;
+	}
+
+	spinLock(&rq->lock);
+	if (rq->bitmap != 0 && (self == rq->idle || schedFirstPriority(rq) <= self->priority))
+	{
+		if (self != rq->idle)
+			schedEnqueue(rq, self);
+		rq->stats.yields++;
+		schedSwitch(rq);
+	}
+	else
+	{
+		spinUnlock(&rq->lock);
+	}
+	cpuIrqRestore(flags);
+}
+
+//Ends the calling thread; the idle thread of the CPU it was on frees its stack later
+void schedExit(void)
+{
+	run_queue_t* rq;
+	Task* self;
+
+	asm volatile("cli");
+	rq = schedRq();
+	self = rq->current;
+	spinLock(&rq->lock);
+	self->state = SCHED_DEAD;
+	self->next = rq->dead;
+	rq->dead = self;
+	schedSwitch(rq);
+
+	//nothing switches back to a dead thread
+	for (;;)
+		asm volatile("hlt");
+}
+
+//Blocks the calling thread on "queue" until schedWakeAll. The caller has to hold queue->lock, taken with
+//spinLockIrqSave before checking the condition being waited for; it's let go while the thread sleeps and held again
+//on return. The wait can end early, so loop on the condition.
+//Before initTasking, in an idle thread and with preemption disabled, this waits for the next interrupt instead
+void schedWait(wait_queue_t* queue)
+{
+	run_queue_t* rq = schedRq();
+	Task* self = rq->current;
+
+	if (self == NULL || self == rq->idle || rq->preempt_count != 0)
+	{
+		spinUnlock(&queue->lock);
+		if (rq->preempt_count == 0 && softirqPending())
+			softirqRun();
+		else if (rq == &sched_queues[0])
+			asm volatile("sti\n\thlt\n\tcli" : : : "memory");
+		else
+			asm volatile("sti\n\tpause\n\tcli" : : : "memory"); //the other CPUs only get IPIs, which may never come
+		spinLock(&queue->lock);
+		return;
+	}
+
+	spinLock(&rq->lock);
+	self->state = SCHED_BLOCKED;
+	self->next = NULL;
+	if (queue->tail != NULL)
+		queue->tail->next = self;
+	else
+		queue->head = self;
+	queue->tail = self;
+	spinUnlock(&queue->lock);
+	schedSwitch(rq);
+	spinLock(&queue->lock);
+}
+
+//schedWakeAll for a caller that already holds queue->lock, with interrupts off; for when whatever is being waited
+//for has to change under the same lock, because "queue" goes away as soon as the waiter sees it has
+void schedWakeAllLocked(wait_queue_t* queue)
+{
+	Task* task = queue->head;
+
+	queue->head = NULL;
+	queue->tail = NULL;
+	while (task != NULL)
+	{
+		Task* next = task->next; //before schedWake links it into a run queue
+		unsigned long ignored;
+		run_queue_t* rq = schedLockTask(task, &ignored);
+
+		schedWake(rq, task, queue->boost);
+		spinUnlock(&rq->lock);
+		task = next;
+	}
+}
+
+//Makes every thread waiting on "queue" runnable; safe from interrupt handlers
+void schedWakeAll(wait_queue_t* queue)
+{
+	unsigned long flags = spinLockIrqSave(&queue->lock);
+
+	schedWakeAllLocked(queue);
+	spinUnlockIrqRestore(&queue->lock, flags);
+}
+
+//Switches away if the running thread's slice is up or something more urgent woke up. Only for idtDispatch, on the
+//way out of an interrupt that came in with interrupts on
+void schedPreempt(void)
+{
+	run_queue_t* rq = schedRq();
+	Task* self = rq->current;
+
+	if (self == NULL || !rq->need_resched || rq->preempt_count != 0)
+		return;
+
+	spinLock(&rq->lock);
+	if (self != rq->idle)
+	{
+		schedCharge(rq, timerNow());
+		if (self->slice == 0)
+		{
+			schedSliceUsed(rq, self);
+			schedEnqueue(rq, self);
+		}
+		else
+		{
+			schedEnqueueFront(rq, self);
+		}
+		if (rq->heads[schedFirstPriority(rq)] != self)
+		{
+			self->preemptions++;
+			rq->stats.preemptions++;
+			if (!self->pinned)
+				schedKickIdle(rq);
+		}
+	}
+	schedSwitch(rq);
+}
+
+//Keeps the running thread on its CPU until the matching schedPreemptEnable, interrupts or not; these nest
+void schedPreemptDisable(void)
+{
+	unsigned long flags = cpuIrqSave();
+	schedRq()->preempt_count++;
+	cpuIrqRestore(flags);
+}
+
+void schedPreemptEnable(void)
+{
+	unsigned long flags = cpuIrqSave();
+	schedRq()->preempt_count--;
+	cpuIrqRestore(flags);
+}
+
+//Copies the index'th thread, for listing them; a copy, as another CPU may reap it meanwhile
+//Returns: 0, or -1 past the last one
+int schedGetThread(unsigned int index, Task* thread)
+{
+	unsigned long flags = spinLockIrqSave(&sched_lock);
+	int found = index < sched_thread_count;
+
+	if (found)
+		*thread = *sched_threads[index];
+	spinUnlockIrqRestore(&sched_lock, flags);
+	return found ? 0 : -1;
+}
+
+//The counters of CPU "cpu"'s run queue
+void schedGetCpuStats(unsigned int cpu, sched_stats_t* stats)
+{
+	if (cpu < SMP_MAX_CPUS)
+		*stats = sched_queues[cpu].stats;
+	else
+		memset(stats, 0, sizeof(sched_stats_t));
+}
+
+//The counters of every run queue added up
+void schedGetStats(sched_stats_t* stats)
+{
+	unsigned int cpu;
+
+	memset(stats, 0, sizeof(sched_stats_t));
+	for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+	{
+		const sched_stats_t* queue = &sched_queues[cpu].stats;
+
+		stats->created += queue->created;
+		stats->reaped += queue->reaped;
+		stats->switches += queue->switches;
+		stats->preemptions += queue->preemptions;
+		stats->yields += queue->yields;
+		stats->wakeups += queue->wakeups;
+		stats->boosts += queue->boosts;
+		stats->slices += queue->slices;
+		stats->steals += queue->steals;
+		stats->ipis += queue->ipis;
+	}
+}
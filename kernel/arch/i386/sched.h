@@ -0,0 +1,129 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include "spinlock.h"
+
+//Kernel threads and a preemptive fixed-priority scheduler.
+//Every thread has its own stack (a vmm region with a guard page below it, registered with the stack table) and is
+//switched to and from by switchTask in switch.S, which saves and loads a Registers.
+//There are SCHED_PRIORITIES levels, 0 the most urgent, each with a FIFO run queue, and a bitmap of the levels that
+//have anyone waiting; the next thread is the head of the queue bsf finds in the bitmap, so picking is O(1) however
+//many threads there are. The running thread always has the most urgent priority of everything runnable: waking a
+//more urgent thread preempts it (it goes back to the front of its queue, keeping what's left of its slice).
+//Threads of the same priority take turns: each gets SCHED_SLICE_US of CPU, charged whenever it stops running,
+//and a one-shot timer sends it to the back of its queue when that runs out. The timer is only armed while someone
+//else could use the CPU, so a thread running alone isn't interrupted.
+//A thread woken from a wait queue with a boost (the keyboard's, say) runs SCHED_BOOST_IO levels more urgent than
+//its own priority, with a fresh slice, until it uses that slice up; so an interactive thread that mostly waits
+//gets the CPU as soon as its input arrives, ahead of threads of its own priority grinding through bulk work.
+//Nothing is ever switched inside an interrupt handler: a switch happens when a thread yields or blocks, or on
+//the way out of the outermost hardware interrupt once the handler has sent its EOI and the softirqs have run
+//(idtDispatch calls schedPreempt), and only if the interrupted code had interrupts on. So code that keeps
+//interrupts off is never preempted, and neither are softirqs or anything between schedPreemptDisable and
+//schedPreemptEnable.
+//Every CPU has its own run queues, bitmap, slice timer and idle thread (see smp.h for how the others are started),
+//each under a spinlock. A thread stays on the CPU it last ran on: it's woken onto that CPU's queue, and a wakeup
+//that should preempt what's running there sends that CPU a reschedule IPI. Balancing is by work stealing: a CPU
+//with nothing to run takes the most urgent waiting thread off the busiest other queue, and a thread queued behind
+//something on a busy CPU wakes an idle one to come and take it. "main" (the boot thread, which runs the shell and
+//the drivers written for one CPU) and the idle threads are pinned and never move.
+//Blocking goes through wait queues: take the queue's lock, check the condition, then schedWait; whoever makes
+//the condition true (interrupt handlers included) calls schedWakeAll, which takes the lock too, so a wakeup on
+//another CPU can't slip in between the check and the wait. Before initTasking, and in an idle thread, schedWait
+//just waits for the next interrupt, so callers loop on their condition either way. timerSleep blocks the calling
+//thread the same way.
+//A thread that returns from its entry function (or calls schedExit) is reaped by the idle thread of the CPU it
+//exited on, which frees its stack and its Task, so a Task pointer mustn't be used after the thread may have exited.
+
+#define SCHED_STACK_SIZE 0x4000
+#define SCHED_SLICE_US 10000
+#define SCHED_MAX_THREADS 32
+#define SCHED_PRIORITIES 32 //one bit each in the run queue bitmap
+#define SCHED_PRIORITY_DEFAULT 16
+#define SCHED_PRIORITY_IDLE SCHED_PRIORITIES //below every queue; the idle thread is never on one
+#define SCHED_BOOST_IO 4 //levels gained on waking from an I/O wait
+
+//thread states
+#define SCHED_RUNNING 0
+#define SCHED_READY 1 //on the run queue
+#define SCHED_BLOCKED 2 //on a wait queue
+#define SCHED_DEAD 3 //waiting to be reaped
+
+//switchTask's layout; the offsets are in switch.S
+typedef struct registers
+{
+	unsigned long eax, ebx, ecx, edx, esi, edi, esp, ebp, eip, eflags, cr3;
+}
+Registers;
+
+typedef struct Task
+{
+	Registers regs; //saved while the thread isn't running
+	struct Task* next; //run queue, wait queue or dead list
+	unsigned int id;
+	const char* name; //not copied
+	unsigned int state;
+	void (*entry)(void* arg);
+	void* arg;
+	unsigned long stack; //start of the stack region, 0 for the boot thread, which keeps the boot stack
+	unsigned long long runtime; //microseconds spent running
+	unsigned int switches; //times it was switched to
+	unsigned int preemptions; //times it was switched away from while it still wanted the CPU
+	unsigned int base_priority; //as set by schedCreate or schedSetPriority
+	unsigned int priority; //what it runs at: base_priority, or more urgent while boosted
+	unsigned long slice; //microseconds left of its slice
+	unsigned long long woken; //timerNow when it was last woken, 0 once it has run since
+	unsigned long long latency_total; //microseconds from being woken to running, over "wakeups" wakeups
+	unsigned long latency_max;
+	unsigned int wakeups;
+	unsigned int cpu; //whose run queue it's on, or last ran on
+	int pinned; //never taken by another CPU
+	unsigned int migrations; //times another CPU took it
+}
+Task;
+
+typedef struct wait_queue
+{
+	Task* head;
+	Task* tail;
+	unsigned int boost; //levels the threads it wakes are boosted by; SCHED_BOOST_IO for I/O waits
+	spinlock_t lock;
+}
+wait_queue_t;
+
+typedef struct sched_stats
+{
+	unsigned int created;
+	unsigned int reaped;
+	unsigned int switches;
+	unsigned int preemptions;
+	unsigned int yields;
+	unsigned int wakeups;
+	unsigned int boosts; //wakeups that raised a thread's priority
+	unsigned int slices; //slices that ran out
+	unsigned int steals; //threads taken from another CPU's run queue
+	unsigned int ipis; //reschedule IPIs sent on the run queue's behalf
+}
+sched_stats_t;
+
+extern void switchTask(Registers* from, Registers* to);
+
+int initTasking(void);
+unsigned long schedPrepareCpu(unsigned int cpu);
+void schedRunCpu(void) __attribute__((noreturn));
+Task* schedCreate(const char* name, void (*entry)(void* arg), void* arg, unsigned int priority);
+Task* schedCurrent(void);
+void schedSetPriority(Task* task, unsigned int priority);
+void schedYield(void);
+void schedExit(void) __attribute__((noreturn));
+void schedWait(wait_queue_t* queue);
+void schedWakeAll(wait_queue_t* queue);
+void schedWakeAllLocked(wait_queue_t* queue);
+void schedPreempt(void);
+void schedPreemptDisable(void);
+void schedPreemptEnable(void);
+int schedGetThread(unsigned int index, Task* thread);
+void schedGetCpuStats(unsigned int cpu, sched_stats_t* stats);
+void schedGetStats(sched_stats_t* stats);
+
+#endif
@@ -0,0 +1,271 @@
+#include "smp.h"
+#include "spinlock.h"
+#include "lapic.h"
+#include "acpi.h"
+#include "gdt.h"
+#include "idt.h"
+#include "paging.h"
+#include "pmm.h"
+#include "memtype.h"
+#include "sched.h"
+#include "timer.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+#include <string.h>
+
+//smp_trampoline_data's layout in smpboot.S
+typedef struct smp_trampoline
+{
+	unsigned long cr0;
+	unsigned long cr3; //physical; a copy of boot_page_directory that also maps the first 4MB where they are
+	unsigned long cr4;
+	unsigned long esp;
+	unsigned long entry;
+}
+smp_trampoline_t;
+
+static cpu_t smp_cpus[SMP_MAX_CPUS];
+static unsigned int smp_cpu_count = 1;
+static volatile unsigned int smp_booting; //the CPU the trampoline is set up for
+static spinlock_t smp_tlb_lock; //one shootdown at a time
+static volatile unsigned long smp_tlb_start;
+static volatile unsigned long smp_tlb_end;
+static volatile unsigned int smp_tlb_waiting; //CPUs that haven't flushed yet
+
+//Returns: CPU "index"'s per-CPU area with its self pointer and index filled in, for gdtLoadCpu. The BSP's is
+//online from the start
+cpu_t* smpCpuArea(unsigned int index)
+{
+	cpu_t* cpu = &smp_cpus[index % SMP_MAX_CPUS];
+
+	cpu->self = cpu;
+	cpu->index = index;
+	if (index == 0)
+		cpu->online = 1;
+	return cpu;
+}
+
+//drops this CPU's TLB entries for [start, end), or all of them, global ones included, for a long range
+static void smpFlushLocal(unsigned long start, unsigned long end)
+{
+	unsigned long page;
+	unsigned long reg;
+
+	start &= ~(unsigned long)(PMM_FRAME_SIZE - 1);
+	if ((end - start) / PMM_FRAME_SIZE <= SMP_TLB_MAX_PAGES)
+	{
+		for (page = start; page < end; page += PMM_FRAME_SIZE)
+			asm volatile("invlpg (%0)" : : "r"(page) : "memory");
+		return;
+	}
+
+	asm volatile("mov %%cr4, %0" : "=r"(reg));
+	if (reg & CR4_PGE)
+	{
+		asm volatile("mov %0, %%cr4" : : "r"(reg & ~CR4_PGE) : "memory");
+		asm volatile("mov %0, %%cr4" : : "r"(reg) : "memory");
+	}
+	else
+	{
+		asm volatile("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(reg) : : "memory");
+	}
+}
+
+//Carries out the shootdown waiting for this CPU, if there is one. Called from the IPI, and by anything spinning,
+//which may have interrupts off. Nothing can be waiting before the APs start, which also keeps it from touching GS
+//before gdtInit has loaded it (setup's prompts poll the keyboard that early)
+void smpTlbPoll(void)
+{
+	unsigned long flags;
+	cpu_t* self;
+
+	if (smp_cpu_count == 1)
+		return;
+
+	flags = cpuIrqSave();
+	self = smpSelf();
+	if (self->tlb_request)
+	{
+		self->tlb_request = 0;
+		smpFlushLocal(smp_tlb_start, smp_tlb_end);
+		self->stats.tlb_flushes++;
+		__atomic_fetch_sub(&smp_tlb_waiting, 1, __ATOMIC_SEQ_CST);
+	}
+	cpuIrqRestore(flags);
+}
+
+static void smpTlbInterrupt(interrupt_frame_t* frame)
+{
+	(void)frame;
+	smpSelf()->stats.tlb_ipis++;
+	smpTlbPoll();
+	lapicEOI();
+}
+
+//nothing to do here: idtDispatch calls schedPreempt on the way out
+static void smpRescheduleInterrupt(interrupt_frame_t* frame)
+{
+	(void)frame;
+	smpSelf()->stats.resched_ipis++;
+	lapicEOI();
+}
+
+//Makes every other online CPU drop its TLB entries for the kernel addresses [start, end), and waits until they
+//have; the caller has already changed the page tables and flushed its own. Interrupts can be on or off
+void smpFlushTlb(unsigned long start, unsigned long end)
+{
+	unsigned long flags;
+	unsigned int i, waiting = 0;
+	cpu_t* self;
+
+	if (smp_cpu_count == 1)
+		return;
+
+	flags = spinLockIrqSave(&smp_tlb_lock);
+	self = smpSelf();
+	for (i = 0; i < smp_cpu_count; i++)
+	{
+		if (i != self->index && smp_cpus[i].online)
+			waiting++;
+	}
+	if (waiting == 0)
+	{
+		spinUnlockIrqRestore(&smp_tlb_lock, flags);
+		return;
+	}
+
+	smp_tlb_start = start;
+	smp_tlb_end = end;
+	smp_tlb_waiting = waiting;
+	for (i = 0; i < smp_cpu_count; i++)
+	{
+		if (i != self->index && smp_cpus[i].online)
+		{
+			smp_cpus[i].tlb_request = 1;
+			lapicSendIpi(smp_cpus[i].apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | IDT_VECTOR_IPI_TLB);
+		}
+	}
+	//a CPU spinning with interrupts off answers from the spin loop instead
+	while (smp_tlb_waiting != 0)
+		asm volatile("pause");
+	self->stats.tlb_shootdowns++;
+	spinUnlockIrqRestore(&smp_tlb_lock, flags);
+}
+
+//Sends "vector" to CPU "index", if it's online
+void smpSendIpi(unsigned int index, unsigned int vector)
+{
+	if (index < smp_cpu_count && smp_cpus[index].online)
+		lapicSendIpi(smp_cpus[index].apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | (vector & 0xFF));
+}
+
+//Where the trampoline lands, on the new CPU's idle stack with interrupts off and the trampoline's page directory
+static void smpApEntry(void)
+{
+	cpu_t* cpu = &smp_cpus[smp_booting];
+
+	gdtLoadCpu(cpu->index, cpu);
+	asm volatile("mov %0, %%cr3" : : "r"(VIRT_TO_PHYS(boot_page_directory)) : "memory");
+	smpFlushLocal(0, ~0ul); //the trampoline's identity map may be in the TLB as global pages
+	idtLoad();
+	lapicInitCpu();
+	memtypeInitCpu();
+
+	__atomic_store_n(&cpu->online, 1, __ATOMIC_SEQ_CST);
+	schedRunCpu();
+}
+
+//Starts every other enabled processor the MADT lists, one at a time. acpiInit, timerInit (with the local APIC),
+//initTasking and ktimeInit have to have run, and interrupts have to be on
+//Returns: the number of processors running, this one included
+int smpInit(void)
+{
+	smp_trampoline_t* trampoline = PHYS_TO_VIRT(SMP_TRAMPOLINE_BASE + (smp_trampoline_data - smp_trampoline_start));
+	const acpi_cpu_t* entry;
+	unsigned long directory;
+	unsigned int* pages;
+	unsigned int i, bsp, online = 1;
+	int stuck = 0;
+
+	idtSetHandler(IDT_VECTOR_IPI_RESCHEDULE, smpRescheduleInterrupt);
+	idtSetHandler(IDT_VECTOR_IPI_TLB, smpTlbInterrupt);
+	if (lapic_registers == NULL)
+		return 1;
+	bsp = lapicId();
+	smp_cpus[0].apic_id = bsp;
+
+	directory = pmmAllocFrame();
+	if (directory == 0)
+		return 1;
+	pages = PHYS_TO_VIRT(directory);
+	memcpy(PHYS_TO_VIRT(SMP_TRAMPOLINE_BASE), smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+
+	for (i = 0; (entry = acpiGetCpu(i)) != NULL && smp_cpu_count < SMP_MAX_CPUS; i++)
+	{
+		unsigned long long deadline;
+		unsigned long esp;
+		cpu_t* cpu;
+
+		if (!(entry->flags & ACPI_MADT_CPU_ENABLED))
+			continue;
+		if (entry->apic_id == bsp)
+		{
+			smp_cpus[0].acpi_id = entry->acpi_id;
+			continue;
+		}
+
+		cpu = smpCpuArea(smp_cpu_count);
+		cpu->apic_id = entry->apic_id;
+		cpu->acpi_id = entry->acpi_id;
+		esp = schedPrepareCpu(cpu->index);
+		if (esp == 0)
+			break;
+
+		//copied for each CPU, so it has the page table behind the idle stack just made
+		memcpy(pages, boot_page_directory, PMM_FRAME_SIZE);
+		pages[0] = boot_page_directory[KERNEL_PDE_INDEX] & ~PAGE_GLOBAL;
+		asm volatile("mov %%cr0, %0" : "=r"(trampoline->cr0));
+		asm volatile("mov %%cr4, %0" : "=r"(trampoline->cr4));
+		trampoline->cr3 = directory;
+		trampoline->esp = esp;
+		trampoline->entry = (unsigned long)smpApEntry;
+		smp_booting = cpu->index;
+		smp_cpu_count++;
+
+		//INIT, then STARTUP twice; a processor that's already running ignores the second
+		lapicSendInit(cpu->apic_id);
+		timerSleep(SMP_INIT_DELAY_US);
+		lapicSendStartup(cpu->apic_id, SMP_TRAMPOLINE_BASE >> 12);
+		timerSleep(SMP_STARTUP_DELAY_US);
+		if (!cpu->online)
+			lapicSendStartup(cpu->apic_id, SMP_TRAMPOLINE_BASE >> 12);
+
+		deadline = timerNow() + SMP_START_TIMEOUT_US;
+		while (!cpu->online && timerNow() < deadline)
+			timerSleep(SMP_STARTUP_DELAY_US);
+		if (!cpu->online)
+		{
+			//it may yet start, on this trampoline and stack, so leave them be and start no others
+			stuck = 1;
+			break;
+		}
+		online++;
+	}
+
+	if (!stuck)
+		pmmFreeFrame(directory);
+	return online;
+}
+
+//Returns: how many CPUs were found and given an index, including any that never came online
+unsigned int smpCpuCount(void)
+{
+	return smp_cpu_count;
+}
+
+//Returns: the index'th CPU, for listing them, or NULL past the last one
+const cpu_t* smpGetCpu(unsigned int index)
+{
+	return index < smp_cpu_count ? &smp_cpus[index] : NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef SMP_H_
+#define SMP_H_
+
+//The other processors. smpInit starts every enabled processor the MADT lists besides the one we booted on (the
+//BSP): each is sent INIT, then a STARTUP IPI (twice, as the MP spec asks) pointing at smpboot.S, which has been
+//copied to SMP_TRAMPOLINE_BASE, the one place below 1MB a processor starting in real mode can be sent to. The
+//trampoline goes to protected mode and paging by itself and jumps to smpApEntry, on the stack of the idle thread
+//schedPrepareCpu made for that processor, which loads the GDT, IDT and page directory, enables its local APIC
+//and becomes that idle thread for good.
+//Every processor has a cpu_t, reached through GS: gdtLoadCpu gives each its own GS segment based at its cpu_t, so
+//smpSelf and smpCpuIndex are one load. They're only meaningful while the caller can't move to another CPU, that
+//is with interrupts or preemption off.
+//Processors talk through IPIs: IDT_VECTOR_IPI_RESCHEDULE makes one look at its run queue on the way out of the
+//interrupt, and smpFlushTlb makes every other one drop TLB entries for a range of kernel addresses that has been
+//unmapped or made read-only, and waits until they all have. A CPU spinning on a lock (see spinlock.h) answers
+//flush requests while it spins, so a CPU flushing with a lock held can't deadlock against one waiting for it.
+//This header is also included by smpboot.S, so only #defines outside the __ASSEMBLER__ block.
+
+#define SMP_MAX_CPUS 16
+#define SMP_TRAMPOLINE_BASE 0x8000 //physical, page aligned; the STARTUP vector is its page number
+#define SMP_INIT_DELAY_US 10000 //after INIT, before the first STARTUP
+#define SMP_STARTUP_DELAY_US 200 //between the STARTUPs
+#define SMP_START_TIMEOUT_US 100000 //how long a processor gets to come up
+#define SMP_TLB_MAX_PAGES 32 //longer ranges are flushed whole
+
+#ifndef __ASSEMBLER__
+
+typedef struct smp_cpu_stats
+{
+	unsigned int resched_ipis; //IDT_VECTOR_IPI_RESCHEDULE received
+	unsigned int tlb_ipis; //IDT_VECTOR_IPI_TLB received
+	unsigned int tlb_flushes; //shootdowns this CPU carried out, by IPI or while spinning
+	unsigned int tlb_shootdowns; //smpFlushTlb calls it made that had another CPU to ask
+}
+smp_cpu_stats_t;
+
+//the per-CPU area; self and index have to stay first, at %gs:0 and %gs:4
+typedef struct cpu
+{
+	struct cpu* self;
+	unsigned int index; //0 is the BSP; in the order they were started
+	unsigned int apic_id;
+	unsigned int acpi_id;
+	volatile unsigned int online;
+	unsigned int irq_depth; //idtDispatch's nesting
+	volatile unsigned int tlb_request; //a shootdown is waiting for this CPU to flush
+	smp_cpu_stats_t stats;
+}
+cpu_t;
+
+extern char smp_trampoline_start[], smp_trampoline_data[], smp_trampoline_end[]; //smpboot.S
+
+static inline cpu_t* smpSelf(void)
+{
+	cpu_t* self;
+	asm volatile("mov %%gs:0, %0" : "=r"(self));
+	return self;
+}
+
+static inline unsigned int smpCpuIndex(void)
+{
+	unsigned int index;
+	asm volatile("mov %%gs:4, %0" : "=r"(index));
+	return index;
+}
+
+cpu_t* smpCpuArea(unsigned int index);
+int smpInit(void);
+unsigned int smpCpuCount(void);
+const cpu_t* smpGetCpu(unsigned int index);
+void smpSendIpi(unsigned int index, unsigned int vector);
+void smpFlushTlb(unsigned long start, unsigned long end);
+void smpTlbPoll(void);
+
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+#include "softirq.h"
+#include "sched.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+static volatile unsigned int softirq_pending; //bit n: softirq n wants to run
+static softirq_handler_t softirq_handlers[SOFTIRQ_COUNT];
+static softirq_stats_t softirq_stats[SOFTIRQ_COUNT];
+static int softirq_running; //on some CPU; softirqs run on one at a time
+static unsigned int softirq_deferred; //times SOFTIRQ_MAX_ROUNDS ran out with work left
+
+void softirqRegister(unsigned int nr, softirq_handler_t handler)
+{
+	if (nr < SOFTIRQ_COUNT)
+		softirq_handlers[nr] = handler;
+}
+
+//Marks softirq "nr" pending; safe anywhere, hard interrupt handlers included
+void softirqRaise(unsigned int nr)
+{
+	if (nr >= SOFTIRQ_COUNT)
+		return;
+	__atomic_fetch_add(&softirq_stats[nr].raised, 1, __ATOMIC_RELAXED); //from any CPU
+	__atomic_fetch_or(&softirq_pending, 1u << nr, __ATOMIC_SEQ_CST);
+}
+
+//Returns: 1 if a softirq is waiting to run
+int softirqPending(void)
+{
+	return softirq_pending != 0;
+}
+
+//Runs the pending softirqs with interrupts on and returns with them the way they were. Does nothing if it's
+//already running, further up the stack or on another CPU
+void softirqRun(void)
+{
+	unsigned long flags = cpuIrqSave();
+	unsigned int rounds;
+
+	if (__atomic_exchange_n(&softirq_running, 1, __ATOMIC_ACQUIRE))
+	{
+		cpuIrqRestore(flags);
+		return;
+	}
+	schedPreemptDisable();
+
+	for (rounds = 0; softirq_pending != 0 && rounds < SOFTIRQ_MAX_ROUNDS; rounds++)
+	{
+		//take the whole mask at once; whatever is raised from here on waits for the next round
+		unsigned int pending = __atomic_exchange_n(&softirq_pending, 0, __ATOMIC_SEQ_CST);
+		unsigned int nr;
+
+		asm volatile("sti" : : : "memory");
+		while (pending != 0)
+		{
+			nr = __builtin_ctz(pending);
+			pending &= pending - 1;
+			if (softirq_handlers[nr] != NULL)
+			{
+				softirq_stats[nr].runs++;
+				softirq_handlers[nr]();
+			}
+		}
+		asm volatile("cli" : : : "memory");
+	}
+	if (softirq_pending != 0)
+		softirq_deferred++;
+
+	schedPreemptEnable();
+	__atomic_store_n(&softirq_running, 0, __ATOMIC_RELEASE);
+	cpuIrqRestore(flags);
+}
+
+void softirqGetStats(unsigned int nr, softirq_stats_t* stats)
+{
+	if (nr < SOFTIRQ_COUNT)
+		*stats = softirq_stats[nr];
+}
+
+//Returns: how often softirqRun stopped at SOFTIRQ_MAX_ROUNDS with softirqs still pending
+unsigned int softirqDeferred(void)
+{
+	return softirq_deferred;
+}
@@ -0,0 +1,38 @@
+#ifndef SOFTIRQ_H_
+#define SOFTIRQ_H_
+
+//Softirqs: the part of an interrupt's work that doesn't have to happen with interrupts off. A hardware handler
+//does the minimum and raises its softirq; idtDispatch runs the pending ones on the way out of the outermost
+//hardware interrupt, with interrupts back on, before returning to whatever was interrupted. A softirq raised
+//again while it runs goes round again, up to SOFTIRQ_MAX_ROUNDS times; what's still pending after that is left
+//for the next interrupt exit or the idle thread, so a flood can't starve the interrupted code.
+//Handlers can't sleep and don't nest, not even across CPUs: an interrupt arriving during one runs its hard handler
+//only, and the thread running them isn't preempted until they're done.
+//Each type is one bit of the pending mask, so raising an already pending softirq costs nothing and a burst of
+//interrupts is handled in one batch.
+
+#define SOFTIRQ_COUNT 8
+#define SOFTIRQ_MAX_ROUNDS 10
+
+//softirq types, in the order they're run
+#define SOFTIRQ_TIMER 0 //expired ktimer_t callbacks
+#define SOFTIRQ_BLOCK 1 //disk completions
+#define SOFTIRQ_NET 2 //received packets
+
+typedef void (*softirq_handler_t)(void);
+
+typedef struct softirq_stats
+{
+	unsigned int raised; //times the bit was set (whether it already was or not)
+	unsigned int runs; //times the handler ran
+}
+softirq_stats_t;
+
+void softirqRegister(unsigned int nr, softirq_handler_t handler);
+void softirqRaise(unsigned int nr);
+int softirqPending(void);
+void softirqRun(void);
+void softirqGetStats(unsigned int nr, softirq_stats_t* stats);
+unsigned int softirqDeferred(void);
+
+#endif
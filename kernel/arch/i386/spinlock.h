@@ -0,0 +1,104 @@
+#ifndef SPINLOCK_H_
+#define SPINLOCK_H_
+
+//Spinlocks, for anything more than one CPU gets at. Turning interrupts off only keeps out this CPU's interrupt
+//handlers; the lock keeps out the other CPUs. The IrqSave variants do both, and are what to use for data an
+//interrupt handler also touches: they wait with interrupts the way the caller had them, only turning them off once
+//the lock is theirs, so a CPU waiting for a lock still takes IPIs. Every wait also answers TLB shootdowns (see
+//smp.h), which is what a CPU waiting with interrupts off would otherwise hold up forever.
+//An rspinlock_t can be taken again by the CPU that holds it, and is released when every taking has been.
+
+#include "cpu.h"
+#include "smp.h"
+
+typedef struct spinlock
+{
+	volatile unsigned int locked;
+}
+spinlock_t;
+
+typedef struct rspinlock
+{
+	spinlock_t lock;
+	volatile unsigned int owner; //smpCpuIndex + 1 of the holder, 0 if free
+	unsigned int depth;
+}
+rspinlock_t;
+
+//Returns: 1 if the lock was free and is now the caller's
+static inline int spinTryLock(spinlock_t* lock)
+{
+	return __atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline void spinWait(spinlock_t* lock)
+{
+	while (lock->locked)
+	{
+		asm volatile("pause");
+		smpTlbPoll();
+	}
+}
+
+//For when interrupts are already off, or the lock is never taken by an interrupt handler
+static inline void spinLock(spinlock_t* lock)
+{
+	while (!spinTryLock(lock))
+		spinWait(lock);
+}
+
+static inline void spinUnlock(spinlock_t* lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+//Takes "lock" and turns interrupts off
+//Returns: EFLAGS from before, for spinUnlockIrqRestore
+static inline unsigned long spinLockIrqSave(spinlock_t* lock)
+{
+	unsigned long flags = cpuIrqSave();
+
+	while (!spinTryLock(lock))
+	{
+		cpuIrqRestore(flags);
+		spinWait(lock);
+		flags = cpuIrqSave();
+	}
+	return flags;
+}
+
+static inline void spinUnlockIrqRestore(spinlock_t* lock, unsigned long flags)
+{
+	spinUnlock(lock);
+	cpuIrqRestore(flags);
+}
+
+static inline unsigned long rspinLockIrqSave(rspinlock_t* lock)
+{
+	unsigned long flags = cpuIrqSave();
+
+	//with interrupts off, the owner can only be us if we took it further up
+	if (lock->owner == smpCpuIndex() + 1)
+	{
+		lock->depth++;
+		return flags;
+	}
+	cpuIrqRestore(flags);
+
+	flags = spinLockIrqSave(&lock->lock);
+	lock->owner = smpCpuIndex() + 1;
+	lock->depth = 1;
+	return flags;
+}
+
+static inline void rspinUnlockIrqRestore(rspinlock_t* lock, unsigned long flags)
+{
+	if (--lock->depth == 0)
+	{
+		lock->owner = 0;
+		spinUnlock(&lock->lock);
+	}
+	cpuIrqRestore(flags);
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include "stack.h"
+#include "paging.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+#include <stdio.h>
+
+extern char boot_stack_guard[]; //boot.S
+extern char boot_stack_bottom[];
+extern char boot_stack_top[];
+
+static kstack_t stacks[STACK_MAX_STACKS];
+static unsigned int stack_count;
+
+//Returns: 0 on success, -1 if the table is full
+int stackRegister(const char* name, unsigned long bottom, unsigned long top, unsigned int flags)
+{
+	unsigned long irq = rspinLockIrqSave(&mm_lock);
+
+	if (stack_count == STACK_MAX_STACKS)
+	{
+		rspinUnlockIrqRestore(&mm_lock, irq);
+		return -1;
+	}
+
+	stacks[stack_count].name = name;
+	stacks[stack_count].bottom = bottom;
+	stacks[stack_count].top = top;
+	stacks[stack_count].flags = flags;
+	stack_count++;
+	rspinUnlockIrqRestore(&mm_lock, irq);
+	return 0;
+}
+
+void stackUnregister(unsigned long bottom)
+{
+	unsigned long irq = rspinLockIrqSave(&mm_lock);
+	unsigned int i;
+
+	for (i = 0; i < stack_count; i++)
+	{
+		if (stacks[i].bottom == bottom)
+		{
+			stacks[i] = stacks[--stack_count];
+			break;
+		}
+	}
+	rspinUnlockIrqRestore(&mm_lock, irq);
+}
+
+//Returns: the most bytes of "stack" ever in use
+unsigned long stackPeak(const kstack_t* stack)
+{
+	unsigned long address = stack->bottom;
+
+	if (stack->flags & STACK_LAZY)
+	{
+		while (address < stack->top && !vmmIsResident(address))
+			address += 0x1000;
+		while (address < stack->top && *(unsigned int*)address == 0)
+			address += sizeof(unsigned int);
+	}
+	else if (stack->flags & STACK_PAINTED)
+	{
+		while (address < stack->top && *(unsigned int*)address == STACK_PAINT)
+			address += sizeof(unsigned int);
+	}
+	else
+		return 0;
+
+	return stack->top - address;
+}
+
+//Returns: the index'th stack, for listing them, or NULL past the last one
+const kstack_t* stackGet(unsigned int index)
+{
+	return index < stack_count ? &stacks[index] : NULL;
+}
+
+//Returns: the stack whose guard page "esp" has reached, or NULL
+const kstack_t* stackFindOverflow(unsigned long esp)
+{
+	unsigned int i;
+
+	for (i = 0; i < stack_count; i++)
+	{
+		if (esp + STACK_GUARD_SIZE >= stacks[i].bottom && esp < stacks[i].bottom + STACK_OVERFLOW_SLACK)
+			return &stacks[i];
+	}
+	return NULL;
+}
+
+//Paints the unused part of the boot stack and unmaps its guard page. Needs the frame allocator, for the page
+//table the guard page's 4MB mapping gets split into
+void stackInit(void)
+{
+	unsigned int* word = (unsigned int*)boot_stack_bottom;
+	unsigned long esp;
+
+	//everything below esp is free; stay a little clear of it, since this loop's own frame is right there
+	asm volatile("mov %%esp, %0" : "=r"(esp));
+	while ((unsigned long)word < esp - 64)
+		*word++ = STACK_PAINT;
+
+	stackRegister("boot", (unsigned long)boot_stack_bottom, (unsigned long)boot_stack_top, STACK_PAINTED);
+	if (pagingUnmapPage((unsigned long)boot_stack_guard) != 0)
+		printf("stack: no frame to split the boot stack's mapping, it has no guard page%n");
+}
@@ -0,0 +1,38 @@
+#ifndef STACK_H_
+#define STACK_H_
+
+//Kernel stack registry, for high-water marks and overflow reports.
+//Painted stacks (the boot stack) are filled with STACK_PAINT up front; the deepest point reached is the lowest word
+//that no longer holds the pattern. Lazy stacks live in vmm regions and start out unbacked, so instead of painting
+//them (which would back every page) the deepest point is found from the lowest page that has a frame, refined to
+//the lowest nonzero word in it since demand-zero pages start out as zeros.
+//Every registered stack has an unmapped guard page right below it; running into it ends in a double fault, whose
+//handler uses stackFindOverflow to name the stack.
+//Build with "make STACK_USAGE=1 stack-usage.txt" in kernel/ for gcc's static per-function frame sizes.
+
+#define STACK_PAINT 0x57AC57AC
+#define STACK_MAX_STACKS 32
+#define STACK_GUARD_SIZE 0x1000
+#define STACK_OVERFLOW_SLACK 256 //how close to the bottom esp can be at a double fault and still count as an overflow
+
+//stack flags
+#define STACK_PAINTED 0x01
+#define STACK_LAZY 0x02
+
+typedef struct kstack
+{
+	const char* name; //not copied
+	unsigned long bottom; //lowest usable byte
+	unsigned long top; //one past the highest
+	unsigned int flags;
+}
+kstack_t;
+
+void stackInit(void);
+int stackRegister(const char* name, unsigned long bottom, unsigned long top, unsigned int flags);
+void stackUnregister(unsigned long bottom);
+unsigned long stackPeak(const kstack_t* stack);
+const kstack_t* stackGet(unsigned int index);
+const kstack_t* stackFindOverflow(unsigned long esp);
+
+#endif
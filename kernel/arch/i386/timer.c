@@ -0,0 +1,403 @@
+#include "timer.h"
+#include "lapic.h"
+#include "pic.h"
+#include "idt.h"
+#include "cpu.h"
+#include "softirq.h"
+#include "sched.h"
+#include "smp.h"
+#include "ktime.h"
+#include "spinlock.h"
+#include "lib_asm.h"
+#include "lib_c.h"
+
+#define TIMER_US_PER_SECOND 1000000ull
+
+//PIT command bytes
+#define TIMER_PIT_CHANNEL0_ONESHOT 0x30 //channel 0, low then high byte, mode 0 (interrupt on terminal count)
+#define TIMER_PIT_CHANNEL2_ONESHOT 0xB0 //the same on channel 2
+#define TIMER_PIT_READBACK_CHANNEL0 0xC2 //latch channel 0's status and count
+#define TIMER_PIT_STATUS_OUTPUT 0x80 //terminal count reached
+#define TIMER_PIT_STATUS_NULL 0x40 //new count not loaded yet
+
+#define TIMER_PIT_GATE_ENABLE 0x01
+#define TIMER_PIT_GATE_SPEAKER 0x02
+#define TIMER_PIT_GATE_OUTPUT 0x20
+
+static ktimer_t* timer_pending;
+static unsigned long long timer_base_us; //the clock when the device was last programmed
+static unsigned long long timer_base_rem; //what didn't make a whole microsecond then, in ticks * 1000000
+static unsigned long timer_programmed; //ticks the device was last set to count
+static unsigned long timer_max_ticks;
+static timer_stats_t timer_stats;
+static int timer_expired; //SOFTIRQ_TIMER is raised for timers that are due and hasn't taken them yet
+static unsigned long long timer_base_ktime; //ktimeGet at the last fold, if timer_base_valid
+static int timer_base_valid;
+static unsigned long long timer_last; //the latest timerNow handed out, which none after go below
+static spinlock_t timer_lock; //everything above, and the device
+
+//Returns: 1 if the calling CPU can read and program the device
+static int timerOwner(void)
+{
+	return timer_stats.source != TIMER_SOURCE_LAPIC || smpCpuIndex() == 0;
+}
+
+//Returns: device ticks since it was last programmed, at most what it was programmed for
+static unsigned long timerElapsed(void)
+{
+	if (timer_stats.source == TIMER_SOURCE_LAPIC)
+		return timer_programmed - lapicRead(LAPIC_TIMER_CURRENT);
+
+	outb(TIMER_PIT_COMMAND, TIMER_PIT_READBACK_CHANNEL0);
+	unsigned char status = inb(TIMER_PIT_CHANNEL0);
+	unsigned long count = inb(TIMER_PIT_CHANNEL0);
+	count |= (unsigned long)inb(TIMER_PIT_CHANNEL0) << 8;
+
+	if (status & TIMER_PIT_STATUS_OUTPUT)
+		return timer_programmed;
+	if ((status & TIMER_PIT_STATUS_NULL) || count > timer_programmed)
+		return 0;
+	return timer_programmed - count;
+}
+
+//folds the ticks counted so far into the clock and starts the device over for the next deadline (or for as long
+//as it and TIMER_MAX_IDLE_US allow). A handful of ticks go missing between reading the device and restarting it
+static void timerReprogram(void)
+{
+	unsigned long long scaled = (unsigned long long)timerElapsed() * TIMER_US_PER_SECOND + timer_base_rem;
+	unsigned long long delta = TIMER_MAX_IDLE_US;
+	unsigned long long ticks;
+
+	timer_base_us += scaled / timer_stats.frequency;
+	timer_base_rem = scaled % timer_stats.frequency;
+	timer_base_valid = ktimeIndependent();
+	if (timer_base_valid)
+		timer_base_ktime = ktimeGet();
+
+	//due timers are the softirq's; until it has them, counting to their deadline would only interrupt again at once
+	if (timer_pending != NULL && !timer_expired)
+		delta = timer_pending->deadline > timer_base_us ? timer_pending->deadline - timer_base_us : 0;
+	if (delta > TIMER_MAX_IDLE_US)
+		delta = TIMER_MAX_IDLE_US;
+
+	//rounded up, so a timer never fires before its deadline
+	ticks = (delta * timer_stats.frequency + TIMER_US_PER_SECOND - 1) / TIMER_US_PER_SECOND;
+	if (ticks == 0)
+		ticks = 1;
+	if (ticks > timer_max_ticks)
+		ticks = timer_max_ticks;
+	timer_programmed = ticks;
+
+	if (timer_stats.source == TIMER_SOURCE_LAPIC)
+	{
+		lapicWrite(LAPIC_LVT_TIMER, IDT_VECTOR_LAPIC_TIMER);
+		lapicWrite(LAPIC_TIMER_INITIAL, ticks);
+	}
+	else
+	{
+		outb(TIMER_PIT_COMMAND, TIMER_PIT_CHANNEL0_ONESHOT);
+		outb(TIMER_PIT_CHANNEL0, ticks & 0xFF);
+		outb(TIMER_PIT_CHANNEL0, ticks >> 8);
+	}
+	timer_stats.programs++;
+}
+
+//timerReprogram from whichever CPU; timer_lock has to be held
+static void timerUpdate(void)
+{
+	if (timerOwner())
+		timerReprogram();
+	else
+		smpSendIpi(0, IDT_VECTOR_IPI_TIMER);
+}
+
+//Only brings the clock up to date and restarts the device; the callbacks of due timers are left to SOFTIRQ_TIMER
+static void timerInterrupt(interrupt_frame_t* frame)
+{
+	(void)frame;
+	spinLock(&timer_lock);
+	timer_stats.interrupts++;
+	timerReprogram();
+	if (!timer_expired && timer_pending != NULL && timer_pending->deadline <= timer_base_us)
+	{
+		timer_expired = 1;
+		softirqRaise(SOFTIRQ_TIMER);
+		timerReprogram();
+	}
+	spinUnlock(&timer_lock);
+}
+
+//SOFTIRQ_TIMER: runs the callbacks of the timers that are due, one at a time with interrupts on, then sets the
+//device for the next deadline
+static void timerSoftirq(void)
+{
+	unsigned long long now = timerNow();
+	unsigned long flags = spinLockIrqSave(&timer_lock);
+
+	while (timer_pending != NULL && timer_pending->deadline <= now)
+	{
+		ktimer_t* timer = timer_pending;
+		timer_pending = timer->next;
+		timer->next = NULL;
+		timer->pending = 0;
+		timer_stats.fired++;
+		spinUnlockIrqRestore(&timer_lock, flags);
+
+		timer->callback(timer);
+
+		flags = spinLockIrqSave(&timer_lock);
+	}
+
+	timer_expired = 0;
+	timerUpdate();
+	spinUnlockIrqRestore(&timer_lock, flags);
+}
+
+static void timerLapicInterrupt(interrupt_frame_t* frame)
+{
+	timerInterrupt(frame);
+	lapicEOI();
+}
+
+//another CPU changed the earliest deadline
+static void timerIpiInterrupt(interrupt_frame_t* frame)
+{
+	(void)frame;
+	spinLock(&timer_lock);
+	timerReprogram();
+	spinUnlock(&timer_lock);
+	lapicEOI();
+}
+
+//Loads PIT channel 2 with "count" ticks of TIMER_PIT_HZ (TIMER_PIT_MAX_COUNT at most) with its gate held low, so it
+//doesn't start until timerPitRun. Interrupts should be off from here until timerPitRun returns
+//Returns: the gate port as it was, for timerPitRun
+unsigned char timerPitArm(unsigned long count)
+{
+	unsigned char gate = inb(TIMER_PIT_GATE);
+
+	outb(TIMER_PIT_GATE, gate & ~(TIMER_PIT_GATE_ENABLE | TIMER_PIT_GATE_SPEAKER));
+	outb(TIMER_PIT_COMMAND, TIMER_PIT_CHANNEL2_ONESHOT);
+	outb(TIMER_PIT_CHANNEL2, count & 0xFF);
+	outb(TIMER_PIT_CHANNEL2, count >> 8);
+	return gate;
+}
+
+//Starts the count timerPitArm loaded, spins until it runs out and puts the gate port back. Whatever is being
+//measured against it should be read right before and right after
+void timerPitRun(unsigned char gate)
+{
+	outb(TIMER_PIT_GATE, (gate & ~TIMER_PIT_GATE_SPEAKER) | TIMER_PIT_GATE_ENABLE);
+	while (!(inb(TIMER_PIT_GATE) & TIMER_PIT_GATE_OUTPUT))
+		;
+	outb(TIMER_PIT_GATE, gate);
+}
+
+//Returns: local APIC timer ticks per second, measured against PIT channel 2
+static unsigned long timerCalibrateLapic(void)
+{
+	unsigned long count = (unsigned long long)TIMER_CALIBRATE_US * TIMER_PIT_HZ / TIMER_US_PER_SECOND;
+	unsigned char gate;
+	unsigned int current;
+
+	lapicWrite(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapicWrite(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | IDT_VECTOR_LAPIC_TIMER);
+
+	gate = timerPitArm(count);
+	lapicWrite(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+	timerPitRun(gate);
+	current = lapicRead(LAPIC_TIMER_CURRENT);
+
+	lapicWrite(LAPIC_TIMER_INITIAL, 0);
+	return (unsigned long long)(0xFFFFFFFF - current) * TIMER_PIT_HZ / count;
+}
+
+//Picks the local APIC timer if there is one, the PIT otherwise, and starts the clock at 0. picInit and vmmInit
+//have to have run
+//Returns: TIMER_SOURCE_LAPIC or TIMER_SOURCE_PIT
+int timerInit(void)
+{
+	unsigned long flags = spinLockIrqSave(&timer_lock);
+
+	if (timer_stats.source != TIMER_SOURCE_NONE)
+	{
+		spinUnlockIrqRestore(&timer_lock, flags);
+		return timer_stats.source;
+	}
+
+	if (lapicInit() == 0)
+	{
+		timer_stats.frequency = timerCalibrateLapic();
+		if (timer_stats.frequency != 0)
+		{
+			timer_stats.source = TIMER_SOURCE_LAPIC;
+			timer_max_ticks = 0xFFFFFFFF;
+			idtSetHandler(IDT_VECTOR_LAPIC_TIMER, timerLapicInterrupt);
+			idtSetHandler(IDT_VECTOR_IPI_TIMER, timerIpiInterrupt);
+		}
+	}
+
+	if (timer_stats.source == TIMER_SOURCE_NONE)
+	{
+		timer_stats.source = TIMER_SOURCE_PIT;
+		timer_stats.frequency = TIMER_PIT_HZ;
+		timer_max_ticks = TIMER_PIT_MAX_COUNT;
+		picSetHandler(TIMER_PIT_IRQ, timerInterrupt);
+	}
+
+	softirqRegister(SOFTIRQ_TIMER, timerSoftirq);
+	timerReprogram();
+	spinUnlockIrqRestore(&timer_lock, flags);
+	return timer_stats.source;
+}
+
+//Returns: microseconds since timerInit, or 0 before it
+unsigned long long timerNow(void)
+{
+	unsigned long long now;
+	unsigned long flags;
+
+	if (timer_stats.source == TIMER_SOURCE_NONE)
+		return 0;
+
+	flags = spinLockIrqSave(&timer_lock);
+	if (timerOwner())
+		now = timer_base_us + ((unsigned long long)timerElapsed() * TIMER_US_PER_SECOND + timer_base_rem) / timer_stats.frequency;
+	else if (timer_base_valid)
+		now = timer_base_us + (ktimeGet() - timer_base_ktime) / 1000;
+	else
+		now = timer_base_us;
+
+	//the two clocks drift apart a little between folds
+	if (now < timer_last)
+		now = timer_last;
+	timer_last = now;
+	spinUnlockIrqRestore(&timer_lock, flags);
+	return now;
+}
+
+//unlinks a pending timer; timer_lock has to be held
+static void timerUnlink(ktimer_t* timer)
+{
+	ktimer_t** link = &timer_pending;
+
+	while (*link != NULL && *link != timer)
+		link = &(*link)->next;
+	if (*link != NULL)
+		*link = timer->next;
+	timer->next = NULL;
+	timer->pending = 0;
+}
+
+//Arms "timer" to call its callback once timerNow reaches "deadline"; a timer that's already pending is moved
+void timerAdd(ktimer_t* timer, unsigned long long deadline)
+{
+	unsigned long flags = spinLockIrqSave(&timer_lock);
+	ktimer_t** link = &timer_pending;
+
+	if (timer->pending)
+		timerUnlink(timer);
+
+	while (*link != NULL && (*link)->deadline <= deadline)
+		link = &(*link)->next;
+	timer->deadline = deadline;
+	timer->next = *link;
+	timer->pending = 1;
+	*link = timer;
+
+	//only a new earliest deadline changes what the device should be counting to
+	if (timer_pending == timer && timer_stats.source != TIMER_SOURCE_NONE)
+		timerUpdate();
+	spinUnlockIrqRestore(&timer_lock, flags);
+}
+
+//Disarms "timer" if it's pending. The device may still go off for it, which does no harm
+void timerCancel(ktimer_t* timer)
+{
+	unsigned long flags = spinLockIrqSave(&timer_lock);
+
+	if (timer->pending)
+		timerUnlink(timer);
+	spinUnlockIrqRestore(&timer_lock, flags);
+}
+
+typedef struct timer_sleeper
+{
+	volatile int done;
+	wait_queue_t wait;
+}
+timer_sleeper_t;
+
+//"done" changes under the wait queue's lock: the sleeper returns, and its stack with the queue on it goes, as soon
+//as it sees it
+static void timerWake(ktimer_t* timer)
+{
+	timer_sleeper_t* sleeper = timer->data;
+	unsigned long flags = spinLockIrqSave(&sleeper->wait.lock);
+
+	sleeper->done = 1;
+	schedWakeAllLocked(&sleeper->wait);
+	spinUnlockIrqRestore(&sleeper->wait.lock, flags);
+}
+
+//Waits at least "microseconds". With interrupts on, the calling thread blocks until the timer for the deadline
+//wakes it (before initTasking, the CPU halts instead); with them off, the device is polled. Returns at once before
+//timerInit
+void timerSleep(unsigned long microseconds)
+{
+	unsigned long long deadline;
+	unsigned long flags;
+
+	if (timer_stats.source == TIMER_SOURCE_NONE)
+		return;
+
+	deadline = timerNow() + microseconds;
+	flags = cpuIrqSave();
+
+	if (!(flags & CPU_EFLAGS_IF))
+	{
+		while (timerNow() < deadline)
+		{
+			//nothing will take the interrupt, so restart the device here or the clock stops when it runs out; on
+			//another CPU than the device's, the BSP takes it as usual
+			spinLock(&timer_lock);
+			if (timerOwner() && timerElapsed() >= timer_programmed)
+				timerReprogram();
+			spinUnlock(&timer_lock);
+			smpTlbPoll(); //the IPI can't get in either
+		}
+		cpuIrqRestore(flags);
+		return;
+	}
+
+	timer_sleeper_t sleeper;
+	ktimer_t timer;
+	sleeper.done = 0;
+	sleeper.wait.head = NULL;
+	sleeper.wait.tail = NULL;
+	sleeper.wait.boost = 0;
+	sleeper.wait.lock.locked = 0;
+	timer.callback = timerWake;
+	timer.data = &sleeper;
+	timer.pending = 0;
+	timerAdd(&timer, deadline);
+
+	spinLock(&sleeper.wait.lock);
+	while (!sleeper.done)
+	{
+		timer_stats.halts++;
+		schedWait(&sleeper.wait);
+	}
+	spinUnlock(&sleeper.wait.lock);
+	cpuIrqRestore(flags);
+}
+
+void timerSleepMs(unsigned long milliseconds)
+{
+	timerSleep(milliseconds * 1000);
+}
+
+void timerGetStats(timer_stats_t* stats)
+{
+	*stats = timer_stats;
+}
@@ -0,0 +1,66 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+//One-shot timers and the clock behind them. There's no periodic tick: the timer device (the local APIC timer when
+//there is one, calibrated against the PIT, otherwise PIT channel 0) is programmed for the earliest pending deadline
+//only, and with nothing pending, for the longest interval it or TIMER_MAX_IDLE_US allows, which is just to keep
+//the clock from running out. The clock is the device's own count: each interrupt (or reprogram) adds the ticks
+//that went by to a running total, and timerNow adds what the device has counted since.
+//The interrupt itself only keeps the clock; due timers are taken off the list and their callbacks run by the
+//SOFTIRQ_TIMER softirq, with interrupts on.
+//timerSleep blocks the calling thread until its deadline passes (see schedWait); with interrupts off (in panic,
+//say) it polls the device instead, so waits have real lengths wherever they happen.
+//timerPitArm and timerPitRun time a fixed interval on PIT channel 2, for calibrating other counters against.
+//A local APIC timer is the BSP's own, so only the BSP reads or programs it: another CPU that moves the earliest
+//deadline sends the BSP IDT_VECTOR_IPI_TIMER to do it, and reads the clock as the last fold plus how far ktimeGet
+//has gone since (just the last fold, when ktime has nothing but this clock to go on). The PIT can be read from
+//anywhere. Everything is under one spinlock.
+
+#define TIMER_PIT_HZ 1193182
+#define TIMER_PIT_CHANNEL0 0x40
+#define TIMER_PIT_CHANNEL2 0x42
+#define TIMER_PIT_COMMAND 0x43
+#define TIMER_PIT_GATE 0x61 //channel 2 gate (bit 0) and output (bit 5), and the speaker enable (bit 1)
+#define TIMER_PIT_IRQ 0
+#define TIMER_PIT_MAX_COUNT 0xFFFF
+
+#define TIMER_CALIBRATE_US 10000 //how long the local APIC timer is measured against PIT channel 2
+#define TIMER_MAX_IDLE_US 1000000 //longest the device is left alone when nothing is pending
+
+//timerInit's pick
+#define TIMER_SOURCE_NONE 0
+#define TIMER_SOURCE_PIT 1
+#define TIMER_SOURCE_LAPIC 2
+
+typedef struct ktimer
+{
+	unsigned long long deadline; //microseconds on the timerNow clock
+	void (*callback)(struct ktimer* timer); //runs in SOFTIRQ_TIMER, so it mustn't sleep
+	void* data; //for the callback
+	struct ktimer* next; //pending list, sorted by deadline
+	int pending;
+}
+ktimer_t;
+
+typedef struct timer_stats
+{
+	unsigned int source;
+	unsigned long frequency; //device ticks per second
+	unsigned int interrupts;
+	unsigned int fired; //timers whose callbacks ran
+	unsigned int programs; //times the device was (re)programmed
+	unsigned int halts; //times timerSleep blocked or halted
+}
+timer_stats_t;
+
+int timerInit(void);
+unsigned long long timerNow(void);
+void timerAdd(ktimer_t* timer, unsigned long long deadline);
+void timerCancel(ktimer_t* timer);
+void timerSleep(unsigned long microseconds);
+void timerSleepMs(unsigned long milliseconds);
+void timerGetStats(timer_stats_t* stats);
+unsigned char timerPitArm(unsigned long count);
+void timerPitRun(unsigned char gate);
+
+#endif
@@ -16,6 +16,28 @@
 #include <kernel/tty.h>
 
 #include "vga.h"
+#include "fatcheck.h"
+#include "pmm.h"
+#include "kheap.h"
+#include "paging.h"
+#include "idt.h"
+#include "pic.h"
+#include "timer.h"
+#include "ktime.h"
+#include "acpi.h"
+#include "hpet.h"
+#include "keyboard.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "sched.h"
+#include "smp.h"
+#include "vmm.h"
+#include "arena.h"
+#include "gdt.h"
+#include "stack.h"
+#include "memtype.h"
+#include "dma.h"
+#include "meminfo.h"
 
 
 #define UART0_BASE 0x101f0000
@@ -54,7 +76,7 @@ void uart_puts(const char *str) {
 
 static const size_t VGA_WIDTH = 80;
 static const size_t VGA_HEIGHT = 25;
-static uint16_t* const VGA_MEMORY = (uint16_t*) 0xB8000;
+static uint16_t* const VGA_MEMORY = (uint16_t*) PHYS_TO_VIRT(0xB8000);
 
 static size_t terminal_row;
 static size_t terminal_column;
@@ -69,10 +91,20 @@ static inline char* subversion = "2.5.2";
 
 static inline char* username = "potato";
 static inline char* hostname = "live";
+static char username_buffer[32];
+
+#define SHELL_ARENA_SIZE 0x400000 //per command scratch; fatcheck takes the most, up to FATCHECK_WORK_SIZE
+#define BOOT_ARENA_SIZE 0x100000 //per boot step scratch
+
+static arena_t shell_arena;
+static arena_t boot_arena;
 
 #define MAX_EVENTS 10000
+#define BOOT_EVENTS 64 //the log starts in this static array and moves to the heap once it fills up
 
-char* eventlog[MAX_EVENTS] = {"test"};
+static char* boot_eventlog[BOOT_EVENTS] = {"test"};
+char** eventlog = boot_eventlog;
+static int eventlog_capacity = BOOT_EVENTS;
 int size = 1;
 
 enum taskstate {
@@ -82,7 +114,19 @@ enum taskstate {
 };
 
 void addevent(char* new_event) {
-    if (size < MAX_EVENTS) {
+    if (size == eventlog_capacity && eventlog_capacity < MAX_EVENTS) {
+        int capacity = eventlog_capacity * 2 < MAX_EVENTS ? eventlog_capacity * 2 : MAX_EVENTS;
+        char** grown = kmalloc(capacity * sizeof(char*));
+        if (grown != NULL) {
+            memcpy(grown, eventlog, size * sizeof(char*));
+            if (eventlog != boot_eventlog) {
+                kfree(eventlog);
+            }
+            eventlog = grown;
+            eventlog_capacity = capacity;
+        }
+    }
+    if (size < eventlog_capacity) {
         eventlog[size] = new_event;
         size++;
     }
@@ -122,6 +166,10 @@ char* task(char* name, int state) {
 
 void shutdown() {
     task("Attempting to shutdown computer...", 0);
+    task("Shutdown computer using ACPI...", 0);
+
+    acpiShutdown();
+
     task("Shutdown computer using old QEMU...", 0);
 	
 	outw(0xB004, 0x2000);
@@ -165,10 +213,271 @@ size_t input_buffer_index = 0;
 
 bool waitwrite;
 
+#define WAITWRITE_DELAY_US 100 //per character while waitwrite is on, and per cell when a screen is filled
+#define PANIC_REBOOT_MS 10000 //how long the panic screen's timeout bar takes to fill
+#define BEEP_MS 250
+#define VGA_SETTLE_MS 100
+
+
+void list_mounts() {
+    for (int i = 0; i < FAT_MAX_VOLUMES; i++) {
+        fat_volume_t* vol = &fat_volumes[i];
+        if (vol->mounted) {
+            terminal_newline();
+            printf("%c: FAT%u on drive %u, sector %u, %u sectors", vol->letter, vol->fat_type, vol->drive, vol->part_start_lba, vol->part_length);
+        }
+    }
+}
+
+void list_slabs() {
+    kmem_cache_t* cache;
+    kmem_cache_stats_t large;
+
+    terminal_newline();
+    printf("cache         size active peak slabs allocs frees fail");
+    for (unsigned int i = 0; (cache = kmemCacheGet(i)) != NULL; i++) {
+        terminal_newline();
+        printf("%s", cache->name);
+        for (size_t pad = strlen(cache->name); pad < 13; pad++) {
+            printf(" ");
+        }
+        printf("%u %u %u %u %u %u %u", cache->object_size, cache->stats.active, cache->stats.peak_active, cache->stats.slabs, cache->stats.allocs, cache->stats.frees, cache->stats.failures);
+    }
+    kmallocGetLargeStats(&large);
+    terminal_newline();
+    printf("large (frames) %u %u %u %u %u %u", large.active, large.peak_active, large.slabs, large.allocs, large.frees, large.failures);
+}
+
+void list_stacks() {
+    const kstack_t* stack;
+
+    terminal_newline();
+    printf("stack         size  peak  free");
+    for (unsigned int i = 0; (stack = stackGet(i)) != NULL; i++) {
+        unsigned long size = stack->top - stack->bottom;
+        unsigned long peak = stackPeak(stack);
+        terminal_newline();
+        printf("%s", stack->name);
+        for (size_t pad = strlen(stack->name); pad < 13; pad++) {
+            printf(" ");
+        }
+        printf(" %u %u %u", (unsigned int)size, (unsigned int)peak, (unsigned int)(size - peak));
+    }
+}
+
+void list_threads() {
+    static const char* const states[] = { "running", "ready", "blocked", "dead" };
+    Task thread;
+    sched_stats_t stats;
+
+    terminal_newline();
+    printf("id name      state cpu pri ms switches preempted wakeups latency avg/max us");
+    for (unsigned int i = 0; schedGetThread(i, &thread) == 0; i++) {
+        terminal_newline();
+        printf("%u %s", thread.id, thread.name);
+        for (size_t pad = strlen(thread.name); pad < 9; pad++) {
+            printf(" ");
+        }
+        printf(" %s %u%s %u/%u %u %u %u", states[thread.state], thread.cpu, thread.pinned ? "*" : "", thread.priority, thread.base_priority, (unsigned int)(thread.runtime / 1000), thread.switches, thread.preemptions);
+        printf(" %u %u/%u", thread.wakeups, thread.wakeups != 0 ? (unsigned int)(thread.latency_total / thread.wakeups) : 0, (unsigned int)thread.latency_max);
+    }
+    schedGetStats(&stats);
+    terminal_newline();
+    printf("%u switches, %u preemptions, %u yields, %u slices used up, %u wakeups (%u boosted); %u threads created, %u reaped", stats.switches, stats.preemptions, stats.yields, stats.slices, stats.wakeups, stats.boosts, stats.created, stats.reaped);
+}
+
+void list_cpus() {
+    const cpu_t* cpu;
+    sched_stats_t stats;
+
+    terminal_newline();
+    printf("cpu apic acpi state   switches steals ipis sent/resched/tlb tlb flushes/shootdowns");
+    for (unsigned int i = 0; (cpu = smpGetCpu(i)) != NULL; i++) {
+        schedGetCpuStats(i, &stats);
+        terminal_newline();
+        printf("%u %u %u %s %u %u", cpu->index, cpu->apic_id, cpu->acpi_id, cpu->online ? "online " : "stuck  ", stats.switches, stats.steals);
+        printf(" %u/%u/%u %u/%u", stats.ipis, cpu->stats.resched_ipis, cpu->stats.tlb_ipis, cpu->stats.tlb_flushes, cpu->stats.tlb_shootdowns);
+    }
+}
+
+#define CPU_TEST_THREADS 8
+#define CPU_TEST_NS 200000000ULL
+
+static volatile unsigned int cpu_test_running;
+
+// Keeps writing to its own page of the test region for a while, so every CPU it ends up on has the page in its TLB.
+void cpu_test_thread(void* arg) {
+    volatile unsigned int* page = arg;
+    unsigned long long end = ktimeGet() + CPU_TEST_NS;
+
+    while (ktimeGet() < end) {
+        (*page)++;
+    }
+    __atomic_fetch_sub(&cpu_test_running, 1, __ATOMIC_SEQ_CST);
+}
+
+// cpus -t: starts unpinned threads on this CPU for the idle ones to steal, then releases the memory they wrote to,
+// which takes a TLB shootdown, and lists the processors.
+void test_cpus() {
+    unsigned char* region = vmmReserve(CPU_TEST_THREADS * PMM_FRAME_SIZE, VMM_REGION_WRITE, "cpu test");
+    unsigned int started = 0;
+
+    if (region == NULL) {
+        terminal_newline();
+        printf("No address space for the test.");
+        return;
+    }
+    cpu_test_running = CPU_TEST_THREADS;
+    for (unsigned int i = 0; i < CPU_TEST_THREADS; i++) {
+        if (schedCreate("cputest", cpu_test_thread, region + i * PMM_FRAME_SIZE, SCHED_PRIORITY_DEFAULT) != NULL) {
+            started++;
+        } else {
+            __atomic_fetch_sub(&cpu_test_running, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    while (cpu_test_running != 0) {
+        timerSleepMs(10);
+    }
+    vmmRelease(region);
+    terminal_newline();
+    printf("%u threads ran for %u ms each.", started, (unsigned int)(CPU_TEST_NS / 1000000));
+    list_cpus();
+}
+
+void print_two_digits(unsigned int value) {
+    if (value < 10) {
+        printf("0");
+    }
+    printf("%u", value);
+}
+
+void show_date() {
+    ktime_date_t date;
+    ktime_stats_t stats;
+    unsigned long long uptime = ktimeGet();
+
+    ktimeGetDate(&date);
+    ktimeGetStats(&stats);
+    terminal_newline();
+    printf("%u-", date.year);
+    print_two_digits(date.month);
+    printf("-");
+    print_two_digits(date.day);
+    printf(" ");
+    print_two_digits(date.hour);
+    printf(":");
+    print_two_digits(date.minute);
+    printf(":");
+    print_two_digits(date.second);
+    terminal_newline();
+    printf("up %u ms", (unsigned int)(uptime / 1000000));
+    terminal_newline();
+    if (stats.source == KTIME_SOURCE_TSC) {
+        printf("clock: invariant TSC at %u kHz, measured against the %s", (unsigned int)(stats.tsc_frequency / 1000), stats.reference == KTIME_REFERENCE_HPET ? "HPET" : "PIT");
+    } else if (stats.source == KTIME_SOURCE_HPET) {
+        printf("clock: HPET at %u kHz, TSC %s", (unsigned int)(stats.hpet_frequency / 1000), stats.tsc_frequency != 0 ? "not invariant" : "missing");
+    } else {
+        printf("clock: timer, TSC %s", stats.tsc_frequency != 0 ? "not invariant" : "missing");
+    }
+}
+
+void list_acpi() {
+    acpi_info_t info;
+    const acpi_header_t* table;
+    const acpi_cpu_t* cpu;
+
+    acpiGetInfo(&info);
+    terminal_newline();
+    if (info.tables == 0) {
+        printf("no ACPI tables");
+        return;
+    }
+    printf("ACPI revision %u, %u tables (%u bad)", info.revision, info.tables, info.bad_tables);
+    for (unsigned int i = 0; (table = acpiGetTable(i)) != NULL; i++) {
+        terminal_newline();
+        printf("  %c%c%c%c rev %u, %u bytes", table->signature[0], table->signature[1], table->signature[2], table->signature[3], table->revision, table->length);
+    }
+    terminal_newline();
+    printf("PM1a %x, PM1b %x, S5 %s, century register %x", info.pm1a_control, info.pm1b_control, info.s5 ? "found" : "missing", info.century);
+    terminal_newline();
+    printf("local APIC %x, %u I/O APICs, %u overrides, HPET %x", (unsigned int)info.lapic_address, info.ioapics, info.overrides, (unsigned int)info.hpet_address);
+    for (unsigned int i = 0; (cpu = acpiGetCpu(i)) != NULL; i++) {
+        terminal_newline();
+        printf("  cpu %u: APIC id %u%s", cpu->acpi_id, cpu->apic_id, (cpu->flags & ACPI_MADT_CPU_ENABLED) ? "" : ", disabled");
+    }
+}
+
+void list_irqstat() {
+    idt_vector_stats_t stats;
+
+    terminal_newline();
+    printf("vector count avg max (cycles)");
+    for (unsigned int vector = 0; idtGetVectorStats(vector, &stats) == 0; vector++) {
+        if (stats.count == 0) {
+            continue;
+        }
+        terminal_newline();
+        printf("%u %u %u %u", vector, stats.count, (unsigned int)(stats.cycles / stats.count), stats.max_cycles);
+        terminal_newline();
+        printf(" ");
+        for (unsigned int bucket = 0; bucket < IDT_LATENCY_BUCKETS; bucket++) {
+            if (stats.latency[bucket] != 0) {
+                printf(" 2^%u:%u", bucket, stats.latency[bucket]);
+            }
+        }
+    }
+
+    terminal_newline();
+    printf("softirq raised runs");
+    for (unsigned int nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+        softirq_stats_t softirq;
+        softirqGetStats(nr, &softirq);
+        if (softirq.raised != 0) {
+            terminal_newline();
+            printf("%u %u %u", nr, softirq.raised, softirq.runs);
+        }
+    }
+    terminal_newline();
+    printf("%u times left for later", softirqDeferred());
+
+    workqueue_t* queue;
+    terminal_newline();
+    printf("workqueue batch queued merged runs batches");
+    for (unsigned int i = 0; (queue = workqueueGet(i)) != NULL; i++) {
+        terminal_newline();
+        printf("%s %u %u %u %u %u", queue->name, queue->batch, queue->queued, queue->merged, queue->runs, queue->batches);
+    }
+}
+
+void list_meminfo() {
+    meminfo_t info;
+
+    meminfoCollect(&info);
+    terminal_newline();
+    printf("total %u kB, free %u kB, used %u kB", (unsigned int)(info.total >> 10), (unsigned int)(info.free >> 10), (unsigned int)(info.used >> 10));
+    terminal_newline();
+    printf("  boot reserved %u kB (image %u kB, bss %u kB)", (unsigned int)(info.boot_reserved >> 10), (unsigned int)(info.image >> 10), (unsigned int)(info.bss >> 10));
+    terminal_newline();
+    printf("  slab %u kB (%u kB in objects), large kmalloc %u kB", (unsigned int)(info.slab >> 10), (unsigned int)(info.slab_objects >> 10), (unsigned int)(info.kmalloc_large >> 10));
+    terminal_newline();
+    printf("  vmm %u kB of %u kB reserved, page tables %u kB", (unsigned int)(info.vmm_resident >> 10), (unsigned int)(info.vmm_reserved >> 10), (unsigned int)(info.vmm_page_tables >> 10));
+    terminal_newline();
+    printf("  dma %u kB, other %u kB", (unsigned int)(info.dma >> 10), (unsigned int)(info.other >> 10));
+    terminal_newline();
+    printf("FAT cache %u kB over %u volumes", (unsigned int)(info.fat_cache >> 10), info.fat_volumes);
+    terminal_newline();
+    printf("reclaim under %u kB free, up to %u kB; %u runs gave back %u kB", (unsigned int)(info.low_watermark >> 10), (unsigned int)(info.high_watermark >> 10), info.reclaims, (unsigned int)(info.reclaimed >> 10));
+    terminal_newline();
+    printf("stacks %u kB in %u, %u kB used at most", (unsigned int)(info.stacks >> 10), info.stack_count, (unsigned int)(info.stacks_peak >> 10));
+}
 
 int mainfat() {
-    task("No FAT FS support yet.", 2);
-    return 1;
+    if (FATMountAll() == 0) {
+        task("No FAT volumes found.", 2);
+        return 1;
+    }
+    list_mounts();
+    return 0;
 }
 
 
@@ -179,7 +488,7 @@ void terminal_initialize(void)
     if (!havebeeninitbefore) {
         terminal_color = vga_entry_color(VGA_COLOR_BLACK, VGA_COLOR_LIGHT_GREY);
     }
-	terminal_buffer = (uint16_t*) 0xB8000;
+	terminal_buffer = VGA_MEMORY;
 	for (size_t y = 0; y < VGA_HEIGHT; y++) {
 		for (size_t x = 0; x < VGA_WIDTH; x++) {
 			const size_t index = y * VGA_WIDTH + x;
@@ -188,19 +497,19 @@ void terminal_initialize(void)
 	}
 
 	terminal_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-	terminal_buffer = (uint16_t*) 0xB8000;
+	terminal_buffer = VGA_MEMORY;
 	for (size_t y = 0; y < VGA_HEIGHT; y++) {
 		for (size_t x = 0; x < VGA_WIDTH; x++) {
 			const size_t index = y * VGA_WIDTH + x;
 			terminal_buffer[index] = vga_entry(' ', terminal_color);
             if (waitwrite) {
-                for (volatile int i = 0; i < 60000; i++);
+                timerSleep(WAITWRITE_DELAY_US);
             }
 		}
 	}
     havebeeninitbefore = true;
-    if (terminal_buffer == (uint16_t*) 0xB8005) {
-        terminal_buffer = (uint16_t*) 0xB8000;
+    if (terminal_buffer == (uint16_t*) PHYS_TO_VIRT(0xB8005)) {
+        terminal_buffer = VGA_MEMORY;
         panic("Invalid buffer");
     }
 }
@@ -234,7 +543,7 @@ void terminal_putchar(char c)
         	terminal_scroll();
     	}
     if (waitwrite) {
-        for (volatile int i = 0; i < 60000; i++);
+        timerSleep(WAITWRITE_DELAY_US);
     }
 	terminal_putentryat(c, terminal_color, terminal_column, terminal_row);
 	if (++terminal_column == VGA_WIDTH) {
@@ -249,7 +558,7 @@ void terminal_write(const char* data, size_t size)
 	for (size_t i = 0; i < size; i++)
 		terminal_putchar(data[i]);
         if (waitwrite) {
-            for (volatile int i = 0; i < 60000; i++);
+            timerSleep(WAITWRITE_DELAY_US);
         }
 }
 
@@ -283,7 +592,7 @@ void terminal_newline(void)
 	terminal_row += 1;
 	terminal_column = 0;
 	if (terminal_row == VGA_HEIGHT) {
-		terminal_buffer = (uint16_t*) 0xB8000;
+		terminal_buffer = VGA_MEMORY;
 		for (size_t y = 0; y < VGA_HEIGHT; y++) {
 			for (size_t x = 0; x < VGA_WIDTH; x++) {
 				const size_t index = y * VGA_WIDTH + x;
@@ -340,10 +649,10 @@ void beep(unsigned int frequency) {
     outb(0x61, inb(0x61) | 0x03);
     // Set the PIT to the desired frequency
     unsigned int divisor = 1193180 / frequency; // PIT frequency is 1193180 Hz
-    outb(0x43, 0x27); // Command port: Set the PIT to mode 3 (square wave generator)
-    outb(0x40, divisor & 0xFF); // Low byte of divisor
-    outb(0x40, (divisor >> 80) & 0xFF); // High byte of divisor
-    for (volatile int i = 0; i < 600000000; i++);
+    outb(0x43, 0xB6); // Command port: Set PIT channel 2, the speaker's, to mode 3 (square wave generator)
+    outb(0x42, divisor & 0xFF); // Low byte of divisor
+    outb(0x42, (divisor >> 8) & 0xFF); // High byte of divisor
+    timerSleepMs(BEEP_MS);
     stop_beep();
 }
 
@@ -355,269 +664,6 @@ void stop_beep() {
 
 
 
-#define MAX_FILES 128
-#define MAX_FILENAME_LENGTH 32
-#define BLOCK_SIZE 512
-#define MAX_BLOCKS 1024
-#define MAX_MOUNTED_DRIVES 4
-
-
-typedef struct {
-    char name[MAX_FILENAME_LENGTH];
-    uint32_t size; // Size of the file in bytes
-    uint32_t start_cluster; // Starting cluster on disk
-} FileEntry;
-
-typedef struct {
-    uint32_t file_count;
-    FileEntry files[MAX_FILES];
-} Directory;
-
-typedef struct {
-    uint8_t jump[3];
-    char oem[8];
-    uint16_t bytes_per_sector;
-    uint8_t sectors_per_cluster;
-    uint16_t reserved_sectors;
-    uint8_t num_fats;
-    uint16_t max_root_dir_entries;
-    uint16_t total_sectors_16;
-    uint8_t media_descriptor;
-    uint16_t fat_size_16;
-    uint16_t sectors_per_track;
-    uint16_t number_of_heads;
-    uint32_t hidden_sectors;
-    uint32_t total_sectors_32;
-    uint32_t fat_size_32;
-    uint16_t flags;
-    uint16_t version;
-    uint32_t root_cluster;
-    uint16_t fsinfo_sector;
-    uint16_t backup_boot_sector;
-    uint8_t reserved[12];
-    uint8_t drive_number;
-    uint8_t reserved1;
-    uint8_t boot_signature;
-    uint32_t volume_id;
-    char volume_label[11];
-    char file_system_type[8];
-} __attribute__((packed)) FAT32BootSector;
-
-typedef struct {
-    bool is_mounted;
-    FAT32BootSector boot_sector;
-    uint32_t fat_start; // Start sector of the FAT
-    uint32_t data_start; // Start sector of the data area
-    Directory root_directory; // Add root directory structure
-} MountedDrive;
-
-MountedDrive mounted_drives[MAX_MOUNTED_DRIVES];
-
-
-void read_boot_sector(uint8_t drive_number) {
-    read_block(0, &mounted_drives[drive_number].boot_sector);
-}
-
-void initialize_fat32(uint8_t drive_number) {
-    FAT32BootSector* boot_sector = &mounted_drives[drive_number].boot_sector;
-
-    // Calculate the start of the FAT and data area
-    mounted_drives[drive_number].fat_start = boot_sector->reserved_sectors;
-    mounted_drives[drive_number].data_start = boot_sector->reserved_sectors + (boot_sector->num_fats * boot_sector->fat_size_32);
-}
-
-
-bool mount_drive(uint8_t drive_number) {
-    if (drive_number >= MAX_MOUNTED_DRIVES) {
-        return false; // Invalid drive number
-    }
-
-    MountedDrive* drive = &mounted_drives[drive_number];
-    if (drive->is_mounted) {
-        return false; // Drive already mounted
-    }
-
-    // Read the boot sector
-    read_boot_sector(drive_number);
-    
-    // Initialize the FAT32 structure
-    initialize_fat32(drive_number);
-
-    drive->is_mounted = true;
-
-    terminal_newline();
-    terminal_writestring("[  OK  ] Drive mounted successfully.");
-    return true;
-}
-
-#define DISK_PORT 0x0
-void read_block(uint32_t block_num, void* buffer) {
-    // Wait for the disk to be ready
-    outb(DISK_PORT + 6, 0xE0); // Select drive
-    outb(DISK_PORT + 1, 0); // Clear error register
-    outb(DISK_PORT + 2, 1); // Sector count
-    outb(DISK_PORT + 3, (block_num & 0xFF)); // LBA low
-    outb(DISK_PORT + 4, (block_num >> 8) & 0xFF); // LBA mid
-    outb(DISK_PORT + 5, (block_num >> 16) & 0xFF); // LBA high
-    outb(DISK_PORT + 7, 0x20); // Read sectors command
-
-    // Wait for the disk to finish
-    while (!(inb(DISK_PORT + 7) & 0x08)); // Wait for DRQ
-
-    // Read the data
-    for (int i = 0; i < BLOCK_SIZE / 2; i++) {
-        ((uint16_t*)buffer)[i] = inw(DISK_PORT);
-    }
-}
-
-void write_block(uint32_t block_num, const void* buffer) {
-    // Wait for the disk to be ready
-    outb(DISK_PORT + 6, 0xE0); // Select drive
-    outb(DISK_PORT + 1, 0); // Clear error register
-    outb(DISK_PORT + 2, 1); // Sector count
-    outb(DISK_PORT + 3, (block_num & 0xFF)); // LBA low
-    outb(DISK_PORT + 4, (block_num >> 8) & 0xFF); // LBA mid
-    outb(DISK_PORT + 5, (block_num >> 16) & 0xFF); // LBA high
-    outb(DISK_PORT + 7, 0x30); // Write sectors command
-
-    // Wait for the disk to finish
-    while (!(inb(DISK_PORT + 7) & 0x08)); // Wait for DRQ
-
-    // Write the data
-    for (int i = 0; i < BLOCK_SIZE / 2; i++) {
-        outw(DISK_PORT, ((uint16_t*)buffer)[i]);
-    }
-}
-
-uint32_t get_cluster_address(uint32_t cluster_number, MountedDrive* drive) {
-    // Calculate the address of the cluster in the data area
-    return drive->data_start + (cluster_number - 2) * drive->boot_sector.sectors_per_cluster;
-}
-
-void read_cluster(uint32_t cluster_number, void* buffer, MountedDrive* drive) {
-    uint32_t cluster_address = get_cluster_address(cluster_number, drive);
-    for (uint32_t i = 0; i < drive->boot_sector.sectors_per_cluster; i++) {
-        read_block(cluster_address + i, (uint8_t*)buffer + (i * BLOCK_SIZE));
-    }
-}
-
-void write_cluster(uint32_t cluster_number, const void* buffer, MountedDrive* drive) {
-    uint32_t cluster_address = get_cluster_address(cluster_number, drive);
-    for (uint32_t i = 0; i < drive->boot_sector.sectors_per_cluster; i++) {
-        write_block(cluster_address + i, (const uint8_t*)buffer + (i * BLOCK_SIZE));
-    }
-}
-
-void read_root_directory(uint8_t drive_number) {
-    MountedDrive* drive = &mounted_drives[drive_number];
-    uint32_t cluster = drive->boot_sector.root_cluster;
-    FileEntry test;
-    test.name[1] = 'test';
-    drive->root_directory.files[drive->root_directory.file_count++] = test;
-
-    // Read the root directory entries starting from the root cluster
-    for (size_t i = 0; i < MAX_FILES; i++) {
-        FileEntry entry;
-        // Read the cluster into the entry (you will need to implement the logic to read the directory entries)
-        // For example, read the first cluster of the root directory
-        read_cluster(cluster, &entry, drive);
-        
-        // Check if the entry is valid (e.g., not deleted)
-        //if (entry.size > 0) {
-        //drive->root_directory.files[drive->root_directory.file_count++] = entry;
-        //printf(test.name[1]);
-        //}
-        
-        // Move to the next entry (you will need to implement the logic to find the next entry)
-    }
-}
-
-#define FAT_ENTRY_SIZE 4 // FAT32 uses 32-bit entries
-
-void read_fat_table(uint32_t* fat_table, MountedDrive* drive) {
-    uint32_t fat_start = drive->fat_start;
-    for (uint32_t i = 0; i < (drive->boot_sector.fat_size_32 * drive->boot_sector.num_fats); i++) {
-        read_block(fat_start + i, (uint8_t*)&fat_table[i * BLOCK_SIZE / FAT_ENTRY_SIZE]);
-    }
-}
-
-
-bool is_cluster_free(uint32_t cluster_number, uint32_t* fat_table) {
-    return (fat_table[cluster_number] == 0);
-}
-
-
-uint32_t find_free_cluster(MountedDrive* drive) {
-    uint32_t fat_table[BLOCK_SIZE / FAT_ENTRY_SIZE]; // Adjust size as needed
-    read_fat_table(fat_table, drive); // Read the FAT table into memory
-
-    // Iterate through the FAT table to find a free cluster
-    for (uint32_t i = 2; i < (drive->boot_sector.total_sectors_32 / drive->boot_sector.sectors_per_cluster); i++) {
-        if (is_cluster_free(i, fat_table)) {
-            return i; // Return the first free cluster found
-        }
-    }
-    return 0; // No free cluster found
-}
-
-
-void write_file(uint8_t drive_number, const char* filename, const char* content) {
-    MountedDrive* drive = &mounted_drives[drive_number];
-
-    // Find a free entry in the root directory
-    for (size_t i = 0; i < MAX_FILES; i++) {
-        if (drive->root_directory.files[i].size == 0) { // Assuming size 0 means free
-            // Create the file entry
-            FileEntry new_file;
-            strncpy(new_file.name, filename, MAX_FILENAME_LENGTH);
-            new_file.size = strlen(content);
-            new_file.start_cluster = find_free_cluster(drive); // Find a free cluster
-
-            // Write the file content to the allocated cluster
-            char buffer[BLOCK_SIZE] = {0};
-            strncpy(buffer, content, BLOCK_SIZE);
-            write_cluster(new_file.start_cluster, buffer, drive);
-
-            // Update the FAT table to mark the cluster as used
-            update_fat_entry(new_file.start_cluster, 0xFFFFFFFF, drive); // Mark as end of file (EOF)
-
-            // Add the file to the root directory
-            drive->root_directory.files[drive->root_directory.file_count++] = new_file;
-
-            return;
-        }
-    }
-}
-
-void update_fat_entry(uint32_t cluster_number, uint32_t value, MountedDrive* drive) {
-    uint32_t fat_table[BLOCK_SIZE / FAT_ENTRY_SIZE];
-    read_fat_table(fat_table, drive); // Read the FAT table into memory
-
-    // Update the FAT entry for the specified cluster
-    fat_table[cluster_number] = value;
-
-    // Write the updated FAT table back to disk
-    uint32_t fat_start = drive->fat_start;
-    write_block(fat_start + (cluster_number * FAT_ENTRY_SIZE / BLOCK_SIZE), fat_table);
-}
-
-
-void read_file(uint8_t drive_number, const char* filename) {
-    MountedDrive* drive = &mounted_drives[drive_number];
-
-    for (size_t i = 0; i < drive->root_directory.file_count; i++) {
-        if (strcmp(drive->root_directory.files[i].name, filename) == 0) {
-            FileEntry* file = &drive->root_directory.files[i];
-            char buffer[BLOCK_SIZE] = {0};
-
-            // Read the file content from the allocated cluster
-            read_cluster(file->start_cluster, buffer, drive);
-            terminal_writestring(buffer);
-            return;
-        }
-    }
-}
-
 char *strchr(const char *s, int c) {
     while (*s != '\0') {
         if (*s == (char)c) {
@@ -666,32 +712,8 @@ char *strtok(char *str, const char *delim) {
     return current_token; // Return the current token
 }
 
-const char keyboard_layout[128] = {
-    0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
-    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
-    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
-    0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', ' ', 
-    '!', '@', ' ', '$', '%', '^', '&', '*', '(', ')', '~',
-    'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L',
-    'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '/', '|' 
-};
-
 uint8_t read_keyboard() {
-    uint8_t data;
-    while ((inb(0x64) & 0x01) == 0) {
-        // Wait for data to be available
-    }
-    data = inb(0x60);
-
-    if (data & 0x80) {
-        return 0;
-    }
-    
-    if (data < sizeof(keyboard_layout)) {
-        return keyboard_layout[data];
-    }
-    
-    return 0;
+    return kbdGetChar();
 }
 
 
@@ -759,131 +781,6 @@ void WriteTOCMOS(unsigned char array[])
    }
 } */
 
-#define CURRENT_YEAR        2023                            // Change this each year!
-
-int century_register = 0x00;                                // Set by ACPI table parsing code if possible
-
-unsigned char second;
-unsigned char minute;
-unsigned char hour;
-unsigned char day;
-unsigned char month;
-unsigned int year;
-
-
-enum {
-      cmos_address = 0x70,
-      cmos_data    = 0x71
-};
-
-int get_update_in_progress_flag() {
-      outb(cmos_address, 0x0A);
-      return (inb(cmos_data) & 0x80);
-}
-
-unsigned char get_RTC_register(int reg) {
-      outb(cmos_address, reg);
-      return inb(cmos_data);
-}
-
-void read_rtc() {
-      task("Read RTC...", 0);
-      unsigned char century;
-      unsigned char last_second;
-      int century_register = 0x00;   
-      unsigned char last_minute;
-      unsigned char last_hour;
-      unsigned char last_day;
-      unsigned char last_month;
-      unsigned char last_year;
-      unsigned char last_century;
-      unsigned char registerB;
-
-      // Note: This uses the "read registers until you get the same values twice in a row" technique
-      //       to avoid getting dodgy/inconsistent values due to RTC updates
-
-      while (get_update_in_progress_flag());                // Make sure an update isn't in progress
-      second = get_RTC_register(0x00);
-      minute = get_RTC_register(0x02);
-      hour = get_RTC_register(0x04);
-      day = get_RTC_register(0x07);
-      month = get_RTC_register(0x08);
-      year = get_RTC_register(0x09);
-      if(century_register != 0) {
-            century = get_RTC_register(century_register);
-      }
-
-      do {
-            last_second = second;
-            last_minute = minute;
-            last_hour = hour;
-            last_day = day;
-            last_month = month;
-            last_year = year;
-            last_century = century;
-
-            while (get_update_in_progress_flag());           // Make sure an update isn't in progress
-            second = get_RTC_register(0x00);
-            minute = get_RTC_register(0x02);
-            hour = get_RTC_register(0x04);
-            day = get_RTC_register(0x07);
-            month = get_RTC_register(0x08);
-            year = get_RTC_register(0x09);
-            if(century_register != 0) {
-                  century = get_RTC_register(century_register);
-            }
-      } while( (last_second != second) || (last_minute != minute) || (last_hour != hour) ||
-               (last_day != day) || (last_month != month) || (last_year != year) ||
-               (last_century != century) );
-
-      registerB = get_RTC_register(0x0B);
-
-      // Convert BCD to binary values if necessary
-
-      if (!(registerB & 0x04)) {
-            second = (second & 0x0F) + ((second / 16) * 10);
-            minute = (minute & 0x0F) + ((minute / 16) * 10);
-            hour = ( (hour & 0x0F) + (((hour & 0x70) / 16) * 10) ) | (hour & 0x80);
-            day = (day & 0x0F) + ((day / 16) * 10);
-            month = (month & 0x0F) + ((month / 16) * 10);
-            year = (year & 0x0F) + ((year / 16) * 10);
-            if(century_register != 0) {
-                  century = (century & 0x0F) + ((century / 16) * 10);
-            }
-      }
-
-      // Convert 12 hour clock to 24 hour clock if necessary
-
-      if (!(registerB & 0x02) && (hour & 0x80)) {
-            hour = ((hour & 0x7F) + 12) % 24;
-      }
-
-      // Calculate the full (4-digit) year
-
-      if(century_register != 0) {
-            year += century * 100;
-      } else {
-            year += (CURRENT_YEAR / 100) * 100;
-            if(year < CURRENT_YEAR) year += 100;
-      }
-      task("Read RTC...", 1);
-      /* terminal_putchar(second);
-      terminal_putchar(minute);
-      terminal_putchar(hour);
-      terminal_putchar(month);
-      terminal_putchar(year); */
-}
-
-extern void initTasking();
-
-typedef struct {
-    uint32_t eax, ebx, ecx, edx, esi, edi, esp, ebp, eip, eflags, cr3;
-} Registers;
-
-typedef struct Task {
-    Registers regs;
-    struct Task *next;
-} Task;
 
 
 
@@ -904,16 +801,16 @@ void handle_keyboard_input() {
             update_cursor(terminal_column, terminal_row);
         }
     } else {
-        if (data == 'U') {
-            data -= 'U';
+        if (data == KBD_KEY_UP) {
+            data = 0;
             terminal_color = vga_entry_color(terminal_row * input_buffer_index, input_buffer_index);
-            terminal_buffer = (uint16_t*) 0xB8000;
+            terminal_buffer = VGA_MEMORY;
             terminal_row = 0;
             for (size_t y = 0; y < VGA_HEIGHT; y++) {
                 for (size_t x = 0; x < VGA_WIDTH; x++) {
                     const size_t index = y * VGA_WIDTH + x;
                     terminal_buffer[index] = vga_entry(' ', terminal_color);
-                    for (volatile int i = 0; i < 60000; i++);
+                    timerSleep(WAITWRITE_DELAY_US);
                 }
             }
             terminal_row = 6;
@@ -921,6 +818,9 @@ void handle_keyboard_input() {
             terminal_writestring("Select a color");
         }
         if (data == '\n') { // Null-terminate the input
+            // the command's words live in the shell arena until the next prompt
+            int argc = 0;
+            char** argv = arenaSplit(&shell_arena, input_buffer, " ", &argc);
             if (strcmp(input_buffer, "ls") == 0) {
 				terminal_newline();
 				if (fsinit != true) {
@@ -951,10 +851,11 @@ void handle_keyboard_input() {
             //    } else {
             //        terminal_writestring("Usage: echo <filename> <content>\n");
             //    }
-            } else if (strncmp(input_buffer, "echo ", 5) == 0) {
-                char* content = strtok(input_buffer + 5, " ");
+            } else if (argc > 1 && strcmp(argv[0], "echo") == 0) {
                 terminal_newline();
-                terminal_writestring(content);
+                for (int i = 1; i < argc; i++) {
+                    printf(i > 1 ? " %s" : "%s", argv[i]);
+                }
             } else if (strcmp(input_buffer, "m") == 0){
                 m();
             } else if (strcmp(input_buffer, "ppm") == 0) {
@@ -974,6 +875,26 @@ void handle_keyboard_input() {
 				terminal_newline();
                 printf("fatinit         - Initialize the FAT.");
                 terminal_newline();
+                printf("mounts          - List the mounted FAT volumes.");
+                terminal_newline();
+                printf("fatcheck [-r]   - Check the FAT volumes for errors, -r repairs them.");
+                terminal_newline();
+                printf("slabinfo        - Show the kernel heap caches and their usage.");
+                terminal_newline();
+                printf("stacks          - Show the kernel stacks and the most each has used.");
+                terminal_newline();
+                printf("ps              - List the kernel threads, their priorities, run time and wake-up latency.");
+                terminal_newline();
+                printf("cpus [-t]       - List the processors with their scheduling, IPI and TLB shootdown counts, -t runs threads on them first.");
+                terminal_newline();
+                printf("meminfo [-s]    - Show where memory is going, -s dumps the detail to the serial port.");
+                terminal_newline();
+                printf("date            - Show the time of day, the uptime and the clock source.");
+                terminal_newline();
+                printf("irqstat [-s|-r] - Show interrupt counts and handler cycles, -s dumps them to the serial port, -r resets them.");
+                terminal_newline();
+                printf("acpi            - List the ACPI tables, processors and power management ports.");
+                terminal_newline();
                 printf("shutdown        - Shut down the computer.");
                 terminal_newline();
                 printf("color           - Show the color test screen.");
@@ -988,7 +909,7 @@ void handle_keyboard_input() {
                 terminal_newline();
                 printf("ld              - Link object files and libraries.");
 			} else if (strcmp(input_buffer, "clear") == 0) {
-				/*terminal_buffer = (uint16_t*) 0xB8000;
+				/*terminal_buffer = VGA_MEMORY;
 				for (size_t y = 0; y < VGA_HEIGHT; y++) {
 					for (size_t x = 0; x < VGA_WIDTH; x++) {
 						const size_t index = y * VGA_WIDTH + x;
@@ -1043,6 +964,47 @@ void handle_keyboard_input() {
                 } else {
                     fsinit = false;
                 }
+            } else if (strcmp(input_buffer, "mounts") == 0) {
+                list_mounts();
+            } else if (argc > 0 && strcmp(argv[0], "irqstat") == 0 && (argc == 1 || (argc == 2 && (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-r") == 0)))) {
+                if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+                    idtResetStats();
+                } else {
+                    list_irqstat();
+                    if (argc == 2 && strcmp(argv[1], "-s") == 0) {
+                        idtDumpSerial();
+                    }
+                }
+            } else if (strcmp(input_buffer, "acpi") == 0) {
+                list_acpi();
+            } else if (strcmp(input_buffer, "date") == 0) {
+                show_date();
+            } else if (strcmp(input_buffer, "slabinfo") == 0) {
+                list_slabs();
+            } else if (strcmp(input_buffer, "ps") == 0) {
+                list_threads();
+            } else if (argc > 0 && strcmp(argv[0], "cpus") == 0 && (argc == 1 || (argc == 2 && strcmp(argv[1], "-t") == 0))) {
+                if (argc == 2) {
+                    test_cpus();
+                } else {
+                    list_cpus();
+                }
+            } else if (strcmp(input_buffer, "stacks") == 0) {
+                list_stacks();
+            } else if (argc > 0 && strcmp(argv[0], "meminfo") == 0 && (argc == 1 || (argc == 2 && strcmp(argv[1], "-s") == 0))) {
+                list_meminfo();
+                if (argc == 2) {
+                    meminfoDumpSerial();
+                }
+            } else if (argc > 0 && strcmp(argv[0], "fatcheck") == 0 && (argc == 1 || (argc == 2 && strcmp(argv[1], "-r") == 0))) {
+                for (int i = 0; i < FAT_MAX_VOLUMES; i++) {
+                    if (fat_volumes[i].mounted) {
+                        arena_mark_t mark = arenaMark(&shell_arena);
+                        terminal_newline();
+                        fatcheck(&fat_volumes[i], argc == 2 ? FATCHECK_REPAIR : 0, &shell_arena);
+                        arenaRelease(&shell_arena, mark);
+                    }
+                }
             } else if (strcmp(input_buffer, "waitwrite") == 0) {
                 waitwrite = true;
                 /* if (content == true) {
@@ -1058,10 +1020,9 @@ void handle_keyboard_input() {
 				shutdown();
             //} else if (strcmp(input_buffer, "setup") == 0) {
             //    setup();
-            } else if (strncmp(input_buffer, "un ", 2) == 0) {
-                char** new_buffer = input_buffer;
-                char* content = strtok(new_buffer + 2, " ");
-                username = content;
+            } else if (argc == 2 && strcmp(argv[0], "un") == 0) {
+                strncpy(username_buffer, argv[1], sizeof(username_buffer) - 1);
+                username = username_buffer;
                 terminal_newline();
                 terminal_writestring("Username is now: ");
                 terminal_writestring(username);
@@ -1072,7 +1033,7 @@ void handle_keyboard_input() {
                     //terminal_buffer = (uint16_t*) 0xB8005;
                     for (size_t y = 0; y < VGA_HEIGHT - wait; y++) {
 
-                        terminal_buffer = (uint16_t*) 0xB8000 + y;
+                        terminal_buffer = VGA_MEMORY + y;
                         outb(0x3D4, 0x0A);
                         outb(0x3D5, 0x20);
                         for (size_t y = 0; y < VGA_HEIGHT; y++) {
@@ -1120,6 +1081,7 @@ void handle_keyboard_input() {
             terminal_writestring(hostname);
             terminal_writestring(" /> ");
             input_buffer_index = 0; // Reset input buffer index
+            arenaReset(&shell_arena);
         } else {
             if (input_buffer_index < sizeof(input_buffer) - 1) {
                 input_buffer[input_buffer_index++] = data;
@@ -1181,14 +1143,14 @@ void panic(char* msg)
     outb(0x3D5, 0x20);
 	terminal_writestring("PANIC!!!");
 	terminal_color = vga_entry_color(VGA_COLOR_WHITE, paniccolor); 
-    terminal_buffer = (uint16_t*) 0xB8000;
+    terminal_buffer = VGA_MEMORY;
     input_buffer_index = 0;
 
     for (size_t y = 0; y < VGA_HEIGHT; y++) {
         for (size_t x = 0; x < VGA_WIDTH; x++) {
             const size_t index = y * VGA_WIDTH + x;
             terminal_buffer[index] = vga_entry(' ', terminal_color);
-			for (volatile int i = 0; i < 60000; i++);
+			timerSleep(WAITWRITE_DELAY_US);
         }
     }
     waitwrite = true;
@@ -1230,7 +1192,7 @@ void panic(char* msg)
 	terminal_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_WHITE); 
     for (volatile int i = 0; i < VGA_WIDTH; i++) {
         terminal_writestring("#");
-        for (volatile int i = 0; i < 60000000; i++);
+        timerSleepMs(PANIC_REBOOT_MS / VGA_WIDTH);
     }
     reboot();
 
@@ -1267,6 +1229,8 @@ uint16_t htons(uint16_t hostshort) {
     return (hostshort >> 8) | (hostshort << 8);
 }
 
+#define PACKET_BUFFER_SIZE 1536 // an Ethernet frame, rounded up
+
 // Define network structures
 struct ip_header {
     uint8_t  version_ihl;
@@ -1382,9 +1346,18 @@ void send_ping(uint32_t dest_ip) {
 }
 
 // Function to receive ICMP echo reply (ping response)
+static kmem_cache_t* packet_cache;
+
 void receive_ping() {
-    uint8_t buffer[1500];
-    size_t len = network_receive(buffer, sizeof(buffer));
+    if (packet_cache == NULL) {
+        packet_cache = kmemCacheCreate("net_packet", PACKET_BUFFER_SIZE);
+    }
+    uint8_t* buffer = packet_cache != NULL ? kmemCacheAlloc(packet_cache) : NULL;
+    if (buffer == NULL) {
+        networkinit = false;
+        return;
+    }
+    size_t len = network_receive(buffer, PACKET_BUFFER_SIZE);
 
     struct ip_header *ip = (struct ip_header *)buffer;
     struct icmp_header *icmp = (struct icmp_header *)(buffer + sizeof(struct ip_header));
@@ -1405,6 +1378,7 @@ void receive_ping() {
     terminal_putchar(icmp->code);
     terminal_newline();
     terminal_putchar(icmp->type);
+    kmemCacheFree(packet_cache, buffer);
 }
 
 void int32(uint8_t intnum, uint16_t ax, uint16_t bx, uint16_t cx, uint16_t dx, uint16_t *ax_out) {
@@ -1415,55 +1389,12 @@ void int32(uint8_t intnum, uint16_t ax, uint16_t bx, uint16_t cx, uint16_t dx, u
     ); */
 }
 
-#define PAGE_SIZE 4096
 #define FRAMEBUFFER_ADDRESS 0xA0000
 #define FRAMEBUFFER_SIZE (VGA_HEIGHT * 600)
 
-uint32_t page_directory[1024] __attribute__((aligned(PAGE_SIZE)));
-uint32_t page_table[1024] __attribute__((aligned(PAGE_SIZE)));
-
-void setup_paging() {
-    // Initialize page directory and page table
-    task("Initialize page directory and page table...", 0);
-    for (int i = 0; i < 1024; i++) {
-        page_directory[i] = 0x00000002; // Not present
-        page_table[i] = (i * PAGE_SIZE) | 3; // Present, R/W, User
-        printf(".");
-    }
-    task("Initialize page directory and page table...", 1);
-    // Map the framebuffer
-    task("Map the framebuffer...", 0);
-    for (int i = 0; i < (FRAMEBUFFER_SIZE / PAGE_SIZE); i++) {
-        printf(".");
-        page_table[(FRAMEBUFFER_ADDRESS / PAGE_SIZE) + i] = (FRAMEBUFFER_ADDRESS + (i * PAGE_SIZE)) | 3;
-    }
-    task("Map the framebuffer...", 1);
-
-    // Point the page directory to the page table
-    task("Point the page directory to the page table...", 0);
-    page_directory[0] = ((uint32_t)page_table) | 3;
-    task("Point the page directory to the page table...", 1);
-
-    // Load the page directory
-    task("Load the page directory...", 0);
-    load_page_directory(page_directory);
-    enable_paging();
-    task("Load the page directory...", 1);
-}
-
-void load_page_directory(uint32_t* page_directory) {
-    asm volatile("mov %0, %%cr3" : : "r"(page_directory));
-}
-
-void enable_paging() {
-    uint32_t cr0;
-    asm volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
-    asm volatile("mov %0, %%cr0" : : "r"(cr0));
-}
 
 void draw_pixel(int x, int y, uint8_t color) {
-    uint8_t* framebuffer = (uint8_t*)0xA0000; // VGA framebuffer address
+    uint8_t* framebuffer = (uint8_t*)PHYS_TO_VIRT(FRAMEBUFFER_ADDRESS); // VGA framebuffer address
     framebuffer[y * 800 + x] = color;
 }
 
@@ -1491,7 +1422,7 @@ void draw_box(int x1, int y1, int x2, int y2, uint8_t color) {
 
 void draw_char(uint8_t* framebuffer, int x, int y, char c) {
     // Define a simple font
-    uint8_t font[256][8] = {
+    static const uint8_t font[256][8] = {
         // A
         {0x1F, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1F},
         // B
@@ -1659,7 +1590,7 @@ void disable_cursor()
 
 
 void setup_framebuffer() {
-    uint8_t* framebuffer = (uint8_t*)FRAMEBUFFER_ADDRESS;
+    uint8_t* framebuffer = (uint8_t*)PHYS_TO_VIRT(FRAMEBUFFER_ADDRESS);
     for (int i = 0; i < FRAMEBUFFER_SIZE; i++) {
         framebuffer[i] = 0x03; // Black
     }
@@ -1687,8 +1618,6 @@ uint16_t get_cursor_position(void)
 
 void set_vga_mode() {
     //terminal_initialize();
-    task("Stop for 6000000...", 0);
-    for (volatile int i = 0; i < 6000000; i++);
     task("Set VESA mode number...", 0);
     //outb(0x3C4, 0x4F01);
     //outb(0x3C5, 0x101); // Set VESA mode number
@@ -1703,12 +1632,12 @@ void set_vga_mode() {
     task("Change cursor", 1);
 
     // Clear the display memory
-    uint8_t* framebuffer = (uint8_t*)0xB8000;
+    uint8_t* framebuffer = (uint8_t*)VGA_MEMORY;
     // Ensure the framebuffer address is correct for the mode
 
-    task("Stop for 6000000...", 0);
-    for (volatile int i = 0; i < 60000000; i++);
-    task("Stop for 6000000...", 1);
+    task("Wait for the display...", 0);
+    timerSleepMs(VGA_SETTLE_MS);
+    task("Wait for the display...", 1);
     //for (int i = 0; i < 800 * 600; i++) {
         //for (volatile int i = 0; i < 6000; i++);
         //draw_vertical_line(i,i + 10,i + 20, 0xFF);
@@ -1747,14 +1676,14 @@ void m() {
 
 int fixflash() {
     terminal_color = vga_entry_color(VGA_COLOR_WHITE, paniccolor); 
-    terminal_buffer = (uint16_t*) 0xB8000;
+    terminal_buffer = VGA_MEMORY;
     input_buffer_index = 0;
 
     for (size_t y = 0; y < VGA_HEIGHT; y++) {
         for (size_t x = 0; x < VGA_WIDTH; x++) {
             const size_t index = y * VGA_WIDTH + x;
             terminal_buffer[index] = vga_entry(' ', terminal_color);
-            for (volatile int i = 0; i < 60000; i++);
+            timerSleep(WAITWRITE_DELAY_US);
         }
     }
     waitwrite = true;
@@ -1773,14 +1702,14 @@ int fixflash() {
 
 int displayscreen() {
     terminal_color = vga_entry_color(VGA_COLOR_WHITE, paniccolor); 
-    terminal_buffer = (uint16_t*) 0xB8000;
+    terminal_buffer = VGA_MEMORY;
     input_buffer_index = 0;
 
     for (size_t y = 0; y < VGA_HEIGHT; y++) {
         for (size_t x = 0; x < VGA_WIDTH; x++) {
             const size_t index = y * VGA_WIDTH + x;
             terminal_buffer[index] = vga_entry(' ', terminal_color);
-            for (volatile int i = 0; i < 60000; i++);
+            timerSleep(WAITWRITE_DELAY_US);
         }
     }
     waitwrite = true;
@@ -1790,7 +1719,6 @@ int displayscreen() {
     terminal_writestring("Do you have a black and white display? [y/N]");
 
     terminal_column = 6;
-    read_keyboard();
     uint8_t data = read_keyboard();
     terminal_putchar(data);
     if (data == 0) {
@@ -1813,7 +1741,7 @@ void setup() {
 }
 
 
-void kernel_main(void) 
+void kernel_main(unsigned int multiboot_magic, unsigned long multiboot_info) 
 {
 
     waitwrite = true;
@@ -1869,15 +1797,88 @@ void kernel_main(void)
 
 	terminal_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
 
+    task("Install interrupt handlers...", 0);
+    gdtInit();
+    idtInit();
+    picInit();
+    kbdInit();
+    workqueueInit();
+    asm volatile("sti");
+    task("Install interrupt handlers...", 1);
+    task("Initialize frame allocator...", 0);
+    if (pmmInit(multiboot_magic, PHYS_TO_VIRT(multiboot_info)) == 0) {
+        pmm_stats_t frames;
+        pmmGetStats(&frames);
+        kheapInit();
+        task("Initialize frame allocator...", 1);
+        printf(" (%u kB free)", frames.free_frames * (PMM_FRAME_SIZE / 1024));
+    } else {
+        task("Initialize frame allocator...", 2);
+    }
     task("Setup paging...", 0);
-    setup_paging();
+    pagingInit(pmmMemoryTop());
+    vmmInit();
+    stackInit();
     task("Setup paging...", 1);
+    task("Write-combine video memory...", 0);
+    if (memtypeInit() != MEMTYPE_VIA_NONE && memtypeSetWriteCombining(PHYS_TO_VIRT(MEMTYPE_VGA_START), MEMTYPE_VGA_END - MEMTYPE_VGA_START) == 0) {
+        task("Write-combine video memory...", 1);
+    } else {
+        task("Write-combine video memory...", 2);
+    }
+    task("Read ACPI tables...", 0);
+    if (acpiInit() == 0) {
+        task("Read ACPI tables...", 1);
+    } else {
+        task("Read ACPI tables...", 2);
+    }
+    task("Start HPET...", 0);
+    if (hpetInit() == 0) {
+        task("Start HPET...", 1);
+    } else {
+        task("Start HPET...", 2);
+    }
+    task("Start timers...", 0);
+    if (timerInit() == TIMER_SOURCE_LAPIC) {
+        task("Start timers...", 1);
+    } else {
+        task("Start timers...", 2); //PIT fallback
+    }
+    task("Start scheduler...", 0);
+    if (initTasking() == 0 && workqueueStart() == 0) {
+        task("Start scheduler...", 1);
+    } else {
+        task("Start scheduler...", 2);
+    }
+    task("Create scratch arenas...", 0);
+    if (arenaCreate(&boot_arena, "boot scratch", BOOT_ARENA_SIZE) == 0 && arenaCreate(&shell_arena, "shell scratch", SHELL_ARENA_SIZE) == 0) {
+        task("Create scratch arenas...", 1);
+    } else {
+        task("Create scratch arenas...", 2);
+    }
+    task("Reserve DMA bounce buffers...", 0);
+    if (dmaBouncePoolInit(DMA_BOUNCE_COUNT, DMA_BOUNCE_SIZE, DMA_LIMIT_16M) == DMA_BOUNCE_COUNT) {
+        task("Reserve DMA bounce buffers...", 1);
+    } else {
+        task("Reserve DMA bounce buffers...", 2);
+    }
     task("Setup framebuffer...", 0);
     setup_framebuffer();
     task("Setup framebuffer...", 1);
     task("Set video mode...", 0);
     set_vga_mode();
-    read_rtc();
+    task("Calibrate clock and read RTC...", 0);
+    if (ktimeInit() != KTIME_SOURCE_TIMER) {
+        task("Calibrate clock and read RTC...", 1);
+    } else {
+        task("Calibrate clock and read RTC...", 2); //no invariant TSC or HPET, timer resolution
+    }
+    task("Start other processors...", 0);
+    if (smpInit() > 1) {
+        task("Start other processors...", 1);
+    } else {
+        task("Start other processors...", 2); //uniprocessor, or no local APIC
+    }
     task("Attempting to initialize FAT...", 0);
     if (mainfat() == 0) {
         fsinit = true;
@@ -1914,12 +1915,37 @@ void kernel_main(void)
     } else {
         panic("Config file invalid or not found.");
     }
+    arenaDestroy(&boot_arena);
 
 
 }
 
+//reads a config file off the boot volume; "file" is a / separated path like /sys/config
 int findconfig(char* file) {
-    return -1;
+    arena_mark_t mark = arenaMark(&boot_arena);
+    char* path = arenaAlloc(&boot_arena, strlen(file) + 3);
+    char* contents;
+    directory_entry_t meta;
+    size_t i;
+    int result = -1;
+
+    if (FATGetVolume('C') == NULL || path == NULL) {
+        arenaRelease(&boot_arena, mark);
+        return -1;
+    }
+
+    path[0] = 'C';
+    path[1] = ':';
+    for (i = 0; file[i] != '\0'; i++) {
+        path[i + 2] = file[i] == '/' ? '\\' : file[i];
+    }
+    path[i + 2] = '\0';
+
+    if (getFile(path, &contents, &meta, 1) == 0 && meta.file_size != 0) {
+        result = 0;
+    }
+    arenaRelease(&boot_arena, mark);
+    return result;
 }
 
 void shell() {
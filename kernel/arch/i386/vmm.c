@@ -0,0 +1,417 @@
+#include "vmm.h"
+#include "idt.h"
+#include "pmm.h"
+#include "paging.h"
+#include "smp.h"
+#include "cpu.h"
+#include "lib_c.h"
+#include "panic.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define VMM_PAGE_SIZE 0x1000
+#define VMM_PTE_FRAME(entry) ((entry) & ~(unsigned long)(VMM_PAGE_SIZE - 1))
+
+static vmm_region_t vmm_regions[VMM_MAX_REGIONS]; //sorted by start
+static unsigned int vmm_region_count;
+static vmm_stats_t vmm_stats;
+
+static void vmmInvalidate(unsigned long address)
+{
+	asm volatile("invlpg (%0)" : : "r"(address) : "memory");
+}
+
+//Returns: the page table entry mapping "address", or NULL if its page table doesn't exist and "create" is 0 (or
+//no frame was free for it)
+static unsigned int* vmmPageEntry(unsigned long address, int create)
+{
+	unsigned int* pde = &boot_page_directory[address >> 22];
+
+	if (!(*pde & PAGE_PRESENT))
+	{
+		if (!create)
+			return NULL;
+
+		unsigned long table = pmmAllocFrame();
+		if (table == 0)
+			return NULL;
+		memset(PHYS_TO_VIRT(table), 0, PMM_FRAME_SIZE);
+		*pde = table | PAGE_PRESENT | PAGE_WRITE;
+		vmm_stats.page_tables++;
+	}
+
+	return (unsigned int*)PHYS_TO_VIRT(VMM_PTE_FRAME(*pde)) + ((address >> 12) & 0x3FF);
+}
+
+//Returns: the region "address" falls in, or NULL
+const vmm_region_t* vmmFindRegion(unsigned long address)
+{
+	unsigned int low = 0, high = vmm_region_count;
+
+	while (low < high)
+	{
+		unsigned int middle = (low + high) / 2;
+
+		if (address < vmm_regions[middle].start)
+			high = middle;
+		else if (address >= vmm_regions[middle].end)
+			low = middle + 1;
+		else
+			return &vmm_regions[middle];
+	}
+	return NULL;
+}
+
+//Returns: 1 if the page "address" is in has a frame mapped, 0 if touching it would fault
+int vmmIsResident(unsigned long address)
+{
+	unsigned int* entry = vmmPageEntry(address, 0);
+	return entry != NULL && (*entry & PAGE_PRESENT);
+}
+
+//Returns: the index'th region, for listing them, or NULL past the last one
+const vmm_region_t* vmmGetRegion(unsigned int index)
+{
+	return index < vmm_region_count ? &vmm_regions[index] : NULL;
+}
+
+//Returns: how many of the region's pages have a frame mapped
+unsigned int vmmRegionResident(const vmm_region_t* region)
+{
+	unsigned long page;
+	unsigned int resident = 0;
+
+	for (page = region->start; page < region->end; page += VMM_PAGE_SIZE)
+	{
+		if (vmmIsResident(page))
+			resident++;
+	}
+	return resident;
+}
+
+//Returns: the region whose guard page "address" is in, or NULL
+static const vmm_region_t* vmmFindGuard(unsigned long address)
+{
+	return vmmFindRegion(address + VMM_GUARD_SIZE);
+}
+
+//Reserves "size" bytes (rounded up to pages) of address space. Nothing is backed until it's touched
+//Returns: the start of the region, or NULL if the area or the region table is full
+void* vmmReserve(unsigned long size, unsigned int flags, const char* name)
+{
+	unsigned long candidate = VMM_AREA_START;
+	unsigned long irq;
+	unsigned int i;
+
+	if (size == 0)
+		return NULL;
+	size = (size + VMM_PAGE_SIZE - 1) & ~(unsigned long)(VMM_PAGE_SIZE - 1);
+
+	irq = rspinLockIrqSave(&mm_lock);
+	if (vmm_region_count == VMM_MAX_REGIONS)
+	{
+		rspinUnlockIrqRestore(&mm_lock, irq);
+		return NULL;
+	}
+
+	//first fit, each region taking its guard page along with it
+	for (i = 0; i < vmm_region_count; i++)
+	{
+		if (vmm_regions[i].start - VMM_GUARD_SIZE - candidate >= VMM_GUARD_SIZE + size)
+			break;
+		candidate = vmm_regions[i].end;
+	}
+	if (VMM_AREA_END - candidate < VMM_GUARD_SIZE + size)
+	{
+		rspinUnlockIrqRestore(&mm_lock, irq);
+		return NULL;
+	}
+
+	memmove(&vmm_regions[i + 1], &vmm_regions[i], (vmm_region_count - i) * sizeof(vmm_region_t));
+	vmm_regions[i].start = candidate + VMM_GUARD_SIZE;
+	vmm_regions[i].end = candidate + VMM_GUARD_SIZE + size;
+	vmm_regions[i].flags = flags;
+	vmm_regions[i].name = name;
+	vmm_region_count++;
+
+	vmm_stats.regions++;
+	vmm_stats.reserved_pages += size / VMM_PAGE_SIZE;
+	rspinUnlockIrqRestore(&mm_lock, irq);
+	return (void*)(candidate + VMM_GUARD_SIZE);
+}
+
+//drops the frames behind [start, end), freeing the ones no clone still shares. MMIO pages are only unmapped
+static void vmmUnmapRange(unsigned long start, unsigned long end, int mmio)
+{
+	unsigned long page;
+
+	for (page = start; page < end; page += VMM_PAGE_SIZE)
+	{
+		unsigned int* entry = vmmPageEntry(page, 0);
+		if (entry == NULL || !(*entry & PAGE_PRESENT))
+			continue;
+
+		if (!mmio)
+		{
+			unsigned long frame = VMM_PTE_FRAME(*entry);
+			if (pmmFrameUnref(frame) == 0)
+				pmmFreeFrame(frame);
+			vmm_stats.resident_pages--;
+		}
+		*entry = 0;
+		vmmInvalidate(page);
+	}
+	smpFlushTlb(start, end);
+}
+
+//Unmaps a region and gives its address space back
+void vmmRelease(void* address)
+{
+	unsigned long irq = rspinLockIrqSave(&mm_lock);
+	const vmm_region_t* region = vmmFindRegion((unsigned long)address);
+
+	if (region == NULL || region->start != (unsigned long)address)
+	{
+		rspinUnlockIrqRestore(&mm_lock, irq);
+		printf("vmm: release of %x, which isn't the start of a region%n", (unsigned int)(unsigned long)address);
+		return;
+	}
+
+	vmmUnmapRange(region->start, region->end, region->flags & VMM_REGION_MMIO);
+
+	unsigned int i = region - vmm_regions;
+	vmm_stats.regions--;
+	vmm_stats.reserved_pages -= (region->end - region->start) / VMM_PAGE_SIZE;
+	vmm_region_count--;
+	memmove(&vmm_regions[i], &vmm_regions[i + 1], (vmm_region_count - i) * sizeof(vmm_region_t));
+	rspinUnlockIrqRestore(&mm_lock, irq);
+}
+
+//Gives back the frames behind the whole pages in [address, address + size) without releasing the region; the
+//pages read as zero again the next time they're touched
+void vmmDecommit(void* address, unsigned long size)
+{
+	unsigned long start = ((unsigned long)address + VMM_PAGE_SIZE - 1) & ~(unsigned long)(VMM_PAGE_SIZE - 1);
+	unsigned long end = ((unsigned long)address + size) & ~(unsigned long)(VMM_PAGE_SIZE - 1);
+	unsigned long irq = rspinLockIrqSave(&mm_lock);
+	const vmm_region_t* region = vmmFindRegion((unsigned long)address);
+
+	if (region != NULL && start < end && !(region->flags & VMM_REGION_MMIO))
+		vmmUnmapRange(start, end < region->end ? end : region->end, 0);
+	rspinUnlockIrqRestore(&mm_lock, irq);
+}
+
+//Makes a copy-on-write copy of the region starting at "address"; pages the original hasn't touched yet are
+//demand-zero in both
+//Returns: the start of the copy, or NULL if there's no room for it
+void* vmmClone(void* address, const char* name)
+{
+	unsigned long irq = rspinLockIrqSave(&mm_lock);
+	const vmm_region_t* source = vmmFindRegion((unsigned long)address);
+	unsigned long page, offset;
+
+	if (source == NULL || source->start != (unsigned long)address || (source->flags & VMM_REGION_MMIO))
+	{
+		rspinUnlockIrqRestore(&mm_lock, irq);
+		return NULL;
+	}
+
+	unsigned long start = source->start;
+	unsigned long size = source->end - source->start;
+	unsigned int flags = source->flags;
+
+	//the table is sorted, so this can move the source's entry
+	unsigned long copy = (unsigned long)vmmReserve(size, flags, name);
+	if (copy == 0)
+	{
+		rspinUnlockIrqRestore(&mm_lock, irq);
+		return NULL;
+	}
+
+	for (offset = 0; offset < size; offset += VMM_PAGE_SIZE)
+	{
+		page = start + offset;
+		unsigned int* entry = vmmPageEntry(page, 0);
+		if (entry == NULL || !(*entry & PAGE_PRESENT))
+			continue;
+
+		unsigned int* copy_entry = vmmPageEntry(copy + offset, 1);
+		if (copy_entry == NULL)
+		{
+			vmmRelease((void*)copy);
+			rspinUnlockIrqRestore(&mm_lock, irq);
+			return NULL;
+		}
+
+		if (*entry & (PAGE_WRITE | VMM_PTE_COW))
+		{
+			*entry = (*entry & ~PAGE_WRITE) | VMM_PTE_COW;
+			vmmInvalidate(page);
+		}
+		*copy_entry = *entry;
+		pmmFrameRef(VMM_PTE_FRAME(*entry));
+		vmm_stats.resident_pages++;
+	}
+	smpFlushTlb(start, start + size); //the other CPUs could still write through what's copy-on-write now
+
+	rspinUnlockIrqRestore(&mm_lock, irq);
+	return (void*)copy;
+}
+
+//Maps "size" bytes of device memory at "physical", uncached, into a region of its own. To unmap it, vmmRelease the
+//returned address rounded down to its page
+//Returns: the virtual address of "physical", or NULL if there's no room for the region or its page tables
+void* vmmMapPhysical(unsigned long physical, unsigned long size, const char* name)
+{
+	unsigned long offset = physical & (VMM_PAGE_SIZE - 1);
+	unsigned long base = physical - offset;
+	unsigned long page;
+	unsigned long irq;
+
+	unsigned long start = (unsigned long)vmmReserve(size + offset, VMM_REGION_WRITE | VMM_REGION_MMIO, name);
+	if (start == 0)
+		return NULL;
+
+	irq = rspinLockIrqSave(&mm_lock);
+	for (page = 0; page < size + offset; page += VMM_PAGE_SIZE)
+	{
+		unsigned int* entry = vmmPageEntry(start + page, 1);
+		if (entry == NULL)
+		{
+			vmmRelease((void*)start);
+			rspinUnlockIrqRestore(&mm_lock, irq);
+			return NULL;
+		}
+		*entry = (base + page) | PAGE_PRESENT | PAGE_WRITE | PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH;
+	}
+	rspinUnlockIrqRestore(&mm_lock, irq);
+	return (void*)(start + offset);
+}
+
+//backs a not-present page of "region" with a zeroed frame
+static int vmmFillPage(const vmm_region_t* region, unsigned long page)
+{
+	unsigned int* entry = vmmPageEntry(page, 1);
+	if (entry == NULL)
+		return -1;
+
+	unsigned long frame = pmmAllocFrame();
+	if (frame == 0)
+		return -1;
+	memset(PHYS_TO_VIRT(frame), 0, PMM_FRAME_SIZE);
+	pmmFrameRef(frame);
+
+	*entry = frame | PAGE_PRESENT | ((region->flags & VMM_REGION_WRITE) ? PAGE_WRITE : 0);
+	vmm_stats.zero_fills++;
+	vmm_stats.resident_pages++;
+	return 0;
+}
+
+//gives a copy-on-write page a frame of its own
+static int vmmBreakCow(unsigned long page)
+{
+	unsigned int* entry = vmmPageEntry(page, 0);
+	if (entry == NULL || !(*entry & VMM_PTE_COW))
+		return -1;
+
+	unsigned long frame = VMM_PTE_FRAME(*entry);
+	if (pmmFrameRefs(frame) == 1)
+	{
+		vmm_stats.cow_reuses++;
+	}
+	else
+	{
+		unsigned long copy = pmmAllocFrame();
+		if (copy == 0)
+			return -1;
+		memcpy(PHYS_TO_VIRT(copy), PHYS_TO_VIRT(frame), PMM_FRAME_SIZE);
+		pmmFrameRef(copy);
+		pmmFrameUnref(frame);
+		*entry = copy | (*entry & (VMM_PAGE_SIZE - 1));
+		vmm_stats.cow_copies++;
+	}
+
+	*entry = (*entry | PAGE_WRITE) & ~VMM_PTE_COW;
+	vmmInvalidate(page);
+	if (frame != VMM_PTE_FRAME(*entry))
+		smpFlushTlb(page, page + VMM_PAGE_SIZE); //the other CPUs may still be reading the old frame
+	return 0;
+}
+
+//Returns: 1 if the fault is already dealt with: another CPU filled or copied the page between the access and
+//mm_lock, or this CPU's TLB still had the entry from before that
+static int vmmSpuriousFault(unsigned long page, unsigned int error_code)
+{
+	unsigned int* entry = vmmPageEntry(page, 0);
+
+	if (entry == NULL || !(*entry & PAGE_PRESENT))
+		return 0;
+	if ((error_code & VMM_FAULT_WRITE) && !(*entry & PAGE_WRITE))
+		return 0;
+	vmmInvalidate(page);
+	return 1;
+}
+
+static void vmmPageFault(interrupt_frame_t* frame)
+{
+	unsigned long address;
+	asm volatile("mov %%cr2, %0" : "=r"(address));
+
+	unsigned long page = address & ~(unsigned long)(VMM_PAGE_SIZE - 1);
+	unsigned long irq = rspinLockIrqSave(&mm_lock);
+	const vmm_region_t* region = vmmFindRegion(address);
+
+	if (region != NULL && !(region->flags & VMM_REGION_MMIO))
+	{
+		if (vmmSpuriousFault(page, frame->error_code))
+		{
+			rspinUnlockIrqRestore(&mm_lock, irq);
+			return;
+		}
+		if (!(frame->error_code & VMM_FAULT_PRESENT))
+		{
+			if (vmmFillPage(region, page) == 0)
+			{
+				rspinUnlockIrqRestore(&mm_lock, irq);
+				return;
+			}
+			printf("vmm: out of memory filling %x in %s%n", (unsigned int)address, region->name);
+		}
+		else if ((frame->error_code & VMM_FAULT_WRITE) && (region->flags & VMM_REGION_WRITE))
+		{
+			if (vmmBreakCow(page) == 0)
+			{
+				rspinUnlockIrqRestore(&mm_lock, irq);
+				return;
+			}
+			printf("vmm: can't copy %x in %s%n", (unsigned int)address, region->name);
+		}
+	}
+	rspinUnlockIrqRestore(&mm_lock, irq);
+
+	printf("page fault at %x, eip %x, error %x", (unsigned int)address, frame->eip, frame->error_code);
+	if (region != NULL)
+		printf(" in %s", region->name);
+	else if ((region = vmmFindGuard(address)) != NULL)
+		printf(" on the guard page below %s", region->name);
+	printf("%n");
+	panic("Page fault");
+}
+
+//Takes over the page fault vector. Has to run after idtInit and pagingInit
+void vmmInit(void)
+{
+	unsigned long cr0;
+
+	//without WP, ring 0 writes go straight through read-only entries and copy-on-write never faults
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_WP));
+
+	idtSetHandler(IDT_VECTOR_PAGE_FAULT, vmmPageFault);
+}
+
+void vmmGetStats(vmm_stats_t* stats)
+{
+	*stats = vmm_stats;
+}
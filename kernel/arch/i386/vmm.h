@@ -0,0 +1,64 @@
+#ifndef VMM_H_
+#define VMM_H_
+
+//Lazily backed kernel memory. A region is a page aligned range of the area above the direct map that is reserved
+//up front and only gets frames when it's touched: the page fault handler maps a zeroed frame on the first access
+//to each page (demand-zero). A region can be cloned without copying anything: the clone maps the frames the
+//original already has, both sides go read-only, and whichever side writes to a page first gets its own copy of it
+//(copy-on-write). Shared frames are reference counted in the frame table.
+//Every region has an unmapped guard page right below it, so a stack running off its bottom or a buffer running
+//off its end faults instead of scribbling over its neighbour.
+//Device registers outside the direct map (the local APIC, HPET, ACPI tables high in RAM) get regions too, mapped
+//up front and uncached by vmmMapPhysical.
+
+#define VMM_AREA_START 0xF0000000 //KERNEL_VIRTUAL_BASE + PAGING_DIRECT_MAP_SIZE
+#define VMM_AREA_END 0xFFC00000 //the last page directory entry is left alone
+#define VMM_MAX_REGIONS 64
+#define VMM_GUARD_SIZE 0x1000
+
+//region flags
+#define VMM_REGION_WRITE 0x01
+#define VMM_REGION_MMIO 0x02 //device memory mapped by vmmMapPhysical: uncached, no frames behind it, never faults in
+
+//software-defined page table entry bit (one of the three the CPU ignores)
+#define VMM_PTE_COW 0x200 //read-only because the frame is shared; a write gets a private copy
+
+//page fault error code bits
+#define VMM_FAULT_PRESENT 0x01 //the page was present, so this is a protection fault
+#define VMM_FAULT_WRITE 0x02
+#define VMM_FAULT_USER 0x04
+
+typedef struct vmm_region
+{
+	unsigned long start; //page aligned, end exclusive; the guard page is below start
+	unsigned long end;
+	unsigned int flags;
+	const char* name; //not copied
+}
+vmm_region_t;
+
+typedef struct vmm_stats
+{
+	unsigned int regions;
+	unsigned int reserved_pages; //pages in all regions, backed or not
+	unsigned int resident_pages; //pages with a frame mapped, counting a shared frame once per mapping
+	unsigned int page_tables;
+	unsigned int zero_fills; //demand-zero faults
+	unsigned int cow_copies; //write faults that copied a shared frame
+	unsigned int cow_reuses; //write faults on a frame the other side had already let go of
+}
+vmm_stats_t;
+
+void vmmInit(void);
+void* vmmReserve(unsigned long size, unsigned int flags, const char* name);
+void vmmRelease(void* address);
+void vmmDecommit(void* address, unsigned long size);
+void* vmmClone(void* address, const char* name);
+void* vmmMapPhysical(unsigned long physical, unsigned long size, const char* name);
+const vmm_region_t* vmmFindRegion(unsigned long address);
+int vmmIsResident(unsigned long address);
+const vmm_region_t* vmmGetRegion(unsigned int index);
+unsigned int vmmRegionResident(const vmm_region_t* region);
+void vmmGetStats(vmm_stats_t* stats);
+
+#endif
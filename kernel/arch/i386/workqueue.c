@@ -0,0 +1,221 @@
+#include "workqueue.h"
+#include "sched.h"
+#include "cpu.h"
+#include "lib_c.h"
+
+workqueue_t system_workqueue;
+
+static workqueue_t* workqueues[WORKQUEUE_MAX];
+static unsigned int workqueue_count;
+static wait_queue_t workqueue_wait; //the worker, when everything is empty
+static spinlock_t workqueue_lock; //the list of queues and what's on them
+
+//Sets up system_workqueue
+void workqueueInit(void)
+{
+	workqueueCreate(&system_workqueue, "system", WORKQUEUE_DEFAULT_BATCH);
+}
+
+//Returns: 0 on success, -1 if WORKQUEUE_MAX queues already exist
+int workqueueCreate(workqueue_t* queue, const char* name, unsigned int batch)
+{
+	unsigned long flags;
+
+	if (workqueue_count == WORKQUEUE_MAX)
+		return -1;
+
+	queue->name = name;
+	queue->batch = batch != 0 ? batch : WORKQUEUE_DEFAULT_BATCH;
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->queued = 0;
+	queue->merged = 0;
+	queue->runs = 0;
+	queue->batches = 0;
+
+	flags = spinLockIrqSave(&workqueue_lock);
+	workqueues[workqueue_count++] = queue;
+	spinUnlockIrqRestore(&workqueue_lock, flags);
+	return 0;
+}
+
+//Unregisters "queue"; whatever is still queued on it is dropped, so flush it first if that matters
+void workqueueDestroy(workqueue_t* queue)
+{
+	unsigned long flags = spinLockIrqSave(&workqueue_lock);
+	unsigned int i;
+
+	for (i = 0; i < workqueue_count && workqueues[i] != queue; i++)
+		;
+	if (i < workqueue_count)
+	{
+		for (; i + 1 < workqueue_count; i++)
+			workqueues[i] = workqueues[i + 1];
+		workqueue_count--;
+	}
+	spinUnlockIrqRestore(&workqueue_lock, flags);
+}
+
+workqueue_t* workqueueGet(unsigned int index)
+{
+	if (index >= workqueue_count)
+		return NULL;
+	return workqueues[index];
+}
+
+void workInit(work_t* work, void (*func)(work_t* work), void* data)
+{
+	work->func = func;
+	work->data = data;
+	work->next = NULL;
+	work->pending = 0;
+}
+
+//Queues "work" at the back of "queue"; safe from interrupt handlers
+//Returns: 1 if it was queued, 0 if it already was
+int workQueue(workqueue_t* queue, work_t* work)
+{
+	unsigned long flags = spinLockIrqSave(&workqueue_lock);
+
+	if (work->pending)
+	{
+		queue->merged++;
+		spinUnlockIrqRestore(&workqueue_lock, flags);
+		return 0;
+	}
+
+	work->pending = 1;
+	work->next = NULL;
+	if (queue->tail != NULL)
+		queue->tail->next = work;
+	else
+		queue->head = work;
+	queue->tail = work;
+	queue->queued++;
+	spinUnlock(&workqueue_lock);
+	schedWakeAll(&workqueue_wait);
+	cpuIrqRestore(flags);
+	return 1;
+}
+
+//Takes "work" off "queue" if it hasn't started yet
+//Returns: 1 if it was taken off, 0 if it wasn't queued
+int workCancel(workqueue_t* queue, work_t* work)
+{
+	unsigned long flags = spinLockIrqSave(&workqueue_lock);
+	work_t* previous = NULL;
+	work_t* item;
+
+	for (item = queue->head; item != NULL && item != work; item = item->next)
+		previous = item;
+	if (item == NULL)
+	{
+		spinUnlockIrqRestore(&workqueue_lock, flags);
+		return 0;
+	}
+
+	if (previous != NULL)
+		previous->next = work->next;
+	else
+		queue->head = work->next;
+	if (queue->tail == work)
+		queue->tail = previous;
+	work->next = NULL;
+	work->pending = 0;
+	spinUnlockIrqRestore(&workqueue_lock, flags);
+	return 1;
+}
+
+//Runs up to queue->batch items of "queue" in the order they were queued. An item is off the queue (and can be
+//queued again) by the time its function runs
+//Returns: the number run
+unsigned int workqueueRun(workqueue_t* queue)
+{
+	unsigned long flags = spinLockIrqSave(&workqueue_lock);
+	work_t* batch = queue->head;
+	work_t* last = batch;
+	unsigned int count = 1;
+	unsigned int run = 0;
+
+	if (batch == NULL)
+	{
+		spinUnlockIrqRestore(&workqueue_lock, flags);
+		return 0;
+	}
+
+	//detach the batch in one go, leaving whatever is beyond it queued
+	while (count < queue->batch && last->next != NULL)
+	{
+		last = last->next;
+		count++;
+	}
+	queue->head = last->next;
+	if (queue->head == NULL)
+		queue->tail = NULL;
+	last->next = NULL;
+	queue->batches++;
+	spinUnlockIrqRestore(&workqueue_lock, flags);
+
+	while (batch != NULL)
+	{
+		work_t* work = batch;
+		batch = work->next;
+
+		flags = spinLockIrqSave(&workqueue_lock);
+		work->next = NULL;
+		work->pending = 0;
+		spinUnlockIrqRestore(&workqueue_lock, flags);
+
+		work->func(work);
+		run++;
+	}
+
+	flags = spinLockIrqSave(&workqueue_lock);
+	queue->runs += run;
+	spinUnlockIrqRestore(&workqueue_lock, flags);
+	return run;
+}
+
+//Returns: 1 if any queue has work. Read without workqueue_lock: under workqueue_wait's, a queue that has just had
+//work put on it either shows it, or is about to wake the worker
+static int workqueueAnyPending(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < workqueue_count; i++)
+	{
+		if (workqueues[i]->head != NULL)
+			return 1;
+	}
+	return 0;
+}
+
+static void workqueueWorker(void* arg)
+{
+	(void)arg;
+	for (;;)
+	{
+		unsigned long flags;
+		unsigned int i;
+
+		for (i = 0; i < workqueue_count; i++)
+			workqueueRun(workqueues[i]);
+
+		flags = spinLockIrqSave(&workqueue_wait.lock);
+		if (workqueueAnyPending())
+		{
+			spinUnlockIrqRestore(&workqueue_wait.lock, flags);
+			schedYield();
+			continue;
+		}
+		schedWait(&workqueue_wait);
+		spinUnlockIrqRestore(&workqueue_wait.lock, flags);
+	}
+}
+
+//Starts the worker thread. initTasking has to have run
+//Returns: 0 on success, -1 if the thread couldn't be created
+int workqueueStart(void)
+{
+	return schedCreate("kworker", workqueueWorker, NULL, WORKQUEUE_PRIORITY) != NULL ? 0 : -1;
+}
@@ -0,0 +1,51 @@
+#ifndef WORKQUEUE_H_
+#define WORKQUEUE_H_
+
+//Workqueues: deferred work that runs in a thread, where it can take as long as it likes and even sleep. Anything,
+//interrupt handlers and softirqs included, can queue a work_t; a work item that's already queued isn't queued
+//twice, so a source that fires faster than the work runs gets one run for the lot.
+//A queue is emptied in batches: the worker detaches up to "batch" items in one go with interrupts off and runs
+//them with interrupts on, leaving the rest queued for the next pass.
+//Every queue is run by one worker thread, "kworker", started by workqueueStart: it takes a batch from each queue
+//in turn, yields between rounds so a long backlog doesn't hog the CPU, and sleeps when they're all empty. Work
+//queued before workqueueStart waits for it.
+
+#define WORKQUEUE_MAX 8
+#define WORKQUEUE_DEFAULT_BATCH 16
+#define WORKQUEUE_PRIORITY 12 //ahead of ordinary threads: deferred work is mostly the tail end of someone's I/O
+
+typedef struct work
+{
+	void (*func)(struct work* work);
+	void* data; //for func
+	struct work* next;
+	int pending;
+}
+work_t;
+
+typedef struct workqueue
+{
+	const char* name;
+	unsigned int batch; //most items run per workqueueRun
+	work_t* head;
+	work_t* tail;
+	unsigned int queued; //workQueue calls that added an item
+	unsigned int merged; //and those that found it already there
+	unsigned int runs; //items run
+	unsigned int batches; //workqueueRun calls that found something to do
+}
+workqueue_t;
+
+extern workqueue_t system_workqueue; //for work that doesn't need a queue of its own
+
+void workqueueInit(void);
+int workqueueCreate(workqueue_t* queue, const char* name, unsigned int batch);
+void workqueueDestroy(workqueue_t* queue);
+workqueue_t* workqueueGet(unsigned int index);
+void workInit(work_t* work, void (*func)(work_t* work), void* data);
+int workQueue(workqueue_t* queue, work_t* work);
+int workCancel(workqueue_t* queue, work_t* work);
+unsigned int workqueueRun(workqueue_t* queue);
+int workqueueStart(void);
+
+#endif
@@ -260,7 +260,7 @@ int	__swbuf(int, FILE *);
 
 #define	BUFSIZ	1024		/* size of buffer used by setbuf */
 #define	EOF	(-1)
-
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -275,4 +275,3 @@ int puts(const char*);
 #endif
 
 #endif
-#endif
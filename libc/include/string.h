@@ -11,12 +11,17 @@
 extern "C" {
 #endif
 
-//int memcmp(const void*, const void*, size_t);
-//void* memcpy(void* __restrict, const void* __restrict, size_t);
-//void* memmove(void*, const void*, size_t);
-//void* memset(void*, int, size_t);
-//size_t strlen(const char*);
-// compiler complained about this for some reason, even it worked before.
+int memcmp(const void*, const void*, size_t);
+void* memcpy(void* __restrict, const void* __restrict, size_t);
+void* memmove(void*, const void*, size_t);
+void* memset(void*, int, size_t);
+size_t strlen(const char*);
+int strcmp(const char*, const char*);
+int strncmp(const char*, const char*, size_t);
+char* strcpy(char* __restrict, const char* __restrict);
+char* strncpy(char* __restrict, const char* __restrict, size_t);
+char* strchr(const char*, int);
+char* strtok(char* __restrict, const char* __restrict);
 
 #ifdef __cplusplus
 }
@@ -52,6 +52,33 @@ int printf(const char* restrict format, ...) {
 			if (!print(&c, sizeof(c)))
 				return -1;
 			written++;
+		} else if (*format == 'd' || *format == 'u' || *format == 'x') {
+			char conversion = *format++;
+			unsigned int value;
+			bool negative = false;
+			if (conversion == 'd') {
+				int signed_value = va_arg(parameters, int);
+				negative = signed_value < 0;
+				value = negative ? 0u - (unsigned int) signed_value : (unsigned int) signed_value;
+			} else {
+				value = va_arg(parameters, unsigned int);
+			}
+			unsigned int base = conversion == 'x' ? 16 : 10;
+			char digits[12];
+			size_t len = 0;
+			do {
+				digits[sizeof(digits) - ++len] = "0123456789abcdef"[value % base];
+				value /= base;
+			} while (value != 0);
+			if (negative)
+				digits[sizeof(digits) - ++len] = '-';
+			if (maxrem < len) {
+				// TODO: Set errno to EOVERFLOW.
+				return -1;
+			}
+			if (!print(&digits[sizeof(digits) - len], len))
+				return -1;
+			written += len;
 		} else if (*format == 'n') {
 			format++;
 			terminal_newline();
@@ -1,8 +1,9 @@
 #!/bin/sh
 set -e
+# Processors to boot with; SMP=1 for a uniprocessor run
+SMP=${SMP:-4}
 . ./iso.sh
-qemu-img create -f raw pos.img 100M
-mformat -i pos.img :: -F
+make -C tools mkfatimg
 echo test >> test.txt
-mcopy -i pos.img test.txt ::
-qemu-system-$(./target-triplet-to-arch.sh $HOST) -cdrom potatoOS.iso -hda pos.img -boot d -net nic,model=virtio
+tools/mkfatimg -o pos.img disk.manifest
+qemu-system-$(./target-triplet-to-arch.sh $HOST) -cdrom potatoOS.iso -hda pos.img -boot d -smp "$SMP" -net nic,model=virtio
@@ -0,0 +1,231 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fathost.h"
+#include "FAT.h"
+
+//fatbench: replays filesystem workloads through the kernel FAT driver against a disk image and reports
+//disk requests, sectors and seeks per operation. Run it on a fresh copy of the image (see fatbench.sh) so
+//numbers from before and after a driver change are comparable.
+
+static BOOL remount_between = TRUE;
+static unsigned int create_serial = 0;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: fatbench [-v] [-w] [-s spread_clusters] image workload...\n"
+		"workloads:\n"
+		"  lookup PATH COUNT        resolve PATH (e.g. C:/A/B/FILE.TXT) COUNT times\n"
+		"  read PATH COUNT          read the whole file COUNT times\n"
+		"  create DIR COUNT SIZE    create COUNT new files of SIZE bytes in DIR (e.g. C:/ or C:/A)\n"
+		"-w keeps the FAT cache warm between workloads instead of remounting\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//FAT.c wants backslashes; accept forward slashes so paths don't need shell quoting
+static void toDriverPath(const char* in, char* out, size_t size)
+{
+	size_t i;
+	for (i = 0; in[i] != '\0' && i < size - 1; i++)
+		out[i] = in[i] == '/' ? '\\' : in[i];
+	out[i] = '\0';
+}
+
+static void remount(void)
+{
+	char letter;
+	for (letter = 'C'; letter < 'C' + FAT_MAX_VOLUMES; letter++)
+		FATUnmount(letter);
+	FATMountAll();
+}
+
+//walks the path one directory at a time like getFile does, without reading the file's data
+static int lookup(const char* path)
+{
+	fat_volume_t* vol = FATVolumeFromPath(path);
+	if (vol == NULL || vol->fat_type != 32)
+		return -1;
+
+	unsigned int cluster = ((fat_extBS_32_t*)vol->bootsect.extended_section)->root_cluster;
+	const char* part = path + 3;
+
+	while (*part != '\0')
+	{
+		char name[256];
+		size_t len = strcspn(part, "\\");
+		if (len == 0 || len >= sizeof(name))
+			return -1;
+		memcpy(name, part, len);
+		name[len] = '\0';
+
+		directory_entry_t entry;
+		if (directorySearch(vol, name, cluster, &entry, NULL) != 0)
+			return -1;
+		cluster = GET_CLUSTER_FROM_ENTRY(entry, vol->fat_type);
+
+		part += len;
+		if (*part == '\\')
+			part++;
+	}
+	return 0;
+}
+
+static int readFile(const char* path, unsigned long long* bytes)
+{
+	char* contents;
+	directory_entry_t meta;
+
+	if (getFile(path, &contents, &meta, 1) != 0)
+		return -1;
+	*bytes += meta.file_size;
+	return 0;
+}
+
+static int createFile(const char* dir, unsigned int size, char* data)
+{
+	directory_entry_t meta;
+	char name[16];
+
+	memset(&meta, 0, sizeof(meta));
+	snprintf(name, sizeof(name), "B%07uDAT", create_serial++);
+	memcpy(meta.file_name, name, 11);
+	meta.attributes = FILE_ARCHIVE;
+	meta.file_size = size;
+
+	memset(data, 'A' + create_serial % 26, size);
+	return putFile(dir, &data, &meta);
+}
+
+static void report(const char* name, unsigned long ops, unsigned long failed, double seconds, unsigned long long bytes)
+{
+	unsigned long requests = fathost_io.reads + fathost_io.writes;
+	double per_op = ops ? 1.0 / ops : 0;
+
+	printf("%-8s %7lu %6lu %9.1f %9lu %9lu %11llu %11llu %8lu %9.2f %11.1f %11.1f\n",
+		name, ops, failed, seconds * 1000.0,
+		fathost_io.reads, fathost_io.writes, fathost_io.sectors_read, fathost_io.sectors_written, fathost_io.seeks,
+		requests * per_op,
+		(fathost_io.sectors_read + fathost_io.sectors_written) * 512.0 * per_op,
+		bytes * per_op);
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "vws:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v':
+			fathost_verbose = 1;
+			break;
+		case 'w':
+			remount_between = FALSE;
+			break;
+		case 's':
+			fat_alloc_spread_clusters = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		usage();
+		return 2;
+	}
+
+	if (fathostAttach(0, argv[optind]) != 0)
+	{
+		perror(argv[optind]);
+		return 2;
+	}
+	optind++;
+
+	if (FATMountAll() == 0)
+	{
+		fprintf(stderr, "fatbench: no FAT volume found on the image\n");
+		return 2;
+	}
+
+	printf("%-8s %7s %6s %9s %9s %9s %11s %11s %8s %9s %11s %11s\n",
+		"workload", "ops", "failed", "ms", "reads", "writes", "sectors_rd", "sectors_wr", "seeks", "IOs/op", "diskB/op", "fileB/op");
+
+	int status = 0;
+	while (optind < argc)
+	{
+		const char* workload = argv[optind++];
+		char path[512];
+		unsigned long count;
+		unsigned long failed = 0;
+		unsigned long long bytes = 0;
+		unsigned long i;
+
+		int needed = strcmp(workload, "create") == 0 ? 3 : 2;
+		if (optind + needed > argc)
+		{
+			usage();
+			return 2;
+		}
+		toDriverPath(argv[optind++], path, sizeof(path));
+		count = strtoul(argv[optind++], NULL, 0);
+
+		if (remount_between)
+			remount();
+		fathostResetCounters();
+		double start = now();
+
+		if (strcmp(workload, "lookup") == 0)
+		{
+			for (i = 0; i < count; i++)
+				failed += lookup(path) != 0;
+		}
+		else if (strcmp(workload, "read") == 0)
+		{
+			for (i = 0; i < count; i++)
+				failed += readFile(path, &bytes) != 0;
+		}
+		else if (strcmp(workload, "create") == 0)
+		{
+			unsigned int size = strtoul(argv[optind++], NULL, 0);
+			char* data = malloc(size ? size : 1);
+			if (data == NULL)
+				return 2;
+
+			for (i = 0; i < count; i++)
+			{
+				if (createFile(path, size, data) != 0)
+					failed++;
+				else
+					bytes += size;
+			}
+			free(data);
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+
+		report(workload, count, failed, now() - start, bytes);
+		if (failed)
+			status = 1;
+	}
+
+	fathostDetachAll();
+	return status;
+}
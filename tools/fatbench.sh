@@ -0,0 +1,43 @@
+#!/bin/sh
+# Builds the standard benchmark image with mtools and runs the standard workloads on a fresh copy of it.
+# Usage: ./fatbench.sh [fatbench options]   (e.g. -s 0 to turn off large file spreading)
+set -e
+cd "$(dirname "$0")"
+make -s fatbench fatcheck
+
+FIXTURE=fatbench-fixture.img
+IMAGE=fatbench.img
+
+if [ ! -f $FIXTURE ]; then
+	qemu-img create -f raw $FIXTURE 100M >/dev/null
+	mformat -i $FIXTURE -F ::
+
+	# eight levels deep, with 40 neighbours in every directory so each lookup has something to skip over
+	DIR=
+	for level in 1 2 3 4 5 6 7 8; do
+		DIR=$DIR/D$level
+		mmd -i $FIXTURE ::$DIR
+		for n in $(seq 1 40); do
+			echo "$DIR $n" > fill.tmp
+			mcopy -i $FIXTURE fill.tmp ::$DIR/F$n.TXT
+		done
+	done
+	echo leaf > fill.tmp
+	mcopy -i $FIXTURE fill.tmp ::$DIR/LEAF.TXT
+
+	# biggest file getFile can read in one go (256kB less the one cluster offset)
+	head -c 200000 /dev/zero | tr '\0' 'p' > fill.tmp
+	mcopy -i $FIXTURE fill.tmp ::BIG.BIN
+	mmd -i $FIXTURE ::NEW
+	rm -f fill.tmp
+fi
+
+cp $FIXTURE $IMAGE
+./fatbench "$@" $IMAGE \
+	lookup C:/D1/D2/D3/D4/D5/D6/D7/D8/LEAF.TXT 2000 \
+	create C:/NEW 500 4096 \
+	create C:/NEW 100 0 \
+	read C:/BIG.BIN 200
+
+# whatever the workloads wrote, empty files included, has to leave a volume fatcheck finds nothing wrong with
+./fatcheck $IMAGE >/dev/null
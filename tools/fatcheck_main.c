@@ -0,0 +1,164 @@
+// Host build of fatcheck: checks a FAT volume inside a disk image file.
+//
+// usage: fatcheck [-r] [-j threads] [-o start_sector] image
+//   -r  repair the volume
+//   -j  number of threads for the FAT and lost cluster scans (default 1)
+//   -o  sector the volume starts at, for partitioned images (default 0)
+//
+// Exit status: 0 if the volume is clean, 1 if problems were found, 2 if the check couldn't run.
+
+#define _FILE_OFFSET_BITS 64
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fatcheck.h"
+
+typedef struct {
+	int fd;
+	unsigned long long start; // byte offset of the volume in the image
+} image_t;
+
+typedef struct {
+	fatcheck_volume_t* vol;
+	unsigned int first;
+	unsigned int last;
+	int phase;
+	fatcheck_report_t report;
+} worker_t;
+
+static int image_read(void* ctx, unsigned long sector, unsigned int count, void* buffer) {
+	image_t* image = ctx;
+	size_t bytes = (size_t)count * 512;
+	return pread(image->fd, buffer, bytes, image->start + (unsigned long long)sector * 512) == (ssize_t)bytes ? 0 : -1;
+}
+
+static int image_write(void* ctx, unsigned long sector, unsigned int count, void* buffer) {
+	image_t* image = ctx;
+	size_t bytes = (size_t)count * 512;
+	return pwrite(image->fd, buffer, bytes, image->start + (unsigned long long)sector * 512) == (ssize_t)bytes ? 0 : -1;
+}
+
+static void* worker_run(void* arg) {
+	worker_t* worker = arg;
+	if (worker->phase == 1)
+		fatcheckScanFAT(worker->vol, worker->first, worker->last, &worker->report);
+	else
+		fatcheckFindLost(worker->vol, worker->first, worker->last, &worker->report);
+	return NULL;
+}
+
+// Runs a range phase over the whole volume, split evenly between "threads" workers
+static void run_phase(fatcheck_volume_t* vol, int phase, int threads, fatcheck_report_t* report) {
+	pthread_t ids[threads];
+	worker_t workers[threads];
+	unsigned int per_worker = (vol->cluster_limit + threads - 1) / threads;
+
+	for (int i = 0; i < threads; i++) {
+		workers[i].vol = vol;
+		workers[i].phase = phase;
+		workers[i].first = i * per_worker;
+		workers[i].last = (i + 1) * per_worker;
+		fatcheckReportInit(&workers[i].report);
+		if (threads > 1)
+			pthread_create(&ids[i], NULL, worker_run, &workers[i]);
+		else
+			worker_run(&workers[i]);
+	}
+
+	for (int i = 0; i < threads; i++) {
+		if (threads > 1)
+			pthread_join(ids[i], NULL);
+		fatcheckReportMerge(report, &workers[i].report);
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: fatcheck [-r] [-j threads] [-o start_sector] image\n");
+	exit(2);
+}
+
+int main(int argc, char** argv) {
+	int threads = 1;
+	unsigned int flags = 0;
+	unsigned long long start_sector = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "rj:o:")) != -1) {
+		switch (opt) {
+		case 'r':
+			flags |= FATCHECK_REPAIR;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > 64)
+				usage();
+			break;
+		case 'o':
+			start_sector = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	image_t image;
+	image.fd = open(argv[optind], (flags & FATCHECK_REPAIR) ? O_RDWR : O_RDONLY);
+	image.start = start_sector * 512;
+	if (image.fd < 0) {
+		perror(argv[optind]);
+		return 2;
+	}
+
+	fatcheck_volume_t vol = { 0 };
+	vol.read = image_read;
+	vol.write = image_write;
+	vol.io_ctx = &image;
+	vol.flags = flags;
+
+	int retVal = fatcheckOpen(&vol);
+	if (retVal != 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], retVal == -1 ? "could not read the boot sector" : "not a FAT16 or FAT32 volume");
+		return 2;
+	}
+
+	void* memory = malloc(fatcheckMemoryNeeded(&vol));
+	if (memory == NULL) {
+		fprintf(stderr, "fatcheck: out of memory\n");
+		return 2;
+	}
+	fatcheckAttach(&vol, memory);
+
+	fatcheck_report_t report;
+	fatcheckReportInit(&report);
+
+	if (fatcheckLoadFAT(&vol) != 0) {
+		fprintf(stderr, "fatcheck: error reading the FAT\n");
+		return 2;
+	}
+	run_phase(&vol, 1, threads, &report);
+	if (fatcheckWalk(&vol, &report) != 0) {
+		fprintf(stderr, "fatcheck: error reading a directory\n");
+		return 2;
+	}
+	run_phase(&vol, 3, threads, &report);
+	if ((flags & FATCHECK_REPAIR) && fatcheckWriteBack(&vol, &report) != 0) {
+		fprintf(stderr, "fatcheck: error writing the FAT\n");
+		return 2;
+	}
+
+	printf("FAT%u: %u clusters, %u free, %u bad\n", vol.fat_type, report.clusters_checked, report.free_clusters, report.bad_clusters);
+	printf("%u directories, %u entries\n", report.directories_checked, report.entries_checked);
+	printf("out of range: %u\nbroken chains: %u\ncross-linked: %u\n", report.out_of_range, report.broken_chains, report.cross_linked);
+	printf("lost clusters: %u\nsize mismatches: %u\ntoo deep: %u\n", report.lost_clusters, report.size_mismatches, report.too_deep);
+	if (flags & FATCHECK_REPAIR)
+		printf("repairs made: %u\n", report.repaired);
+
+	free(memory);
+	close(image.fd);
+	return fatcheckProblems(&report) != 0 ? 1 : 0;
+}
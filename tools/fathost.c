@@ -0,0 +1,117 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fathost.h"
+#include "ata.h"
+
+//One image file per ATA drive position. Every request is counted before it's handed to pread/pwrite,
+//so the numbers reflect what the kernel would send to the disk.
+
+unsigned char fathost_disk_buffer[FATHOST_BUFFER_SIZE];
+unsigned char fathost_disk_write_buffer[FATHOST_WRITE_BUFFER_SIZE];
+fathost_counters_t fathost_io;
+int fathost_verbose;
+
+static int drive_fd[ATA_MAX_DRIVES] = { -1, -1, -1, -1 };
+static unsigned long drive_next_lba[ATA_MAX_DRIVES]; //sector right after the last request, for seek counting
+
+int fathostAttach(unsigned char drive, const char* path)
+{
+	if (drive >= ATA_MAX_DRIVES)
+		return -1;
+
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -1;
+
+	if (drive_fd[drive] >= 0)
+		close(drive_fd[drive]);
+	drive_fd[drive] = fd;
+	drive_next_lba[drive] = 0;
+	return 0;
+}
+
+void fathostDetachAll(void)
+{
+	unsigned char drive;
+	for (drive = 0; drive < ATA_MAX_DRIVES; drive++)
+	{
+		if (drive_fd[drive] >= 0)
+			close(drive_fd[drive]);
+		drive_fd[drive] = -1;
+	}
+}
+
+void fathostResetCounters(void)
+{
+	memset(&fathost_io, 0, sizeof(fathost_io));
+}
+
+int fathostDebugPutchar(int c)
+{
+	if (fathost_verbose)
+		fputc(c, stderr);
+	return c;
+}
+
+static void fathostCount(unsigned char drive, unsigned long lba, unsigned char count)
+{
+	if (lba != drive_next_lba[drive])
+		fathost_io.seeks++;
+	drive_next_lba[drive] = lba + count;
+}
+
+int ataIdentify(unsigned char drive, unsigned long* sectors)
+{
+	if (drive >= ATA_MAX_DRIVES || drive_fd[drive] < 0)
+		return -1;
+
+	if (sectors != NULL)
+	{
+		off_t size = lseek(drive_fd[drive], 0, SEEK_END);
+		*sectors = size < 0 ? 0 : (unsigned long)(size / ATA_SECTOR_SIZE);
+	}
+	return 0;
+}
+
+int ataReadSectors(unsigned char drive, unsigned long lba, unsigned char count, void* buffer)
+{
+	if (drive >= ATA_MAX_DRIVES || drive_fd[drive] < 0 || count == 0 || lba + count - 1 > ATA_MAX_LBA28)
+		return -1;
+
+	fathostCount(drive, lba, count);
+	fathost_io.reads++;
+	fathost_io.sectors_read += count;
+
+	size_t bytes = (size_t)count * ATA_SECTOR_SIZE;
+	return pread(drive_fd[drive], buffer, bytes, (off_t)lba * ATA_SECTOR_SIZE) == (ssize_t)bytes ? 0 : -1;
+}
+
+int ataWriteSectors(unsigned char drive, unsigned long lba, unsigned char count, const void* buffer)
+{
+	if (drive >= ATA_MAX_DRIVES || drive_fd[drive] < 0 || count == 0 || lba + count - 1 > ATA_MAX_LBA28)
+		return -1;
+
+	fathostCount(drive, lba, count);
+	fathost_io.writes++;
+	fathost_io.sectors_written += count;
+
+	size_t bytes = (size_t)count * ATA_SECTOR_SIZE;
+	return pwrite(drive_fd[drive], buffer, bytes, (off_t)lba * ATA_SECTOR_SIZE) == (ssize_t)bytes ? 0 : -1;
+}
+
+//lib_c.c is kernel only (port I/O, IDT), so the one helper FAT.c takes from it lives here
+char* uppercase_str(char* input)
+{
+	char* iterator;
+	for (iterator = input; *iterator != '\0'; iterator++)
+	{
+		if (*iterator >= 'a' && *iterator <= 'z')
+			*iterator -= 'a' - 'A';
+	}
+	return input;
+}
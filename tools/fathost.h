@@ -0,0 +1,35 @@
+#ifndef FATHOST_H_
+#define FATHOST_H_
+
+//Host build of the kernel FAT driver: FAT.c and partition.c are compiled unchanged with this header force-included,
+//and fathost.c stands in for ata.c with pread/pwrite on disk image files.
+
+#define FATHOST_BUFFER_SIZE 0x50000 //DISK_READ_LOCATION window; getFile can fill 256kB past a one cluster offset
+#define FATHOST_WRITE_BUFFER_SIZE 0x20000 //DISK_WRITE_LOCATION window, separate like the kernel's
+
+extern unsigned char fathost_disk_buffer[FATHOST_BUFFER_SIZE];
+extern unsigned char fathost_disk_write_buffer[FATHOST_WRITE_BUFFER_SIZE];
+
+#define DISK_READ_LOCATION ((unsigned long)fathost_disk_buffer)
+#define DISK_WRITE_LOCATION ((unsigned long)fathost_disk_write_buffer)
+#define FAT_DEBUG_PUTCHAR(c) fathostDebugPutchar(c)
+
+typedef struct fathost_counters
+{
+	unsigned long reads; //read requests that reached the disk
+	unsigned long writes;
+	unsigned long long sectors_read;
+	unsigned long long sectors_written;
+	unsigned long seeks; //requests that didn't start where the previous one on the same drive ended
+}
+fathost_counters_t;
+
+extern fathost_counters_t fathost_io;
+extern int fathost_verbose; //pass the driver's debug output through to stderr
+
+int fathostAttach(unsigned char drive, const char* path);
+void fathostDetachAll(void);
+void fathostResetCounters(void);
+int fathostDebugPutchar(int c);
+
+#endif
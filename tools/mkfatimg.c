@@ -0,0 +1,615 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fathost.h"
+#include "FAT.h"
+
+//mkfatimg: builds an unpartitioned FAT32 image from a manifest.
+//
+//Clusters are handed out in one forward sweep, so every file and directory is a single contiguous run.
+//Files marked "boot" go first, each preceded by whichever of its directories haven't been placed yet, which puts
+//everything the kernel touches to open them (root, directories, data) on disk in the order it reads them.
+//Inside each directory the entries on a boot path come first, so lookups stop early.
+//
+//Manifest lines (# starts a comment):
+//  size 100M              image size (K, M or G suffix)
+//  cluster 4096           bytes per cluster (default: the largest up to 4kB that still gives FAT32)
+//  label POTATOOS         volume label
+//  boot /sys/config src   file read during boot, placed in the order listed
+//  file /test.txt src     any other file
+//  dir /sys 64            directory, with room for at least 64 entries before it has to grow
+//Source paths are relative to the manifest's directory.
+
+#define MKFAT_MAX_NODES 4096
+#define MKFAT_RESERVED_SECTORS 32
+#define MKFAT_TABLE_COUNT 2
+#define MKFAT_FSINFO_SECTOR 1
+#define MKFAT_BACKUP_SECTOR 6
+#define MKFAT_MIN_CLUSTERS 65525 //fewer than this and drivers will treat the volume as FAT16
+#define MKFAT_DATE ((0 << 9) | (1 << 5) | 1) //1980-01-01, so the same manifest always gives the same image
+
+typedef struct mkfat_node
+{
+	char name[12]; //FAT format name, as the driver compares it
+	char path[256]; //path in the image, for messages
+	BOOL is_dir;
+	BOOL boot; //read during boot, or a directory on the way to such a file
+	int parent;
+	int first_child;
+	int last_child;
+	int next_sibling;
+	char source[512];
+	unsigned int size;
+	unsigned int reserve_entries;
+	unsigned int first_cluster;
+	unsigned int clusters;
+}
+mkfat_node_t;
+
+static mkfat_node_t nodes[MKFAT_MAX_NODES];
+static int node_count = 1; //node 0 is the root directory
+static int boot_order[MKFAT_MAX_NODES];
+static int boot_count = 0;
+
+static unsigned long long image_size = 0;
+static unsigned int cluster_bytes = 0;
+static char label[12] = "NO NAME    ";
+
+static unsigned int sectors_per_cluster;
+static unsigned int total_sectors;
+static unsigned int fat_size;
+static unsigned int first_data_sector;
+static unsigned int cluster_limit; //one past the last valid cluster
+static unsigned int next_cluster = 2;
+static unsigned int* fat;
+
+static int fail(const char* where, const char* message)
+{
+	fprintf(stderr, "mkfatimg: %s: %s\n", where, message);
+	return -1;
+}
+
+static unsigned long long parseSize(const char* text)
+{
+	char* end;
+	unsigned long long value = strtoull(text, &end, 0);
+
+	switch (toupper((unsigned char)*end))
+	{
+	case 'G':
+		value <<= 10;
+		/* fall through */
+	case 'M':
+		value <<= 10;
+		/* fall through */
+	case 'K':
+		value <<= 10;
+		break;
+	}
+	return value;
+}
+
+//converts one path component to the 11 character FAT name the driver will search for
+static int toFATName(const char* component, char* out)
+{
+	const char* dot = strchr(component, '.');
+	size_t base = dot ? (size_t)(dot - component) : strlen(component);
+	size_t ext = dot ? strlen(dot + 1) : 0;
+
+	if (base == 0 || base > 8 || ext > 3 || (dot && strchr(dot + 1, '.')))
+		return -1;
+
+	char buffer[16];
+	strcpy(buffer, component);
+	convertToFATFormat(buffer); //the same conversion directorySearch applies to the names it looks up
+	if (testIfFATFormat(buffer) != 0)
+		return -1;
+
+	memcpy(out, buffer, 11);
+	out[11] = '\0';
+	return 0;
+}
+
+static int findChild(int parent, const char* name)
+{
+	int child;
+	for (child = nodes[parent].first_child; child != 0; child = nodes[child].next_sibling)
+	{
+		if (memcmp(nodes[child].name, name, 11) == 0)
+			return child;
+	}
+	return 0;
+}
+
+//returns the node for "path", creating it (and any missing parent directories) if needed
+static int lookupPath(const char* path, BOOL is_dir)
+{
+	if (path[0] != '/')
+		return fail(path, "image paths start with /");
+
+	char copy[256];
+	if (strlen(path) >= sizeof(copy))
+		return fail(path, "path too long");
+	strcpy(copy, path);
+
+	int current = 0;
+	char* save;
+	char* component = strtok_r(copy + 1, "/", &save);
+
+	while (component != NULL)
+	{
+		char* next = strtok_r(NULL, "/", &save);
+		BOOL last = next == NULL;
+		char name[12];
+
+		if (toFATName(component, name) != 0)
+			return fail(path, "not a valid 8.3 name");
+		if (!nodes[current].is_dir)
+			return fail(path, "a parent is a file");
+
+		int child = findChild(current, name);
+		if (child == 0)
+		{
+			if (node_count == MKFAT_MAX_NODES)
+				return fail(path, "too many entries");
+
+			child = node_count++;
+			memset(&nodes[child], 0, sizeof(mkfat_node_t));
+			memcpy(nodes[child].name, name, 12);
+			snprintf(nodes[child].path, sizeof(nodes[child].path), "%.*s", (int)(component - copy + strlen(component)), path);
+			nodes[child].is_dir = last ? is_dir : TRUE;
+			nodes[child].parent = current;
+
+			if (nodes[current].first_child == 0)
+				nodes[current].first_child = child;
+			else
+				nodes[nodes[current].last_child].next_sibling = child;
+			nodes[current].last_child = child;
+		}
+		else if (last && nodes[child].is_dir != is_dir)
+			return fail(path, "listed as both a file and a directory");
+
+		current = child;
+		component = next;
+	}
+
+	return current;
+}
+
+static int readManifest(const char* manifest)
+{
+	FILE* file = fopen(manifest, "r");
+	if (file == NULL)
+	{
+		perror(manifest);
+		return -1;
+	}
+
+	char base[512] = "";
+	const char* slash = strrchr(manifest, '/');
+	if (slash != NULL)
+		snprintf(base, sizeof(base), "%.*s/", (int)(slash - manifest), manifest);
+
+	char line[1024];
+	int line_number = 0;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		line_number++;
+		char* comment = strchr(line, '#');
+		if (comment != NULL)
+			*comment = '\0';
+
+		char* save;
+		char* keyword = strtok_r(line, " \t\r\n", &save);
+		char* arg1 = strtok_r(NULL, " \t\r\n", &save);
+		char* arg2 = strtok_r(NULL, " \t\r\n", &save);
+		char where[600];
+		snprintf(where, sizeof(where), "%s:%d", manifest, line_number);
+
+		if (keyword == NULL)
+			continue;
+		else if (arg1 == NULL)
+			return fail(where, "missing argument");
+		else if (strcmp(keyword, "size") == 0)
+			image_size = parseSize(arg1);
+		else if (strcmp(keyword, "cluster") == 0)
+			cluster_bytes = parseSize(arg1);
+		else if (strcmp(keyword, "label") == 0)
+		{
+			size_t length = strlen(arg1);
+			if (length > 11)
+				return fail(where, "labels are at most 11 characters");
+			memset(label, ' ', 11);
+			size_t i;
+			for (i = 0; i < length; i++)
+				label[i] = toupper((unsigned char)arg1[i]);
+		}
+		else if (strcmp(keyword, "dir") == 0)
+		{
+			int node = lookupPath(arg1, TRUE);
+			if (node < 0)
+				return -1;
+			if (arg2 != NULL)
+				nodes[node].reserve_entries = strtoul(arg2, NULL, 0);
+		}
+		else if (strcmp(keyword, "file") == 0 || strcmp(keyword, "boot") == 0)
+		{
+			if (arg2 == NULL)
+				return fail(where, "missing source file");
+
+			int node = lookupPath(arg1, FALSE);
+			if (node < 0)
+				return -1;
+
+			if (arg2[0] == '/')
+				snprintf(nodes[node].source, sizeof(nodes[node].source), "%s", arg2);
+			else
+				snprintf(nodes[node].source, sizeof(nodes[node].source), "%s%s", base, arg2);
+
+			struct stat info;
+			if (stat(nodes[node].source, &info) != 0 || !S_ISREG(info.st_mode))
+				return fail(nodes[node].source, "can't read source file");
+			nodes[node].size = (unsigned int)info.st_size;
+
+			if (keyword[0] == 'b' && !nodes[node].boot)
+			{
+				int walk;
+				for (walk = node; walk != 0; walk = nodes[walk].parent)
+					nodes[walk].boot = TRUE;
+				boot_order[boot_count++] = node;
+			}
+		}
+		else
+			return fail(where, "unknown keyword");
+	}
+
+	fclose(file);
+	return 0;
+}
+
+static int computeGeometry(void)
+{
+	if (image_size == 0)
+		return fail("manifest", "no image size given");
+
+	total_sectors = (unsigned int)(image_size / 512);
+
+	unsigned int spc;
+	unsigned int first = cluster_bytes ? cluster_bytes / 512 : 8;
+	unsigned int last = cluster_bytes ? cluster_bytes / 512 : 1;
+
+	for (spc = first; spc >= last && spc >= 1; spc /= 2)
+	{
+		//the FAT has to cover the clusters left over after the FAT itself, so iterate until the size settles
+		unsigned int size = 1;
+		while (1)
+		{
+			unsigned int data = total_sectors - MKFAT_RESERVED_SECTORS - MKFAT_TABLE_COUNT * size;
+			unsigned int needed = ((data / spc + 2) * 4 + 511) / 512;
+			if (needed <= size)
+				break;
+			size = needed;
+		}
+
+		unsigned int clusters = (total_sectors - MKFAT_RESERVED_SECTORS - MKFAT_TABLE_COUNT * size) / spc;
+		if (clusters >= MKFAT_MIN_CLUSTERS)
+		{
+			sectors_per_cluster = spc;
+			fat_size = size;
+			first_data_sector = MKFAT_RESERVED_SECTORS + MKFAT_TABLE_COUNT * size;
+			cluster_limit = clusters + 2;
+			cluster_bytes = spc * 512;
+			return 0;
+		}
+	}
+
+	if (cluster_bytes && (cluster_bytes % 512 != 0 || (cluster_bytes & (cluster_bytes - 1)) != 0 || cluster_bytes > 32768))
+		return fail("manifest", "cluster size must be a power of two from 512 to 32768");
+	return fail("manifest", "image too small for FAT32 with that cluster size");
+}
+
+static unsigned int entriesNeeded(int node)
+{
+	unsigned int entries = (node == 0) ? 1 : 2; //the volume label in the root, . and .. everywhere else
+	int child;
+	for (child = nodes[node].first_child; child != 0; child = nodes[child].next_sibling)
+		entries++;
+
+	if (entries < nodes[node].reserve_entries)
+		entries = nodes[node].reserve_entries;
+	return entries;
+}
+
+static int place(int node)
+{
+	if (node != 0 && nodes[node].first_cluster != 0)
+		return 0;
+
+	unsigned int clusters;
+	if (nodes[node].is_dir)
+		clusters = (entriesNeeded(node) * sizeof(directory_entry_t) + cluster_bytes - 1) / cluster_bytes;
+	else
+		clusters = (nodes[node].size + cluster_bytes - 1) / cluster_bytes;
+
+	if (clusters == 0) //empty files don't get a cluster
+		return 0;
+	if (next_cluster + clusters > cluster_limit)
+		return fail(nodes[node].path, "image is full");
+
+	nodes[node].first_cluster = next_cluster;
+	nodes[node].clusters = clusters;
+
+	unsigned int cluster;
+	for (cluster = next_cluster; cluster < next_cluster + clusters - 1; cluster++)
+		fat[cluster] = cluster + 1;
+	fat[cluster] = 0x0FFFFFFF;
+
+	next_cluster += clusters;
+	return 0;
+}
+
+//places the directories leading to "node" (outermost first), then the node itself
+static int placeWithParents(int node)
+{
+	if (node != 0 && nodes[node].parent != 0 && placeWithParents(nodes[node].parent) != 0)
+		return -1;
+	return place(node);
+}
+
+static unsigned long long clusterOffset(unsigned int cluster)
+{
+	return ((unsigned long long)first_data_sector + (unsigned long long)(cluster - 2) * sectors_per_cluster) * 512;
+}
+
+static void fillEntry(directory_entry_t* entry, const char* name, unsigned char attributes, unsigned int cluster, unsigned int size)
+{
+	memset(entry, 0, sizeof(directory_entry_t));
+	memcpy(entry->file_name, name, 11);
+	entry->attributes = attributes;
+	entry->creation_date = MKFAT_DATE;
+	entry->last_accessed = MKFAT_DATE;
+	entry->last_modification_date = MKFAT_DATE;
+	entry->low_bits = GET_ENTRY_LOW_BITS(cluster, 32);
+	entry->high_bits = GET_ENTRY_HIGH_BITS(cluster, 32);
+	entry->file_size = size;
+}
+
+static int writeDirectory(int fd, int node)
+{
+	size_t bytes = (size_t)nodes[node].clusters * cluster_bytes;
+	directory_entry_t* entries = calloc(1, bytes);
+	unsigned int count = 0;
+	if (entries == NULL)
+		return fail(nodes[node].path, "out of memory");
+
+	if (node == 0)
+		fillEntry(&entries[count++], label, FILE_VOLUME_ID, 0, 0);
+	else
+	{
+		int parent = nodes[node].parent;
+		fillEntry(&entries[count++], ".          ", FILE_DIRECTORY, nodes[node].first_cluster, 0);
+		fillEntry(&entries[count++], "..         ", FILE_DIRECTORY, parent == 0 ? 0 : nodes[parent].first_cluster, 0); //.. of a first level directory points at cluster 0, meaning the root
+	}
+
+	//entries on a boot path first, then the rest, both in manifest order
+	int pass;
+	for (pass = 0; pass < 2; pass++)
+	{
+		int child;
+		for (child = nodes[node].first_child; child != 0; child = nodes[child].next_sibling)
+		{
+			if (nodes[child].boot != (pass == 0))
+				continue;
+			fillEntry(&entries[count++], nodes[child].name, nodes[child].is_dir ? FILE_DIRECTORY : FILE_ARCHIVE, nodes[child].first_cluster, nodes[child].is_dir ? 0 : nodes[child].size);
+		}
+	}
+
+	int result = pwrite(fd, entries, bytes, clusterOffset(nodes[node].first_cluster)) == (ssize_t)bytes ? 0 : fail(nodes[node].path, "write failed");
+	free(entries);
+	return result;
+}
+
+static int writeFile(int fd, int node)
+{
+	if (nodes[node].clusters == 0)
+		return 0;
+
+	size_t bytes = (size_t)nodes[node].clusters * cluster_bytes;
+	char* data = calloc(1, bytes);
+	if (data == NULL)
+		return fail(nodes[node].path, "out of memory");
+
+	FILE* source = fopen(nodes[node].source, "rb");
+	int result = -1;
+	if (source == NULL || fread(data, 1, nodes[node].size, source) != nodes[node].size)
+		fail(nodes[node].source, "read failed");
+	else if (pwrite(fd, data, bytes, clusterOffset(nodes[node].first_cluster)) != (ssize_t)bytes) //one write for the whole file, it's contiguous
+		fail(nodes[node].path, "write failed");
+	else
+		result = 0;
+
+	if (source != NULL)
+		fclose(source);
+	free(data);
+	return result;
+}
+
+static int writeSystemArea(int fd)
+{
+	unsigned char sector[512];
+	fat_BS_t* bs = (fat_BS_t*)sector;
+	fat_extBS_32_t* ext = (fat_extBS_32_t*)bs->extended_section;
+	unsigned int i;
+
+	memset(sector, 0, sizeof(sector));
+	memcpy(bs->bootjmp, "\xEB\x58\x90", 3);
+	memcpy(bs->oem_name, "POTATOOS", 8);
+	bs->bytes_per_sector = 512;
+	bs->sectors_per_cluster = sectors_per_cluster;
+	bs->reserved_sector_count = MKFAT_RESERVED_SECTORS;
+	bs->table_count = MKFAT_TABLE_COUNT;
+	bs->media_type = 0xF8;
+	bs->sectors_per_track = 63;
+	bs->head_side_count = 255;
+	bs->total_sectors_32 = total_sectors;
+	ext->table_size_32 = fat_size;
+	ext->root_cluster = nodes[0].first_cluster;
+	ext->fat_info = MKFAT_FSINFO_SECTOR;
+	ext->backup_BS_sector = MKFAT_BACKUP_SECTOR;
+	ext->drive_number = 0x80;
+	ext->boot_signature = 0x29;
+	for (i = 0; i < 11; i++)
+		ext->volume_id = ext->volume_id * 31 + (unsigned char)label[i]; //derived from the label, so builds are reproducible
+	memcpy(ext->volume_label, label, 11);
+	memcpy(ext->fat_type_label, "FAT32   ", 8);
+	sector[510] = 0x55;
+	sector[511] = 0xAA;
+
+	if (pwrite(fd, sector, 512, 0) != 512 || pwrite(fd, sector, 512, MKFAT_BACKUP_SECTOR * 512) != 512)
+		return fail("boot sector", "write failed");
+
+	FSInfo_t info;
+	memset(&info, 0, sizeof(info));
+	info.lead_signature = 0x41615252;
+	info.structure_signature = 0x61417272;
+	info.free_space = cluster_limit - next_cluster;
+	info.last_written = next_cluster - 1; //the driver's allocator continues right after it
+	info.trail_signature = 0xAA550000;
+
+	if (pwrite(fd, &info, 512, MKFAT_FSINFO_SECTOR * 512) != 512 || pwrite(fd, &info, 512, (MKFAT_BACKUP_SECTOR + MKFAT_FSINFO_SECTOR) * 512) != 512)
+		return fail("FSInfo", "write failed");
+
+	fat[0] = 0x0FFFFF00 | bs->media_type;
+	fat[1] = 0x0FFFFFFF;
+	for (i = 0; i < MKFAT_TABLE_COUNT; i++)
+	{
+		if (pwrite(fd, fat, (size_t)fat_size * 512, ((unsigned long long)MKFAT_RESERVED_SECTORS + (unsigned long long)i * fat_size) * 512) != (ssize_t)fat_size * 512)
+			return fail("FAT", "write failed");
+	}
+	return 0;
+}
+
+//prints where everything went, and how many separate runs the boot files take to read
+static void printLayout(void)
+{
+	int node;
+	printf("%u clusters of %u bytes, %u used\n", cluster_limit - 2, cluster_bytes, next_cluster - 2);
+	for (node = 0; node < node_count; node++)
+	{
+		printf("%-40s %8u %6u%s\n", node == 0 ? "/" : nodes[node].path, nodes[node].first_cluster, nodes[node].clusters, nodes[node].boot ? "  boot" : "");
+	}
+
+	//replay the boot reads: every directory on the way, then the file
+	unsigned int runs = 0;
+	unsigned int clusters = 0;
+	unsigned int last_end = 0;
+	int boot;
+	for (boot = 0; boot < boot_count; boot++)
+	{
+		int chain[64];
+		int depth = 0;
+		int walk;
+		for (walk = boot_order[boot]; depth < 64; walk = nodes[walk].parent)
+		{
+			chain[depth++] = walk;
+			if (walk == 0)
+				break;
+		}
+		while (depth-- > 0)
+		{
+			const mkfat_node_t* step = &nodes[chain[depth]];
+			if (step->clusters == 0)
+				continue;
+			if (step->first_cluster != last_end)
+				runs++;
+			clusters += step->clusters;
+			last_end = step->first_cluster + step->clusters;
+		}
+	}
+	if (boot_count)
+		printf("boot files: %u clusters in %u contiguous run%s\n", clusters, runs, runs == 1 ? "" : "s");
+}
+
+int main(int argc, char** argv)
+{
+	const char* output = NULL;
+	BOOL quiet = FALSE;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:q")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			output = optarg;
+			break;
+		case 'q':
+			quiet = TRUE;
+			break;
+		default:
+			output = NULL;
+			optind = argc + 1;
+		}
+	}
+
+	if (output == NULL || optind != argc - 1)
+	{
+		fprintf(stderr, "usage: mkfatimg [-q] -o image manifest\n");
+		return 2;
+	}
+
+	memset(&nodes[0], 0, sizeof(mkfat_node_t));
+	nodes[0].is_dir = TRUE;
+	strcpy(nodes[0].path, "/");
+
+	if (readManifest(argv[optind]) != 0 || computeGeometry() != 0)
+		return 1;
+
+	fat = calloc(fat_size, 512);
+	if (fat == NULL)
+		return fail("FAT", "out of memory");
+
+	//root, then the boot files with their directories in access order, then everything else in manifest order
+	int node;
+	if (place(0) != 0)
+		return 1;
+	for (node = 0; node < boot_count; node++)
+	{
+		if (placeWithParents(boot_order[node]) != 0)
+			return 1;
+	}
+	for (node = 1; node < node_count; node++)
+	{
+		if (placeWithParents(node) != 0)
+			return 1;
+	}
+
+	int fd = open(output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror(output);
+		return 1;
+	}
+	if (ftruncate(fd, (off_t)total_sectors * 512) != 0)
+		return fail(output, "can't size the image");
+
+	for (node = 0; node < node_count; node++)
+	{
+		if ((nodes[node].is_dir ? writeDirectory(fd, node) : writeFile(fd, node)) != 0)
+			return 1;
+	}
+	if (writeSystemArea(fd) != 0)
+		return 1;
+
+	close(fd);
+	if (!quiet)
+		printLayout();
+	return 0;
+}